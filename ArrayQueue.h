@@ -1,5 +1,9 @@
+#ifndef ARRAYQUEUE_H
+#define ARRAYQUEUE_H
+
 #include <iostream>
 #include "Event.h"
+#include "Snapshot.h"
 
 using namespace std;
 
@@ -10,16 +14,23 @@ class ArrayQueue {
 		~ArrayQueue();
 		bool enqueue(Event* newEntry);
 		bool dequeue();
+		bool removeRear();
+		bool enqueueFront(Event* newEntry);
+		int rearSlot() const;
+		bool remove(int slot);
 		bool isEmpty() const;
 		bool isFull() const;
 		int getCount();
 		Event* peekFront();
+		void save(Snapshot& out) const;
+		bool load(Snapshot& in);
 
 	private:
 		int max;
 		int front;
 		int rear;
-		int count;
+		int count;			//Events in the queue
+		int used;			//Slots from front to rear, counting the holes remove() leaves
 		Event** data;	
 };
 
@@ -30,6 +41,7 @@ ArrayQueue :: ArrayQueue(int size)
 	front = 0; 
 	rear = max - 1;
 	count = 0;
+	used = 0;
 	data = new Event*[max];
 }
 
@@ -48,6 +60,7 @@ bool ArrayQueue :: enqueue(Event* newEntry)
 		rear = (rear + 1) % max;
 		data[rear] = newEntry;
 		count++;
+		used++;
 		result = true;
 	}
 	
@@ -61,12 +74,89 @@ bool ArrayQueue :: dequeue()
 	{
 		front = (front + 1) % max;
 		count--;
+		used--;
+		while (used > 0 && data[front] == NULL)		//Step over customers removed from the middle
+		{
+			front = (front + 1) % max;
+			used--;
+		}
 		result = true;
 	}
 	
 	return result;		
 }
 
+//Undoes the last enqueue
+bool ArrayQueue :: removeRear()
+{
+	bool result = false;
+	if ( !isEmpty() )
+	{
+		rear = (rear + max - 1) % max;
+		count--;
+		used--;
+		while (used > 0 && data[rear] == NULL)
+		{
+			rear = (rear + max - 1) % max;
+			used--;
+		}
+		result = true;
+	}
+
+	return result;
+}
+
+//Undoes the last dequeue, putting newEntry back at the front of the line
+bool ArrayQueue :: enqueueFront(Event* newEntry)
+{
+	bool result = false;
+	if ( !isFull() )
+	{
+		front = (front + max - 1) % max;
+		data[front] = newEntry;
+		count++;
+		used++;
+		result = true;
+	}
+
+	return result;
+}
+
+//Slot the last enqueue put its event in, which stays its slot until it leaves the queue
+int ArrayQueue :: rearSlot() const
+{
+	return rear;
+}
+
+//Takes the event in a slot out of the queue, wherever it is in line. The slot becomes a hole that dequeue() and removeRear() step over once it reaches
+//the front or the rear, so this is O(1) and the queue is never shifted
+bool ArrayQueue :: remove(int slot)
+{
+	if (isEmpty() || slot < 0 || slot >= max || data[slot] == NULL || (slot - front + max) % max >= used)
+		return false;
+
+	data[slot] = NULL;
+	count--;
+	if (slot == front)
+	{
+		while (used > 0 && data[front] == NULL)
+		{
+			front = (front + 1) % max;
+			used--;
+		}
+	}
+	else if (slot == rear)
+	{
+		while (used > 0 && data[rear] == NULL)
+		{
+			rear = (rear + max - 1) % max;
+			used--;
+		}
+	}
+
+	return true;
+}
+
 bool ArrayQueue :: isEmpty() const
 {
 	return (count == 0);
@@ -75,7 +165,7 @@ bool ArrayQueue :: isEmpty() const
 
 bool ArrayQueue :: isFull() const
 {
-	return (count == max);
+	return (used == max);
 }
 
 int ArrayQueue :: getCount()
@@ -94,3 +184,36 @@ Event* ArrayQueue :: peekFront()
 		return NULL;
 	}
 }
+
+//Writes the events in line order; load() appends them to an empty queue and fails if they do not fit
+void ArrayQueue :: save(Snapshot& out) const
+{
+	out.put(count);
+	for (int i = 0; i < used; i++)
+	{
+		if (data[(front + i) % max] != NULL)
+			out.putEvent(data[(front + i) % max]);
+	}
+}
+
+bool ArrayQueue :: load(Snapshot& in)
+{
+	int saved = -1;
+	in.get(saved);
+	if (in.good() == false || saved < 0 || saved > max - count)
+		return false;
+
+	for (int i = 0; i < saved; i++)
+	{
+		Event* event = in.getEvent();
+		if (in.good() == false || enqueue(event) == false)
+		{
+			delete event;
+			return false;
+		}
+	}
+
+	return true;
+}
+
+#endif
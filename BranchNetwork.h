@@ -0,0 +1,736 @@
+#ifndef BRANCHNETWORK_H
+#define BRANCHNETWORK_H
+
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <climits>
+#include "ArrayQueue.h"
+#include "PriorityQueue.h"
+#include "Random.h"
+#include "Stats.h"
+
+using namespace std;
+
+#define NET_LOOKAHEAD 1			//Shortest transaction length generate_events produces, so a transfer is always sent at least this far ahead
+#define NET_MAX_LENGTH 100		//Longest transaction length of a network customer, outside or transferred
+
+//Event kinds, in the order they are processed when they share a timestamp
+#define KIND_DEPARTURE 0
+#define KIND_ARRIVAL 1
+#define KIND_TRANSFER 2
+
+/** @struct NetworkConfig
+ *  @brief This structure holds the options for simulating a network of bank branches
+ *  @var NetworkConfig::branches
+ *  Member branches holds how many branches are in the network
+ *  @var NetworkConfig::tellers
+ *  Member tellers holds how many tellers each branch has (every branch has 1 line)
+ *  @var NetworkConfig::customers
+ *  Member customers holds how many customers walk into each branch from outside the network
+ *  @var NetworkConfig::horizon
+ *  Member horizon holds the last time an outside customer can arrive
+ *  @var NetworkConfig::transferProb
+ *  Member transferProb holds the chance a customer is sent on to another branch once their transaction starts
+ *  @var NetworkConfig::threads
+ *  Member threads holds how many threads the branches are partitioned across
+ *  @var NetworkConfig::seed
+ *  Member seed is the base seed; branch i generates customers and transfers from its own streams
+ */
+struct NetworkConfig {
+	int branches;
+	int tellers;
+	int customers;
+	int horizon;
+	double transferProb;
+	int threads;
+	unsigned long long seed;
+
+	void initialize()
+	{
+		branches = 100;
+		tellers = 8;
+		customers = 2000;
+		horizon = 20000;
+		transferProb = 0.1;
+		threads = 1;
+		seed = 0;
+	}
+};
+
+/** @struct Transfer
+ *  @brief Message carrying a customer from one branch to another. (origin, seq) identifies it
+ *
+ *  An anti-message (anti == true) cancels the earlier Transfer with the same time, origin and seq. Only simulate_network_timewarp sends them
+ */
+struct Transfer {
+	int time;
+	int length;
+	int origin;
+	long long seq;
+	bool anti;
+	Transfer* next;
+};
+
+/** @struct BranchState
+ *  @brief Everything about a branch that changes as events are processed, apart from its line and event queue. Small enough to copy per event
+ */
+struct BranchState {
+	int freeTellers;
+	RandomStream rng;
+	long long departures;
+	long long sent;
+
+	//Variables for keeping track of stats
+	int currentTime;
+	int lastTime;
+	long long served;
+	long long cumulative_wait;
+	int max_wait;
+	long long events;
+	long long cumulative_line;
+	int max_line;
+	long long idle_time;
+};
+
+//Ways processing an event can change a branch's line
+#define LINE_UNCHANGED 0
+#define LINE_ENQUEUED 1
+#define LINE_DEQUEUED 2
+
+/** @struct UndoRecord
+ *  @brief What Branch::processNext changed while processing 1 event, so the event can be rolled back
+ *
+ *  The line is saved incrementally (at most 1 enqueue or dequeue per event) and the rest of the state as a BranchState copy
+ */
+struct UndoRecord {
+	int time;
+	long long tie;
+	Event* event;
+	bool departure;			//Whether event was a departure; an arrival that is served turns into its departure in place
+	BranchState before;
+	int lineChange;
+	Arrival* dequeued;
+	int scheduledTime;			//Departure this event scheduled, -1 if none
+	long long scheduledTie;
+	int destination;			//Branch a Transfer was sent to, -1 if none
+	Transfer sent;
+};
+
+/** @class Mailbox
+ *  @brief Lock-free inbox of Transfers for one branch. Any thread may post, only the owning thread collects
+ */
+class Mailbox {
+
+	public:
+		Mailbox();
+		void post(Transfer* msg);
+		Transfer* collect();
+		bool isEmpty() const;
+
+	private:
+		atomic<Transfer*> head;
+};
+
+/** @class SpinBarrier
+ *  @brief Reusable barrier for the worker threads of simulate_network_parallel
+ */
+class SpinBarrier {
+
+	public:
+		SpinBarrier(int count);
+		void wait();
+
+	private:
+		int total;
+		atomic<int> waiting;
+		atomic<int> generation;
+};
+
+/** @class Branch
+ *  @brief One bank branch: 1 line and several tellers, with its own event queue and random streams
+ *
+ *  Events are ordered by time, then kind, then (origin, seq), so a branch processes the same events in the same order no matter how
+ *  branches are spread over threads
+ */
+class Branch {
+
+	public:
+		Branch(int index, const NetworkConfig& config);
+		~Branch();
+		int nextTime() const;
+		void receive(Mailbox& box);
+		int processNext(Mailbox* mailboxes, UndoRecord* undo = NULL);
+		void finish(Stats* simData);
+
+	protected:
+		static long long key(int kind, int origin, long long seq);
+		static void outsideCustomers(const NetworkConfig& config, int index, vector<int>& arrivalTimes, vector<int>& transactionLengths);
+		int startService(Arrival* arr, Mailbox* mailboxes, UndoRecord* undo);
+
+		int id;
+		int branches;
+		double transferProb;
+
+		PriorityQueue eventQueue;
+		ArrayQueue line;
+		BranchState state;
+		Transfer lastSent;			//Copy of the last Transfer posted
+};
+
+/** @class ConservativeBranch
+ *  @brief Branch that also keeps a lower bound on the time of the next Transfer it can send, which sets how far simulate_network_parallel's windows reach
+ *
+ *  A Transfer is sent when a customer starts service, due when they leave, so no earlier than the start plus their transaction length. An outside customer
+ *  starts no earlier than they arrive; a customer received by Transfer or waiting in line starts no earlier than the branch's next event. The bound is
+ *  a suffix minimum of arrival time plus length over the outside customers still to come, and the shortest length among the rest, kept as a bitmask
+ *  so it costs O(1). Transfers this branch has sent since the last window started are counted too, until their destinations collect them
+ */
+class ConservativeBranch : public Branch {
+
+	public:
+		ConservativeBranch(int index, const NetworkConfig& config);
+		void receive(Mailbox& box);
+		int processNext(Mailbox* mailboxes);
+		int earliestEvent() const;
+		int earliestSend() const;
+		void clearSent();
+
+	private:
+		void countWaiting(int length, int change);
+
+		vector<int> outsideSend;		//Least arrival time plus transaction length over outside customer i and every later one
+		int outsideNext;			//Outside customers processed so far, which arrive in index order
+		int waiting[NET_MAX_LENGTH + 1];	//Customers received by Transfer or in line, not yet served, by transaction length
+		unsigned long long lengths[2];		//Bit length - 1 is set while waiting[length] > 0
+		int sentTime;				//Earliest time of the Transfers sent since clearSent()
+		int sentSend;				//and earliest time plus transaction length
+};
+
+static_assert(NET_MAX_LENGTH <= 128, "ConservativeBranch keeps the lengths it has waiting in a 128 bit mask");
+
+
+Mailbox :: Mailbox()
+{
+	head.store(NULL);
+}
+
+void Mailbox :: post(Transfer* msg)
+{
+	Transfer* old = head.load(memory_order_relaxed);
+	do
+	{
+		msg->next = old;
+	} while ( !head.compare_exchange_weak(old, msg, memory_order_release, memory_order_relaxed) );
+}
+
+Transfer* Mailbox :: collect()
+{
+	return head.exchange(NULL, memory_order_acquire);
+}
+
+bool Mailbox :: isEmpty() const
+{
+	return head.load(memory_order_acquire) == NULL;
+}
+
+
+SpinBarrier :: SpinBarrier(int count)
+{
+	total = count;
+	waiting.store(0);
+	generation.store(0);
+}
+
+void SpinBarrier :: wait()
+{
+	int gen = generation.load(memory_order_acquire);
+	if (waiting.fetch_add(1, memory_order_acq_rel) == total - 1)
+	{
+		//Last thread in releases everyone else
+		waiting.store(0, memory_order_relaxed);
+		generation.fetch_add(1, memory_order_acq_rel);
+	}
+	else
+	{
+		while (generation.load(memory_order_acquire) == gen)
+			this_thread::yield();
+	}
+}
+
+
+Branch :: Branch(int index, const NetworkConfig& config) : line(config.customers * 4 + 16)
+{
+	id = index;
+	branches = config.branches;
+	transferProb = config.transferProb;
+
+	state.freeTellers = config.tellers;
+	state.rng.seed(config.seed, index);
+	state.departures = 0;
+	state.sent = 0;
+	state.currentTime = 0;
+	state.lastTime = 0;
+	state.served = 0;
+	state.cumulative_wait = 0;
+	state.max_wait = 0;
+	state.events = 0;
+	state.cumulative_line = 0;
+	state.max_line = 0;
+	state.idle_time = 0;
+
+	vector<int> arrivalTimes;
+	vector<int> transactionLengths;
+	outsideCustomers(config, index, arrivalTimes, transactionLengths);
+
+	//Enqueue latest first so every insert lands at the front of the event queue
+	for (int i = config.customers - 1; i >= 0; i--)
+	{
+		Arrival* temp = new Arrival(arrivalTimes[i], transactionLengths[i]);
+		eventQueue.enqueue(temp, arrivalTimes[i], key(KIND_ARRIVAL, id, i));
+	}
+}
+
+Branch :: ~Branch()
+{
+	while ( !eventQueue.isEmpty() )
+	{
+		Event* temp = eventQueue.peekFront();
+		delete temp;
+		eventQueue.dequeue();
+	}
+	while ( !line.isEmpty() )
+	{
+		delete line.peekFront();
+		line.dequeue();
+	}
+}
+
+long long Branch :: key(int kind, int origin, long long seq)
+{
+	return ((long long) kind << 60) | ((long long) origin << 36) | seq;
+}
+
+//Customer i arrives at arrivalTimes[i], which are sorted, with transactionLengths[i]
+void Branch :: outsideCustomers(const NetworkConfig& config, int index, vector<int>& arrivalTimes, vector<int>& transactionLengths)
+{
+	//Outside customers: uniform arrival times from 0 - horizon, transaction lengths from 1 - NET_MAX_LENGTH, from a stream of their own
+	RandomStream generator(config.seed, config.branches + index);
+	arrivalTimes.resize(config.customers);
+	transactionLengths.resize(config.customers);
+	for (int i = 0; i < config.customers; i++)
+	{
+		arrivalTimes[i] = generator.below(config.horizon + 1);
+		transactionLengths[i] = generator.below(NET_MAX_LENGTH) + 1;
+	}
+	sort(arrivalTimes.begin(), arrivalTimes.end());
+}
+
+int Branch :: nextTime() const
+{
+	if (eventQueue.isEmpty())
+		return INT_MAX;
+
+	return eventQueue.peekPriority();
+}
+
+void Branch :: receive(Mailbox& box)
+{
+	Transfer* msg = box.collect();
+	while (msg != NULL)
+	{
+		Transfer* next = msg->next;
+		Arrival* temp = new Arrival(msg->time, msg->length);
+		eventQueue.enqueue(temp, msg->time, key(KIND_TRANSFER, msg->origin, msg->seq));
+		delete msg;
+		msg = next;
+	}
+}
+
+int Branch :: processNext(Mailbox* mailboxes, UndoRecord* undo)
+{
+	Event* nextEvent = eventQueue.peekFront();
+	int time = eventQueue.peekPriority();
+	long long tie = eventQueue.peekTie();
+	eventQueue.dequeue();
+
+	if (undo != NULL)
+	{
+		undo->time = time;
+		undo->tie = tie;
+		undo->event = nextEvent;
+		undo->departure = (nextEvent->getType() == false);
+		undo->before = state;
+		undo->lineChange = LINE_UNCHANGED;
+		undo->dequeued = NULL;
+		undo->scheduledTime = -1;
+		undo->destination = -1;
+	}
+
+	state.currentTime = time;
+	state.idle_time += (long long) state.freeTellers * (time - state.lastTime);	//Tellers free since the last event were idle
+	state.lastTime = time;
+
+	int destination = -1;
+	if (nextEvent->getType() == true)
+	{
+		Arrival* arr = static_cast<Arrival*> (nextEvent);
+
+		//If line is empty and there is an available teller then customer goes straight to that teller
+		if (line.isEmpty() && state.freeTellers > 0)
+		{
+			state.freeTellers--;
+			destination = startService(arr, mailboxes, undo);
+		}
+		else
+		{
+			line.enqueue(arr);
+			if (undo != NULL)
+				undo->lineChange = LINE_ENQUEUED;
+		}
+	}
+	else
+	{
+		Departure* dep = static_cast<Departure*> (nextEvent);
+
+		int wait = time - dep->getTransactionLength() - dep->getArrivalTime();	//wait time = d - t - a
+		state.cumulative_wait += wait;
+		if (wait > state.max_wait)
+			state.max_wait = wait;
+		state.served++;
+
+		//A departure that may still be rolled back is freed when it is committed instead
+		if (undo == NULL)
+			delete dep;
+
+		if ( !line.isEmpty() )
+		{
+			Arrival* nextCustomer = static_cast<Arrival*> (line.peekFront());
+			line.dequeue();
+			if (undo != NULL)
+			{
+				undo->lineChange = LINE_DEQUEUED;
+				undo->dequeued = nextCustomer;
+			}
+			destination = startService(nextCustomer, mailboxes, undo);
+		}
+		else
+		{
+			state.freeTellers++;
+		}
+	}
+
+	state.events++;
+	state.cumulative_line += line.getCount();
+	if (line.getCount() > state.max_line)
+		state.max_line = line.getCount();
+
+	return destination;
+}
+
+int Branch :: startService(Arrival* arr, Mailbox* mailboxes, UndoRecord* undo)
+{
+	int departureTime = state.currentTime + arr->getTransactionLength();
+	long long departureTie = key(KIND_DEPARTURE, id, state.departures++);
+	eventQueue.enqueue(arr->depart(departureTime), departureTime, departureTie);
+
+	if (undo != NULL)
+	{
+		undo->scheduledTime = departureTime;
+		undo->scheduledTie = departureTie;
+	}
+
+	//The teller knows at the start of the transaction whether the customer will be sent on, so the transfer is posted now,
+	//timestamped for when the customer leaves. That is at least NET_LOOKAHEAD ahead of currentTime
+	if (branches > 1 && state.rng.uniform() < transferProb)
+	{
+		int destination = state.rng.below(branches - 1);
+		if (destination >= id)
+			destination++;
+
+		Transfer* msg = new Transfer;
+		msg->time = departureTime;
+		msg->length = state.rng.below(NET_MAX_LENGTH) + 1;
+		msg->origin = id;
+		msg->seq = state.sent++;
+		msg->anti = false;
+
+		if (undo != NULL)
+		{
+			undo->destination = destination;
+			undo->sent = *msg;
+		}
+
+		lastSent = *msg;
+		mailboxes[destination].post(msg);
+
+		return destination;
+	}
+
+	return -1;
+}
+
+void Branch :: finish(Stats* simData)
+{
+	simData->process_time = state.currentTime;
+	simData->avg_wait = (state.served == 0) ? 0 : (double) state.cumulative_wait / state.served;
+	simData->avg_length = (state.events == 0) ? 0 : state.cumulative_line / state.events;
+	simData->max_wait = state.max_wait;
+	simData->max_length = state.max_line;
+	simData->idle_time = state.idle_time;
+}
+
+
+ConservativeBranch :: ConservativeBranch(int index, const NetworkConfig& config) : Branch(index, config)
+{
+	vector<int> arrivalTimes;
+	vector<int> transactionLengths;
+	outsideCustomers(config, index, arrivalTimes, transactionLengths);
+
+	outsideSend.resize(config.customers);
+	int earliest = INT_MAX;
+	for (int i = config.customers - 1; i >= 0; i--)
+	{
+		earliest = min(earliest, arrivalTimes[i] + transactionLengths[i]);
+		outsideSend[i] = earliest;
+	}
+
+	outsideNext = 0;
+	for (int length = 0; length <= NET_MAX_LENGTH; length++)
+		waiting[length] = 0;
+	lengths[0] = 0;
+	lengths[1] = 0;
+	clearSent();
+}
+
+void ConservativeBranch :: receive(Mailbox& box)
+{
+	Transfer* msg = box.collect();
+	while (msg != NULL)
+	{
+		Transfer* next = msg->next;
+		countWaiting(msg->length, 1);
+		Arrival* temp = new Arrival(msg->time, msg->length);
+		eventQueue.enqueue(temp, msg->time, key(KIND_TRANSFER, msg->origin, msg->seq));
+		delete msg;
+		msg = next;
+	}
+}
+
+int ConservativeBranch :: processNext(Mailbox* mailboxes)
+{
+	//Whoever starts service here stops waiting: an arrival served at once, or the front of the line at a departure
+	Event* nextEvent = eventQueue.peekFront();
+	bool arrival = nextEvent->getType();
+	bool outside = (eventQueue.peekTie() >> 60) == KIND_ARRIVAL;
+	int length = arrival ? (int) static_cast<Arrival*> (nextEvent)->getTransactionLength() : 0;
+	int before = line.getCount();
+	int front = (arrival == false && before > 0) ? (int) static_cast<Arrival*> (line.peekFront())->getTransactionLength() : 0;
+
+	int destination = Branch::processNext(mailboxes);
+
+	if (arrival)
+	{
+		bool joined = line.getCount() > before;
+		if (outside)
+		{
+			outsideNext++;
+			if (joined)
+				countWaiting(length, 1);
+		}
+		else if (joined == false)
+		{
+			countWaiting(length, -1);
+		}
+	}
+	else if (before > 0)
+	{
+		countWaiting(front, -1);
+	}
+
+	if (destination != -1)
+	{
+		sentTime = min(sentTime, lastSent.time);
+		sentSend = min(sentSend, lastSent.time + lastSent.length);
+	}
+
+	return destination;
+}
+
+//Earliest event this branch knows of: its own next one, or a Transfer it sent that may not have been collected yet
+int ConservativeBranch :: earliestEvent() const
+{
+	return min(nextTime(), sentTime);
+}
+
+int ConservativeBranch :: earliestSend() const
+{
+	if (branches == 1 || transferProb <= 0)			//Never sends any
+		return INT_MAX;
+
+	int earliest = min(sentSend, (outsideNext < (int) outsideSend.size()) ? outsideSend[outsideNext] : INT_MAX);
+	if (lengths[0] != 0)
+		earliest = min(earliest, nextTime() + __builtin_ctzll(lengths[0]) + 1);
+	else if (lengths[1] != 0)
+		earliest = min(earliest, nextTime() + __builtin_ctzll(lengths[1]) + 65);
+
+	return earliest;
+}
+
+//Once a window starts, every Transfer sent before it has been collected by its destination, which counts it from then on
+void ConservativeBranch :: clearSent()
+{
+	sentTime = INT_MAX;
+	sentSend = INT_MAX;
+}
+
+void ConservativeBranch :: countWaiting(int length, int change)
+{
+	waiting[length] += change;
+	unsigned long long bit = 1ULL << ((length - 1) % 64);
+	if (waiting[length] > 0)
+		lengths[(length - 1) / 64] |= bit;
+	else
+		lengths[(length - 1) / 64] &= ~bit;
+}
+
+
+/**@brief Simulates a network of branches on one thread, one event at a time
+ *
+ *@details Always processes the earliest event in the whole network and hands transfers over immediately. This is the reference the parallel
+ *engine is checked against
+ *
+ *@param config Options for the network
+ *@param branchStats Array of config.branches Stats structs, filled in with the results for each branch
+ *@return void
+ */
+void simulate_network_sequential(const NetworkConfig& config, Stats* branchStats)
+{
+	int count = config.branches;
+	vector<Branch*> branches(count);
+	Mailbox* mailboxes = new Mailbox[count];
+	for (int b = 0; b < count; b++)
+		branches[b] = new Branch(b, config);
+
+	while (true)
+	{
+		int earliest = -1;
+		int earliestTime = INT_MAX;
+		for (int b = 0; b < count; b++)
+		{
+			int t = branches[b]->nextTime();
+			if (t < earliestTime)
+			{
+				earliestTime = t;
+				earliest = b;
+			}
+		}
+
+		if (earliest == -1)
+			break;
+
+		int destination = branches[earliest]->processNext(mailboxes);
+		if (destination != -1)
+			branches[destination]->receive(mailboxes[destination]);
+	}
+
+	for (int b = 0; b < count; b++)
+	{
+		branches[b]->finish(&branchStats[b]);
+		delete branches[b];
+	}
+	delete[] mailboxes;
+}
+
+/**@brief Simulates a network of branches with conservative parallel discrete event simulation
+ *
+ *@details Branch b belongs to thread b % threads. Threads agree on the earliest pending event time T and on E, the earliest time any Transfer
+ *still to be sent can be due (ConservativeBranch::earliestSend; a customer that arrives by Transfer inside the window is due to leave after E, so it
+ *cannot lower it). Each thread then processes its own branches up to E, which is at least T + NET_LOOKAHEAD and usually several time units past it,
+ *so there are far fewer windows and barriers than 1 per time unit. No transfer sent in that window can be due inside it, so nothing ever arrives
+ *in a branch's past. Transfers go through lock-free mailboxes that are emptied at the next window. A sender counts the Transfers it posted in its own
+ *bounds until then, so the threads publish T and E as they finish a window and meet at 1 barrier per window, with the bounds of alternate windows
+ *kept apart so a slow reader never sees the next ones. Because event order inside a branch does not depend on
+ *the partition, the results match simulate_network_sequential exactly
+ *
+ *@param config Options for the network
+ *@param branchStats Array of config.branches Stats structs, filled in with the results for each branch
+ *@return void
+ */
+void simulate_network_parallel(const NetworkConfig& config, Stats* branchStats)
+{
+	int count = config.branches;
+	int threads = max(min(config.threads, count), 1);		//At least 1, even for a network with no branches
+
+	vector<ConservativeBranch*> branches(count);
+	Mailbox* mailboxes = new Mailbox[count];
+	for (int b = 0; b < count; b++)
+		branches[b] = new ConservativeBranch(b, config);
+
+	//One cache line per thread and window parity: the earliest event, then the earliest Transfer due
+	vector<int> localMin(2 * threads * 16);
+	SpinBarrier barrier(threads);
+
+	auto bounds = [&](int t, int parity)
+	{
+		int earliest = INT_MAX;
+		int send = INT_MAX;
+		for (int b = t; b < count; b += threads)
+		{
+			earliest = min(earliest, branches[b]->earliestEvent());
+			send = min(send, branches[b]->earliestSend());
+		}
+		localMin[(parity * threads + t) * 16] = earliest;
+		localMin[(parity * threads + t) * 16 + 1] = send;
+	};
+
+	auto worker = [&](int t)
+	{
+		int parity = 0;
+		bounds(t, parity);
+		while (true)
+		{
+			barrier.wait();
+
+			int windowStart = INT_MAX;
+			int windowEnd = INT_MAX;
+			for (int i = 0; i < threads; i++)
+			{
+				windowStart = min(windowStart, localMin[(parity * threads + i) * 16]);
+				windowEnd = min(windowEnd, localMin[(parity * threads + i) * 16 + 1]);
+			}
+
+			if (windowStart == INT_MAX)
+				break;
+
+			for (int b = t; b < count; b += threads)
+			{
+				branches[b]->receive(mailboxes[b]);
+				branches[b]->clearSent();
+				while (branches[b]->nextTime() < windowEnd)
+					branches[b]->processNext(mailboxes);
+			}
+
+			parity ^= 1;
+			bounds(t, parity);
+		}
+	};
+
+	vector<thread> pool;
+	for (int t = 1; t < threads; t++)
+		pool.push_back(thread(worker, t));
+	worker(0);
+	for (int t = 0; t < (int) pool.size(); t++)
+		pool[t].join();
+
+	for (int b = 0; b < count; b++)
+	{
+		branches[b]->finish(&branchStats[b]);
+		delete branches[b];
+	}
+	delete[] mailboxes;
+}
+
+
+#endif
@@ -0,0 +1,263 @@
+#ifndef CLASSQUEUE_H
+#define CLASSQUEUE_H
+
+#include "Event.h"
+#include "Stats.h"
+
+using namespace std;
+
+#define CLASS_STRICT 0			//Service disciplines of a ClassQueue: always the highest class waiting,
+#define CLASS_WEIGHTED 1		//or each class in proportion to its weight (deficit round robin)
+#define CLASS_QUANTUM 256		//Transaction time a class of weight 1 is owed per round of CLASS_WEIGHTED
+#define CLASS_BITS 2			//Low bits of a slot that hold its class; 1 << CLASS_BITS must be at least MAX_CLASSES
+#define CLASS_SEQUENCE_MASK 0x1FFFFFFF	//Bits of a slot's position in its class ring that fit above them
+
+/** @class ClassQueue
+ *  @brief 1 line of customers of several classes: a ring per class, plus a bitmask of the classes with someone waiting
+ *
+ *  Class 0 is the highest. With CLASS_STRICT the next customer is the first of the highest class waiting, found with 1 count-trailing-zeros of the
+ *  bitmask. With CLASS_WEIGHTED classes take turns: each turn a class is owed CLASS_QUANTUM * its weight more transaction time, and serves customers
+ *  while what it is owed covers the next one, so over time each class that keeps waiting gets transaction time in proportion to its weight.
+ *  Customers are FIFO within their class. Rings double when full, so they start small whatever the mix.
+ *
+ *  Has the members of ArrayQueue that engineA and engineB use, so either can be their line. A slot holds a customer's class and position in its ring,
+ *  which growing a ring does not change, so remove() takes a customer out of the middle of their class in O(1) like ArrayQueue::remove
+ */
+class ClassQueue {
+
+	public:
+		ClassQueue(int classes, int discipline, const int* weights);
+		~ClassQueue();
+		bool enqueue(Event* newEntry);
+		bool dequeue();
+		int rearSlot() const;
+		bool remove(int slot);
+		bool isEmpty() const;
+		int getCount();
+		int getCount(int c) const;
+		Event* peekFront();
+
+	private:
+		struct Ring {
+			Event** data;
+			unsigned int mask;		//Capacity - 1, a power of 2
+			unsigned int head;		//Position of the first customer; positions only grow, and index data through mask
+			unsigned int used;		//Positions from head to the last customer, counting the holes remove() leaves
+			int count;			//Customers in the ring
+		};
+
+		ClassQueue(const ClassQueue&) = delete;
+		ClassQueue& operator=(const ClassQueue&) = delete;
+		int next();
+		SimTime frontLength(int c) const;
+		void grow(Ring& ring);
+		void skipFront(Ring& ring);
+		void emptied(int c);
+
+		Ring rings[MAX_CLASSES];
+		int classes;
+		int discipline;
+		int quantum[MAX_CLASSES];
+		long long deficit[MAX_CLASSES];		//Transaction time each class is still owed this round (CLASS_WEIGHTED)
+		int current;				//Class whose turn it is (CLASS_WEIGHTED)
+		unsigned int occupied;			//Bit c is set while class c has a customer waiting
+		int count;
+		int rear;
+};
+
+
+ClassQueue :: ClassQueue(int classes, int discipline, const int* weights)
+{
+	this->classes = min(max(classes, 1), MAX_CLASSES);
+	this->discipline = discipline;
+	for (int c = 0; c < MAX_CLASSES; c++)
+	{
+		rings[c].data = new Event*[16];
+		rings[c].mask = 15;
+		rings[c].head = 0;
+		rings[c].used = 0;
+		rings[c].count = 0;
+		quantum[c] = CLASS_QUANTUM * ((weights != NULL) ? max(weights[c], 1) : 1);
+		deficit[c] = 0;
+	}
+	current = 0;
+	occupied = 0;
+	count = 0;
+	rear = -1;
+}
+
+ClassQueue :: ~ClassQueue()
+{
+	for (int c = 0; c < MAX_CLASSES; c++)
+		delete[] rings[c].data;
+}
+
+//The customer's class picks their ring; classes past the last one configured join the lowest
+bool ClassQueue :: enqueue(Event* newEntry)
+{
+	int c = min(static_cast<Customer*> (newEntry)->getClass(), classes - 1);
+	Ring& ring = rings[c];
+	if (ring.used > ring.mask)
+		grow(ring);
+
+	unsigned int position = ring.head + ring.used;
+	ring.data[position & ring.mask] = newEntry;
+	ring.used++;
+	ring.count++;
+	count++;
+	occupied |= 1u << c;
+	rear = (int) (((position & CLASS_SEQUENCE_MASK) << CLASS_BITS) | c);
+	return true;
+}
+
+bool ClassQueue :: dequeue()
+{
+	if (isEmpty())
+		return false;
+
+	int c = next();
+	Ring& ring = rings[c];
+	if (discipline == CLASS_WEIGHTED)
+		deficit[c] -= static_cast<Customer*> (ring.data[ring.head & ring.mask])->getTransactionLength();
+
+	ring.head++;
+	ring.used--;
+	ring.count--;
+	count--;
+	skipFront(ring);
+	if (ring.count == 0)
+		emptied(c);
+	return true;
+}
+
+//Slot of the last customer enqueued, which stays theirs until they leave the line
+int ClassQueue :: rearSlot() const
+{
+	return rear;
+}
+
+bool ClassQueue :: remove(int slot)
+{
+	if (slot < 0)
+		return false;
+
+	int c = slot & ((1 << CLASS_BITS) - 1);
+	Ring& ring = rings[c];
+	unsigned int offset = ((unsigned int) (slot >> CLASS_BITS) - ring.head) & CLASS_SEQUENCE_MASK;
+	if (c >= classes || offset >= ring.used || ring.data[(ring.head + offset) & ring.mask] == NULL)
+		return false;
+
+	ring.data[(ring.head + offset) & ring.mask] = NULL;
+	ring.count--;
+	count--;
+	if (offset == 0)
+		skipFront(ring);
+	else
+	{
+		while (ring.used > 0 && ring.data[(ring.head + ring.used - 1) & ring.mask] == NULL)	//Holes at the rear are dropped too
+			ring.used--;
+	}
+	if (ring.count == 0)
+		emptied(c);
+	return true;
+}
+
+bool ClassQueue :: isEmpty() const
+{
+	return (count == 0);
+}
+
+int ClassQueue :: getCount()
+{
+	return count;
+}
+
+int ClassQueue :: getCount(int c) const
+{
+	return rings[c].count;
+}
+
+Event* ClassQueue :: peekFront()
+{
+	if (isEmpty())
+		return NULL;
+
+	Ring& ring = rings[next()];
+	return ring.data[ring.head & ring.mask];
+}
+
+//Class the next customer is taken from. Only called when someone is waiting
+int ClassQueue :: next()
+{
+	if (discipline == CLASS_STRICT)
+		return __builtin_ctz(occupied);
+
+	//Deficit round robin: the class whose turn it is keeps it while what it is owed covers its first customer, then the next class with
+	//someone waiting gets its quantum. Asking again without a dequeue in between gives the same class
+	if ((occupied & (1u << current)) && frontLength(current) <= deficit[current])
+		return current;
+
+	//A transaction many quanta long would take as many rounds in which nobody is served, so those are given in one step: every class waiting
+	//is owed the quanta of the rounds before the first in which one of them is covered, which leaves the turn order as it was
+	long long rounds = -1;
+	for (unsigned int waiting = occupied; waiting != 0; waiting &= waiting - 1)
+	{
+		int c = __builtin_ctz(waiting);
+		long long turns = max((frontLength(c) - deficit[c] + quantum[c] - 1) / quantum[c], 1LL);
+		if (rounds < 0 || turns - 1 < rounds)
+			rounds = turns - 1;
+	}
+	for (unsigned int waiting = occupied; waiting != 0; waiting &= waiting - 1)
+	{
+		int c = __builtin_ctz(waiting);
+		deficit[c] += rounds * quantum[c];
+	}
+
+	while (true)
+	{
+		unsigned int later = occupied & ~((2u << current) - 1);
+		current = __builtin_ctz((later != 0) ? later : occupied);
+		deficit[current] += quantum[current];
+		if (frontLength(current) <= deficit[current])
+			return current;
+	}
+}
+
+//Transaction length of the first customer of class c, which has someone waiting
+SimTime ClassQueue :: frontLength(int c) const
+{
+	const Ring& ring = rings[c];
+	return static_cast<Customer*> (ring.data[ring.head & ring.mask])->getTransactionLength();
+}
+
+//Doubles a full ring, keeping every position at the same place modulo the new capacity so slots stay valid
+void ClassQueue :: grow(Ring& ring)
+{
+	unsigned int mask = ring.mask * 2 + 1;
+	Event** data = new Event*[mask + 1];
+	for (unsigned int i = 0; i < ring.used; i++)
+		data[(ring.head + i) & mask] = ring.data[(ring.head + i) & ring.mask];
+
+	delete[] ring.data;
+	ring.data = data;
+	ring.mask = mask;
+}
+
+//Steps the head over customers removed from the middle, once they reach the front
+void ClassQueue :: skipFront(Ring& ring)
+{
+	while (ring.used > 0 && ring.data[ring.head & ring.mask] == NULL)
+	{
+		ring.head++;
+		ring.used--;
+	}
+}
+
+void ClassQueue :: emptied(int c)
+{
+	occupied &= ~(1u << c);
+	deficit[c] = 0;				//A class is not owed time it had nobody waiting for
+}
+
+
+#endif
@@ -0,0 +1,267 @@
+#ifndef CUSTOMERLOG_H
+#define CUSTOMERLOG_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <fcntl.h>
+#include <unistd.h>
+#include "SimTime.h"
+
+using namespace std;
+
+#define CUSTOMER_LOG_MAGIC 0x3143455248534142ULL	//"BASHREC1", first 8 bytes of every customer log
+#define CUSTOMER_LOG_RING 65536			//Records the event loop can get ahead of the writer thread by
+#define CUSTOMER_LOG_BLOCK (1 << 20)			//Bytes per write(), and the alignment of the buffer they are written from
+#define CUSTOMER_LOG_IDLE_US 50			//How long the writer thread sleeps when the ring is empty
+
+/*
+ * Customer log file: a 16 byte header, then 1 CustomerRecord per customer in order of departure, as raw little-endian ints.
+ *
+ *   header:  magic (8 bytes, "BASHREC1")  record size (4 bytes, 20, or 32 from a LONG_HORIZON build)  0 (4 bytes)
+ *   record:  arrival  serviceStart  departure		(1 SimTime each, 4 bytes or 8 from a LONG_HORIZON build)
+ *            teller  line				(4 bytes each)
+ */
+
+/** @struct CustomerRecord
+ *  @brief This structure holds what happened to 1 customer, as written to a customer log
+ *  @var CustomerRecord::arrival
+ *  Member arrival holds when the customer arrived
+ *  @var CustomerRecord::serviceStart
+ *  Member serviceStart holds when a teller started serving the customer
+ *  @var CustomerRecord::departure
+ *  Member departure holds when the customer left
+ *  @var CustomerRecord::teller
+ *  Member teller holds which teller served the customer
+ *  @var CustomerRecord::line
+ *  Member line holds which line the customer waited in, always 0 for simulateA
+ */
+struct CustomerRecord {
+	SimTime arrival;
+	SimTime serviceStart;
+	SimTime departure;
+	int teller;
+	int line;
+};
+
+/** @class RecordRing
+ *  @brief Lock-free ring buffer of CustomerRecords for exactly 1 producer thread and 1 consumer thread
+ *
+ *  head and tail only ever grow and are kept on their own cache lines. The producer keeps its own copy of head and only reloads it when the ring
+ *  looks full, so a push is normally 1 store of the record and 1 release store of tail
+ */
+class RecordRing {
+
+	public:
+		RecordRing(int capacity = CUSTOMER_LOG_RING);
+		~RecordRing();
+		bool push(const CustomerRecord& record);
+		int pop(CustomerRecord* records, int most);
+
+	private:
+		CustomerRecord* slots;
+		size_t mask;
+		alignas(64) atomic<size_t> head;		//Next record to pop; written by the consumer
+		alignas(64) atomic<size_t> tail;		//Next slot to push into; written by the producer
+		size_t knownHead;				//Producer's copy of head
+};
+
+/** @class CustomerLog
+ *  @brief Writes 1 CustomerRecord per customer to a binary file without slowing the event loop down
+ *
+ *  The event loop pushes records into a RecordRing, and a writer thread drains it into a CUSTOMER_LOG_BLOCK aligned buffer that is written out a
+ *  whole block at a time. When the ring is full record() waits for the writer, so no record is ever dropped. Only call record() if good() is true
+ *  after construction
+ */
+class CustomerLog {
+
+	public:
+		CustomerLog(string fileName);
+		~CustomerLog();
+		bool good() const;
+		void record(SimTime arrival, SimTime serviceStart, SimTime departure, int teller, int line);
+		bool close();
+		long long count() const;
+
+	private:
+		void drain();
+		bool flush(size_t bytes);
+
+		int fd;
+		RecordRing ring;
+		char* buffer;
+		size_t used;
+		long long records;
+		atomic<bool> stopping;
+		atomic<bool> ok;
+		thread writer;
+};
+
+
+RecordRing :: RecordRing(int capacity)
+{
+	size_t size = 1;
+	while (size < (size_t) capacity)
+		size *= 2;
+
+	slots = new CustomerRecord[size];
+	mask = size - 1;
+	head = 0;
+	tail = 0;
+	knownHead = 0;
+}
+
+RecordRing :: ~RecordRing()
+{
+	delete[] slots;
+}
+
+inline bool RecordRing :: push(const CustomerRecord& record)
+{
+	size_t t = tail.load(memory_order_relaxed);
+	if (t - knownHead > mask)
+	{
+		knownHead = head.load(memory_order_acquire);
+		if (t - knownHead > mask)
+			return false;
+	}
+
+	slots[t & mask] = record;
+	tail.store(t + 1, memory_order_release);
+	return true;
+}
+
+int RecordRing :: pop(CustomerRecord* records, int most)
+{
+	size_t h = head.load(memory_order_relaxed);
+	size_t available = tail.load(memory_order_acquire) - h;
+	int n = (int) min(available, (size_t) most);
+
+	//At most 2 runs of slots: up to the end of the array, then from its start
+	size_t start = h & mask;
+	size_t first = min((size_t) n, mask + 1 - start);
+	memcpy(records, slots + start, first * sizeof(CustomerRecord));
+	memcpy(records + first, slots, (n - first) * sizeof(CustomerRecord));
+
+	head.store(h + n, memory_order_release);
+	return n;
+}
+
+
+CustomerLog :: CustomerLog(string fileName)
+{
+	used = 0;
+	records = 0;
+	stopping = false;
+	buffer = NULL;
+	fd = open(fileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	ok = (fd >= 0) && posix_memalign((void**) &buffer, 4096, CUSTOMER_LOG_BLOCK) == 0;
+	if (ok == false)
+		return;
+
+	//The header is the start of the first block, so every write but the last is a whole block at a block aligned offset
+	unsigned long long magic = CUSTOMER_LOG_MAGIC;
+	int header[2] = {(int) sizeof(CustomerRecord), 0};
+	memcpy(buffer, &magic, sizeof(magic));
+	memcpy(buffer + sizeof(magic), header, sizeof(header));
+	used = sizeof(magic) + sizeof(header);
+
+	writer = thread(&CustomerLog::drain, this);
+}
+
+CustomerLog :: ~CustomerLog()
+{
+	close();
+	free(buffer);
+}
+
+bool CustomerLog :: good() const
+{
+	return ok;
+}
+
+inline void CustomerLog :: record(SimTime arrival, SimTime serviceStart, SimTime departure, int teller, int line)
+{
+	CustomerRecord r = {arrival, serviceStart, departure, teller, line};
+	while (ring.push(r) == false)
+		this_thread::yield();
+	records++;
+}
+
+bool CustomerLog :: close()
+{
+	if (writer.joinable())
+	{
+		stopping = true;
+		writer.join();
+	}
+
+	if (fd >= 0)
+	{
+		ok = (::close(fd) == 0) && ok;
+		fd = -1;
+	}
+
+	return ok;
+}
+
+long long CustomerLog :: count() const
+{
+	return records;
+}
+
+void CustomerLog :: drain()
+{
+	CustomerRecord batch[4096];
+	while (true)
+	{
+		//stopping is read before popping, so the records pushed before it was set are all popped on this pass or an earlier one
+		bool last = stopping;
+		int n = ring.pop(batch, 4096);
+		if (n == 0)
+		{
+			if (last == true)
+				break;
+			this_thread::sleep_for(chrono::microseconds(CUSTOMER_LOG_IDLE_US));
+			continue;
+		}
+
+		const char* bytes = reinterpret_cast<const char*> (batch);
+		size_t left = n * sizeof(CustomerRecord);
+		while (left > 0)
+		{
+			size_t part = min(left, (size_t) CUSTOMER_LOG_BLOCK - used);
+			memcpy(buffer + used, bytes, part);
+			used += part;
+			bytes += part;
+			left -= part;
+			if (used == CUSTOMER_LOG_BLOCK)
+				flush(CUSTOMER_LOG_BLOCK);
+		}
+	}
+
+	flush(used);
+}
+
+bool CustomerLog :: flush(size_t bytes)
+{
+	size_t written = 0;
+	while (written < bytes && ok)
+	{
+		ssize_t put = write(fd, buffer + written, bytes - written);
+		if (put <= 0)
+			ok = false;
+		else
+			written += put;
+	}
+
+	used = 0;
+	return ok;
+}
+
+
+#endif
@@ -1,10 +1,14 @@
 #ifndef EVENT_H
 #define EVENT_H
 
+#include <vector>
+#include "SimTime.h"
+#include "TimingWheel.h"
+
 using namespace std;
 
 class Event {
-	
+
 	public:
 		Event(bool type)
 		{
@@ -12,7 +16,7 @@ class Event {
 		}
 
 		virtual ~Event() {}
-	
+
 		bool getType()
 		{
 			return arrival;
@@ -20,28 +24,66 @@ class Event {
 
 	protected:
 		bool arrival;
-		
+
 };
 
-class Arrival : public Event {
-	
+/** @class Customer
+ *  @brief 1 customer's visit, which is the same object through all of it: an arrival in the event queue, a waiting customer in a line, then its own
+ *  departure back in the event queue
+ *
+ *  depart() flips it from arrival to departure in place, so serving a customer never allocates. Arrival and Departure name the 2 phases
+ */
+class Customer : public Event {
+
 	public:
-		Arrival(int a, int t) : Event(true)
+		Customer(SimTime a, SimTime t) : Event(true)
+		{
+			reset(a, t);
+		}
+
+		//Makes this the arrival of a new customer, for records reused by a CustomerPool
+		void reset(SimTime a, SimTime t)
 		{
+			arrival = true;
 			arrivalTime = a;
 			transactionLength = t;
+			departureTime = 0;
+			queueIndex = -1;
+			customerClass = 0;
+			slot = -1;
+			timer.initialize();
+		}
+
+		//Schedules the customer's departure: from here on it is a Departure
+		Customer* depart(SimTime d)
+		{
+			arrival = false;
+			departureTime = d;
+			return this;
 		}
 
-		int getArrivalTime()
+		//Undoes depart(), for an engine that rolls events back
+		void undepart()
+		{
+			arrival = true;
+			departureTime = 0;
+		}
+
+		SimTime getArrivalTime()
 		{
 			return arrivalTime;
 		}
 
-		int getTransactionLength()
+		SimTime getTransactionLength()
 		{
 			return transactionLength;
 		}
-		
+
+		SimTime getDepartureTime()
+		{
+			return departureTime;
+		}
+
 		void setQueueIndex(int index)
 		{
 			queueIndex = index;
@@ -51,35 +93,100 @@ class Arrival : public Event {
 		{
 			return queueIndex;
 		}
-	
+
+		//Class of a customer in a line with several classes, 0 (the highest) otherwise
+		void setClass(int c)
+		{
+			customerClass = c;
+		}
+
+		int getClass()
+		{
+			return customerClass;
+		}
+
+		//Where the customer is in their line's ArrayQueue, so they can leave from the middle of it
+		void setSlot(int s)
+		{
+			slot = s;
+		}
+
+		int getSlot()
+		{
+			return slot;
+		}
+
+		//The customer's patience timer, while they wait in a line of a simulation where customers give up
+		TimerHandle& getTimer()
+		{
+			return timer;
+		}
+
 	private:
-		int arrivalTime;
-		int transactionLength;
-		int queueIndex;			//Only used when simulating with multiple lines
+		unsigned char customerClass;	//Declared first so it fits in the padding after Event::arrival
+		SimTime arrivalTime;
+		SimTime transactionLength;
+		SimTime departureTime;		//Set by depart()
+		int queueIndex;			//Line the customer waits in (simulateB), or teller serving them (simulateA)
+		int slot;
+		TimerHandle timer;
 };
 
-class Departure : public Event {
-	
+typedef Customer Arrival;		//A Customer that has arrived, or is waiting in a line
+typedef Customer Departure;		//A Customer whose departure is scheduled
+
+/** @class CustomerPool
+ *  @brief Free list of Customers that have departed, so an engine reuses them for later arrivals instead of allocating 1 per customer
+ *
+ *  Once as many customers as are ever in the bank at once have been allocated, acquire() stops allocating. The pool only owns the Customers on its
+ *  free list: one that is in an event queue or a line belongs to whoever holds it, and release() hands it back. Any Customer can be released, not only
+ *  ones the pool allocated
+ */
+class CustomerPool {
+
 	public:
-		Departure(int d, Arrival* a) : Event(false)
+		CustomerPool()
 		{
-			departureTime = d;
-			linkedArrival = a;
+			allocated = 0;
 		}
 
-		int getDepartureTime()
+		~CustomerPool()
 		{
-			return departureTime;
+			for (size_t i = 0; i < spare.size(); i++)
+				delete spare[i];
+		}
+
+		CustomerPool(const CustomerPool&) = delete;
+		CustomerPool& operator=(const CustomerPool&) = delete;
+
+		Arrival* acquire(SimTime a, SimTime t)
+		{
+			if (spare.empty())
+			{
+				allocated++;
+				return new Arrival(a, t);
+			}
+
+			Arrival* arr = spare.back();
+			spare.pop_back();
+			arr->reset(a, t);
+			return arr;
+		}
+
+		void release(Customer* customer)
+		{
+			spare.push_back(customer);
 		}
 
-		Arrival* getLinkedArrival()
+		//Customers this pool has ever allocated
+		long long allocations() const
 		{
-			return linkedArrival;
+			return allocated;
 		}
-	
+
 	private:
-		int departureTime;
-		Arrival* linkedArrival;
+		vector<Customer*> spare;
+		long long allocated;
 };
 
 
@@ -0,0 +1,524 @@
+#ifndef GENERATOR_H
+#define GENERATOR_H
+
+#include <cmath>
+#include <cfloat>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <thread>
+#include <algorithm>
+#include "Random.h"
+#include "SimTime.h"
+
+using namespace std;
+
+#define GENERATED_DAY 100001		//Arrival times of a generated day are 0 - 100,000, as generate_events draws them
+#define PROFILE_MAX_POINTS 64		//Most lines of an arrival profile file
+#define PROFILE_GUIDE 1024		//Entries of an arrival profile's guide table, a power of 2
+#define SERVICE_MAX_BINS 64		//Most lines of an empirical service file
+#define SERVICE_MAX 100000		//Longest transaction time a service distribution draws
+#define SERVICE_UNIFORM 0		//Service distributions: 1 - 100 with equal chances, as generate_events draws them,
+#define SERVICE_EXPONENTIAL 1		//exponential,
+#define SERVICE_LOGNORMAL 2		//lognormal,
+#define SERVICE_EMPIRICAL 3		//or a histogram read from a file
+#define GENERATE_BLOCK 65536		//Customers per block of generate_profiled; each block draws from its own lanes, so any number of threads gives the same customers
+#define GENERATE_CHUNK 1024		//Uniforms drawn at a time, a multiple of RANDOM_LANES small enough to stay in L1 with the times made from them
+
+/*
+ * Arrival profile file: 1 "time rate" line per breakpoint, in increasing time, and optionally a line "linear" or "step" (the default). # starts a comment.
+ *
+ *   linear
+ *   9    40			times in any unit; the first and last lines are the start and end of the day
+ *   12   120			rates in any unit too: only their shape matters, since a day always has config.customers arrivals
+ *   14   40
+ *   17   30
+ *
+ * With step the rate of each line holds until the next line's time, and the last line's rate is not used. With linear the rate goes in a straight line
+ * from each breakpoint to the next. Empirical service file: 1 "length weight" line per transaction time, the weights in any unit
+ */
+
+/** @struct ArrivalProfile
+ *  @brief This structure holds how the arrival rate changes over a generated day, scaled to span 0 - GENERATED_DAY
+ *  @var ArrivalProfile::points
+ *  Member points holds the number of breakpoints, 0 for a flat day like generate_events'
+ *  @var ArrivalProfile::linear
+ *  Member linear is true if the rate changes linearly between breakpoints, false if it steps at each one
+ *  @var ArrivalProfile::time
+ *  Member time holds the time of each breakpoint, from 0 to GENERATED_DAY
+ *  @var ArrivalProfile::rate
+ *  Member rate holds the rate at each breakpoint
+ *  @var ArrivalProfile::slope
+ *  Member slope holds how fast the rate changes from each breakpoint to the next, 0 if it steps
+ *  @var ArrivalProfile::area
+ *  Member area holds the area under the rate from the start of the day to each breakpoint, the expected arrivals up to it at that rate
+ *  @var ArrivalProfile::guide
+ *  Member guide holds, for each 1 / PROFILE_GUIDE of the day's area, the breakpoint its start comes after, so a time is found without a search
+ *  @var ArrivalProfile::reach
+ *  Member reach holds the most breakpoints any 1 / PROFILE_GUIDE of the day's area goes past, usually 1
+ */
+struct ArrivalProfile {
+	int points;
+	bool linear;
+	double time[PROFILE_MAX_POINTS];
+	double rate[PROFILE_MAX_POINTS];
+	double slope[PROFILE_MAX_POINTS];
+	double area[PROFILE_MAX_POINTS];
+	int guide[PROFILE_GUIDE];
+	int reach;
+
+	void initialize()
+	{
+		points = 0;
+		reach = 0;
+		linear = false;
+		for (int k = 0; k < PROFILE_MAX_POINTS; k++)
+		{
+			time[k] = 0;
+			rate[k] = 0;
+			slope[k] = 0;
+			area[k] = 0;
+		}
+		for (int j = 0; j < PROFILE_GUIDE; j++)
+			guide[j] = 0;
+	}
+};
+
+/** @struct ServiceModel
+ *  @brief This structure holds the distribution transaction times are drawn from
+ *  @var ServiceModel::kind
+ *  Member kind holds which SERVICE_ distribution it is
+ *  @var ServiceModel::mean
+ *  Member mean holds the mean transaction time (SERVICE_EXPONENTIAL, SERVICE_LOGNORMAL)
+ *  @var ServiceModel::sd
+ *  Member sd holds the standard deviation of the transaction time (SERVICE_LOGNORMAL)
+ *  @var ServiceModel::bins
+ *  Member bins holds the number of transaction times of a SERVICE_EMPIRICAL histogram
+ *  @var ServiceModel::length
+ *  Member length holds the histogram's transaction times, shortest first
+ *  @var ServiceModel::cumulative
+ *  Member cumulative holds the weight of each of the histogram's transaction times and the ones shorter than it
+ */
+struct ServiceModel {
+	int kind;
+	double mean;
+	double sd;
+	int bins;
+	SimTime length[SERVICE_MAX_BINS];
+	double cumulative[SERVICE_MAX_BINS];
+
+	void initialize()
+	{
+		kind = SERVICE_UNIFORM;
+		mean = 0;
+		sd = 0;
+		bins = 0;
+		for (int b = 0; b < SERVICE_MAX_BINS; b++)
+		{
+			length[b] = 0;
+			cumulative[b] = 0;
+		}
+	}
+};
+
+
+/**@brief Reads an arrival profile file, scaling its times to span the generated day
+ *@param fileName Name of the profile file
+ *@param profile Reference to the profile that is filled in
+ *@param error Reference to the reason the file was refused
+ *@return bool Returns false if the file could not be opened or has a bad line, too many lines, fewer than 2, or no arrivals at all
+ */
+bool read_profile(string fileName, ArrivalProfile& profile, string& error);
+
+/**@brief Parses a service distribution: uniform, exponential:MEAN, lognormal:MEAN:SD or empirical:FILE
+ *@param spec The distribution
+ *@param model Reference to the model that is filled in
+ *@param error Reference to the reason the distribution was refused
+ *@return bool Returns false if the distribution is unknown, a number is out of bounds or the empirical file is bad
+ */
+bool parse_service(string spec, ServiceModel& model, string& error);
+
+/**@brief Generates count customers over a day whose arrival rate follows a profile, with transaction times drawn from a service model
+ *
+ *@details A day with a fixed number of arrivals from a nonhomogeneous Poisson process is count independent arrival times with density proportional to
+ *the rate, so each is drawn exactly by inverting the area under the rate (the time change that makes the process homogeneous), with 1 uniform and no
+ *rejections. Transaction times are drawn by inverting their distribution, so the mirrored (antithetic) customers are the mirror image of the plain ones.
+ *
+ *The customers are split into blocks of GENERATE_BLOCK, each with its own RandomLanes drawn from 1 seed taken from each stream, and the blocks are spread
+ *over the threads. Each thread counts the arrivals of its blocks per time unit instead of storing them, and the counts are added up and written out in
+ *order, which sorts the arrival times without sorting. The customers are the same whatever the number of threads
+ *
+ *@param profile The arrival profile
+ *@param model The service model
+ *@param arrivals Stream the arrival times' seed is drawn from; its antithetic flag mirrors the arrival times
+ *@param service Stream the transaction times' seed is drawn from; its antithetic flag mirrors the transaction times
+ *@param arrivalTimes Array of count SimTimes that the sorted arrival times are written into
+ *@param transactionLengths Array of count SimTimes that the transaction times are written into
+ *@param count Number of customers
+ *@param threads Most threads to generate on
+ *@return void
+ */
+void generate_profiled(const ArrivalProfile& profile, const ServiceModel& model, RandomStream& arrivals, RandomStream& service,
+	SimTime* arrivalTimes, SimTime* transactionLengths, int count, int threads);
+
+/**@brief Generates the arrivals and transaction times of 1 block of generate_profiled
+ *@param profile The arrival profile
+ *@param model The service model
+ *@param arrivals Lanes the arrival times are drawn from
+ *@param service Lanes the transaction times are drawn from
+ *@param mirrored Which of arrivals and service are mirrored
+ *@param counts Array of GENERATED_DAY arrival counts per time unit, which the block's arrivals are added to
+ *@param transactionLengths Array of size SimTimes that the block's transaction times are written into
+ *@param size Number of customers in the block
+ *@return void
+ */
+void generate_block(const ArrivalProfile& profile, const ServiceModel& model, RandomLanes& arrivals, RandomLanes& service, const bool mirrored[2],
+	int* counts, SimTime* transactionLengths, int size);
+
+/**@brief Returns the arrival time at which the area under a profile's rate reaches u times the whole day's
+ *@param profile The arrival profile
+ *@param u Uniform in (0, 1)
+ *@return SimTime
+ */
+SimTime profile_time(const ArrivalProfile& profile, double u);
+
+/**@brief Returns the standard normal quantile of p, by Acklam's rational approximation (relative error below 1.2e-9), which is odd about 1/2
+ *@param p Probability in (0, 1)
+ *@return double
+ */
+double inverse_normal(double p);
+
+
+bool read_profile(string fileName, ArrivalProfile& profile, string& error)
+{
+	ifstream profileFile;
+	profileFile.open(fileName.c_str());
+	if ( !profileFile )
+	{
+		error = "could not open the profile file " + fileName;
+		return false;
+	}
+
+	profile.initialize();
+	string line;
+	int number = 0;
+	while (getline(profileFile, line))
+	{
+		number++;
+		line = line.substr(0, line.find('#'));
+		istringstream fields(line);
+		string first;
+		if ( !(fields >> first) )
+			continue;
+
+		error = fileName + " line " + to_string(number) + ": ";
+		if (first == "linear" || first == "step")
+		{
+			profile.linear = (first == "linear");
+			continue;
+		}
+
+		char* end = NULL;
+		double time = strtod(first.c_str(), &end);
+		double rate = -1;
+		string rest;
+		if (*end != '\0' || !(fields >> rate) || (fields >> rest) || !(rate >= 0 && rate < 1e300) || !(time > -1e300 && time < 1e300))
+		{
+			error += "expected time rate";
+			return false;
+		}
+		if (profile.points == PROFILE_MAX_POINTS)
+		{
+			error += "more than " + to_string(PROFILE_MAX_POINTS) + " breakpoints";
+			return false;
+		}
+		if (profile.points > 0 && time <= profile.time[profile.points - 1])
+		{
+			error += "times must increase";
+			return false;
+		}
+
+		profile.time[profile.points] = time;
+		profile.rate[profile.points] = rate;
+		profile.points++;
+	}
+
+	error = fileName + ": ";
+	if (profile.points < 2)
+	{
+		error += "a profile needs at least 2 breakpoints";
+		return false;
+	}
+
+	//Scale the times to the generated day, then add up the area under the rate segment by segment
+	double start = profile.time[0];
+	double scale = GENERATED_DAY / (profile.time[profile.points - 1] - start);
+	for (int k = 0; k < profile.points; k++)
+		profile.time[k] = (k == profile.points - 1) ? GENERATED_DAY : (profile.time[k] - start) * scale;
+
+	profile.area[0] = 0;
+	for (int k = 1; k < profile.points; k++)
+	{
+		double width = profile.time[k] - profile.time[k - 1];
+		double height = profile.linear ? (profile.rate[k - 1] + profile.rate[k]) / 2 : profile.rate[k - 1];
+		profile.area[k] = profile.area[k - 1] + width * height;
+		profile.slope[k - 1] = profile.linear ? (profile.rate[k] - profile.rate[k - 1]) / width : 0;
+	}
+
+	if ( !(profile.area[profile.points - 1] > 0) )
+	{
+		error += "the rate is 0 all day";
+		return false;
+	}
+
+	//(j / PROFILE_GUIDE) * area is rounded no higher than the area any u from j / PROFILE_GUIDE on is scaled to, so the search never has to go back
+	for (int j = 0; j < PROFILE_GUIDE; j++)
+	{
+		double start = (j / (double) PROFILE_GUIDE) * profile.area[profile.points - 1];
+		profile.guide[j] = upper_bound(profile.area + 1, profile.area + profile.points - 1, start) - profile.area - 1;
+	}
+	for (int j = 0; j < PROFILE_GUIDE; j++)
+		profile.reach = max(profile.reach, ((j + 1 < PROFILE_GUIDE) ? profile.guide[j + 1] : profile.points - 2) - profile.guide[j]);
+
+	return true;
+}
+
+bool parse_service(string spec, ServiceModel& model, string& error)
+{
+	model.initialize();
+	vector<string> parts;
+	istringstream items(spec);
+	string item;
+	while (getline(items, item, ':'))
+		parts.push_back(item);
+
+	error = "bad service distribution " + spec;
+	vector<double> numbers;
+	for (int i = 1; i < (int) parts.size() && parts[0] != "empirical"; i++)
+	{
+		char* end = NULL;
+		double number = strtod(parts[i].c_str(), &end);
+		if (parts[i].empty() || *end != '\0' || !(number >= 0 && number <= SERVICE_MAX))
+			return false;
+		numbers.push_back(number);
+	}
+
+	if (parts.size() == 1 && parts[0] == "uniform")
+		return true;
+	if (parts.size() == 2 && parts[0] == "exponential" && numbers[0] > 0)
+	{
+		model.kind = SERVICE_EXPONENTIAL;
+		model.mean = numbers[0];
+		return true;
+	}
+	if (parts.size() == 3 && parts[0] == "lognormal" && numbers[0] > 0)
+	{
+		model.kind = SERVICE_LOGNORMAL;
+		model.mean = numbers[0];
+		model.sd = numbers[1];
+		return true;
+	}
+	if (parts.size() < 2 || parts[0] != "empirical")
+		return false;
+
+	string fileName = spec.substr(spec.find(':') + 1);
+	ifstream histogramFile;
+	histogramFile.open(fileName.c_str());
+	if ( !histogramFile )
+	{
+		error = "could not open the service file " + fileName;
+		return false;
+	}
+
+	vector<pair<SimTime, double> > bins;
+	string line;
+	int number = 0;
+	while (getline(histogramFile, line))
+	{
+		number++;
+		line = line.substr(0, line.find('#'));
+		istringstream fields(line);
+		long long length = 0;
+		double weight = -1;
+		string rest;
+		if (line.find_first_not_of(" \t\r") == string::npos)
+			continue;
+		if ( !(fields >> length >> weight) || (fields >> rest) || length < 1 || length > SERVICE_MAX || !(weight >= 0 && weight < 1e300) )
+		{
+			error = fileName + " line " + to_string(number) + ": expected length weight, the length 1 - " + to_string(SERVICE_MAX);
+			return false;
+		}
+		if ((int) bins.size() == SERVICE_MAX_BINS)
+		{
+			error = fileName + ": more than " + to_string(SERVICE_MAX_BINS) + " transaction times";
+			return false;
+		}
+		bins.push_back(make_pair((SimTime) length, weight));
+	}
+
+	//Shortest first, so a lower uniform always gives a shorter transaction and mirrored customers are mirrored
+	sort(bins.begin(), bins.end());
+	double total = 0;
+	for (int b = 0; b < (int) bins.size(); b++)
+	{
+		total += bins[b].second;
+		model.length[b] = bins[b].first;
+		model.cumulative[b] = total;
+	}
+	if ( !(total > 0) )
+	{
+		error = fileName + ": the weights add up to 0";
+		return false;
+	}
+
+	model.kind = SERVICE_EMPIRICAL;
+	model.bins = bins.size();
+	return true;
+}
+
+void generate_profiled(const ArrivalProfile& profile, const ServiceModel& model, RandomStream& arrivals, RandomStream& service,
+	SimTime* arrivalTimes, SimTime* transactionLengths, int count, int threads)
+{
+	int blocks = (count + GENERATE_BLOCK - 1) / GENERATE_BLOCK;
+	threads = max(min(threads, blocks), 1);
+	unsigned long long arrivalSeed = arrivals.next();
+	unsigned long long serviceSeed = service.next();
+	bool mirrored[2] = {arrivals.isAntithetic(), service.isAntithetic()};
+
+	vector<vector<int> > counts(threads, vector<int>(GENERATED_DAY, 0));
+	auto work = [&](int t)
+	{
+		for (int b = t; b < blocks; b += threads)
+		{
+			RandomLanes arrivalLanes(arrivalSeed, b);
+			RandomLanes serviceLanes(serviceSeed, b);
+			int first = b * GENERATE_BLOCK;
+			generate_block(profile, model, arrivalLanes, serviceLanes, mirrored, counts[t].data(), transactionLengths + first,
+				min(GENERATE_BLOCK, count - first));
+		}
+	};
+
+	vector<thread> pool;
+	for (int t = 1; t < threads; t++)
+		pool.push_back(thread(work, t));
+	work(0);
+	for (int t = 0; t < (int) pool.size(); t++)
+		pool[t].join();
+
+	//Time x is written once for each arrival at it, in order of x
+	SimTime* next = arrivalTimes;
+	for (int x = 0; x < GENERATED_DAY; x++)
+	{
+		int arrived = counts[0][x];
+		for (int t = 1; t < threads; t++)
+			arrived += counts[t][x];
+		for (int i = 0; i < arrived; i++)
+			*next++ = x;
+	}
+}
+
+void generate_block(const ArrivalProfile& profile, const ServiceModel& model, RandomLanes& arrivals, RandomLanes& service, const bool mirrored[2],
+	int* counts, SimTime* transactionLengths, int size)
+{
+	double u[GENERATE_CHUNK];
+	double mu = 0;
+	double sigma = 0;
+	if (model.kind == SERVICE_LOGNORMAL)
+	{
+		//Parameters of the normal whose exponential has the model's mean and standard deviation
+		sigma = sqrt(log(1 + (model.sd * model.sd) / (model.mean * model.mean)));
+		mu = log(model.mean) - sigma * sigma / 2;
+	}
+
+	for (int first = 0; first < size; first += GENERATE_CHUNK)
+	{
+		int n = min(GENERATE_CHUNK, size - first);
+		SimTime* lengths = transactionLengths + first;
+
+		arrivals.fill(u, n, mirrored[0]);
+		if (profile.points == 0)
+		{
+			for (int i = 0; i < n; i++)
+				counts[(int) (u[i] * GENERATED_DAY)]++;
+		}
+		else
+		{
+			for (int i = 0; i < n; i++)
+				counts[profile_time(profile, u[i])]++;
+		}
+
+		//1 loop per distribution, so each is a straight run over the chunk. Continuous times are rounded to the nearest unit, at least 1
+		service.fill(u, n, mirrored[1]);
+		switch (model.kind)
+		{
+			case SERVICE_UNIFORM:
+				for (int i = 0; i < n; i++)
+					lengths[i] = (SimTime) (u[i] * 100) + 1;
+				break;
+			case SERVICE_EXPONENTIAL:
+				for (int i = 0; i < n; i++)
+					lengths[i] = (SimTime) min(max(-model.mean * log(1 - u[i]) + 0.5, 1.0), (double) SERVICE_MAX);
+				break;
+			case SERVICE_LOGNORMAL:
+				for (int i = 0; i < n; i++)
+					lengths[i] = (SimTime) min(max(exp(mu + sigma * inverse_normal(u[i])) + 0.5, 1.0), (double) SERVICE_MAX);
+				break;
+			default:
+				for (int i = 0; i < n; i++)
+				{
+					//Counting the cumulative weights at or below the draw instead of a binary search, which would mispredict half its branches
+					double weight = u[i] * model.cumulative[model.bins - 1];
+					int b = 0;
+					for (int j = 0; j < model.bins - 1; j++)
+						b += (model.cumulative[j] <= weight);
+					lengths[i] = model.length[b];
+				}
+				break;
+		}
+	}
+}
+
+SimTime profile_time(const ArrivalProfile& profile, double u)
+{
+	//The segment the area reaches u of the day's in, then how far into it: rate * d for a step, rate * d + slope * d^2 / 2 for a line.
+	//The guide table has the segment or one reach or fewer before it, stepped over without branches. Segments with no area are stepped over too, since
+	//their end has the same area as their start, and the last segment never is, since its end has the whole day's
+	double target = u * profile.area[profile.points - 1];
+	int k = profile.guide[(int) (u * PROFILE_GUIDE)];
+	for (int j = 0; j < profile.reach; j++)
+		k += (profile.area[k + 1] <= target);
+	double left = target - profile.area[k];
+	double rate = profile.rate[k];
+
+	//For a line, the root of the quadratic that does not cancel. Only a segment that starts at rate 0 with nothing left of it makes its divisor 0
+	double d = (profile.linear == false) ? left / rate : 2 * left / max(rate + sqrt(max(rate * rate + 2 * profile.slope[k] * left, 0.0)), DBL_MIN);
+
+	return min((SimTime) (profile.time[k] + d), (SimTime) (GENERATED_DAY - 1));
+}
+
+double inverse_normal(double p)
+{
+	static const double a[] = {-3.969683028665376e+01, 2.209460984245205e+02, -2.759285104469687e+02, 1.383577518672690e+02, -3.066479806614716e+01,
+		2.506628277459239e+00};
+	static const double b[] = {-5.447609879822406e+01, 1.615858368580409e+02, -1.556989798598866e+02, 6.680131188771972e+01, -1.328068155288572e+01};
+	static const double c[] = {-7.784894002430293e-03, -3.223964580411365e-01, -2.400758277161838e+00, -2.549732539343734e+00, 4.374664141464968e+00,
+		2.938163982698783e+00};
+	static const double d[] = {7.784695709041462e-03, 3.224671290700398e-01, 2.445134137142996e+00, 3.754408661907416e+00};
+	const double low = 0.02425;
+
+	if (p < low || p > 1 - low)
+	{
+		//Tails: the upper one is the lower one mirrored, worked out from 1 - p so the 2 agree exactly
+		double q = sqrt(-2 * log((p < low) ? p : 1 - p));
+		double x = (((((c[0] * q + c[1]) * q + c[2]) * q + c[3]) * q + c[4]) * q + c[5]) / ((((d[0] * q + d[1]) * q + d[2]) * q + d[3]) * q + 1);
+		return (p < low) ? x : -x;
+	}
+
+	double q = p - 0.5;
+	double r = q * q;
+	return (((((a[0] * r + a[1]) * r + a[2]) * r + a[3]) * r + a[4]) * r + a[5]) * q / (((((b[0] * r + b[1]) * r + b[2]) * r + b[3]) * r + b[4]) * r + 1);
+}
+
+
+#endif
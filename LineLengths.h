@@ -0,0 +1,373 @@
+#ifndef LINELENGTHS_H
+#define LINELENGTHS_H
+
+#include <climits>
+#include <cstdlib>
+#include <new>
+#include <stdexcept>
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+#include "Snapshot.h"
+
+using namespace std;
+
+/** @class LineLengths
+ *  @brief Line lengths for simulateB when n is only known at runtime, mirrored into one contiguous, 64 byte aligned int array
+ *
+ *  A line's length counts everyone at that line, including the customer being served, so it must be incremented when a customer
+ *  joins a line and decremented when they depart. A teller's break counts as 1 more at their line for as long as it lasts, as if it were a customer
+ *  being served, so routing sees the line as busy and waiting() still gives the number of customers queued behind the tellers. The array is padded to a
+ *  multiple of 16 entries with INT_MAX so shortest() can compare whole vectors. Built with -mavx512f or -mavx2 (or -march=native)
+ *  shortest() uses those instructions, otherwise it falls back to a scalar scan. The constructor throws invalid_argument for fewer than 1 line and
+ *  bad_alloc if the array cannot be allocated
+ */
+class LineLengths {
+
+	public:
+		LineLengths(int size);
+		~LineLengths();
+		void increment(int i);
+		void decrement(int i);
+		void setBreak(int i, bool on);
+		int get(int i) const;
+		int size() const;
+		int waiting() const;
+		int shortest() const;
+		void save(Snapshot& out) const;
+		bool load(Snapshot& in);
+
+	private:
+		LineLengths(const LineLengths&) = delete;
+		LineLengths& operator=(const LineLengths&) = delete;
+
+		int n;
+		int padded;
+		int* count;
+		int customers;
+		int busy;
+		int away;				//Tellers on a break
+};
+
+
+LineLengths :: LineLengths(int size)
+{
+	if (size < 1)
+		throw invalid_argument("LineLengths needs at least 1 line");
+
+	n = size;
+	padded = (n + 15) & ~15;
+
+	void* block = NULL;
+	if (posix_memalign(&block, 64, padded * sizeof(int)) != 0)
+		throw bad_alloc();
+	count = static_cast<int*> (block);
+
+	for (int i = 0; i < n; i++)
+		count[i] = 0;
+	for (int i = n; i < padded; i++)
+		count[i] = INT_MAX;		//Padding is never the shortest line
+
+	customers = 0;
+	busy = 0;
+	away = 0;
+}
+
+LineLengths :: ~LineLengths()
+{
+	free(count);
+}
+
+void LineLengths :: increment(int i)
+{
+	if (count[i] == 0)
+		busy++;				//First customer goes straight to the teller
+	count[i]++;
+	customers++;
+}
+
+void LineLengths :: decrement(int i)
+{
+	count[i]--;
+	customers--;
+	if (count[i] == 0)
+		busy--;
+}
+
+//A break starts at an empty line and holds its teller like a customer would; when it ends, the first customer waiting there, if any, is served
+void LineLengths :: setBreak(int i, bool on)
+{
+	if (on)
+	{
+		if (count[i] == 0)
+			busy++;
+		count[i]++;
+		away++;
+	}
+	else
+	{
+		count[i]--;
+		away--;
+		if (count[i] == 0)
+			busy--;
+	}
+}
+
+int LineLengths :: get(int i) const
+{
+	return count[i];
+}
+
+int LineLengths :: size() const
+{
+	return n;
+}
+
+int LineLengths :: waiting() const
+{
+	return customers - (busy - away);		//A teller on a break serves nobody
+}
+
+int LineLengths :: shortest() const
+{
+	//Lowest index wins ties, same as shortest_line: first find the minimum, then the first lane holding it
+#if defined(__AVX512F__)
+	//GCC 12 warns that the unmasked AVX-512 intrinsics read an uninitialized vector (the undefined one they merge into), so the masked forms are used
+	//with every lane set, and the minimum is folded down to 4 lanes and then 1 as the AVX2 branch does
+	__m512i best = _mm512_load_si512(count);
+	for (int i = 16; i < padded; i += 16)
+		best = _mm512_mask_min_epi32(best, 0xFFFF, best, _mm512_load_si512(count + i));
+
+	__m256i zero = _mm256_setzero_si256();
+	__m256i half = _mm256_min_epi32(_mm512_mask_extracti64x4_epi64(zero, 0xFF, best, 0), _mm512_mask_extracti64x4_epi64(zero, 0xFF, best, 1));
+	__m128i low = _mm_min_epi32(_mm256_castsi256_si128(half), _mm256_extracti128_si256(half, 1));
+	low = _mm_min_epi32(low, _mm_shuffle_epi32(low, _MM_SHUFFLE(1, 0, 3, 2)));
+	low = _mm_min_epi32(low, _mm_shuffle_epi32(low, _MM_SHUFFLE(2, 3, 0, 1)));
+
+	__m512i target = _mm512_set1_epi32(_mm_cvtsi128_si32(low));
+	for (int i = 0; i < padded; i += 16)
+	{
+		__mmask16 hit = _mm512_cmpeq_epi32_mask(_mm512_load_si512(count + i), target);
+		if (hit != 0)
+			return i + __builtin_ctz(hit);
+	}
+
+	return 0;
+#elif defined(__AVX2__)
+	__m256i best = _mm256_load_si256((const __m256i*) count);
+	for (int i = 8; i < padded; i += 8)
+		best = _mm256_min_epi32(best, _mm256_load_si256((const __m256i*) (count + i)));
+
+	__m128i low = _mm_min_epi32(_mm256_castsi256_si128(best), _mm256_extracti128_si256(best, 1));
+	low = _mm_min_epi32(low, _mm_shuffle_epi32(low, _MM_SHUFFLE(1, 0, 3, 2)));
+	low = _mm_min_epi32(low, _mm_shuffle_epi32(low, _MM_SHUFFLE(2, 3, 0, 1)));
+
+	__m256i target = _mm256_broadcastd_epi32(low);
+	for (int i = 0; i < padded; i += 8)
+	{
+		__m256i equal = _mm256_cmpeq_epi32(_mm256_load_si256((const __m256i*) (count + i)), target);
+		int hit = _mm256_movemask_ps(_mm256_castsi256_ps(equal));
+		if (hit != 0)
+			return i + __builtin_ctz(hit);
+	}
+
+	return 0;
+#else
+	int index = 0;
+	int shortest = count[0];
+	for (int i = 1; i < n; i++)
+	{
+		if (count[i] < shortest)
+		{
+			shortest = count[i];
+			index = i;
+		}
+	}
+
+	return index;
+#endif
+}
+
+void LineLengths :: save(Snapshot& out) const
+{
+	out.put(customers);
+	out.put(busy);
+	out.put(away);
+	for (int i = 0; i < n; i++)
+		out.put(count[i]);
+}
+
+//Fails unless the totals are the ones the lengths add up to, breaks included
+bool LineLengths :: load(Snapshot& in)
+{
+	in.get(customers);
+	in.get(busy);
+	in.get(away);
+	for (int i = 0; i < n; i++)
+		in.get(count[i]);
+	if (in.good() == false)
+		return false;
+
+	long long total = 0;
+	int nonEmpty = 0;
+	for (int i = 0; i < n; i++)
+	{
+		if (count[i] < 0)
+			return false;
+		total += count[i];
+		nonEmpty += (count[i] > 0);
+	}
+
+	return customers >= 0 && away >= 0 && away <= busy && busy == nonEmpty && total == (long long) customers + away;
+}
+
+
+/** @class FixedLineLengths
+ *  @brief Line lengths for simulateB mirrored into one cache line, for N known at compile time (N <= MAX_FIXED_TELLERS)
+ *
+ *  Same counting rules as LineLengths, breaks included
+ */
+template <int N>
+class FixedLineLengths {
+
+	public:
+		FixedLineLengths();
+		void increment(int i);
+		void decrement(int i);
+		void setBreak(int i, bool on);
+		int get(int i) const;
+		int size() const;
+		int waiting() const;
+		int shortest() const;
+		void save(Snapshot& out) const;
+		bool load(Snapshot& in);
+
+	private:
+		alignas(64) int count[N];
+		int customers;
+		int busy;
+		int away;				//Tellers on a break
+};
+
+
+template <int N>
+FixedLineLengths<N> :: FixedLineLengths()
+{
+	for (int i = 0; i < N; i++)
+		count[i] = 0;
+
+	customers = 0;
+	busy = 0;
+	away = 0;
+}
+
+template <int N>
+void FixedLineLengths<N> :: increment(int i)
+{
+	if (count[i] == 0)
+		busy++;				//First customer goes straight to the teller
+	count[i]++;
+	customers++;
+}
+
+template <int N>
+void FixedLineLengths<N> :: decrement(int i)
+{
+	count[i]--;
+	customers--;
+	if (count[i] == 0)
+		busy--;
+}
+
+template <int N>
+void FixedLineLengths<N> :: setBreak(int i, bool on)
+{
+	if (on)
+	{
+		if (count[i] == 0)
+			busy++;
+		count[i]++;
+		away++;
+	}
+	else
+	{
+		count[i]--;
+		away--;
+		if (count[i] == 0)
+			busy--;
+	}
+}
+
+template <int N>
+int FixedLineLengths<N> :: get(int i) const
+{
+	return count[i];
+}
+
+template <int N>
+int FixedLineLengths<N> :: size() const
+{
+	return N;
+}
+
+template <int N>
+int FixedLineLengths<N> :: waiting() const
+{
+	return customers - (busy - away);		//A teller on a break serves nobody
+}
+
+template <int N>
+int FixedLineLengths<N> :: shortest() const
+{
+	//Lowest index wins ties, same as shortest_line
+	int index = 0;
+	int shortest = count[0];
+	for (int i = 1; i < N; i++)
+	{
+		if (count[i] < shortest)
+		{
+			shortest = count[i];
+			index = i;
+		}
+	}
+
+	return index;
+}
+
+template <int N>
+void FixedLineLengths<N> :: save(Snapshot& out) const
+{
+	out.put(customers);
+	out.put(busy);
+	out.put(away);
+	for (int i = 0; i < N; i++)
+		out.put(count[i]);
+}
+
+//Same checks as LineLengths
+template <int N>
+bool FixedLineLengths<N> :: load(Snapshot& in)
+{
+	in.get(customers);
+	in.get(busy);
+	in.get(away);
+	for (int i = 0; i < N; i++)
+		in.get(count[i]);
+	if (in.good() == false)
+		return false;
+
+	long long total = 0;
+	int nonEmpty = 0;
+	for (int i = 0; i < N; i++)
+	{
+		if (count[i] < 0)
+			return false;
+		total += count[i];
+		nonEmpty += (count[i] > 0);
+	}
+
+	return customers >= 0 && away >= 0 && away <= busy && busy == nonEmpty && total == (long long) customers + away;
+}
+
+
+#endif
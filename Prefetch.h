@@ -0,0 +1,110 @@
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include "Trace.h"
+
+using namespace std;
+
+/** @class TracePrefetch
+ *  @brief Double buffered input: a background thread loads the next replication's customers while the current one is simulated
+ *
+ *  There are 2 Traces. take() hands out the front one, which stays untouched until the next take(), and start() fills the back one on the
+ *  background thread. The buffers are swapped in take(), so their vectors keep their capacity from one replication to the next. Only 1 load can be
+ *  in flight; start() must not be called again until it is taken
+ */
+class TracePrefetch {
+
+	public:
+		TracePrefetch();
+		~TracePrefetch();
+		void start(function<void(Trace&)> load);
+		const Trace& take();
+		bool pending() const;
+
+	private:
+		void work();
+
+		Trace buffers[2];
+		int front;
+		function<void(Trace&)> job;
+		bool loading;				//A load has been started and not taken
+		bool loaded;				//The back buffer is filled
+		bool stopping;
+		mutex guard;
+		condition_variable changed;
+		thread worker;
+};
+
+
+TracePrefetch :: TracePrefetch()
+{
+	front = 0;
+	loading = false;
+	loaded = false;
+	stopping = false;
+	worker = thread(&TracePrefetch::work, this);
+}
+
+TracePrefetch :: ~TracePrefetch()
+{
+	{
+		lock_guard<mutex> lock(guard);
+		stopping = true;
+	}
+	changed.notify_all();
+	worker.join();				//Lets a load in flight finish first
+}
+
+void TracePrefetch :: start(function<void(Trace&)> load)
+{
+	{
+		lock_guard<mutex> lock(guard);
+		job = load;
+		loading = true;
+		loaded = false;
+	}
+	changed.notify_all();
+}
+
+const Trace& TracePrefetch :: take()
+{
+	unique_lock<mutex> lock(guard);
+	changed.wait(lock, [&]() { return loaded; });
+	loading = false;
+	loaded = false;
+	front = 1 - front;
+	return buffers[front];
+}
+
+bool TracePrefetch :: pending() const
+{
+	return loading;
+}
+
+void TracePrefetch :: work()
+{
+	unique_lock<mutex> lock(guard);
+	while (true)
+	{
+		changed.wait(lock, [&]() { return (loading && !loaded && job) || stopping; });
+		if (loading == false || loaded == true || !job)
+			return;
+
+		function<void(Trace&)> load = job;
+		job = nullptr;
+		Trace& back = buffers[1 - front];
+		lock.unlock();
+		load(back);				//front is not touched until take(), which waits for this
+		lock.lock();
+
+		loaded = true;
+		changed.notify_all();
+	}
+}
+
+
+#endif
@@ -1,5 +1,9 @@
+#ifndef PRIORITYQUEUE_H
+#define PRIORITYQUEUE_H
+
 #include <iostream>
 #include "Event.h"
+#include "Snapshot.h"
 
 using namespace std;
 
@@ -7,9 +11,10 @@ class PriorityQueue;
 
 class Node{
 	private:
-		Node(Event*, int, Node*);
+		Node(Event*, SimTime, long long, Node*);
 		Event* data;
-		int priority;
+		SimTime priority;
+		long long tie;
 		Node* next;
 		friend class PriorityQueue;
 };
@@ -18,25 +23,42 @@ class PriorityQueue{
 	public:
 		PriorityQueue(int = 0);
   		~PriorityQueue();
-		bool enqueue(Event*, int);
+		bool enqueue(Event*, SimTime, long long = 0);
 		bool dequeue();
 		Event* peekFront();
+		SimTime peekPriority() const;
+		long long peekTie() const;
+		Event* remove(SimTime, long long);
 		bool isEmpty() const;
+		int size() const;
+		long long allocations() const;
+		void save(Snapshot& out) const;
+		bool load(Snapshot& in);
 	private:
+		Node* newNode(Event*, SimTime, long long);
+		void freeNode(Node*);
+
 		Node* front;
+		int nodes;			//Events in the queue
+		Node* spare;			//Nodes taken off the queue, reused by the next enqueues
+		long long allocated;		//Nodes ever allocated
 };
 
 
-Node :: Node(Event* newEntry, int p, Node* nd)
+Node :: Node(Event* newEntry, SimTime p, long long t, Node* nd)
 {
 	data = newEntry;
 	priority = p;
+	tie = t;
 	next = nd;
 }
 
 PriorityQueue :: PriorityQueue(int size)
 {
 	front = NULL;
+	nodes = 0;
+	spare = NULL;
+	allocated = 0;
 }
 
 
@@ -60,18 +82,51 @@ PriorityQueue :: ~PriorityQueue()
 	
 		front = NULL;
 	}
+
+	while (spare != NULL)
+	{
+		Node* temp = spare;
+		spare = spare->next;
+		delete temp;
+	}
 }
 
+//Nodes are recycled rather than freed, so a queue whose size stays bounded stops allocating once it has been as large as it gets
+Node* PriorityQueue :: newNode(Event* newEntry, SimTime pri, long long tie)
+{
+	if (spare == NULL)
+	{
+		allocated++;
+		return new Node(newEntry, pri, tie, NULL);
+	}
 
+	Node* temp = spare;
+	spare = spare->next;
+	temp->data = newEntry;
+	temp->priority = pri;
+	temp->tie = tie;
+	temp->next = NULL;
+	return temp;
+}
 
-bool PriorityQueue :: enqueue(Event* newEntry, int pri)
+void PriorityQueue :: freeNode(Node* node)
+{
+	node->next = spare;
+	spare = node;
+}
+
+
+
+bool PriorityQueue :: enqueue(Event* newEntry, SimTime pri, long long tie)
 {
 	Node* temp;
 	Node* index;
-	temp = new Node(newEntry, pri, NULL);
+	temp = newNode(newEntry, pri, tie);
+	nodes++;
 		
+	//Nodes are ordered by priority, then by tie; nodes with equal priority and tie stay in insertion order
 	//If queue is empty or if new node is higher priority than front, insert new node at front
-	if ( (front == NULL) || (pri < front->priority) )
+	if ( (front == NULL) || (pri < front->priority) || (pri == front->priority && tie < front->tie) )
 	{
 		temp->next = front;
 		front = temp;
@@ -81,7 +136,7 @@ bool PriorityQueue :: enqueue(Event* newEntry, int pri)
 		index = front;
 			
 		//Find correct position to insert new node
-		while (index->next != NULL && index->next->priority <= pri)
+		while (index->next != NULL && (index->next->priority < pri || (index->next->priority == pri && index->next->tie <= tie)))
 		{
 			index = index->next;
 		}
@@ -104,9 +159,9 @@ bool PriorityQueue :: dequeue()
 	{
 		Node* temp = front;
 		front = front->next;
+		nodes--;
 
-		//delete node
-		delete temp;
+		freeNode(temp);
 		temp = NULL;
 
 		result = true;
@@ -121,6 +176,43 @@ Event* PriorityQueue :: peekFront()
 	return front->data;
 }
 
+SimTime PriorityQueue :: peekPriority() const
+{
+	return front->priority;
+}
+
+long long PriorityQueue :: peekTie() const
+{
+	return front->tie;
+}
+
+//Removes the node with exactly this priority and tie from anywhere in the queue and returns its event, or NULL if there is none
+Event* PriorityQueue :: remove(SimTime pri, long long tie)
+{
+	Node* previous = NULL;
+	Node* current = front;
+
+	while (current != NULL && (current->priority < pri || (current->priority == pri && current->tie < tie)))
+	{
+		previous = current;
+		current = current->next;
+	}
+
+	if (current == NULL || current->priority != pri || current->tie != tie)
+		return NULL;
+
+	if (previous == NULL)
+		front = current->next;
+	else
+		previous->next = current->next;
+
+	Event* result = current->data;
+	freeNode(current);
+	nodes--;
+
+	return result;
+}
+
 bool PriorityQueue :: isEmpty() const
 {
 	if (front == NULL)
@@ -130,5 +222,55 @@ bool PriorityQueue :: isEmpty() const
 
 }
 
+int PriorityQueue :: size() const
+{
+	return nodes;
+}
+
+long long PriorityQueue :: allocations() const
+{
+	return allocated;
+}
+
+//Writes the nodes front to back; load() re-enqueues them in that order, which keeps equal keys in their original order
+void PriorityQueue :: save(Snapshot& out) const
+{
+	int count = 0;
+	for (Node* current = front; current != NULL; current = current->next)
+		count++;
 
+	out.put(count);
+	for (Node* current = front; current != NULL; current = current->next)
+	{
+		out.put(current->priority);
+		out.put(current->tie);
+		out.putEvent(current->data);
+	}
+}
+
+bool PriorityQueue :: load(Snapshot& in)
+{
+	int count = -1;
+	in.get(count);
+	if (in.good() == false || count < 0)
+		return false;
+
+	for (int i = 0; i < count; i++)
+	{
+		SimTime pri = 0;
+		long long tie = 0;
+		in.get(pri);
+		in.get(tie);
+		Event* event = in.getEvent();
+		if (in.good() == false)			//Cut short: the count promised more events than the file holds
+		{
+			delete event;
+			return false;
+		}
+		enqueue(event, pri, tie);
+	}
+
+	return true;
+}
 
+#endif
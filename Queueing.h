@@ -0,0 +1,175 @@
+#ifndef QUEUEING_H
+#define QUEUEING_H
+
+#include <cmath>
+#include "SimTime.h"
+
+using namespace std;
+
+/** @struct TraceMoments
+ *  @brief This structure holds what the analytic estimates need to know about a data file
+ *  @var TraceMoments::count
+ *  Member count holds the number of arrivals
+ *  @var TraceMoments::rate
+ *  Member rate holds the number of arrivals per unit of time
+ *  @var TraceMoments::arrival_scv
+ *  Member arrival_scv holds the squared coefficient of variation (variance / mean^2) of the times between arrivals, 1 for Poisson arrivals
+ *  @var TraceMoments::service_mean
+ *  Member service_mean holds the mean transaction time
+ *  @var TraceMoments::service_scv
+ *  Member service_scv holds the squared coefficient of variation of the transaction times
+ *  @var TraceMoments::last_arrival
+ *  Member last_arrival holds the time of the last arrival
+ */
+struct TraceMoments {
+	int count;
+	double rate;
+	double arrival_scv;
+	double service_mean;
+	double service_scv;
+	SimTime last_arrival;
+
+	void initialize()
+	{
+		count = 0;
+		rate = 0;
+		arrival_scv = 1;
+		service_mean = 0;
+		service_scv = 1;
+		last_arrival = 0;
+	}
+};
+
+/**@brief Returns the Erlang C probability that an arrival has to wait in an M/M/n queue
+ *
+ *@details Builds Erlang B up one server at a time, which stays accurate for hundreds of servers, then converts it to Erlang C. Returns 1 when the
+ *queue is unstable (offered load of at least n)
+ *
+ *@param n Number of servers
+ *@param offered Offered load, arrival rate * mean service time
+ *@return double
+ */
+double erlang_c(int n, double offered);
+
+/**@brief Returns the mean wait in line of an M/M/n queue
+ *@param n Number of servers
+ *@param rate Arrival rate
+ *@param service Mean service time
+ *@return double Mean wait, or HUGE_VAL when the queue is unstable
+ */
+double mmn_mean_wait(int n, double rate, double service);
+
+/**@brief Returns the q quantile of the wait in line of an M/M/n queue
+ *
+ *@details Uses P(W > t) = C * exp(-(n - a) t / service), which is 0 for every t when C <= 1 - q
+ *
+ *@param n Number of servers
+ *@param rate Arrival rate
+ *@param service Mean service time
+ *@param q Quantile, eg 0.95
+ *@return double Wait quantile, or HUGE_VAL when the queue is unstable
+ */
+double mmn_wait_quantile(int n, double rate, double service, double q);
+
+/**@brief Returns the Allen-Cunneen estimate of the mean wait in line of a G/G/n queue
+ *
+ *@details The M/M/n mean wait scaled by (ca^2 + cs^2) / 2. With n = 1 and Poisson arrivals this is the exact M/G/1 (Pollaczek-Khinchine) mean wait
+ *
+ *@param n Number of servers
+ *@param rate Arrival rate
+ *@param service Mean service time
+ *@param arrivalScv Squared coefficient of variation of the times between arrivals
+ *@param serviceScv Squared coefficient of variation of the service times
+ *@return double Mean wait, or HUGE_VAL when the queue is unstable
+ */
+double ggn_mean_wait(int n, double rate, double service, double arrivalScv, double serviceScv);
+
+/**@brief Returns an estimate of the q quantile of the wait in line of a G/G/n queue
+ *
+ *@details Keeps the Erlang C probability of waiting and stretches the exponential tail of the M/M/n wait by the Allen-Cunneen factor, so the mean of the
+ *tail matches ggn_mean_wait
+ *
+ *@param n Number of servers
+ *@param rate Arrival rate
+ *@param service Mean service time
+ *@param arrivalScv Squared coefficient of variation of the times between arrivals
+ *@param serviceScv Squared coefficient of variation of the service times
+ *@param q Quantile, eg 0.95
+ *@return double Wait quantile, or HUGE_VAL when the queue is unstable
+ */
+double ggn_wait_quantile(int n, double rate, double service, double arrivalScv, double serviceScv, double q);
+
+/**@brief Returns an estimate of the q quantile of the number waiting in line of a G/G/n queue
+ *
+ *@details Uses P(Lq >= k) = C * rho^k of the M/M/n queue, with k stretched by the same Allen-Cunneen factor as the wait
+ *
+ *@param n Number of servers
+ *@param rate Arrival rate
+ *@param service Mean service time
+ *@param arrivalScv Squared coefficient of variation of the times between arrivals
+ *@param serviceScv Squared coefficient of variation of the service times
+ *@param q Quantile, eg 0.95
+ *@return double Line length quantile, or HUGE_VAL when the queue is unstable
+ */
+double ggn_line_quantile(int n, double rate, double service, double arrivalScv, double serviceScv, double q);
+
+
+double erlang_c(int n, double offered)
+{
+	if (offered >= n)
+		return 1;
+
+	double b = 1;
+	for (int k = 1; k <= n; k++)
+		b = offered * b / (k + offered * b);
+
+	return n * b / (n - offered * (1 - b));
+}
+
+double mmn_mean_wait(int n, double rate, double service)
+{
+	double offered = rate * service;
+	if (offered >= n)
+		return HUGE_VAL;
+
+	return erlang_c(n, offered) * service / (n - offered);
+}
+
+double mmn_wait_quantile(int n, double rate, double service, double q)
+{
+	double offered = rate * service;
+	if (offered >= n)
+		return HUGE_VAL;
+
+	double c = erlang_c(n, offered);
+	if (c <= 1 - q)
+		return 0;
+
+	return service * log(c / (1 - q)) / (n - offered);
+}
+
+double ggn_mean_wait(int n, double rate, double service, double arrivalScv, double serviceScv)
+{
+	return mmn_mean_wait(n, rate, service) * (arrivalScv + serviceScv) / 2;
+}
+
+double ggn_wait_quantile(int n, double rate, double service, double arrivalScv, double serviceScv, double q)
+{
+	return mmn_wait_quantile(n, rate, service, q) * (arrivalScv + serviceScv) / 2;
+}
+
+double ggn_line_quantile(int n, double rate, double service, double arrivalScv, double serviceScv, double q)
+{
+	double offered = rate * service;
+	if (offered >= n)
+		return HUGE_VAL;
+
+	double c = erlang_c(n, offered);
+	if (c <= 1 - q)
+		return 0;
+
+	return log((1 - q) / c) / log(offered / n) * (arrivalScv + serviceScv) / 2;
+}
+
+
+#endif
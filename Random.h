@@ -0,0 +1,206 @@
+#ifndef RANDOM_H
+#define RANDOM_H
+
+#include <cstring>
+#include "Snapshot.h"
+
+using namespace std;
+
+#define STREAM_ROUTING 0		//Purposes within a replication; replication i, purpose p draws from stream i * STREAMS_PER_REPLICATION + p
+#define STREAM_ARRIVALS 1
+#define STREAM_SERVICE 2
+#define STREAM_PATIENCE 3
+#define STREAMS_PER_REPLICATION 4
+#define STREAM_CLASS 4			//Purposes past STREAMS_PER_REPLICATION, added after the layout above was fixed, use extra_stream()
+#define RANDOM_LANES 8			//Streams a RandomLanes steps side by side, 1 AVX-512 register (or 2-4 narrower ones) per state word
+
+/**@brief Returns the stream replication i draws from for a purpose numbered past STREAMS_PER_REPLICATION
+ *
+ *@details Those streams start at 2^32, past every stream i * STREAMS_PER_REPLICATION + p, so adding a purpose leaves every existing stream, and
+ *every result drawn from them, unchanged
+ *
+ *@param replication Index of the replication
+ *@param purpose STREAM_ purpose, at least STREAMS_PER_REPLICATION
+ *@return unsigned long long
+ */
+inline unsigned long long extra_stream(unsigned long long replication, int purpose)
+{
+	return ((unsigned long long) (purpose - STREAMS_PER_REPLICATION + 1) << 32) + replication;
+}
+
+/** @class RandomStream
+ *  @brief Independent pseudo random number stream (xoshiro256**), one per replication
+ *
+ *  Streams are identified by (seed, stream) so every replication, and every purpose inside a replication, can draw from its own
+ *  reproducible sequence instead of sharing the global rand() state. An antithetic stream returns 1 - U for every U the plain stream
+ *  with the same (seed, stream) would return
+ */
+class RandomStream {
+
+	public:
+		RandomStream(unsigned long long seed = 0, unsigned long long stream = 0);
+		void seed(unsigned long long seed, unsigned long long stream);
+		unsigned long long next();
+		double uniform();
+		int below(int bound);
+		void setAntithetic(bool on);
+		bool isAntithetic() const;
+		void save(Snapshot& out) const;
+		bool load(Snapshot& in);
+
+	private:
+		friend class RandomLanes;
+		static unsigned long long splitmix(unsigned long long& x);
+		static unsigned long long rotl(unsigned long long x, int k);
+		unsigned long long s[4];
+		bool antithetic;
+};
+
+/** @class RandomLanes
+ *  @brief RANDOM_LANES xoshiro256** streams stepped together, for drawing uniforms in bulk
+ *
+ *  Lane l is the RandomStream (seed, stream * RANDOM_LANES + l). The state is kept word by word across the lanes, so every step of fill() is the same
+ *  shifts, xors and adds on RANDOM_LANES independent values, which the compiler turns into vector instructions. Uniforms are made from the top 52 bits
+ *  with the exponent trick instead of an integer to double conversion, as odd multiples of 2^-53: never 0 or 1, and 1 - U is exactly another one, so an
+ *  antithetic fill is the exact mirror image of a plain one
+ */
+class RandomLanes {
+
+	public:
+		RandomLanes(unsigned long long seed = 0, unsigned long long stream = 0);
+		void fill(double* out, int count, bool antithetic);
+
+	private:
+		unsigned long long s[4][RANDOM_LANES];
+};
+
+
+RandomStream :: RandomStream(unsigned long long seed, unsigned long long stream)
+{
+	this->seed(seed, stream);
+	antithetic = false;
+}
+
+void RandomStream :: seed(unsigned long long seed, unsigned long long stream)
+{
+	//Expand (seed, stream) into the 256 bit state with splitmix64 so nearby seeds give unrelated streams
+	unsigned long long x = seed ^ (stream * 0xD1B54A32D192ED03ULL);
+	for (int i = 0; i < 4; i++)
+		s[i] = splitmix(x);
+}
+
+unsigned long long RandomStream :: next()
+{
+	unsigned long long result = rotl(s[1] * 5, 7) * 9;
+	unsigned long long t = s[1] << 17;
+
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = rotl(s[3], 45);
+
+	return result;
+}
+
+double RandomStream :: uniform()
+{
+	//Top 53 bits -> [0, 1), or (0, 1] when antithetic
+	double u = (next() >> 11) * (1.0 / 9007199254740992.0);
+	return antithetic ? 1.0 - u : u;
+}
+
+int RandomStream :: below(int bound)
+{
+	//Multiply-shift maps 32 random bits onto 0 - (bound - 1)
+	int x = (int) (((next() >> 32) * (unsigned long long) bound) >> 32);
+	return antithetic ? bound - 1 - x : x;
+}
+
+void RandomStream :: setAntithetic(bool on)
+{
+	antithetic = on;
+}
+
+bool RandomStream :: isAntithetic() const
+{
+	return antithetic;
+}
+
+void RandomStream :: save(Snapshot& out) const
+{
+	for (int i = 0; i < 4; i++)
+		out.put(s[i]);
+	out.put(antithetic);
+}
+
+//An all zero state would only ever draw 0, so it fails
+bool RandomStream :: load(Snapshot& in)
+{
+	for (int i = 0; i < 4; i++)
+		in.get(s[i]);
+	in.get(antithetic);
+	return in.good() && (s[0] | s[1] | s[2] | s[3]) != 0;
+}
+
+unsigned long long RandomStream :: splitmix(unsigned long long& x)
+{
+	unsigned long long z = (x += 0x9E3779B97F4A7C15ULL);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+unsigned long long RandomStream :: rotl(unsigned long long x, int k)
+{
+	return (x << k) | (x >> (64 - k));
+}
+
+
+RandomLanes :: RandomLanes(unsigned long long seed, unsigned long long stream)
+{
+	for (int l = 0; l < RANDOM_LANES; l++)
+	{
+		RandomStream lane(seed, stream * RANDOM_LANES + l);
+		for (int i = 0; i < 4; i++)
+			s[i][l] = lane.s[i];
+	}
+}
+
+//Writes count uniforms in (0, 1), rounded up to a multiple of RANDOM_LANES, so out needs room for that many
+void RandomLanes :: fill(double* out, int count, bool antithetic)
+{
+	//The state is worked on in a local copy, which the compiler can keep in registers since out cannot alias it
+	unsigned long long x[4][RANDOM_LANES];
+	memcpy(x, s, sizeof(x));
+	double base = antithetic ? 1.0 : 0.0;
+	double sign = antithetic ? -1.0 : 1.0;
+
+	for (int i = 0; i < count; i += RANDOM_LANES)
+	{
+		for (int l = 0; l < RANDOM_LANES; l++)
+		{
+			unsigned long long result = RandomStream::rotl(x[1][l] * 5, 7) * 9;
+			unsigned long long t = x[1][l] << 17;
+
+			x[2][l] ^= x[0][l];
+			x[3][l] ^= x[1][l];
+			x[1][l] ^= x[2][l];
+			x[0][l] ^= x[3][l];
+			x[2][l] ^= t;
+			x[3][l] = RandomStream::rotl(x[3][l], 45);
+
+			//1.mantissa is in [1, 2); adding 2^-53 sets the bit below the mantissa, so 0 and 1 never come out
+			unsigned long long bits = (result >> 12) | 0x3FF0000000000000ULL;
+			double one;
+			memcpy(&one, &bits, sizeof(one));
+			out[i + l] = base + sign * ((one - 1.0) + (1.0 / 9007199254740992.0));
+		}
+	}
+
+	memcpy(s, x, sizeof(x));
+}
+
+
+#endif
@@ -0,0 +1,333 @@
+#ifndef RESULTCACHE_H
+#define RESULTCACHE_H
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include "Stats.h"
+#include "Snapshot.h"
+#include "SimTime.h"
+
+using namespace std;
+
+#define CACHE_VERSION 4			//Part of every key; bump it whenever a change to the generator or the engines changes their results
+#define CACHE_DIR ".simcache"
+#define CACHE_MAX_BYTES (256LL << 20)	//Least recently used entries are deleted once the cache is larger than this
+#define CACHE_SCAN_WRITES 256		//Writes between scans of the directory, which pick up what other processes wrote and deleted
+
+#define FNV_OFFSET_BASIS 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+/**@brief Mixes the bytes of a value into a 64 bit FNV-1a hash
+ *@param hash Reference to the hash so far, FNV_OFFSET_BASIS to start
+ *@param value Value whose bytes are mixed in; pass fields one at a time, since struct padding is not hashed consistently
+ *@return void
+ */
+template <class T>
+void fnv_add(unsigned long long& hash, const T& value);
+
+/** @struct CacheUsage
+ *  @brief How many bytes a cache directory holds, as the last scan found it plus what this process has written since
+ *  @var CacheUsage::bytes
+ *  Member bytes holds the size of the finished entries
+ *  @var CacheUsage::writes
+ *  Member writes holds the number of entries written since the last scan
+ *  @var CacheUsage::scanned
+ *  Member scanned is true once the directory has been scanned, so bytes started from what was already there
+ */
+struct CacheUsage {
+	long long bytes;
+	int writes;
+	bool scanned;
+
+	void initialize()
+	{
+		bytes = 0;
+		writes = 0;
+		scanned = false;
+	}
+};
+
+/** @class ResultCache
+ *  @brief Content addressed cache of generated data files and the Stats simulated on them, kept in a directory
+ *
+ *  Entries are named by the 64 bit hash of everything that produced them, so they never need to be invalidated, only evicted. Traces are stored
+ *  compactly: each arrival time as a varint of its gap from the last one and each transaction time as a varint too, about 2 bytes per customer instead
+ *  of the data file's 12 (a transaction time under 128 is 1 byte, as it was before longer ones could be generated). Every entry is written to a temporary file and renamed, so a reader never sees half of one. Reading an entry sets its modification
+ *  time to now. The process keeps a running total of each directory's size, loaded by 1 scan and added to on every write, and only scans again to delete
+ *  the oldest entries once the total is over maxBytes, or every CACHE_SCAN_WRITES writes to catch up with other processes. A scan over maxBytes deletes the oldest entries until the cache is down to 3/4 of it
+ */
+class ResultCache {
+
+	public:
+		ResultCache(string dir = CACHE_DIR, long long maxBytes = CACHE_MAX_BYTES);
+		bool getTrace(unsigned long long key, vector<SimTime>& arrivalTimes, vector<SimTime>& transactionLengths);
+		void putTrace(unsigned long long key, const SimTime* arrivalTimes, const SimTime* transactionLengths, int count);
+		bool getStats(unsigned long long key, Stats& simData);
+		void putStats(unsigned long long key, const Stats& simData);
+
+	private:
+		string path(unsigned long long key, string kind) const;
+		string temporaryPath(string file) const;
+		bool publish(string temporary, string file, bool written);
+		void record(long long added);
+		long long evict();
+		static CacheUsage& usage(string dir);
+		static mutex usageLock;
+
+		string directory;
+		long long limit;
+};
+
+mutex ResultCache :: usageLock;
+
+
+template <class T>
+void fnv_add(unsigned long long& hash, const T& value)
+{
+	const unsigned char* bytes = reinterpret_cast<const unsigned char*> (&value);
+	for (size_t i = 0; i < sizeof(T); i++)
+	{
+		hash ^= bytes[i];
+		hash *= FNV_PRIME;
+	}
+}
+
+
+ResultCache :: ResultCache(string dir, long long maxBytes)
+{
+	directory = dir;
+	limit = maxBytes;
+	mkdir(directory.c_str(), 0755);		//Fails harmlessly when it already exists
+}
+
+bool ResultCache :: getTrace(unsigned long long key, vector<SimTime>& arrivalTimes, vector<SimTime>& transactionLengths)
+{
+	string file = path(key, "trace");
+	Snapshot in(file, false);
+
+	int count = 0;
+	long long size = 0;
+	in.get(count);
+	in.get(size);
+	if (in.good() == false || count < 0 || size < count)
+		return false;
+
+	//The size is only read from the file, so it has to account for the rest of it before anything that large is allocated
+	struct stat info;
+	long long header = sizeof(unsigned long long) + sizeof(count) + sizeof(size);
+	if (stat(file.c_str(), &info) != 0 || info.st_size != header + size)
+	{
+		remove(file.c_str());
+		return false;
+	}
+
+	vector<unsigned char> bytes(size);
+	in.getArray(bytes.data(), size);
+	if (in.good() == false)
+		return false;
+
+	arrivalTimes.resize(count);
+	transactionLengths.resize(count);
+	long long at = 0;
+	SimTime time = 0;
+	for (int i = 0; i < count; i++)
+	{
+		//Gap from the last arrival, then the transaction time, each 7 bits per byte with the high bit set on every byte but the last
+		unsigned long long values[2] = {0, 0};
+		for (int v = 0; v < 2; v++)
+		{
+			int shift = 0;
+			while (at < size && (bytes[at] & 0x80) && shift < 63)
+			{
+				values[v] |= (unsigned long long) (bytes[at++] & 0x7F) << shift;
+				shift += 7;
+			}
+			if (at >= size)		//Cut short: the last byte is missing
+				return false;
+			values[v] |= (unsigned long long) bytes[at++] << shift;
+		}
+
+		time += values[0];
+		arrivalTimes[i] = time;
+		transactionLengths[i] = values[1];
+	}
+
+	if (at != size)
+		return false;
+
+	utimes(file.c_str(), NULL);		//Now the most recently used
+	return true;
+}
+
+void ResultCache :: putTrace(unsigned long long key, const SimTime* arrivalTimes, const SimTime* transactionLengths, int count)
+{
+	vector<unsigned char> bytes;
+	bytes.reserve(2 * (size_t) count);
+	SimTime previous = 0;
+	for (int i = 0; i < count; i++)
+	{
+		unsigned long long values[2] = {(unsigned long long) (arrivalTimes[i] - previous), (unsigned long long) transactionLengths[i]};
+		previous = arrivalTimes[i];
+		for (int v = 0; v < 2; v++)
+		{
+			while (values[v] >= 0x80)
+			{
+				bytes.push_back((values[v] & 0x7F) | 0x80);
+				values[v] >>= 7;
+			}
+			bytes.push_back(values[v]);
+		}
+	}
+
+	string file = path(key, "trace");
+	string temporary = temporaryPath(file);
+	long long size = bytes.size();
+	Snapshot out(temporary, true);
+	out.put(count);
+	out.put(size);
+	out.putArray(bytes.data(), size);
+	publish(temporary, file, out.close());
+}
+
+bool ResultCache :: getStats(unsigned long long key, Stats& simData)
+{
+	string file = path(key, "stats");
+	Snapshot in(file, false);
+
+	int size = 0;
+	Stats saved;
+	in.get(size);
+	if (size != (int) sizeof(Stats))			//Written before Stats changed
+		return false;
+	in.get(saved);
+	if (in.good() == false)
+		return false;
+
+	simData = saved;
+	simData.cached = true;
+	utimes(file.c_str(), NULL);
+	return true;
+}
+
+void ResultCache :: putStats(unsigned long long key, const Stats& simData)
+{
+	string file = path(key, "stats");
+	string temporary = temporaryPath(file);
+	int size = sizeof(Stats);
+	Snapshot out(temporary, true);
+	out.put(size);
+	out.put(simData);
+	publish(temporary, file, out.close());
+}
+
+string ResultCache :: path(unsigned long long key, string kind) const
+{
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx.", key);
+	return directory + "/" + name + kind;
+}
+
+string ResultCache :: temporaryPath(string file) const
+{
+	//Unique per process and per write, so threads and processes sharing the directory never write the same temporary file
+	static atomic<unsigned long long> writes(0);
+	return file + ".tmp" + to_string(getpid()) + "." + to_string(writes++);
+}
+
+bool ResultCache :: publish(string temporary, string file, bool written)
+{
+	struct stat fresh;
+	struct stat old;
+	if (written == false || stat(temporary.c_str(), &fresh) != 0)
+	{
+		remove(temporary.c_str());
+		return false;
+	}
+
+	long long replaced = (stat(file.c_str(), &old) == 0) ? old.st_size : 0;	//Another thread or process may have written the same entry
+	if (rename(temporary.c_str(), file.c_str()) != 0)
+	{
+		remove(temporary.c_str());
+		return false;
+	}
+
+	record(fresh.st_size - replaced);
+	return true;
+}
+
+void ResultCache :: record(long long added)
+{
+	lock_guard<mutex> hold(usageLock);
+	CacheUsage& used = usage(directory);
+	used.bytes += added;
+	used.writes++;
+	if (used.scanned == false || used.bytes > limit || used.writes >= CACHE_SCAN_WRITES)
+	{
+		used.bytes = evict();
+		used.writes = 0;
+		used.scanned = true;
+	}
+}
+
+CacheUsage& ResultCache :: usage(string dir)
+{
+	static map<string, CacheUsage> directories;
+	if (directories.count(dir) == 0)
+		directories[dir].initialize();
+	return directories[dir];
+}
+
+//Returns the size of the entries left
+long long ResultCache :: evict()
+{
+	DIR* dir = opendir(directory.c_str());
+	if (dir == NULL)
+		return 0;
+
+	//(modification time, size, name) of every finished entry
+	vector<pair<pair<long long, long long>, string> > entries;
+	long long total = 0;
+	struct dirent* entry;
+	while ( (entry = readdir(dir)) != NULL )
+	{
+		string name = entry->d_name;
+		if (name == "." || name == ".." || name.find(".tmp") != string::npos)
+			continue;
+
+		struct stat info;
+		string file = directory + "/" + name;
+		if (stat(file.c_str(), &info) != 0 || !S_ISREG(info.st_mode))
+			continue;
+
+		long long modified = (long long) info.st_mtim.tv_sec * 1000000000LL + info.st_mtim.tv_nsec;
+		entries.push_back(make_pair(make_pair(modified, (long long) info.st_size), file));
+		total += info.st_size;
+	}
+	closedir(dir);
+
+	if (total <= limit)
+		return total;
+
+	//Down to 3/4 of the limit, which leaves room for the next writes so a full cache is not scanned again on every one of them
+	long long target = limit - limit / 4;
+	sort(entries.begin(), entries.end());
+	for (int i = 0; i < (int) entries.size() && total > target; i++)
+	{
+		if (remove(entries[i].second.c_str()) == 0)
+			total -= entries[i].first.second;
+	}
+
+	return total;
+}
+
+
+#endif
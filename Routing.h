@@ -0,0 +1,224 @@
+#ifndef ROUTING_H
+#define ROUTING_H
+
+#include "Random.h"
+#include "Snapshot.h"
+
+using namespace std;
+
+#define ROUTE_SHORTEST 0		//Join the line with the fewest customers, O(n)
+#define ROUTE_POWER_OF_D 1		//Join the shortest of d randomly sampled lines, O(d)
+#define ROUTE_JOIN_IDLE 2		//Join a line whose teller is idle, otherwise a random line, O(1) amortized
+#define ROUTE_ROUND_ROBIN 3		//Join lines in turn, O(1)
+
+/** @class Router
+ *  @brief Picks the line an arriving customer joins in simulateB
+ *
+ *  Counts how many line lengths were inspected per arrival so the cost of each routing mode can be reported next to its wait times. A Router
+ *  only sends customers to the first size lines, so lines past those (closed by what_if) serve out their customers and take no new ones
+ */
+class Router {
+
+	public:
+		Router(int type, int size, int d, RandomStream* stream);
+		~Router();
+		template <class Lengths>
+		int choose(Lengths& lengths);
+		void lineIdle(int i);
+		double cost() const;
+		void save(Snapshot& out) const;
+		bool load(Snapshot& in);
+
+	private:
+		int routing;
+		int n;
+		int choices;
+		RandomStream* rng;
+
+		int nextLine;				//Round robin position
+
+		int* idleLines;				//Join idle queue: circular queue of lines whose teller went idle
+		bool* listed;
+		int idleFront;
+		int idleCount;
+
+		long long probes;
+		long long arrivals;
+};
+
+
+Router :: Router(int type, int size, int d, RandomStream* stream)
+{
+	routing = type;
+	n = size;
+	choices = (d < 1) ? 1 : d;
+	rng = stream;
+	nextLine = 0;
+	probes = 0;
+	arrivals = 0;
+
+	idleLines = NULL;
+	listed = NULL;
+	idleFront = 0;
+	idleCount = 0;
+
+	if (routing == ROUTE_JOIN_IDLE)
+	{
+		//Every teller starts idle
+		idleLines = new int[n];
+		listed = new bool[n];
+		for (int i = 0; i < n; i++)
+		{
+			idleLines[i] = i;
+			listed[i] = true;
+		}
+		idleCount = n;
+	}
+}
+
+Router :: ~Router()
+{
+	delete[] idleLines;
+	delete[] listed;
+}
+
+template <class Lengths>
+int Router :: choose(Lengths& lengths)
+{
+	arrivals++;
+
+	switch (routing)
+	{
+		case ROUTE_POWER_OF_D:
+		{
+			int best = rng->below(n);
+			int shortest = lengths.get(best);
+			for (int k = 1; k < choices; k++)
+			{
+				int i = rng->below(n);
+				if (lengths.get(i) < shortest)
+				{
+					shortest = lengths.get(i);
+					best = i;
+				}
+			}
+			probes += choices;
+			return best;
+		}
+
+		case ROUTE_JOIN_IDLE:
+		{
+			//Entries go stale when a randomly routed customer lands on a listed line or its teller goes on a break, so skip any that are no longer idle
+			while (idleCount > 0)
+			{
+				int i = idleLines[idleFront];
+				idleFront = (idleFront + 1) % n;
+				idleCount--;
+				listed[i] = false;
+				probes++;
+
+				if (lengths.get(i) == 0)
+					return i;
+			}
+			probes++;
+			return rng->below(n);
+		}
+
+		case ROUTE_ROUND_ROBIN:
+		{
+			int i = nextLine;
+			nextLine = (nextLine + 1) % n;
+			probes++;
+			return i;
+		}
+
+		default:
+		{
+			probes += n;
+			if (n == lengths.size())
+				return lengths.shortest();
+
+			int index = 0;
+			for (int i = 1; i < n; i++)
+			{
+				if (lengths.get(i) < lengths.get(index))
+					index = i;
+			}
+			return index;
+		}
+	}
+}
+
+void Router :: lineIdle(int i)
+{
+	if (routing == ROUTE_JOIN_IDLE && i < n && !listed[i])
+	{
+		idleLines[(idleFront + idleCount) % n] = i;
+		idleCount++;
+		listed[i] = true;
+	}
+}
+
+double Router :: cost() const
+{
+	if (arrivals == 0)
+		return 0;
+
+	return (double) probes / arrivals;
+}
+
+//The RandomStream is saved by its owner
+void Router :: save(Snapshot& out) const
+{
+	out.put(nextLine);
+	out.put(idleFront);
+	out.put(idleCount);
+	out.put(probes);
+	out.put(arrivals);
+	if (routing == ROUTE_JOIN_IDLE)
+	{
+		for (int i = 0; i < n; i++)
+		{
+			out.put(idleLines[i]);
+			out.put(listed[i]);
+		}
+	}
+}
+
+//Fails on a position outside the lines, or an idle queue whose entries are not exactly the listed lines
+bool Router :: load(Snapshot& in)
+{
+	in.get(nextLine);
+	in.get(idleFront);
+	in.get(idleCount);
+	in.get(probes);
+	in.get(arrivals);
+	if (in.good() == false || nextLine < 0 || nextLine >= n || idleFront < 0 || idleFront >= n || idleCount < 0 || idleCount > n ||
+		arrivals < 0)
+		return false;
+
+	if (routing == ROUTE_JOIN_IDLE)
+	{
+		int listedCount = 0;
+		for (int i = 0; i < n; i++)
+		{
+			in.get(idleLines[i]);
+			in.get(listed[i]);
+			listedCount += listed[i];
+		}
+		if (in.good() == false || listedCount != idleCount)
+			return false;
+
+		for (int k = 0; k < idleCount; k++)
+		{
+			int i = idleLines[(idleFront + k) % n];
+			if (i < 0 || i >= n || listed[i] == false)
+				return false;
+		}
+	}
+
+	return true;
+}
+
+
+#endif
@@ -0,0 +1,305 @@
+#ifndef SIMSERVER_H
+#define SIMSERVER_H
+
+#include <cstring>
+#include <string>
+#include <list>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <future>
+#include <functional>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "Trace.h"
+
+using namespace std;
+
+#define SERVER_SOCKET "simulate3.sock"	//Default path of the Unix domain socket simulate3 serves on and simclient connects to
+#define SERVER_WORKERS 4			//Default number of worker threads
+#define SERVER_HOT_TRACES 64			//Traces kept in memory, about 800 KB each
+#define SERVER_MAX_LINE 4096			//Longest request line accepted
+#define SERVER_MAX_REPLICATIONS 1000		//Most replications one request can ask for
+
+/*
+ * Protocol: the client sends 1 request per line and the server answers with lines, ending with "done ..." or "error <reason>".
+ *
+ *   request:  mode=a|b n=<int> [routing=s|d|i|r] [choices=<d>] [seed=<int>] [replications=<int>] [metrics=<name>,<name>,...] [cache=0|1]
+ *             defaults: routing=s choices=2 seed=0 replications=3, every metric, cache=1. Replication i is the same as run i of sim() with that seed
+ *   answer:   run=<i> <name>=<value> ...		once per replication, as soon as it finishes (replications run at once, so in any order)
+ *             mean <name>=<value> ...			means over the replications
+ *             halfwidth <name>=<value> ...		confidence interval half-widths (95%)
+ *             done replications=<r> hot=<h> cached=<c> ms=<wall clock>
+ *   request:  shutdown				stops the server once the requests it is running are answered
+ *
+ * A client can send its next request before the last one is answered. Requests run concurrently, but each connection's answers come back whole and in
+ * the order its requests were sent
+ *
+ * Metric names are those of the Stats fields: cpu_time process_time avg_wait avg_length max_wait max_length idle_time route_cost p95_wait reneged
+ *               class1_wait class2_wait class3_wait class4_wait
+ */
+
+/** @class LineSocket
+ *  @brief A connected stream socket that is read and written 1 '\n' terminated line at a time. Closes the socket when destroyed
+ *
+ *  readLine blocks until a whole line is in. readLines reads once, for a socket poll() says is readable, and returns the lines that completed
+ */
+class LineSocket {
+
+	public:
+		LineSocket(int descriptor);
+		~LineSocket();
+		int descriptor() const;
+		bool readLine(string& line);
+		bool readLines(vector<string>& lines);
+		bool writeLine(const string& line);
+
+	private:
+		int fd;
+		string buffer;
+};
+
+/** @class TraceStore
+ *  @brief The traces a server keeps in memory, shared by its worker threads and evicted least recently used first
+ *
+ *  Traces are handed out as shared_ptr, so one that is evicted while a worker is still simulating on it stays alive until the worker is done. load()
+ *  makes a missing trace only once: workers that ask for it while it is being made wait for that one instead of making their own
+ */
+class TraceStore {
+
+	public:
+		TraceStore(int capacity = SERVER_HOT_TRACES);
+		shared_ptr<const Trace> find(unsigned long long key);
+		void insert(unsigned long long key, shared_ptr<const Trace> trace);
+		shared_ptr<const Trace> load(unsigned long long key, function<void(Trace&)> make, bool& hot);
+
+	private:
+		typedef list<pair<unsigned long long, shared_ptr<const Trace> > > Entries;
+
+		int limit;
+		Entries entries;					//Most recently used first
+		map<unsigned long long, Entries::iterator> index;
+		map<unsigned long long, shared_future<shared_ptr<const Trace> > > pending;	//Traces some worker is making right now
+		mutex guard;
+};
+
+/**@brief Creates a Unix domain socket listening at path, replacing a stale socket file left there
+ *@param path File name of the socket
+ *@return int Socket descriptor, or -1 on failure
+ */
+int listen_server(string path);
+
+/**@brief Connects to a Unix domain socket at path
+ *@param path File name of the socket
+ *@return int Socket descriptor, or -1 on failure
+ */
+int connect_server(string path);
+
+
+LineSocket :: LineSocket(int descriptor)
+{
+	fd = descriptor;
+}
+
+LineSocket :: ~LineSocket()
+{
+	if (fd >= 0)
+		close(fd);
+}
+
+int LineSocket :: descriptor() const
+{
+	return fd;
+}
+
+bool LineSocket :: readLine(string& line)
+{
+	size_t end;
+	while ( (end = buffer.find('\n')) == string::npos )
+	{
+		if (buffer.size() > SERVER_MAX_LINE)
+			return false;
+
+		char chunk[1024];
+		ssize_t got = recv(fd, chunk, sizeof(chunk), 0);
+		if (got <= 0)
+			return false;
+		buffer.append(chunk, got);
+	}
+
+	line = buffer.substr(0, end);
+	buffer.erase(0, end + 1);
+	return true;
+}
+
+//Returns false once the other end has hung up or sent a line longer than SERVER_MAX_LINE; lines already complete are still returned
+bool LineSocket :: readLines(vector<string>& lines)
+{
+	lines.clear();
+	char chunk[1024];
+	ssize_t got = recv(fd, chunk, sizeof(chunk), 0);
+	if (got <= 0)
+		return false;
+	buffer.append(chunk, got);
+
+	size_t end;
+	while ( (end = buffer.find('\n')) != string::npos )
+	{
+		lines.push_back(buffer.substr(0, end));
+		buffer.erase(0, end + 1);
+	}
+
+	return buffer.size() <= SERVER_MAX_LINE;
+}
+
+bool LineSocket :: writeLine(const string& line)
+{
+	string out = line + "\n";
+	size_t sent = 0;
+	while (sent < out.size())
+	{
+		//MSG_NOSIGNAL: a client that hung up is an error for this request, not a SIGPIPE for the whole server
+		ssize_t put = send(fd, out.data() + sent, out.size() - sent, MSG_NOSIGNAL);
+		if (put <= 0)
+			return false;
+		sent += put;
+	}
+
+	return true;
+}
+
+
+TraceStore :: TraceStore(int capacity)
+{
+	limit = capacity;
+}
+
+shared_ptr<const Trace> TraceStore :: find(unsigned long long key)
+{
+	lock_guard<mutex> lock(guard);
+	map<unsigned long long, Entries::iterator>::iterator found = index.find(key);
+	if (found == index.end())
+		return shared_ptr<const Trace>();
+
+	entries.splice(entries.begin(), entries, found->second);
+	return found->second->second;
+}
+
+void TraceStore :: insert(unsigned long long key, shared_ptr<const Trace> trace)
+{
+	lock_guard<mutex> lock(guard);
+	if (index.count(key) > 0)			//Another worker got there first
+		return;
+
+	entries.push_front(make_pair(key, trace));
+	index[key] = entries.begin();
+	while ((int) entries.size() > limit)
+	{
+		index.erase(entries.back().first);
+		entries.pop_back();
+	}
+}
+
+shared_ptr<const Trace> TraceStore :: load(unsigned long long key, function<void(Trace&)> make, bool& hot)
+{
+	promise<shared_ptr<const Trace> > made;
+	{
+		unique_lock<mutex> lock(guard);
+		map<unsigned long long, Entries::iterator>::iterator found = index.find(key);
+		if (found != index.end())
+		{
+			entries.splice(entries.begin(), entries, found->second);
+			hot = true;
+			return found->second->second;
+		}
+
+		map<unsigned long long, shared_future<shared_ptr<const Trace> > >::iterator making = pending.find(key);
+		if (making != pending.end())
+		{
+			shared_future<shared_ptr<const Trace> > ready = making->second;
+			lock.unlock();
+			hot = true;
+			return ready.get();
+		}
+
+		pending[key] = made.get_future().share();
+	}
+
+	shared_ptr<Trace> fresh;
+	try
+	{
+		fresh = make_shared<Trace>();
+		make(*fresh);
+	}
+	catch (...)
+	{
+		//The workers waiting for this trace get the same exception, and the next one to ask tries again
+		{
+			lock_guard<mutex> lock(guard);
+			pending.erase(key);
+		}
+		made.set_exception(current_exception());
+		throw;
+	}
+
+	insert(key, fresh);
+	{
+		lock_guard<mutex> lock(guard);
+		pending.erase(key);
+	}
+	made.set_value(fresh);
+
+	hot = false;
+	return fresh;
+}
+
+
+int listen_server(string path)
+{
+	sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (path.size() >= sizeof(address.sun_path))
+		return -1;
+	strcpy(address.sun_path, path.c_str());
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		return -1;
+
+	unlink(path.c_str());
+	if (bind(fd, (sockaddr*) &address, sizeof(address)) != 0 || listen(fd, 64) != 0)
+	{
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+int connect_server(string path)
+{
+	sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (path.size() >= sizeof(address.sun_path))
+		return -1;
+	strcpy(address.sun_path, path.c_str());
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		return -1;
+
+	if (connect(fd, (sockaddr*) &address, sizeof(address)) != 0)
+	{
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef SIMTIME_H
+#define SIMTIME_H
+
+#include <climits>
+
+/*
+ * Simulation times: arrival, transaction and departure times, waits, and the times and line lengths in Stats.
+ *
+ * By default they are 32 bit ints, which keeps Events, Traces and the event queue small. Built with -DLONG_HORIZON they are 64 bit, for traces
+ * that run past INT_MAX time units (a day at millisecond resolution is 86,400,000; a long run of 10^9 customers passes 2^31 at the rates generate_events
+ * uses). The text data file format is the same either way, and a LONG_HORIZON build reads every file the default one does. Binary files that hold
+ * times (snapshots, customer logs, cached Stats) are only read back by a build with the same SimTime
+ */
+
+#ifdef LONG_HORIZON
+typedef long long SimTime;
+#define SIMTIME_MAX LLONG_MAX
+#define SIMTIME_MIN LLONG_MIN
+#define SIMTIME_DIGITS 19		//Most digits a SimTime can have
+#else
+typedef int SimTime;
+#define SIMTIME_MAX INT_MAX
+#define SIMTIME_MIN INT_MIN
+#define SIMTIME_DIGITS 10
+#endif
+
+/**@brief Converts a time worked out as a double to a SimTime, saturating at SIMTIME_MAX
+ *@param time The time
+ *@return SimTime
+ */
+inline SimTime clamp_time(double time)
+{
+	//(double) LLONG_MAX rounds up to 2^63, so times equal to it saturate too
+	return (time >= (double) SIMTIME_MAX) ? SIMTIME_MAX : (SimTime) time;
+}
+
+#endif
@@ -0,0 +1,157 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <cstdio>
+#include <string>
+#include "Event.h"
+
+using namespace std;
+
+#ifdef LONG_HORIZON
+#define SNAPSHOT_MAGIC 0x364C4E5348534142ULL		//"BASHSNL6", first 8 bytes of every snapshot a LONG_HORIZON build writes
+#else
+#define SNAPSHOT_MAGIC 0x36504E5348534142ULL		//"BASHSNP6", first 8 bytes of every snapshot
+#endif
+
+/** @class Snapshot
+ *  @brief Binary file that simulation state is written to with put() and read back in the same order with get()
+ *
+ *  Values are written as their raw bytes, so a snapshot can only be restored by the same build on the same machine. Any failed read or write
+ *  clears good(), and later calls do nothing
+ */
+class Snapshot {
+
+	public:
+		Snapshot(string fileName, bool writing);
+		~Snapshot();
+		bool good() const;
+		bool close();
+		template <class T>
+		void put(const T& value);
+		template <class T>
+		void get(T& value);
+		template <class T>
+		void putArray(const T* values, long long count);
+		template <class T>
+		void getArray(T* values, long long count);
+		void putEvent(Event* event);
+		Event* getEvent();
+
+	private:
+		void putArrival(Arrival* arr);
+		Arrival* getArrival();
+
+		FILE* file;
+		bool ok;
+};
+
+
+Snapshot :: Snapshot(string fileName, bool writing)
+{
+	file = fopen(fileName.c_str(), writing ? "wb" : "rb");
+	ok = (file != NULL);
+
+	unsigned long long magic = SNAPSHOT_MAGIC;
+	if (writing)
+		put(magic);
+	else
+		get(magic);
+
+	if (magic != SNAPSHOT_MAGIC)
+		ok = false;
+}
+
+Snapshot :: ~Snapshot()
+{
+	close();
+}
+
+bool Snapshot :: good() const
+{
+	return ok;
+}
+
+//Writes are only known to have reached the file once it is closed
+bool Snapshot :: close()
+{
+	if (file != NULL && fclose(file) != 0)
+		ok = false;
+	file = NULL;
+	return ok;
+}
+
+template <class T>
+void Snapshot :: put(const T& value)
+{
+	if (ok && fwrite(&value, sizeof(T), 1, file) != 1)
+		ok = false;
+}
+
+template <class T>
+void Snapshot :: get(T& value)
+{
+	if (ok && fread(&value, sizeof(T), 1, file) != 1)
+		ok = false;
+}
+
+template <class T>
+void Snapshot :: putArray(const T* values, long long count)
+{
+	if (ok && count > 0 && fwrite(values, sizeof(T), count, file) != (size_t) count)
+		ok = false;
+}
+
+template <class T>
+void Snapshot :: getArray(T* values, long long count)
+{
+	if (ok && count > 0 && fread(values, sizeof(T), count, file) != (size_t) count)
+		ok = false;
+}
+
+void Snapshot :: putEvent(Event* event)
+{
+	bool arrival = event->getType();
+	put(arrival);
+
+	Customer* customer = static_cast<Customer*> (event);
+	if (arrival == false)
+		put(customer->getDepartureTime());
+	putArrival(customer);
+}
+
+Event* Snapshot :: getEvent()
+{
+	bool arrival = true;
+	get(arrival);
+
+	if (arrival)
+		return getArrival();
+
+	SimTime departureTime = 0;
+	get(departureTime);
+	return getArrival()->depart(departureTime);
+}
+
+void Snapshot :: putArrival(Arrival* arr)
+{
+	put(arr->getArrivalTime());
+	put(arr->getTransactionLength());
+	put(arr->getQueueIndex());
+}
+
+Arrival* Snapshot :: getArrival()
+{
+	SimTime a = 0;
+	SimTime t = 0;
+	int index = -1;
+	get(a);
+	get(t);
+	get(index);
+
+	Arrival* arr = new Arrival(a, t);
+	arr->setQueueIndex(index);
+	return arr;
+}
+
+
+#endif
@@ -0,0 +1,374 @@
+#ifndef STATISTICS_H
+#define STATISTICS_H
+
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include "Stats.h"
+
+using namespace std;
+
+#define WAIT_HISTOGRAM_EXACT (1 << 20)	//Waits shorter than this are counted exactly; longer ones share buckets
+#define WAIT_HISTOGRAM_SPLIT 10		//Each power of 2 past WAIT_HISTOGRAM_EXACT is split into 2^WAIT_HISTOGRAM_SPLIT buckets
+#define STATS_FIELDS 14		//CPU time, process time, average wait, average length, max wait, max length, idle time, routing cost, 95th percentile wait, customers reneged,
+				//then the average wait of each of the MAX_CLASSES classes
+
+//Names of the Stats fields in STATS_FIELDS order, as used by the server protocol
+const char* const STATS_NAMES[STATS_FIELDS] = {"cpu_time", "process_time", "avg_wait", "avg_length", "max_wait", "max_length", "idle_time", "route_cost", "p95_wait", "reneged",
+                                               "class1_wait", "class2_wait", "class3_wait", "class4_wait"};
+
+//Indexes of single Stats fields in STATS_FIELDS order
+#define STATS_CPU_TIME 0
+#define STATS_AVG_WAIT 2		//Also the field the stopping rule is gated on unless told otherwise
+#define STATS_MAX_WAIT 4
+#define STATS_MAX_LENGTH 5
+#define STATS_IDLE_TIME 6
+#define STATS_ROUTE_COST 7
+#define STATS_RENEGED 9
+#define STATS_CLASS_WAIT 10		//The first class's; the other classes follow it
+#define STATS_EXTREMES ((1 << STATS_CPU_TIME) | (1 << STATS_MAX_WAIT) | (1 << STATS_MAX_LENGTH))	//CPU time, max wait and max length: never gate the stopping rule, since no number of replications narrows them
+
+/** @class RunningStat
+ *  @brief Streaming mean and variance of a series of observations (Welford's method), plus its min and max
+ */
+class RunningStat {
+
+	public:
+		RunningStat();
+		void push(double x);
+		long long count() const;
+		double mean() const;
+		double variance() const;
+		double halfWidth(double confidence) const;
+		double min() const;
+		double max() const;
+
+	private:
+		long long n;
+		double m;
+		double m2;
+		double minValue;
+		double maxValue;
+};
+
+/** @class ReplicationStats
+ *  @brief One RunningStat per Stats field, fed one replication at a time
+ *
+ *  An observation can also be pushed as STATS_FIELDS doubles, for combinations of runs such as antithetic pair averages or paired differences
+ */
+class ReplicationStats {
+
+	public:
+		void push(const Stats& simData);
+		void push(const double* values);
+		long long count() const;
+		const RunningStat& field(int i) const;
+		bool precise(double relative, double confidence, int fields) const;
+		void averages(Stats& avg) const;
+
+		RunningStat cpu;
+		RunningStat process;
+		RunningStat wait;
+		RunningStat length;
+		RunningStat maxWait;
+		RunningStat maxLength;
+		RunningStat idle;
+		RunningStat route;
+		RunningStat p95Wait;
+		RunningStat reneged;
+		RunningStat classWait[MAX_CLASSES];
+};
+
+/** @class WaitHistogram
+ *  @brief Counts how many customers waited each whole number of time units, so wait percentiles can be read off after a run
+ *
+ *  Waits of WAIT_HISTOGRAM_EXACT or more are counted in log-linear buckets instead, each less than 0.1% of its waits wide, so memory stays bounded
+ *  however long the waits get. A quantile that falls in one of them is reported as the longest wait the bucket holds
+ */
+class WaitHistogram {
+
+	public:
+		WaitHistogram();
+		void add(SimTime wait);
+		SimTime quantile(double q) const;
+
+	private:
+		vector<long long> counts;
+		vector<long long> wide;		//Buckets of the waits of WAIT_HISTOGRAM_EXACT or more
+		long long total;
+};
+
+/**@brief Copies the fields of a Stats struct into an array of doubles, in the order of STATS_FIELDS
+ *@param simData Stats to copy
+ *@param values Array of STATS_FIELDS doubles
+ *@return void
+ */
+void stats_fields(const Stats& simData, double* values);
+
+/**@brief Returns the standard normal quantile: the x with P(Z <= x) = p
+ *@param p Probability, 0 < p < 1
+ *@return double
+ */
+double normal_quantile(double p);
+
+/**@brief Returns the two-sided Student t critical value for a confidence level
+ *
+ *@details Exact (3 digit) table values for 90%, 95% and 99% with up to 30 degrees of freedom, otherwise the Cornish-Fisher expansion around the normal quantile
+ *
+ *@param confidence Confidence level, eg 0.95
+ *@param df Degrees of freedom
+ *@return double
+ */
+double t_quantile(double confidence, long long df);
+
+
+RunningStat :: RunningStat()
+{
+	n = 0;
+	m = 0;
+	m2 = 0;
+	minValue = 0;
+	maxValue = 0;
+}
+
+void RunningStat :: push(double x)
+{
+	n++;
+	double delta = x - m;
+	m += delta / n;
+	m2 += delta * (x - m);
+
+	if (n == 1 || x < minValue)
+		minValue = x;
+	if (n == 1 || x > maxValue)
+		maxValue = x;
+}
+
+long long RunningStat :: count() const
+{
+	return n;
+}
+
+double RunningStat :: mean() const
+{
+	return m;
+}
+
+double RunningStat :: variance() const
+{
+	if (n < 2)
+		return 0;
+
+	return m2 / (n - 1);
+}
+
+double RunningStat :: halfWidth(double confidence) const
+{
+	if (n < 2)
+		return 0;
+
+	return t_quantile(confidence, n - 1) * sqrt(variance() / n);
+}
+
+double RunningStat :: min() const
+{
+	return minValue;
+}
+
+double RunningStat :: max() const
+{
+	return maxValue;
+}
+
+
+void ReplicationStats :: push(const Stats& simData)
+{
+	double values[STATS_FIELDS];
+	stats_fields(simData, values);
+	push(values);
+}
+
+void ReplicationStats :: push(const double* values)
+{
+	cpu.push(values[0]);
+	process.push(values[1]);
+	wait.push(values[2]);
+	length.push(values[3]);
+	maxWait.push(values[4]);
+	maxLength.push(values[5]);
+	idle.push(values[6]);
+	route.push(values[7]);
+	p95Wait.push(values[8]);
+	reneged.push(values[9]);
+	for (int c = 0; c < MAX_CLASSES; c++)
+		classWait[c].push(values[10 + c]);
+}
+
+long long ReplicationStats :: count() const
+{
+	return wait.count();
+}
+
+const RunningStat& ReplicationStats :: field(int i) const
+{
+	const RunningStat* fields[] = {&cpu, &process, &wait, &length, &maxWait, &maxLength, &idle, &route, &p95Wait, &reneged,
+	                               &classWait[0], &classWait[1], &classWait[2], &classWait[3]};
+	return *fields[i];
+}
+
+bool ReplicationStats :: precise(double relative, double confidence, int fields) const
+{
+	//A field whose mean is 0 (nobody reneged, a class nobody is in) has nothing to be relative to, and a relative bound on a noisy or nearly
+	//empty field would hold every run to the maximum, so only the fields asked for are checked
+	for (int i = 0; i < STATS_FIELDS; i++)
+	{
+		if ((fields & (1 << i)) == 0 || (STATS_EXTREMES & (1 << i)) != 0 || field(i).mean() == 0)
+			continue;
+		if (field(i).halfWidth(confidence) > relative * fabs(field(i).mean()))
+			return false;
+	}
+
+	return true;
+}
+
+void ReplicationStats :: averages(Stats& avg) const
+{
+	avg.CPU_time = cpu.mean();
+	avg.process_time = process.mean();
+	avg.avg_wait = wait.mean();
+	avg.avg_length = length.mean();
+	avg.max_wait = maxWait.max();		//Longest wait seen in any replication
+	avg.max_length = maxLength.max();
+	avg.idle_time = idle.mean();
+	avg.route_cost = route.mean();
+	avg.p95_wait = p95Wait.mean();
+	avg.reneged = reneged.mean();
+	for (int c = 0; c < MAX_CLASSES; c++)
+		avg.class_wait[c] = classWait[c].mean();
+}
+
+
+WaitHistogram :: WaitHistogram()
+{
+	total = 0;
+}
+
+void WaitHistogram :: add(SimTime wait)
+{
+	if (wait < WAIT_HISTOGRAM_EXACT)
+	{
+		if (wait >= (SimTime) counts.size())
+			counts.resize(wait + 1, 0);
+		counts[wait]++;
+	}
+	else
+	{
+		//Bucket: which power of 2 past WAIT_HISTOGRAM_EXACT, then the WAIT_HISTOGRAM_SPLIT bits below the leading one
+		int power = 63 - __builtin_clzll(wait);
+		int shift = power - WAIT_HISTOGRAM_SPLIT;
+		size_t bucket = ((size_t) (power - __builtin_ctz(WAIT_HISTOGRAM_EXACT)) << WAIT_HISTOGRAM_SPLIT) + ((wait >> shift) & ((1 << WAIT_HISTOGRAM_SPLIT) - 1));
+		if (bucket >= wide.size())
+			wide.resize(bucket + 1, 0);
+		wide[bucket]++;
+	}
+
+	total++;
+}
+
+SimTime WaitHistogram :: quantile(double q) const
+{
+	//Smallest wait that at least q of all customers did not exceed
+	long long needed = (long long) ceil(q * total);
+	long long seen = 0;
+	for (int w = 0; w < (int) counts.size(); w++)
+	{
+		seen += counts[w];
+		if (seen >= needed && seen > 0)
+			return w;
+	}
+
+	for (size_t b = 0; b < wide.size(); b++)
+	{
+		seen += wide[b];
+		if (seen >= needed && seen > 0)
+		{
+			int shift = (b >> WAIT_HISTOGRAM_SPLIT) + __builtin_ctz(WAIT_HISTOGRAM_EXACT) - WAIT_HISTOGRAM_SPLIT;
+			unsigned long long top = (1ULL << WAIT_HISTOGRAM_SPLIT) + (b & ((1 << WAIT_HISTOGRAM_SPLIT) - 1)) + 1;
+			return (SimTime) min((top << shift) - 1, (unsigned long long) SIMTIME_MAX);
+		}
+	}
+
+	return 0;
+}
+
+
+void stats_fields(const Stats& simData, double* values)
+{
+	values[0] = simData.CPU_time;
+	values[1] = simData.process_time;
+	values[2] = simData.avg_wait;
+	values[3] = simData.avg_length;
+	values[4] = simData.max_wait;
+	values[5] = simData.max_length;
+	values[6] = simData.idle_time;
+	values[7] = simData.route_cost;
+	values[8] = simData.p95_wait;
+	values[9] = simData.reneged;
+	for (int c = 0; c < MAX_CLASSES; c++)
+		values[10 + c] = simData.class_wait[c];
+}
+
+
+double normal_quantile(double p)
+{
+	//Bisect the normal CDF; 100 halvings of [-40, 40] is well past double precision
+	double low = -40;
+	double high = 40;
+	for (int i = 0; i < 100; i++)
+	{
+		double mid = (low + high) / 2;
+		if (0.5 * erfc(-mid / sqrt(2.0)) < p)
+			low = mid;
+		else
+			high = mid;
+	}
+
+	return (low + high) / 2;
+}
+
+double t_quantile(double confidence, long long df)
+{
+	static const double t90[30] = {6.314, 2.920, 2.353, 2.132, 2.015, 1.943, 1.895, 1.860, 1.833, 1.812, 1.796, 1.782, 1.771, 1.761, 1.753,
+	                               1.746, 1.740, 1.734, 1.729, 1.725, 1.721, 1.717, 1.714, 1.711, 1.708, 1.706, 1.703, 1.701, 1.699, 1.697};
+	static const double t95[30] = {12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228, 2.201, 2.179, 2.160, 2.145, 2.131,
+	                               2.120, 2.110, 2.101, 2.093, 2.086, 2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042};
+	static const double t99[30] = {63.657, 9.925, 5.841, 4.604, 4.032, 3.707, 3.499, 3.355, 3.250, 3.169, 3.106, 3.055, 3.012, 2.977, 2.947,
+	                               2.921, 2.898, 2.878, 2.861, 2.845, 2.831, 2.819, 2.807, 2.797, 2.787, 2.779, 2.771, 2.763, 2.756, 2.750};
+
+	if (df >= 1 && df <= 30)
+	{
+		if (fabs(confidence - 0.90) < 1e-9)
+			return t90[df - 1];
+		if (fabs(confidence - 0.95) < 1e-9)
+			return t95[df - 1];
+		if (fabs(confidence - 0.99) < 1e-9)
+			return t99[df - 1];
+	}
+
+	double z = normal_quantile(0.5 + confidence / 2);
+	double v = (double) df;
+	double z3 = z * z * z;
+	double z5 = z3 * z * z;
+	double z7 = z5 * z * z;
+	double z9 = z7 * z * z;
+
+	double g1 = (z3 + z) / 4;
+	double g2 = (5 * z5 + 16 * z3 + 3 * z) / 96;
+	double g3 = (3 * z7 + 19 * z5 + 17 * z3 - 15 * z) / 384;
+	double g4 = (79 * z9 + 776 * z7 + 1482 * z5 - 1920 * z3 - 945 * z) / 92160;
+
+	return z + g1 / v + g2 / (v * v) + g3 / (v * v * v) + g4 / (v * v * v * v);
+}
+
+
+#endif
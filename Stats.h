@@ -0,0 +1,77 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include "SimTime.h"
+
+#define MAX_CLASSES 4		//Most customer classes a run can have; Stats keeps the average wait of each
+
+/** @struct Stats
+ *  @brief This structure holds all of the data to be collected from the simulation to allow for easy passing between functions
+ *  @var Stats::CPU_time
+ *  Member CPU_time holds the amount of processor time it takes to run 1 simulation
+ *  @var Stats::process_time 
+ *  Member process_time holds the amount of virtual time processed in the simulation
+ *  @var Stats::avg_wait
+ *  Member avg_wait holds the average wait time for 1 simulation
+ *  @var Stats::avg_line 
+ *  Member avg_line holds the average length of the line during the simulation
+ *  @var Stats::max_wait
+ *  Member max_wait keeps track of the longest time any 1 customer had to wait during simulation
+ *  @var Stats::max_length
+ *  Member max_length keeps track of the longest the line becomes at any point during the simulation
+ *  @var Stats::idle_time
+ *  Member idle_time keeps track of the total idle time spent by tellers
+ *  @var Stats::route_cost
+ *  Member route_cost holds the average number of line lengths inspected to route 1 arrival (simulateB only)
+ *  @var Stats::p95_wait
+ *  Member p95_wait holds the wait time that 95% of customers did not exceed
+ *  @var Stats::reneged
+ *  Member reneged holds how many customers ran out of patience and left the line before being served; the wait stats only count the customers who were served
+ *  @var Stats::class_wait
+ *  Member class_wait holds the average wait of the served customers of each class, all 0 for a run without classes
+ *  @var Stats::analytic
+ *  Member analytic is true when the other members were estimated with queueing formulas instead of simulated
+ *  @var Stats::unstable
+ *  Member unstable is true for an analytic estimate of a configuration whose offered load is at least its tellers, which has no steady state to estimate; every member but CPU_time is then 0
+ *  @var Stats::cached
+ *  Member cached is true when the other members were read back from the ResultCache instead of simulated; CPU_time is then the original run's
+ *  
+ */
+struct Stats {
+	double CPU_time;
+	SimTime process_time;
+	double avg_wait;
+	SimTime avg_length;
+	SimTime max_wait;
+	SimTime max_length;
+	SimTime idle_time;	
+	double route_cost;
+	SimTime p95_wait;
+	int reneged;
+	double class_wait[MAX_CLASSES];
+	bool analytic;
+	bool unstable;
+	bool cached;
+
+	void initialize()
+	{
+		CPU_time = 0;
+		process_time = 0;
+		avg_wait = 0;
+		avg_length = 0;
+		max_wait = 0;
+		max_length = 0;
+		idle_time = 0;	
+		route_cost = 0;
+		p95_wait = 0;
+		reneged = 0;
+		for (int c = 0; c < MAX_CLASSES; c++)
+			class_wait[c] = 0;
+		analytic = false;
+		unstable = false;
+		cached = false;
+	}
+};
+
+
+#endif
@@ -0,0 +1,194 @@
+#ifndef STEADYSTATE_H
+#define STEADYSTATE_H
+
+#include <cmath>
+#include "Statistics.h"
+#include "Snapshot.h"
+
+using namespace std;
+
+#define BATCH_COUNT 64		//Batches kept; when 2 * BATCH_COUNT are full, neighbours merge and the batch size doubles
+
+/** @class BatchMeans
+ *  @brief Non-overlapping batch means of one long series of observations, in constant memory
+ *
+ *  Batches start 1 observation long. Whenever 2 * BATCH_COUNT batches are full, each pair of neighbours is merged, so there are always between
+ *  BATCH_COUNT and 2 * BATCH_COUNT batches and the batch size grows with the run. The warm-up is taken out with MSER applied to the batch means:
+ *  the number of leading batches to delete is the one that minimizes the standard error of what is left, searched over the first half
+ */
+class BatchMeans {
+
+	public:
+		BatchMeans();
+		void push(double x);
+		long long count() const;
+		long long batchSize() const;
+		int batches() const;
+		int warmup() const;
+		double mean() const;
+		double halfWidth(double confidence) const;
+		double lag1() const;
+		void save(Snapshot& out) const;
+		bool load(Snapshot& in);
+
+	private:
+		double sums[2 * BATCH_COUNT];
+		int full;
+		long long size;
+		double partial;
+		long long partialCount;
+		long long n;
+};
+
+
+BatchMeans :: BatchMeans()
+{
+	full = 0;
+	size = 1;
+	partial = 0;
+	partialCount = 0;
+	n = 0;
+}
+
+void BatchMeans :: push(double x)
+{
+	n++;
+	partial += x;
+	partialCount++;
+
+	if (partialCount < size)
+		return;
+
+	sums[full] = partial;
+	full++;
+	partial = 0;
+	partialCount = 0;
+
+	if (full == 2 * BATCH_COUNT)
+	{
+		for (int i = 0; i < BATCH_COUNT; i++)
+			sums[i] = sums[2 * i] + sums[2 * i + 1];
+		full = BATCH_COUNT;
+		size *= 2;
+	}
+}
+
+long long BatchMeans :: count() const
+{
+	return n;
+}
+
+long long BatchMeans :: batchSize() const
+{
+	return size;
+}
+
+int BatchMeans :: batches() const
+{
+	return full - warmup();
+}
+
+int BatchMeans :: warmup() const
+{
+	//MSER(d) = sum over kept batches of (mean_i - kept mean)^2 / kept^2, from suffix sums so the search is O(batches)
+	int best = 0;
+	double bestScore = HUGE_VAL;
+	double sum = 0;
+	double squares = 0;
+	for (int d = full - 1; d >= 0; d--)
+	{
+		double y = sums[d] / size;
+		sum += y;
+		squares += y * y;
+
+		int kept = full - d;
+		if (d <= full / 2 && kept >= 2)
+		{
+			double score = (squares - sum * sum / kept) / ((double) kept * kept);
+			if (score <= bestScore)
+			{
+				bestScore = score;
+				best = d;
+			}
+		}
+	}
+
+	return best;
+}
+
+double BatchMeans :: mean() const
+{
+	int d = warmup();
+	double sum = 0;
+	for (int i = d; i < full; i++)
+		sum += sums[i] / size;
+
+	return (full > d) ? sum / (full - d) : 0;
+}
+
+double BatchMeans :: halfWidth(double confidence) const
+{
+	int d = warmup();
+	int kept = full - d;
+	if (kept < 2)
+		return HUGE_VAL;
+
+	double m = mean();
+	double squares = 0;
+	for (int i = d; i < full; i++)
+		squares += (sums[i] / size - m) * (sums[i] / size - m);
+
+	return t_quantile(confidence, kept - 1) * sqrt(squares / (kept - 1) / kept);
+}
+
+double BatchMeans :: lag1() const
+{
+	//Batches that are long enough to be nearly independent have a lag 1 autocorrelation near 0
+	int d = warmup();
+	if (full - d < 3)
+		return 1;
+
+	double m = mean();
+	double numerator = 0;
+	double denominator = 0;
+	for (int i = d; i < full; i++)
+	{
+		double y = sums[i] / size - m;
+		denominator += y * y;
+		if (i + 1 < full)
+			numerator += y * (sums[i + 1] / size - m);
+	}
+
+	return (denominator > 0) ? numerator / denominator : 0;
+}
+
+void BatchMeans :: save(Snapshot& out) const
+{
+	out.put(full);
+	out.put(size);
+	out.put(partial);
+	out.put(partialCount);
+	out.put(n);
+	for (int i = 0; i < full; i++)
+		out.put(sums[i]);
+}
+
+//Fails unless the batches account for every observation, as push() keeps them
+bool BatchMeans :: load(Snapshot& in)
+{
+	in.get(full);
+	in.get(size);
+	in.get(partial);
+	in.get(partialCount);
+	in.get(n);
+	if (in.good() == false || full < 0 || full >= 2 * BATCH_COUNT || size < 1 || partialCount < 0 || partialCount >= size ||
+		n != full * size + partialCount)
+		return false;
+
+	for (int i = 0; i < full; i++)
+		in.get(sums[i]);
+	return in.good();
+}
+
+
+#endif
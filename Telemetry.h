@@ -0,0 +1,285 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <atomic>
+#include <chrono>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+#define TELEMETRY_NAME "/simulate3.telemetry"	//Shared memory object simulate3 publishes its progress in and simmonitor reads
+#define TELEMETRY_MAGIC 0x324C455448534142ULL	//"BASHTEL2", first 8 bytes of the page
+#define TELEMETRY_EVERY 4096			//Events between updates of the page; a power of 2
+#define TELEMETRY_RATE_MS 250			//Least time between updates of eventsPerSecond and rssBytes
+
+#define TELEMETRY_IDLE 0			//TelemetryPage::state values: no engine has started yet,
+#define TELEMETRY_RUNNING 1			//an engine is simulating,
+#define TELEMETRY_DONE 2			//or the engine that started last has finished
+#define TELEMETRY_CLOSED 3			//simulate3 has exited
+
+/** @struct TelemetryPage
+ *  @brief This structure is the layout of the shared memory page an engine publishes its progress in, 1 relaxed atomic per counter
+ *
+ *  Counters are written independently, so a reader can see some of them 1 update ahead of the others
+ *  @var TelemetryPage::magic
+ *  Member magic holds TELEMETRY_MAGIC once the page is set up
+ *  @var TelemetryPage::pid
+ *  Member pid holds the process id of the simulation
+ *  @var TelemetryPage::state
+ *  Member state holds a TELEMETRY_ state
+ *  @var TelemetryPage::run
+ *  Member run holds how many engine runs have started, counting the one in progress
+ *  @var TelemetryPage::simTime
+ *  Member simTime holds the simulation clock of the current run
+ *  @var TelemetryPage::events
+ *  Member events holds how many events the current run has processed
+ *  @var TelemetryPage::eventsPerSecond
+ *  Member eventsPerSecond holds the event rate over the last TELEMETRY_RATE_MS or more
+ *  @var TelemetryPage::eventSetSize
+ *  Member eventSetSize holds how many events are waiting in the event queue
+ *  @var TelemetryPage::maxLine
+ *  Member maxLine holds the most customers waiting in any one line so far in the current run. With several lines this is the longest of them, not
+ *  the longest average that Stats::max_length holds
+ *  @var TelemetryPage::rssBytes
+ *  Member rssBytes holds the resident set size of the simulation
+ *  @var TelemetryPage::allocations
+ *  Member allocations holds how many customers and event queue nodes the current run has allocated; it stops growing once the run is in steady state
+ *  @var TelemetryPage::updatedNs
+ *  Member updatedNs holds the steady_clock time of the last update, in nanoseconds
+ */
+struct TelemetryPage {
+	unsigned long long magic;
+	atomic<int> pid;
+	atomic<int> state;
+	atomic<long long> run;
+	atomic<long long> simTime;
+	atomic<long long> events;
+	atomic<long long> eventsPerSecond;
+	atomic<long long> eventSetSize;
+	atomic<long long> maxLine;
+	atomic<long long> rssBytes;
+	atomic<long long> allocations;
+	atomic<long long> updatedNs;
+};
+
+static_assert(atomic<long long>::is_always_lock_free && atomic<int>::is_always_lock_free, "TelemetryPage is shared between processes, so its atomics must not use locks");
+
+/** @class Telemetry
+ *  @brief Publishes an engine's progress to a TelemetryPage in shared memory, for simmonitor to read while the simulation runs
+ *
+ *  Engines call publish() every TELEMETRY_EVERY events. It is a read of steady_clock and a handful of relaxed stores, and once every
+ *  TELEMETRY_RATE_MS it also works out the event rate and reads /proc/self/statm. Until open() succeeds every call does nothing, so engines run on threads that share no page can call it freely. Only 1
+ *  thread at a time may publish to an open page. open() fails rather than take over a page a running simulation owns
+ */
+class Telemetry {
+
+	public:
+		Telemetry();
+		~Telemetry();
+		bool open(string name = TELEMETRY_NAME);
+		void close();
+		void detach();
+		void start();
+		void publish(long long simTime, long long events, long long eventSetSize, long long maxLine, long long allocations);
+		void finish(long long simTime, long long events, long long maxLine, long long allocations);
+
+	private:
+		void sample(long long events, long long now);
+		static bool abandoned(string name);
+
+		TelemetryPage* page;
+		string shared;
+		long long lastEvents;			//events and time of the last rate sample
+		long long lastNs;
+};
+
+/**@brief Reads the resident set size of this process
+ *@return long long Resident set size in bytes, or 0 if /proc/self/statm could not be read
+ */
+long long resident_bytes();
+
+/**@brief Reads steady_clock
+ *@return long long steady_clock time in nanoseconds
+ */
+long long steady_ns();
+
+
+Telemetry :: Telemetry()
+{
+	page = NULL;
+	lastEvents = 0;
+	lastNs = 0;
+}
+
+Telemetry :: ~Telemetry()
+{
+	close();
+}
+
+bool Telemetry :: open(string name)
+{
+	close();
+
+	int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+	if (fd < 0 && errno == EEXIST && abandoned(name))
+	{
+		//Left behind by a simulation that was killed, so it is replaced
+		shm_unlink(name.c_str());
+		fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+	}
+	if (fd < 0)
+		return false;
+
+	void* mapped = MAP_FAILED;
+	if (ftruncate(fd, sizeof(TelemetryPage)) == 0)
+		mapped = mmap(NULL, sizeof(TelemetryPage), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (mapped == MAP_FAILED)
+	{
+		shm_unlink(name.c_str());
+		return false;
+	}
+
+	//A new shared memory object is all zeros, which is a valid state for every atomic in it
+	page = static_cast<TelemetryPage*> (mapped);
+	page->pid.store(getpid(), memory_order_relaxed);
+	page->state.store(TELEMETRY_IDLE, memory_order_relaxed);
+	page->rssBytes.store(resident_bytes(), memory_order_relaxed);
+	page->updatedNs.store(steady_ns(), memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	page->magic = TELEMETRY_MAGIC;
+	shared = name;
+	return true;
+}
+
+//A page whose simulation has exited, or one another build set up, belongs to nobody. A page that is not set up yet may be another simulation's
+//between shm_open and writing its magic, so it is left alone
+bool Telemetry :: abandoned(string name)
+{
+	int fd = shm_open(name.c_str(), O_RDONLY, 0);
+	if (fd < 0)
+		return errno == ENOENT;		//Already gone
+
+	struct stat info;
+	void* mapped = MAP_FAILED;
+	if (fstat(fd, &info) == 0 && info.st_size >= (off_t) sizeof(TelemetryPage))
+		mapped = mmap(NULL, sizeof(TelemetryPage), PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (mapped == MAP_FAILED)
+		return false;
+
+	const TelemetryPage* page = static_cast<const TelemetryPage*> (mapped);
+	bool stale = (page->magic != 0);
+	if (page->magic == TELEMETRY_MAGIC)
+	{
+		atomic_thread_fence(memory_order_acquire);
+		int pid = page->pid.load(memory_order_relaxed);
+		stale = page->state.load(memory_order_relaxed) == TELEMETRY_CLOSED || (kill(pid, 0) != 0 && errno == ESRCH);
+	}
+
+	munmap(mapped, sizeof(TelemetryPage));
+	return stale;
+}
+
+void Telemetry :: close()
+{
+	if (page == NULL)
+		return;
+
+	page->state.store(TELEMETRY_CLOSED, memory_order_relaxed);
+	page->updatedNs.store(steady_ns(), memory_order_relaxed);
+	detach();
+	shm_unlink(shared.c_str());
+}
+
+void Telemetry :: detach()
+{
+	if (page != NULL)
+		munmap(page, sizeof(TelemetryPage));
+	page = NULL;
+}
+
+void Telemetry :: start()
+{
+	if (page == NULL)
+		return;
+
+	long long now = steady_ns();
+	lastEvents = 0;
+	lastNs = now;
+	page->run.fetch_add(1, memory_order_relaxed);
+	page->simTime.store(0, memory_order_relaxed);
+	page->events.store(0, memory_order_relaxed);
+	page->eventsPerSecond.store(0, memory_order_relaxed);
+	page->eventSetSize.store(0, memory_order_relaxed);
+	page->maxLine.store(0, memory_order_relaxed);
+	page->allocations.store(0, memory_order_relaxed);
+	page->updatedNs.store(now, memory_order_relaxed);
+	page->state.store(TELEMETRY_RUNNING, memory_order_relaxed);
+}
+
+inline void Telemetry :: publish(long long simTime, long long events, long long eventSetSize, long long maxLine, long long allocations)
+{
+	if (page == NULL)
+		return;
+
+	long long now = steady_ns();
+	page->simTime.store(simTime, memory_order_relaxed);
+	page->events.store(events, memory_order_relaxed);
+	page->eventSetSize.store(eventSetSize, memory_order_relaxed);
+	page->maxLine.store(maxLine, memory_order_relaxed);
+	page->allocations.store(allocations, memory_order_relaxed);
+	page->updatedNs.store(now, memory_order_relaxed);
+	if (now - lastNs >= TELEMETRY_RATE_MS * 1000000LL)
+		sample(events, now);
+}
+
+void Telemetry :: finish(long long simTime, long long events, long long maxLine, long long allocations)
+{
+	if (page == NULL)
+		return;
+
+	publish(simTime, events, 0, maxLine, allocations);
+	if (events > lastEvents)
+		sample(events, steady_ns());
+	page->state.store(TELEMETRY_DONE, memory_order_relaxed);
+}
+
+void Telemetry :: sample(long long events, long long now)
+{
+	if (now > lastNs)
+		page->eventsPerSecond.store((events - lastEvents) * 1000000000LL / (now - lastNs), memory_order_relaxed);
+	page->rssBytes.store(resident_bytes(), memory_order_relaxed);
+	lastEvents = events;
+	lastNs = now;
+}
+
+
+long long resident_bytes()
+{
+	FILE* statm = fopen("/proc/self/statm", "r");
+	if (statm == NULL)
+		return 0;
+
+	long long size = 0;
+	long long resident = 0;
+	int got = fscanf(statm, "%lld %lld", &size, &resident);
+	fclose(statm);
+	return (got == 2) ? resident * sysconf(_SC_PAGESIZE) : 0;
+}
+
+long long steady_ns()
+{
+	return chrono::duration_cast<chrono::nanoseconds> (chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+#endif
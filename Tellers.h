@@ -0,0 +1,199 @@
+#ifndef TELLERS_H
+#define TELLERS_H
+
+#include "Snapshot.h"
+
+using namespace std;
+
+#define MAX_FIXED_TELLERS 32
+
+/** @class TellerArray
+ *  @brief Availability of n tellers when n is only known at runtime. true means the teller is available
+ */
+class TellerArray {
+
+	public:
+		TellerArray(int size);
+		~TellerArray();
+		int size() const;
+		bool isAvailable(int i) const;
+		bool findAvailable(int& index) const;
+		void setBusy(int i);
+		void setAvailable(int i);
+		bool setFirstAvailable();
+		void save(Snapshot& out) const;
+		bool load(Snapshot& in);
+
+	private:
+		int n;
+		bool* tellers;
+};
+
+
+TellerArray :: TellerArray(int size)
+{
+	n = size;
+	tellers = new bool[n];
+	for (int i = 0; i < n; i++)
+		tellers[i] = true;
+}
+
+TellerArray :: ~TellerArray()
+{
+	delete[] tellers;
+}
+
+int TellerArray :: size() const
+{
+	return n;
+}
+
+bool TellerArray :: isAvailable(int i) const
+{
+	return tellers[i];
+}
+
+bool TellerArray :: findAvailable(int& index) const
+{
+	for (int i = 0; i < n; i++)
+	{
+		if (tellers[i] == true)
+		{
+			index = i;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void TellerArray :: setBusy(int i)
+{
+	tellers[i] = false;
+}
+
+void TellerArray :: setAvailable(int i)
+{
+	tellers[i] = true;
+}
+
+bool TellerArray :: setFirstAvailable()
+{
+	//Finds first false entry and sets it to true
+	for (int i = 0; i < n; i++)
+	{
+		if (tellers[i] == false)
+		{
+			tellers[i] = true;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void TellerArray :: save(Snapshot& out) const
+{
+	for (int i = 0; i < n; i++)
+		out.put(tellers[i]);
+}
+
+bool TellerArray :: load(Snapshot& in)
+{
+	for (int i = 0; i < n; i++)
+		in.get(tellers[i]);
+	return in.good();
+}
+
+
+/** @class FixedTellers
+ *  @brief Availability of N tellers packed into one bitmask, for N known at compile time (N <= MAX_FIXED_TELLERS)
+ *
+ *  Bit i is set while teller i is available, so finding a teller is a single count-trailing-zeros instead of a loop
+ */
+template <int N>
+class FixedTellers {
+
+	public:
+		FixedTellers();
+		int size() const;
+		bool isAvailable(int i) const;
+		bool findAvailable(int& index) const;
+		void setBusy(int i);
+		void setAvailable(int i);
+		bool setFirstAvailable();
+		void save(Snapshot& out) const;
+		bool load(Snapshot& in);
+
+	private:
+		static const unsigned int ALL = (N == 32) ? 0xFFFFFFFFu : ((1u << (N % 32)) - 1);
+		unsigned int mask;
+};
+
+
+template <int N>
+FixedTellers<N> :: FixedTellers()
+{
+	mask = ALL;
+}
+
+template <int N>
+int FixedTellers<N> :: size() const
+{
+	return N;
+}
+
+template <int N>
+bool FixedTellers<N> :: isAvailable(int i) const
+{
+	return (mask >> i) & 1u;
+}
+
+template <int N>
+bool FixedTellers<N> :: findAvailable(int& index) const
+{
+	if (mask == 0)
+		return false;
+
+	index = __builtin_ctz(mask);
+	return true;
+}
+
+template <int N>
+void FixedTellers<N> :: setBusy(int i)
+{
+	mask &= ~(1u << i);
+}
+
+template <int N>
+void FixedTellers<N> :: setAvailable(int i)
+{
+	mask |= (1u << i);
+}
+
+template <int N>
+bool FixedTellers<N> :: setFirstAvailable()
+{
+	unsigned int busy = ~mask & ALL;
+	if (busy == 0)
+		return false;
+
+	mask |= (busy & -busy);		//Lowest busy teller becomes available
+	return true;
+}
+
+template <int N>
+void FixedTellers<N> :: save(Snapshot& out) const
+{
+	out.put(mask);
+}
+
+template <int N>
+bool FixedTellers<N> :: load(Snapshot& in)
+{
+	in.get(mask);
+	return in.good() && (mask & ~ALL) == 0;
+}
+
+
+#endif
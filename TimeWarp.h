@@ -0,0 +1,305 @@
+#ifndef TIMEWARP_H
+#define TIMEWARP_H
+
+#include <deque>
+#include "BranchNetwork.h"
+
+using namespace std;
+
+#define TW_WINDOW 500			//How far past GVT a branch may run ahead, which bounds how much history is kept
+#define TW_GVT_INTERVAL 4096		//Events a thread processes between GVT requests
+#define TW_IDLE_SPINS 64		//Passes a thread with nothing to do waits for Transfers before requesting GVT
+
+/** @class OptimisticBranch
+ *  @brief Branch that processes events speculatively and rolls back when a Transfer arrives in its past (Time Warp)
+ *
+ *  Every processed event keeps an UndoRecord until GVT passes it. Rolling back an event that sent a Transfer sends an anti-message
+ *  to cancel it
+ */
+class OptimisticBranch : public Branch {
+
+	public:
+		OptimisticBranch(int index, const NetworkConfig& config);
+		~OptimisticBranch();
+		void step(Mailbox* mailboxes);
+		void receive(Mailbox& box, Mailbox* mailboxes);
+		void fossilCollect(int gvt);
+		long long committedEvents() const;
+
+	private:
+		void handle(Transfer* msg, Mailbox* mailboxes);
+		void rollback(int time, long long tie, bool inclusive, Mailbox* mailboxes);
+		void undoLast(Mailbox* mailboxes);
+
+		deque<UndoRecord> history;
+};
+
+
+OptimisticBranch :: OptimisticBranch(int index, const NetworkConfig& config) : Branch(index, config)
+{
+}
+
+OptimisticBranch :: ~OptimisticBranch()
+{
+	fossilCollect(INT_MAX);
+}
+
+void OptimisticBranch :: step(Mailbox* mailboxes)
+{
+	history.push_back(UndoRecord());
+	processNext(mailboxes, &history.back());
+}
+
+void OptimisticBranch :: receive(Mailbox& box, Mailbox* mailboxes)
+{
+	//The mailbox hands back newest first; reverse it so each sender's Transfer is handled before its anti-message
+	Transfer* msg = box.collect();
+	Transfer* ordered = NULL;
+	while (msg != NULL)
+	{
+		Transfer* next = msg->next;
+		msg->next = ordered;
+		ordered = msg;
+		msg = next;
+	}
+
+	while (ordered != NULL)
+	{
+		Transfer* next = ordered->next;
+		handle(ordered, mailboxes);
+		delete ordered;
+		ordered = next;
+	}
+}
+
+void OptimisticBranch :: handle(Transfer* msg, Mailbox* mailboxes)
+{
+	long long tie = key(KIND_TRANSFER, msg->origin, msg->seq);
+
+	if (msg->anti == false)
+	{
+		//Straggler: roll back everything processed after it
+		rollback(msg->time, tie, false, mailboxes);
+
+		Arrival* temp = new Arrival(msg->time, msg->length);
+		eventQueue.enqueue(temp, msg->time, tie);
+	}
+	else
+	{
+		Event* cancelled = eventQueue.remove(msg->time, tie);
+		if (cancelled == NULL)
+		{
+			//Already processed: roll back to just before it, then it is pending again
+			rollback(msg->time, tie, true, mailboxes);
+			cancelled = eventQueue.remove(msg->time, tie);
+		}
+		delete cancelled;
+	}
+}
+
+void OptimisticBranch :: rollback(int time, long long tie, bool inclusive, Mailbox* mailboxes)
+{
+	while ( !history.empty() )
+	{
+		const UndoRecord& last = history.back();
+		bool later = (last.time > time) || (last.time == time && last.tie > tie);
+		bool same = (last.time == time && last.tie == tie);
+
+		if ( !later && !(inclusive && same) )
+			break;
+
+		undoLast(mailboxes);
+	}
+}
+
+void OptimisticBranch :: undoLast(Mailbox* mailboxes)
+{
+	UndoRecord& last = history.back();
+
+	if (last.destination != -1)
+	{
+		Transfer* anti = new Transfer(last.sent);
+		anti->anti = true;
+		mailboxes[last.destination].post(anti);
+	}
+
+	//Anything this event scheduled is later than it, so it has already been rolled back and is pending again. The departure it scheduled is the
+	//customer it served, which goes back to being an arrival or a waiting customer below
+	if (last.scheduledTime != -1)
+		static_cast<Customer*> (eventQueue.remove(last.scheduledTime, last.scheduledTie))->undepart();
+
+	if (last.lineChange == LINE_ENQUEUED)
+		line.removeRear();
+	else if (last.lineChange == LINE_DEQUEUED)
+		line.enqueueFront(last.dequeued);
+
+	state = last.before;
+	eventQueue.enqueue(last.event, last.time, last.tie);
+
+	history.pop_back();
+}
+
+void OptimisticBranch :: fossilCollect(int gvt)
+{
+	//Nothing before GVT can be rolled back, so commit it and free departed customers
+	while ( !history.empty() && history.front().time < gvt )
+	{
+		if (history.front().departure == true)
+			delete history.front().event;
+		history.pop_front();
+	}
+}
+
+
+long long OptimisticBranch :: committedEvents() const
+{
+	return state.events;
+}
+
+
+/**@brief Simulates a network of branches with optimistic (Time Warp) parallel discrete event simulation
+ *
+ *@details Branch b belongs to thread b % threads. Each thread processes its earliest pending event without waiting for the others, as long as it is within
+ *TW_WINDOW of GVT, saving an UndoRecord per event. A Transfer arriving in a branch's past rolls it back and anti-messages cancel anything the
+ *undone events sent. Every TW_GVT_INTERVAL events, or when a thread has had nothing to do for TW_IDLE_SPINS passes, all threads stop, drain every mailbox until none are posted,
+ *take GVT as the earliest pending event, and commit history before it. The run ends when GVT is infinite. Results match
+ *simulate_network_sequential exactly
+ *
+ *@param config Options for the network
+ *@param branchStats Array of config.branches Stats structs, filled in with the results for each branch
+ *@param rollbacks Reference to a counter set to the number of events that were rolled back
+ *@return void
+ */
+void simulate_network_timewarp(const NetworkConfig& config, Stats* branchStats, long long& rollbacks)
+{
+	int count = config.branches;
+	int threads = max(min(config.threads, count), 1);		//At least 1, even for a network with no branches
+
+	vector<OptimisticBranch*> branches(count);
+	Mailbox* mailboxes = new Mailbox[count];
+	for (int b = 0; b < count; b++)
+		branches[b] = new OptimisticBranch(b, config);
+
+	vector<int> localMin(threads * 16);			//One cache line per thread
+	vector<long long> processed(threads * 16);
+	SpinBarrier barrier(threads);
+	atomic<bool> gvtRequested(false);
+	atomic<bool> inTransit(false);
+
+	auto gvtRound = [&](int t) -> int
+	{
+		barrier.wait();
+		if (t == 0)
+			gvtRequested.store(false);
+
+		//Keep draining until a whole round posts no anti-messages
+		bool again = true;
+		while (again)
+		{
+			for (int b = t; b < count; b += threads)
+				branches[b]->receive(mailboxes[b], mailboxes);
+
+			barrier.wait();
+			for (int b = t; b < count; b += threads)
+			{
+				if ( !mailboxes[b].isEmpty() )
+					inTransit.store(true);
+			}
+			barrier.wait();
+			again = inTransit.load();
+			barrier.wait();
+			if (t == 0)
+				inTransit.store(false);
+		}
+
+		int earliest = INT_MAX;
+		for (int b = t; b < count; b += threads)
+			earliest = min(earliest, branches[b]->nextTime());
+		localMin[t * 16] = earliest;
+
+		barrier.wait();
+
+		int gvt = INT_MAX;
+		for (int i = 0; i < threads; i++)
+			gvt = min(gvt, localMin[i * 16]);
+
+		for (int b = t; b < count; b += threads)
+			branches[b]->fossilCollect(gvt);
+
+		barrier.wait();
+		return gvt;
+	};
+
+	auto worker = [&](int t)
+	{
+		int gvt = 0;
+		long long sinceGVT = 0;
+		int idle = 0;
+
+		while (true)
+		{
+			int next = -1;
+			int nextTime = INT_MAX;
+			for (int b = t; b < count; b += threads)
+			{
+				branches[b]->receive(mailboxes[b], mailboxes);
+				if (branches[b]->nextTime() < nextTime)
+				{
+					nextTime = branches[b]->nextTime();
+					next = b;
+				}
+			}
+
+			//Process before looking at the flag, so a busy thread always makes progress between GVT rounds
+			if (next != -1 && nextTime - gvt < TW_WINDOW)
+			{
+				branches[next]->step(mailboxes);
+				processed[t * 16]++;
+				sinceGVT++;
+				idle = 0;
+			}
+			else
+			{
+				idle++;
+				this_thread::yield();
+			}
+
+			if (sinceGVT >= TW_GVT_INTERVAL || idle >= TW_IDLE_SPINS)
+				gvtRequested.store(true, memory_order_release);
+
+			if (gvtRequested.load(memory_order_acquire))
+			{
+				gvt = gvtRound(t);
+				sinceGVT = 0;
+				idle = 0;
+				if (gvt == INT_MAX)
+					break;
+			}
+		}
+	};
+
+	vector<thread> pool;
+	for (int t = 1; t < threads; t++)
+		pool.push_back(thread(worker, t));
+	worker(0);
+	for (int t = 0; t < (int) pool.size(); t++)
+		pool[t].join();
+
+	//Every processed event was either committed or rolled back
+	long long total = 0;
+	for (int t = 0; t < threads; t++)
+		total += processed[t * 16];
+
+	for (int b = 0; b < count; b++)
+	{
+		branches[b]->finish(&branchStats[b]);
+		total -= branches[b]->committedEvents();
+		delete branches[b];
+	}
+	rollbacks = total;
+
+	delete[] mailboxes;
+}
+
+
+#endif
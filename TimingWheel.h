@@ -0,0 +1,344 @@
+#ifndef TIMINGWHEEL_H
+#define TIMINGWHEEL_H
+
+#include <cstddef>
+#include <vector>
+#include "SimTime.h"
+
+using namespace std;
+
+class Event;
+
+#define WHEEL_BITS 8				//Each level of a TimingWheel has 2^WHEEL_BITS slots,
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_LEVELS 3				//and the levels together cover 2^24 time units ahead; later timers wait in an overflow list
+#define WHEEL_WORDS (WHEEL_SLOTS / 64)		//64 bit words in the occupancy bitmap of 1 level
+
+/** @struct TimerHandle
+ *  @brief This structure identifies 1 scheduled timer so it can be cancelled. A handle whose timer has fired or been cancelled is stale, and cancelling it does nothing
+ *  @var TimerHandle::index
+ *  Member index holds the timer's node in the wheel, -1 for a handle that was never scheduled
+ *  @var TimerHandle::generation
+ *  Member generation holds how many timers had used that node before this one
+ */
+struct TimerHandle {
+	int index;
+	unsigned int generation;
+
+	void initialize()
+	{
+		index = -1;
+		generation = 0;
+	}
+};
+
+/** @struct Timer
+ *  @brief This structure holds what a timer was scheduled with, as handed back when it fires
+ *  @var Timer::time
+ *  Member time holds when the timer fires
+ *  @var Timer::kind
+ *  Member kind holds what the timer is for; the wheel does not look at it
+ *  @var Timer::target
+ *  Member target holds eg the teller the timer is for
+ *  @var Timer::data
+ *  Member data holds eg the customer the timer is for
+ */
+struct Timer {
+	SimTime time;
+	int kind;
+	int target;
+	Event* data;
+};
+
+/** @class TimingWheel
+ *  @brief Hierarchical timing wheel of cancellable timers, for timeouts that are usually cancelled before they fire
+ *
+ *  Level k holds the timers whose time first differs from the wheel's clock in bits 8k - 8k+7, in the slot those bits pick, so schedule() and cancel()
+ *  are O(1): a few bit operations and a doubly linked list insert or unlink, with nodes recycled through a free list. A timer moves down a level each time
+ *  the clock enters its slot, at most WHEEL_LEVELS moves over its life. A 256 bit occupancy bitmap per level finds the next timer without looking at empty slots.
+ *
+ *  The wheel is merged into an event loop by asking nextTime() for its earliest timer no later than the loop's next other event, then advancing to the
+ *  time the loop picks and popping the timers due then. Timers due at the same time fire in the order they were scheduled, unless a slot they were in was
+ *  moved down a level in between
+ */
+class TimingWheel {
+
+	public:
+		TimingWheel(SimTime start = 0);
+		TimerHandle schedule(SimTime time, int kind, int target, Event* data = NULL);
+		bool cancel(TimerHandle& handle);
+		bool isPending(const TimerHandle& handle) const;
+		SimTime nextTime(SimTime limit);
+		void advance(SimTime time);
+		bool pop(SimTime time, Timer& fired);
+		long long pending() const;
+		SimTime clock() const;
+
+	private:
+		struct Node {
+			Timer timer;
+			int previous;
+			int next;
+			int bucket;		//level * WHEEL_SLOTS + slot, WHEEL_LEVELS * WHEEL_SLOTS for the overflow list, -1 while free
+			unsigned int generation;
+		};
+
+		int bucketFor(SimTime time) const;
+		void link(int index);
+		void unlink(int index);
+		void cascade(int bucket);
+		int firstFrom(int level, int slot) const;
+
+		vector<Node> nodes;
+		int freeList;				//Free nodes, chained through next
+		int heads[WHEEL_LEVELS * WHEEL_SLOTS + 1];
+		int tails[WHEEL_LEVELS * WHEEL_SLOTS + 1];
+		unsigned long long occupied[WHEEL_LEVELS][WHEEL_WORDS];
+		SimTime now;
+		long long count;
+};
+
+
+TimingWheel :: TimingWheel(SimTime start)
+{
+	freeList = -1;
+	for (int b = 0; b <= WHEEL_LEVELS * WHEEL_SLOTS; b++)
+	{
+		heads[b] = -1;
+		tails[b] = -1;
+	}
+	for (int k = 0; k < WHEEL_LEVELS; k++)
+		for (int w = 0; w < WHEEL_WORDS; w++)
+			occupied[k][w] = 0;
+	now = start;
+	count = 0;
+}
+
+//A time earlier than the clock is scheduled for the clock, so it fires on the next pop()
+TimerHandle TimingWheel :: schedule(SimTime time, int kind, int target, Event* data)
+{
+	int index = freeList;
+	if (index == -1)
+	{
+		index = nodes.size();
+		nodes.push_back(Node());
+		nodes[index].generation = 0;
+	}
+	else
+		freeList = nodes[index].next;
+
+	Node& node = nodes[index];
+	node.timer.time = (time < now) ? now : time;
+	node.timer.kind = kind;
+	node.timer.target = target;
+	node.timer.data = data;
+	link(index);
+	count++;
+
+	TimerHandle handle;
+	handle.index = index;
+	handle.generation = node.generation;
+	return handle;
+}
+
+//Returns true if the timer was still pending; the handle is stale afterwards either way
+bool TimingWheel :: cancel(TimerHandle& handle)
+{
+	bool pending = isPending(handle);
+	if (pending)
+	{
+		unlink(handle.index);
+		Node& node = nodes[handle.index];
+		node.bucket = -1;
+		node.generation++;
+		node.next = freeList;
+		freeList = handle.index;
+		count--;
+	}
+
+	handle.index = -1;
+	return pending;
+}
+
+bool TimingWheel :: isPending(const TimerHandle& handle) const
+{
+	return handle.index >= 0 && handle.index < (int) nodes.size() && nodes[handle.index].generation == handle.generation && nodes[handle.index].bucket != -1;
+}
+
+//Returns the time of the earliest timer if it is no later than limit, otherwise SIMTIME_MAX. Slots that are entered on the way to it are moved down
+//a level, which advances the clock, but never past limit or the earliest timer, so anything the caller schedules from then on is still in the future
+SimTime TimingWheel :: nextTime(SimTime limit)
+{
+	while (count > 0)
+	{
+		//Level 0 slots hold 1 time each, and every occupied one is at or after the clock's
+		int slot = firstFrom(0, now & (WHEEL_SLOTS - 1));
+		if (slot != -1)
+		{
+			SimTime time = (now & ~(SimTime) (WHEEL_SLOTS - 1)) | slot;
+			return (time <= limit) ? time : SIMTIME_MAX;
+		}
+
+		//Otherwise the earliest timer is in the first occupied slot after the clock's on the lowest level that has one
+		SimTime start = SIMTIME_MAX;
+		for (int k = 1; k < WHEEL_LEVELS && start == SIMTIME_MAX; k++)
+		{
+			int shift = WHEEL_BITS * k;
+			slot = firstFrom(k, ((now >> shift) & (WHEEL_SLOTS - 1)) + 1);
+			if (slot != -1)
+				start = ((now >> (shift + WHEEL_BITS)) << (shift + WHEEL_BITS)) | ((SimTime) slot << shift);
+		}
+
+		if (start == SIMTIME_MAX)
+		{
+			//Only the overflow list is left: start from the beginning of the span its earliest timer falls in
+			int bucket = WHEEL_LEVELS * WHEEL_SLOTS;
+			if (heads[bucket] == -1)
+				break;
+			for (int i = heads[bucket]; i != -1; i = nodes[i].next)
+				start = min(start, nodes[i].timer.time);
+			start = (start >> (WHEEL_BITS * WHEEL_LEVELS)) << (WHEEL_BITS * WHEEL_LEVELS);
+			start = max(start, now);
+		}
+
+		if (start > limit)
+			return SIMTIME_MAX;
+		advance(start);
+	}
+
+	return SIMTIME_MAX;
+}
+
+//Moves the clock to time, which must not be later than the earliest pending timer. Each slot the clock enters is moved down a level
+void TimingWheel :: advance(SimTime time)
+{
+	if (time <= now)
+		return;
+
+	SimTime old = now;
+	now = time;
+
+	int top = WHEEL_BITS * WHEEL_LEVELS;
+	if ((time >> top) != (old >> top))
+		cascade(WHEEL_LEVELS * WHEEL_SLOTS);
+
+	for (int k = WHEEL_LEVELS - 1; k >= 1; k--)
+	{
+		int shift = WHEEL_BITS * k;
+		if ((time >> shift) != (old >> shift))
+			cascade(k * WHEEL_SLOTS + ((time >> shift) & (WHEEL_SLOTS - 1)));
+	}
+}
+
+//Advances the clock to time and takes off 1 timer due then, if there is one. Call it until it returns false to fire every timer due at time
+bool TimingWheel :: pop(SimTime time, Timer& fired)
+{
+	if (count == 0)
+		return false;
+
+	advance(time);
+	int bucket = time & (WHEEL_SLOTS - 1);
+	int index = heads[bucket];
+	if (time != now || index == -1)
+		return false;
+
+	fired = nodes[index].timer;
+	TimerHandle handle;
+	handle.index = index;
+	handle.generation = nodes[index].generation;
+	cancel(handle);
+	return true;
+}
+
+long long TimingWheel :: pending() const
+{
+	return count;
+}
+
+SimTime TimingWheel :: clock() const
+{
+	return now;
+}
+
+int TimingWheel :: bucketFor(SimTime time) const
+{
+	//The highest group of WHEEL_BITS bits where time and the clock differ picks the level
+	SimTime differ = time ^ now;
+	for (int k = 0; k < WHEEL_LEVELS; k++)
+	{
+		int shift = WHEEL_BITS * k;
+		if ((differ >> (shift + WHEEL_BITS)) == 0)
+			return k * WHEEL_SLOTS + ((time >> shift) & (WHEEL_SLOTS - 1));
+	}
+
+	return WHEEL_LEVELS * WHEEL_SLOTS;
+}
+
+void TimingWheel :: link(int index)
+{
+	Node& node = nodes[index];
+	int bucket = bucketFor(node.timer.time);
+	node.bucket = bucket;
+	node.next = -1;
+	node.previous = tails[bucket];
+	if (tails[bucket] == -1)
+		heads[bucket] = index;
+	else
+		nodes[tails[bucket]].next = index;
+	tails[bucket] = index;
+
+	if (bucket < WHEEL_LEVELS * WHEEL_SLOTS)
+		occupied[bucket / WHEEL_SLOTS][(bucket % WHEEL_SLOTS) / 64] |= 1ULL << (bucket % 64);
+}
+
+void TimingWheel :: unlink(int index)
+{
+	Node& node = nodes[index];
+	int bucket = node.bucket;
+	if (node.previous == -1)
+		heads[bucket] = node.next;
+	else
+		nodes[node.previous].next = node.next;
+	if (node.next == -1)
+		tails[bucket] = node.previous;
+	else
+		nodes[node.next].previous = node.previous;
+
+	if (heads[bucket] == -1 && bucket < WHEEL_LEVELS * WHEEL_SLOTS)
+		occupied[bucket / WHEEL_SLOTS][(bucket % WHEEL_SLOTS) / 64] &= ~(1ULL << (bucket % 64));
+}
+
+//Relinks every timer of a bucket for the current clock, which puts it on a lower level (or keeps it in the overflow list if it is still too far ahead)
+void TimingWheel :: cascade(int bucket)
+{
+	int index = heads[bucket];
+	heads[bucket] = -1;
+	tails[bucket] = -1;
+	if (bucket < WHEEL_LEVELS * WHEEL_SLOTS)
+		occupied[bucket / WHEEL_SLOTS][(bucket % WHEEL_SLOTS) / 64] &= ~(1ULL << (bucket % 64));
+
+	while (index != -1)
+	{
+		int next = nodes[index].next;
+		link(index);
+		index = next;
+	}
+}
+
+//Returns the first occupied slot of a level at or after slot, or -1
+int TimingWheel :: firstFrom(int level, int slot) const
+{
+	for (int w = slot / 64; w < WHEEL_WORDS; w++)
+	{
+		unsigned long long bits = occupied[level][w];
+		if (w == slot / 64)
+			bits &= ~0ULL << (slot % 64);
+		if (bits != 0)
+			return w * 64 + __builtin_ctzll(bits);
+	}
+
+	return -1;
+}
+
+
+#endif
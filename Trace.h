@@ -0,0 +1,311 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "SimTime.h"
+
+using namespace std;
+
+#define TRACE_CHUNK_BYTES (4 << 20)	//Least text each parsing thread gets; smaller files are parsed on fewer threads
+
+/** @struct Trace
+ *  @brief This structure holds the customers of one data file in memory, in order of arrival, so engines can be run on them without reading the file
+ *  @var Trace::arrivalTimes
+ *  Member arrivalTimes holds each customer's arrival time
+ *  @var Trace::transactionLengths
+ *  Member transactionLengths holds each customer's transaction time
+ */
+struct Trace {
+	vector<SimTime> arrivalTimes;
+	vector<SimTime> transactionLengths;
+
+	void initialize()
+	{
+		arrivalTimes.clear();
+		transactionLengths.clear();
+	}
+
+	int size() const
+	{
+		return arrivalTimes.size();
+	}
+};
+
+/** @struct TraceReport
+ *  @brief This structure holds what read_trace found wrong with a data file
+ *  @var TraceReport::lines
+ *  Member lines holds how many lines the file has
+ *  @var TraceReport::malformed
+ *  Member malformed holds how many lines were not blank and not 2 integers; they are skipped
+ *  @var TraceReport::firstMalformed
+ *  Member firstMalformed holds the line number (from 1) of the first malformed line, 0 if there is none
+ *  @var TraceReport::unsorted
+ *  Member unsorted holds how many customers arrive before the customer above them; they are kept
+ *  @var TraceReport::firstUnsorted
+ *  Member firstUnsorted holds the number (from 1) of the first customer out of order, 0 if there is none
+ */
+struct TraceReport {
+	long long lines;
+	long long malformed;
+	long long firstMalformed;
+	long long unsorted;
+	long long firstUnsorted;
+
+	void initialize()
+	{
+		lines = 0;
+		malformed = 0;
+		firstMalformed = 0;
+		unsorted = 0;
+		firstUnsorted = 0;
+	}
+};
+
+/**@brief Reads a data file of "arrival time  transaction time" lines into a Trace
+ *
+ *@details The file is memory mapped and split at line boundaries into 1 chunk per thread, at least TRACE_CHUNK_BYTES each. Every thread parses its
+ *chunk in 1 pass with parse_trace_time into its own columns, which are then joined in order. Blank lines are ignored, malformed lines are skipped, and both they and
+ *customers out of order are counted in the report
+ *
+ *@param fileName string holding the name of the data file to read
+ *@param trace Reference to the Trace that is filled in
+ *@param report Reference to the TraceReport that is filled in
+ *@return bool Returns false if the file could not be opened
+ */
+bool read_trace(string fileName, Trace& trace, TraceReport& report);
+
+/**@brief Reads a data file into a Trace, ignoring what is wrong with it
+ *@param fileName string holding the name of the data file to read
+ *@param trace Reference to the Trace that is filled in
+ *@return bool Returns false if the file could not be opened
+ */
+bool read_trace(string fileName, Trace& trace);
+
+/**@brief Puts a Trace's customers in order of arrival, for engines that take arrivals from the trace in order
+ *@param trace Customers to order
+ *@param sorted Reference to a Trace that is filled in only if trace is out of order
+ *@return const Trace& Returns trace if it is in order, otherwise sorted, holding its customers stably sorted by arrival time
+ */
+const Trace& arrival_order(const Trace& trace, Trace& sorted);
+
+/**@brief Parses the lines of 1 chunk of a data file
+ *@param begin First character of the chunk, the start of a line
+ *@param end 1 past the last character of the chunk, just after a '\n' or the end of the file
+ *@param trace Reference to the Trace the chunk's customers are appended to
+ *@param report Reference to the TraceReport of the chunk, with lines and customers counted from the start of the chunk
+ *@return void
+ */
+void parse_trace_chunk(const char* begin, const char* end, Trace& trace, TraceReport& report);
+
+/**@brief Parses 1 decimal SimTime, which may start with '-', and advances past it
+ *@param at Reference to the first character, moved past the last digit when the number is good
+ *@param end 1 past the last character that may be read
+ *@param value Reference to the SimTime that is set
+ *@return bool Returns false if there are no digits or the number does not fit in a SimTime
+ */
+bool parse_trace_time(const char*& at, const char* end, SimTime& value);
+
+
+bool read_trace(string fileName, Trace& trace, TraceReport& report)
+{
+	trace.initialize();
+	report.initialize();
+
+	int fd = open(fileName.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat info;
+	if (fstat(fd, &info) != 0)
+	{
+		close(fd);
+		return false;
+	}
+
+	size_t size = info.st_size;
+	if (size == 0)
+	{
+		close(fd);
+		return true;
+	}
+
+	void* mapped = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (mapped == MAP_FAILED)
+		return false;
+	madvise(mapped, size, MADV_SEQUENTIAL);
+	const char* text = static_cast<const char*> (mapped);
+
+	//Chunks start just after the first '\n' at or past an even split, so no line is cut in two
+	int threads = max(1, (int) min<size_t>(thread::hardware_concurrency(), size / TRACE_CHUNK_BYTES));
+	vector<const char*> bounds(threads + 1, text + size);
+	bounds[0] = text;
+	for (int i = 1; i < threads; i++)
+	{
+		const char* from = max(text + size * i / threads, bounds[i - 1]);
+		const char* newline = static_cast<const char*> (memchr(from, '\n', text + size - from));
+		bounds[i] = (newline != NULL) ? newline + 1 : text + size;
+	}
+
+	vector<Trace> chunks(threads);
+	vector<TraceReport> reports(threads);
+	vector<thread> pool;
+	for (int i = 1; i < threads; i++)
+		pool.push_back(thread(parse_trace_chunk, bounds[i], bounds[i + 1], ref(chunks[i]), ref(reports[i])));
+	parse_trace_chunk(bounds[0], bounds[1], chunks[0], reports[0]);
+	for (int i = 0; i < (int) pool.size(); i++)
+		pool[i].join();
+
+	size_t total = 0;
+	for (int i = 0; i < threads; i++)
+		total += chunks[i].size();
+	trace.arrivalTimes.reserve(total);
+	trace.transactionLengths.reserve(total);
+
+	for (int i = 0; i < threads; i++)
+	{
+		//A chunk cannot see the customer above its first one, so that order is checked here
+		const Trace& chunk = chunks[i];
+		if (chunk.size() > 0 && trace.size() > 0 && chunk.arrivalTimes[0] < trace.arrivalTimes.back())
+		{
+			if (report.unsorted == 0)
+				report.firstUnsorted = trace.size() + 1;
+			report.unsorted++;
+		}
+
+		if (report.malformed == 0 && reports[i].malformed > 0)
+			report.firstMalformed = report.lines + reports[i].firstMalformed;
+		if (report.unsorted == 0 && reports[i].unsorted > 0)
+			report.firstUnsorted = trace.size() + reports[i].firstUnsorted;
+		report.malformed += reports[i].malformed;
+		report.unsorted += reports[i].unsorted;
+		report.lines += reports[i].lines;
+
+		trace.arrivalTimes.insert(trace.arrivalTimes.end(), chunk.arrivalTimes.begin(), chunk.arrivalTimes.end());
+		trace.transactionLengths.insert(trace.transactionLengths.end(), chunk.transactionLengths.begin(), chunk.transactionLengths.end());
+	}
+
+	munmap(mapped, size);
+	return true;
+}
+
+bool read_trace(string fileName, Trace& trace)
+{
+	TraceReport report;
+	return read_trace(fileName, trace, report);
+}
+
+const Trace& arrival_order(const Trace& trace, Trace& sorted)
+{
+	if (is_sorted(trace.arrivalTimes.begin(), trace.arrivalTimes.end()))
+		return trace;
+
+	vector<int> order(trace.size());
+	for (int i = 0; i < trace.size(); i++)
+		order[i] = i;
+	stable_sort(order.begin(), order.end(), [&](int a, int b) { return trace.arrivalTimes[a] < trace.arrivalTimes[b]; });
+
+	sorted.initialize();
+	sorted.arrivalTimes.reserve(trace.size());
+	sorted.transactionLengths.reserve(trace.size());
+	for (int i = 0; i < trace.size(); i++)
+	{
+		sorted.arrivalTimes.push_back(trace.arrivalTimes[order[i]]);
+		sorted.transactionLengths.push_back(trace.transactionLengths[order[i]]);
+	}
+
+	return sorted;
+}
+
+void parse_trace_chunk(const char* begin, const char* end, Trace& trace, TraceReport& report)
+{
+	trace.initialize();
+	report.initialize();
+
+	//About 12 characters per line in the files write_events writes
+	trace.arrivalTimes.reserve((end - begin) / 12 + 1);
+	trace.transactionLengths.reserve((end - begin) / 12 + 1);
+
+	const char* at = begin;
+	SimTime previous = SIMTIME_MIN;
+	while (at < end)
+	{
+		report.lines++;
+		while (at < end && (*at == ' ' || *at == '\t'))
+			at++;
+		const char* first = at;
+
+		//1 pass over the line: arrival time, at least 1 space or tab, transaction time, then only spaces, tabs and '\r' up to the '\n'
+		SimTime a = 0;
+		SimTime t = 0;
+		bool good = parse_trace_time(at, end, a) && at < end && (*at == ' ' || *at == '\t');
+		if (good == true)
+		{
+			while (at < end && (*at == ' ' || *at == '\t'))
+				at++;
+			good = parse_trace_time(at, end, t);
+			while (good == true && at < end && (*at == ' ' || *at == '\t' || *at == '\r'))
+				at++;
+			good = good && (at == end || *at == '\n');
+		}
+
+		if (good == true)
+		{
+			if (a < previous)
+			{
+				if (report.unsorted == 0)
+					report.firstUnsorted = trace.size() + 1;
+				report.unsorted++;
+			}
+			previous = a;
+			trace.arrivalTimes.push_back(a);
+			trace.transactionLengths.push_back(t);
+		}
+		else
+		{
+			if (first < end && *first != '\n' && *first != '\r')		//Not a blank line
+			{
+				if (report.malformed == 0)
+					report.firstMalformed = report.lines;
+				report.malformed++;
+			}
+
+			const char* newline = static_cast<const char*> (memchr(at, '\n', end - at));
+			at = (newline != NULL) ? newline : end;
+		}
+
+		if (at < end)
+			at++;			//Past the '\n'
+	}
+}
+
+bool parse_trace_time(const char*& at, const char* end, SimTime& value)
+{
+	bool negative = (at < end && *at == '-');
+	const char* digits = at + negative;
+	const char* p = digits;
+	unsigned long long number = 0;
+	while (p < end && (unsigned) (*p - '0') < 10 && p - digits < SIMTIME_DIGITS)
+	{
+		number = number * 10 + (*p - '0');
+		p++;
+	}
+
+	if (p == digits || (p < end && (unsigned) (*p - '0') < 10) || number > (unsigned long long) SIMTIME_MAX + negative)
+		return false;
+
+	value = negative ? (SimTime) (0 - number) : (SimTime) number;
+	at = p;
+	return true;
+}
+
+#endif
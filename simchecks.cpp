@@ -0,0 +1,953 @@
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <dirent.h>
+#include <unistd.h>
+
+#define SIMCHECKS			//simulate3.cpp leaves out its main, so its engines can be run here directly
+#include "simulate3.cpp"
+
+using namespace std;
+
+/*
+ * Checks of the data structures whose edge cases the simulations only reach by chance: deficit round robin in ClassQueue, the TimingWheel across
+ * slot wraps, the varint trace encoding of ResultCache, the data file parser and RecordRing. Then checks that the engines' specialized paths give the
+ * same Stats as the generic ones on a fixed trace. Build it like the simulator, eg g++ -Wall -O2 -pthread -o simchecks simchecks.cpp (add
+ * -DLONG_HORIZON to check that build). Prints each failed check and exits 1 if there was any
+ */
+
+#define CHECK_SEED 12345		//Seed of the random workloads, so a failure can be repeated
+#define CHECK_CUSTOMERS 5000		//Customers of the fixed trace: an offered load of about 2.5 tellers, so n = 1 - 32 runs from swamped to idle
+
+int failures = 0;
+
+/**@brief Counts and reports a check that failed
+ *@param good Whether the check passed
+ *@param what What was checked
+ *@return bool Returns good
+ */
+bool check(bool good, string what);
+
+/**@brief Compares ClassQueue's deficit round robin with one that gives every round, on random workloads, and checks the share each class gets
+ *@return void
+ */
+void check_class_queue();
+
+/**@brief Runs timers through a TimingWheel across slot, level and overflow wraps, and checks they fire in order of time
+ *@return void
+ */
+void check_timing_wheel();
+
+/**@brief Round trips a trace through ResultCache with gaps and transaction times at each varint width
+ *@return void
+ */
+void check_trace_cache();
+
+/**@brief Parses a data file with CRLF, blank and malformed lines
+ *@return void
+ */
+void check_trace_parser();
+
+/**@brief Pushes and pops records through a small RecordRing until its positions have wrapped many times
+ *@return void
+ */
+void check_record_ring();
+
+/**@brief Runs every FixedDispatch instantiation of simulateA and simulateB against engineA and engineB on TellerArray and LineLengths, with and
+ *without patience and breaks
+ *@return void
+ */
+void check_fixed_dispatch();
+
+/**@brief Compares LineLengths::shortest, and FixedLineLengths', with a scan for the first shortest line over random lengths, ties and padding. Built
+ *with -mavx2, -mavx512f or -march=native this checks the vector path
+ *@return void
+ */
+void check_shortest_line();
+
+/**@brief Checks each routing mode's choices on hand-set line lengths, then runs simulateB with each against engineB on TellerArray and LineLengths, and
+ *against simulateA for a single line
+ *@return void
+ */
+void check_routing();
+
+/**@brief Checks the stopping rule is gated on the fields asked for only: not on noisy ones left out, zero-mean ones or the extremes
+ *@return void
+ */
+void check_stopping_rule();
+
+/**@brief Pauses long runs of simulateA and simulateB halfway, saves and restores them, and checks they end as the same runs left alone
+ *@return void
+ */
+void check_long_run_snapshot();
+
+/**@brief Runs simulateA, and simulateB with round robin routing, on the fixed trace and checks the waits and the end time against the FIFO recursion
+ *each customer starts at the later of their arrival and the first time a teller of theirs is free
+ *@return void
+ */
+void check_batched_events();
+
+/**@brief Works out the waits of FIFO tellers customer by customer, without an event loop
+ *@param trace Customers in arrival order
+ *@param n Number of tellers sharing 1 line, or 1 teller per line if roundRobin is true
+ *@param roundRobin Whether customer k joins line k mod n instead
+ *@param reference Reference to the Stats to fill in: process time, average, max and 95th percentile wait
+ *@return void
+ */
+void reference_waits(const Trace& trace, int n, bool roundRobin, Stats& reference);
+
+/**@brief Checks a customer CustomerPool hands out again is reset to a fresh arrival, and that a long run stops allocating once the bank is as full
+ *as it gets
+ *@return void
+ */
+void check_customer_pool();
+
+/**@brief Answers requests of many replications each from concurrent worker threads on one connection, and checks each request's answer is all its
+ *run lines, then its means, half widths and "done" last, in the order the requests were sent
+ *@return void
+ */
+void check_server_answers();
+
+/**@brief Returns the fixed trace the engine checks run on: replication 0 of the default configuration, with CHECK_CUSTOMERS customers in arrival order
+ *@return Trace
+ */
+Trace fixed_trace();
+
+/**@brief Returns true if two runs' Stats are identical in every field but CPU time
+ *@param a Stats of one run
+ *@param b Stats of the other
+ *@return bool
+ */
+bool same_stats(const Stats& a, const Stats& b);
+
+/**@brief Class a deficit round robin over the front customers serves next, giving every round in turn
+ *@param front Transaction time of each class's first customer, 0 if nobody of that class is waiting
+ *@param quantum Transaction time each class is owed per round
+ *@param deficit Transaction time each class is still owed, updated
+ *@param current Class whose turn it is, updated
+ *@param classes Number of classes
+ *@return int
+ */
+int reference_next(const SimTime* front, const int* quantum, long long* deficit, int& current, int classes);
+
+
+int main()
+{
+	srand(CHECK_SEED);
+
+	check_class_queue();
+	check_timing_wheel();
+	check_trace_cache();
+	check_trace_parser();
+	check_record_ring();
+	check_fixed_dispatch();
+	check_shortest_line();
+	check_routing();
+	check_stopping_rule();
+	check_long_run_snapshot();
+	check_batched_events();
+	check_customer_pool();
+	check_server_answers();
+
+	if (failures > 0)
+	{
+		cout << failures << " checks failed" << endl;
+		return 1;
+	}
+
+	cout << "All checks passed" << endl;
+	return 0;
+}
+
+bool check(bool good, string what)
+{
+	if (good == false)
+	{
+		failures++;
+		cout << "FAILED: " << what << endl;
+	}
+	return good;
+}
+
+void check_class_queue()
+{
+	//Whole workloads up front, with transactions from a fraction of a quantum to many quanta, so some turns nobody is covered
+	for (int trial = 0; trial < 200; trial++)
+	{
+		int classes = 1 + rand() % MAX_CLASSES;
+		int weights[MAX_CLASSES];
+		int quantum[MAX_CLASSES];
+		for (int c = 0; c < MAX_CLASSES; c++)
+		{
+			weights[c] = 1 + rand() % 4;
+			quantum[c] = CLASS_QUANTUM * weights[c];
+		}
+
+		ClassQueue line(classes, CLASS_WEIGHTED, weights);
+		vector<Customer*> customers;
+		vector<int> waiting[MAX_CLASSES];
+		vector<size_t> served(MAX_CLASSES, 0);
+		for (int i = 0; i < 300; i++)
+		{
+			int c = rand() % classes;
+			SimTime length = (rand() % 4 == 0) ? 1 + rand() % (CLASS_QUANTUM * 40) : 1 + rand() % CLASS_QUANTUM;
+			Customer* customer = new Customer(i, length);
+			customer->setClass(c);
+			customers.push_back(customer);
+			waiting[c].push_back(i);
+			line.enqueue(customer);
+		}
+
+		long long deficit[MAX_CLASSES] = {0, 0, 0, 0};
+		int current = 0;
+		bool same = true;
+		while (line.isEmpty() == false && same == true)
+		{
+			SimTime front[MAX_CLASSES] = {0, 0, 0, 0};
+			for (int c = 0; c < classes; c++)
+				if (served[c] < waiting[c].size())
+					front[c] = customers[waiting[c][served[c]]]->getTransactionLength();
+
+			int c = reference_next(front, quantum, deficit, current, classes);
+			Customer* next = static_cast<Customer*> (line.peekFront());
+			same = check(next == customers[waiting[c][served[c]]], "ClassQueue serves the customer deficit round robin does, trial " + to_string(trial));
+			line.dequeue();
+			deficit[c] -= front[c];
+			served[c]++;
+			if (served[c] == waiting[c].size())
+				deficit[c] = 0;
+		}
+
+		for (Customer* customer : customers)
+			delete customer;
+	}
+
+	//Classes that never run out of customers share transaction time in proportion to their weights, within a quantum and a transaction a class
+	int weights[MAX_CLASSES] = {1, 2, 3, 1};		//The constructor reads a weight for every class
+	ClassQueue line(3, CLASS_WEIGHTED, weights);
+	vector<Customer*> customers;
+	for (int c = 0; c < 3; c++)
+		for (int i = 0; i < 2; i++)
+		{
+			customers.push_back(new Customer(0, 1 + rand() % (3 * CLASS_QUANTUM)));
+			customers.back()->setClass(c);
+			line.enqueue(customers.back());
+		}
+
+	long long time[3] = {0, 0, 0};
+	for (int i = 0; i < 30000; i++)
+	{
+		Customer* next = static_cast<Customer*> (line.peekFront());
+		int c = next->getClass();
+		time[c] += next->getTransactionLength();
+		line.dequeue();
+		next->reset(0, 1 + rand() % (3 * CLASS_QUANTUM));
+		next->setClass(c);
+		line.enqueue(next);
+	}
+
+	long long total = time[0] + time[1] + time[2];
+	for (int c = 0; c < 3; c++)
+	{
+		double share = (double) time[c] / total;
+		double owed = (c + 1) / 6.0;
+		check(share > owed * 0.98 && share < owed * 1.02, "Class " + to_string(c) + " of weight " + to_string(c + 1) + " gets " + to_string(share) + " of the time");
+	}
+
+	for (Customer* customer : customers)
+		delete customer;
+}
+
+int reference_next(const SimTime* front, const int* quantum, long long* deficit, int& current, int classes)
+{
+	if (front[current] > 0 && front[current] <= deficit[current])
+		return current;
+
+	while (true)
+	{
+		do
+			current = (current + 1) % classes;
+		while (front[current] == 0);
+		deficit[current] += quantum[current];
+		if (front[current] <= deficit[current])
+			return current;
+	}
+}
+
+void check_timing_wheel()
+{
+	//Each span reaches a further level: within a slot's turn, the next level 0 wrap, level 1 and 2 wraps, then the overflow list
+	const SimTime spans[5] = {16, 600, 70000, 20000000, 100000000};
+
+	for (int trial = 0; trial < 50; trial++)
+	{
+		SimTime start = (trial % 2 == 0) ? 250 : 65530;		//Just before a level 0 and a level 1 wrap
+		TimingWheel wheel(start);
+		vector<SimTime> scheduled;
+		vector<TimerHandle> handles;
+
+		for (int i = 0; i < 2000; i++)
+		{
+			SimTime time = start + rand() % spans[rand() % 5];
+			handles.push_back(wheel.schedule(time, 0, i));
+			scheduled.push_back(time);
+		}
+
+		//Cancel a tenth of them; their times must not fire
+		vector<bool> cancelled(scheduled.size(), false);
+		for (int i = 0; i < 200; i++)
+		{
+			int index = rand() % handles.size();
+			bool pending = (cancelled[index] == false);
+			check(wheel.cancel(handles[index]) == pending, "Cancelling a timer says whether it was pending");
+			cancelled[index] = true;
+		}
+
+		vector<SimTime> expected;
+		for (size_t i = 0; i < scheduled.size(); i++)
+			if (cancelled[i] == false)
+				expected.push_back(scheduled[i]);
+
+		//Drain it the way the engines do, scheduling more timers from the ones that fire so the wheel keeps wrapping under them
+		vector<SimTime> fired;
+		SimTime last = start;
+		bool ordered = true;
+		while (wheel.pending() > 0 && ordered == true)
+		{
+			SimTime time = wheel.nextTime(SIMTIME_MAX);
+			ordered = check(time != SIMTIME_MAX && time >= last, "TimingWheel's next timer is not before the last, trial " + to_string(trial));
+			last = time;
+
+			Timer timer;
+			while (ordered == true && wheel.pop(time, timer))
+			{
+				ordered = check(timer.time == time, "A timer fires at its own time, trial " + to_string(trial));
+				fired.push_back(timer.time);
+				if (timer.target < 4000 && rand() % 4 == 0)
+				{
+					SimTime later = time + rand() % spans[rand() % 5];
+					wheel.schedule(later, 0, timer.target + 2000);
+					expected.push_back(later);
+				}
+			}
+		}
+
+		sort(expected.begin(), expected.end());
+		check(ordered == false || fired == expected, "Every pending timer fires once, in order of time, trial " + to_string(trial));
+	}
+
+	//A time already past is due at once
+	TimingWheel wheel(1000);
+	wheel.schedule(10, 0, 0);
+	Timer timer;
+	check(wheel.nextTime(SIMTIME_MAX) == 1000 && wheel.pop(1000, timer) && wheel.pending() == 0, "A timer scheduled in the past fires at the clock");
+}
+
+void check_trace_cache()
+{
+	char dir[] = "/tmp/simchecksXXXXXX";
+	if (check(mkdtemp(dir) != NULL, "Making a cache directory") == false)
+		return;
+
+	//Gaps and transaction times either side of each width a varint changes at, then the largest ones
+	vector<SimTime> values = {0, 1, 127, 128, 16383, 16384, 2097151, 2097152, 268435455, 268435456};
+#ifdef LONG_HORIZON
+	values.push_back(34359738367LL);
+	values.push_back(34359738368LL);
+#endif
+
+	vector<SimTime> arrivalTimes;
+	vector<SimTime> transactionLengths;
+	SimTime time = 0;
+	for (size_t i = 0; i < values.size(); i++)
+	{
+		time += values[i];
+		arrivalTimes.push_back(time);
+		transactionLengths.push_back(values[values.size() - 1 - i]);
+	}
+	arrivalTimes.push_back(time);
+	transactionLengths.push_back(SIMTIME_MAX);
+	arrivalTimes.push_back(time - 5);		//Out of order, so a gap is negative
+	transactionLengths.push_back(1);
+
+	{
+		ResultCache cache(dir);
+		cache.putTrace(1, arrivalTimes.data(), transactionLengths.data(), arrivalTimes.size());
+		cache.putTrace(2, arrivalTimes.data(), transactionLengths.data(), 0);
+
+		vector<SimTime> readArrivals;
+		vector<SimTime> readLengths;
+		check(cache.getTrace(1, readArrivals, readLengths) && readArrivals == arrivalTimes && readLengths == transactionLengths, "A trace round trips through the cache");
+		check(cache.getTrace(2, readArrivals, readLengths) && readArrivals.empty() && readLengths.empty(), "An empty trace round trips through the cache");
+		check(cache.getTrace(3, readArrivals, readLengths) == false, "A trace that was never cached is not found");
+	}
+
+	DIR* entries = opendir(dir);
+	if (entries != NULL)
+	{
+		while (dirent* entry = readdir(entries))
+			if (entry->d_name[0] != '.')
+				remove((string(dir) + "/" + entry->d_name).c_str());
+		closedir(entries);
+	}
+	rmdir(dir);
+}
+
+void check_trace_parser()
+{
+	char fileName[] = "/tmp/simchecksXXXXXX";
+	int fd = mkstemp(fileName);
+	if (check(fd >= 0, "Making a data file") == false)
+		return;
+
+	string text = "1 5\r\n"		//Line 1
+		"\r\n"				//2: blank
+		"\n"				//3: blank
+		"  \t\n"			//4: blank
+		"3\t7 \r\n"			//5
+		"4 x\n"				//6: malformed
+		"2 9\n"				//7: out of order
+		"5\n"				//8: malformed
+		"6 6 6\r\n"			//9: malformed
+		"-2 1\n"			//10: out of order
+		"99999999999999999999 1\n"	//11: too large
+		"8 8";				//12: no newline at the end
+	check(write(fd, text.data(), text.size()) == (ssize_t) text.size(), "Writing a data file");
+	close(fd);
+
+	Trace trace;
+	TraceReport report;
+	check(read_trace(fileName, trace, report), "Reading a data file");
+	check(report.lines == 12, "The data file has 12 lines, read " + to_string(report.lines));
+	check(report.malformed == 4 && report.firstMalformed == 6, "The data file has 4 malformed lines from line 6");
+	check(report.unsorted == 2 && report.firstUnsorted == 3, "The data file has 2 customers out of order from the 3rd");
+
+	vector<SimTime> arrivals = {1, 3, 2, -2, 8};
+	vector<SimTime> lengths = {5, 7, 9, 1, 8};
+	check(trace.arrivalTimes == arrivals && trace.transactionLengths == lengths, "The data file's customers are read in order");
+	remove(fileName);
+
+	check(read_trace(fileName, trace, report) == false, "A missing data file is not read");
+}
+
+void check_record_ring()
+{
+	RecordRing ring(5);		//Rounded up to 8
+	CustomerRecord record = {0, 0, 0, 0, 0};
+	for (int i = 0; i < 8; i++)
+	{
+		record.arrival = i;
+		check(ring.push(record), "Pushing into a ring with room");
+	}
+	check(ring.push(record) == false, "Pushing into a full ring fails");
+
+	//Uneven pushes and pops, so runs wrap past the end of the array at every offset
+	CustomerRecord records[8];
+	SimTime pushed = 8;
+	SimTime popped = 0;
+	bool ordered = true;
+	for (int i = 0; i < 5000 && ordered == true; i++)
+	{
+		int n = ring.pop(records, 1 + rand() % 8);
+		for (int r = 0; r < n; r++)
+			ordered = ordered && check(records[r].arrival == popped++, "Records pop in the order they were pushed");
+
+		int more = rand() % 9;
+		for (int p = 0; p < more; p++)
+		{
+			record.arrival = pushed;
+			if (ring.push(record) == false)
+			{
+				check(pushed - popped == 8, "Pushing only fails when the ring is full");
+				break;
+			}
+			pushed++;
+		}
+	}
+
+	int left = ring.pop(records, 8);
+	check(left == pushed - popped && ring.pop(records, 8) == 0, "Popping an emptied ring gives nothing");
+}
+
+Trace fixed_trace()
+{
+	SimConfig config;
+	config.initialize();
+	config.seed = CHECK_SEED;
+	config.customers = CHECK_CUSTOMERS;
+	config.cache = false;			//Leaves no data file in CACHE_DIR under the working directory
+	config.generatorThreads = 1;
+
+	Trace trace;
+	Trace sorted;
+	replication_trace(config, 0, false, trace);
+	return arrival_order(trace, sorted);		//The engines take customers in arrival order, which simulateA and simulateB sort them into
+}
+
+bool same_stats(const Stats& a, const Stats& b)
+{
+	double x[STATS_FIELDS];
+	double y[STATS_FIELDS];
+	stats_fields(a, x);
+	stats_fields(b, y);
+	for (int f = 1; f < STATS_FIELDS; f++)
+		if (x[f] != y[f])
+			return false;
+
+	return true;
+}
+
+void check_fixed_dispatch()
+{
+	Trace trace = fixed_trace();
+
+	for (int withTimeouts = 0; withTimeouts < 2; withTimeouts++)
+	for (int n = 1; n <= MAX_FIXED_TELLERS; n++)
+	{
+		//Every run draws patience from a stream of its own, started at the same place
+		RandomStream patience[4];
+		Timeouts timeouts[4];
+		for (int k = 0; k < 4; k++)
+		{
+			patience[k] = RandomStream(CHECK_SEED, STREAM_PATIENCE);
+			timeouts[k].initialize();
+			timeouts[k].patience = 300;
+			timeouts[k].breakAfter = 40;
+			timeouts[k].breakLength = 25;
+			timeouts[k].rng = &patience[k];
+		}
+		string with = (withTimeouts == 1) ? " with patience and breaks" : "";
+
+		Stats fixed;
+		Stats generic;
+		fixed.initialize();			//The engines leave the fields of the other mode alone, as the callers have zeroed them
+		generic.initialize();
+		simulateA(n, trace, &fixed, NULL, (withTimeouts == 1) ? &timeouts[0] : NULL);
+		TellerArray tellers(n);
+		ArrayQueue bankLine(trace.size());
+		engineA(tellers, bankLine, trace, &generic, NULL, (withTimeouts == 1) ? &timeouts[1] : NULL, (const Classes*) NULL);
+		check(same_stats(fixed, generic), "simulateA with FixedTellers<" + to_string(n) + "> gives the Stats of TellerArray" + with);
+
+		RandomStream fixedRouting(CHECK_SEED, STREAM_ROUTING);
+		RandomStream genericRouting(CHECK_SEED, STREAM_ROUTING);
+		Router fixedRouter(ROUTE_SHORTEST, n, 2, &fixedRouting);
+		Router genericRouter(ROUTE_SHORTEST, n, 2, &genericRouting);
+		simulateB(n, trace, &fixed, &fixedRouter, NULL, (withTimeouts == 1) ? &timeouts[2] : NULL);
+
+		TellerArray lineTellers(n);
+		LineLengths lengths(n);
+		vector<ArrayQueue*> bankLines;
+		for (int i = 0; i < n; i++)
+			bankLines.push_back(new ArrayQueue(trace.size()));
+		engineB(lineTellers, lengths, bankLines.data(), trace, &generic, genericRouter, NULL, (withTimeouts == 1) ? &timeouts[3] : NULL, (const Classes*) NULL);
+		for (int i = 0; i < n; i++)
+			delete bankLines[i];
+		check(same_stats(fixed, generic), "simulateB with FixedTellers<" + to_string(n) + "> and FixedLineLengths gives the Stats of TellerArray and LineLengths" + with);
+	}
+}
+
+void check_shortest_line()
+{
+	for (int trial = 0; trial < 2000; trial++)
+	{
+		//Sizes on either side of the 8 and 16 lane vectors, and few distinct lengths so the minimum is often tied
+		int n = 1 + rand() % 70;
+		int most = 1 + rand() % 4;
+		LineLengths lengths(n);
+		FixedLineLengths<MAX_FIXED_TELLERS> fixed;
+		for (int i = 0; i < n; i++)
+		{
+			int length = rand() % (most + 1);
+			for (int k = 0; k < length; k++)
+			{
+				lengths.increment(i);
+				if (n == MAX_FIXED_TELLERS)
+					fixed.increment(i);
+			}
+		}
+
+		//A run of increments and decrements, checking after each
+		for (int step = 0; step < 20; step++)
+		{
+			int expected = 0;
+			for (int i = 1; i < n; i++)
+				if (lengths.get(i) < lengths.get(expected))
+					expected = i;
+
+			if (check(lengths.shortest() == expected, "LineLengths::shortest of " + to_string(n) + " lines picks line " + to_string(expected)) == false)
+				break;
+			if (n == MAX_FIXED_TELLERS)
+				check(fixed.shortest() == expected, "FixedLineLengths::shortest picks line " + to_string(expected));
+
+			int i = rand() % n;
+			if (lengths.get(i) > 0 && rand() % 2 == 0)
+			{
+				lengths.decrement(i);
+				if (n == MAX_FIXED_TELLERS)
+					fixed.decrement(i);
+			}
+			else
+			{
+				lengths.increment(i);
+				if (n == MAX_FIXED_TELLERS)
+					fixed.increment(i);
+			}
+		}
+	}
+}
+
+void check_routing()
+{
+	//Round robin goes through the lines in turn whatever their lengths
+	LineLengths lengths(5);
+	lengths.increment(0);
+	lengths.increment(0);
+	lengths.increment(3);
+	Router roundRobin(ROUTE_ROUND_ROBIN, 5, 1, NULL);
+	bool cyclic = true;
+	for (int k = 0; k < 12; k++)
+		cyclic = cyclic && roundRobin.choose(lengths) == k % 5;
+	check(cyclic, "Round robin routing joins lines in turn");
+
+	//Join idle hands out the idle lines in order, skips ones that filled up since they were listed, then routes at random
+	RandomStream idleStream(CHECK_SEED, STREAM_ROUTING);
+	Router joinIdle(ROUTE_JOIN_IDLE, 5, 1, &idleStream);
+	check(joinIdle.choose(lengths) == 1, "Join idle routing skips a listed line that is no longer idle");
+	check(joinIdle.choose(lengths) == 2, "Join idle routing joins the next idle line");
+	check(joinIdle.choose(lengths) == 4, "Join idle routing joins the last idle line");
+	int line = joinIdle.choose(lengths);
+	check(line >= 0 && line < 5, "Join idle routing joins a random line when none is idle");
+	joinIdle.lineIdle(3);
+	lengths.decrement(3);
+	check(joinIdle.choose(lengths) == 3, "Join idle routing joins a line listed again when its teller went idle");
+
+	//Power of d joins the shortest of the lines it draws, keeping the first drawn on ties
+	for (int d = 1; d <= 4; d++)
+	{
+		LineLengths random(9);
+		for (int i = 0; i < 9; i++)
+			for (int k = rand() % 3; k > 0; k--)
+				random.increment(i);
+
+		RandomStream stream(CHECK_SEED, STREAM_ROUTING);
+		RandomStream replay(CHECK_SEED, STREAM_ROUTING);
+		Router power(ROUTE_POWER_OF_D, 9, d, &stream);
+		bool same = true;
+		for (int k = 0; k < 200; k++)
+		{
+			int expected = replay.below(9);
+			for (int c = 1; c < d; c++)
+			{
+				int i = replay.below(9);
+				if (random.get(i) < random.get(expected))
+					expected = i;
+			}
+			same = same && power.choose(random) == expected;
+		}
+		check(same, "Power of " + to_string(d) + " routing joins the shortest line drawn");
+		check(power.cost() == d, "Power of " + to_string(d) + " routing inspects " + to_string(d) + " lines per arrival");
+	}
+
+	//Each routing mode through the fixed line lengths gives the Stats of the generic engine, and with a single line those of simulateA
+	Trace trace = fixed_trace();
+	const int routings[4] = {ROUTE_SHORTEST, ROUTE_POWER_OF_D, ROUTE_JOIN_IDLE, ROUTE_ROUND_ROBIN};
+	const int sizes[4] = {1, 3, 16, 32};
+	for (int r = 0; r < 4; r++)
+	for (int s = 0; s < 4; s++)
+	{
+		int n = sizes[s];
+		Stats fixed;
+		Stats generic;
+		fixed.initialize();
+		generic.initialize();
+
+		RandomStream fixedRouting(CHECK_SEED, STREAM_ROUTING);
+		RandomStream genericRouting(CHECK_SEED, STREAM_ROUTING);
+		Router fixedRouter(routings[r], n, 2, &fixedRouting);
+		Router genericRouter(routings[r], n, 2, &genericRouting);
+		simulateB(n, trace, &fixed, &fixedRouter);
+
+		TellerArray tellers(n);
+		LineLengths generalLengths(n);
+		vector<ArrayQueue*> bankLines;
+		for (int i = 0; i < n; i++)
+			bankLines.push_back(new ArrayQueue(trace.size()));
+		engineB(tellers, generalLengths, bankLines.data(), trace, &generic, genericRouter, NULL, (const Timeouts*) NULL, (const Classes*) NULL);
+		for (int i = 0; i < n; i++)
+			delete bankLines[i];
+		check(same_stats(fixed, generic), "simulateB with routing " + to_string(routings[r]) + " on " + to_string(n) + " lines gives the Stats of the generic engine");
+
+		if (n == 1)
+		{
+			Stats single;
+			single.initialize();
+			simulateA(1, trace, &single);
+			check(fixed.avg_wait == single.avg_wait && fixed.max_wait == single.max_wait && fixed.p95_wait == single.p95_wait &&
+				fixed.process_time == single.process_time, "simulateB with routing " + to_string(routings[r]) + " on 1 line waits as simulateA on 1 teller");
+		}
+	}
+}
+
+void check_stopping_rule()
+{
+	//The average wait is steady, the idle time and max wait swing by a factor of 10 and nobody reneges
+	ReplicationStats stats;
+	for (int k = 0; k < 10; k++)
+	{
+		double values[STATS_FIELDS] = {0};
+		values[STATS_CPU_TIME] = 1 + k % 2 * 10;
+		values[STATS_AVG_WAIT] = 100 + 0.01 * (k % 3);
+		values[STATS_MAX_WAIT] = 500 + 5000 * (k % 2);
+		values[STATS_IDLE_TIME] = 10 + 100 * (k % 2);
+		stats.push(values);
+	}
+
+	const int idle = 1 << STATS_IDLE_TIME;
+	const int reneged = 1 << STATS_RENEGED;
+	check(stats.precise(0.01, 0.95, 1 << STATS_AVG_WAIT), "The stopping rule stops on a steady average wait");
+	check(stats.precise(0.01, 0.95, (1 << STATS_AVG_WAIT) | reneged), "The stopping rule skips a field whose mean is 0");
+	check(stats.precise(0.01, 0.95, (1 << STATS_AVG_WAIT) | STATS_EXTREMES), "The stopping rule never gates on CPU time, max wait or max length");
+	check(stats.precise(0.01, 0.95, (1 << STATS_AVG_WAIT) | idle) == false, "The stopping rule waits on a noisy field that was asked for");
+
+	ReplicationStats noisy;
+	for (int k = 0; k < 10; k++)
+	{
+		double values[STATS_FIELDS] = {0};
+		values[STATS_AVG_WAIT] = 100 + 50 * (k % 2);
+		noisy.push(values);
+	}
+	check(noisy.precise(0.01, 0.95, 1 << STATS_AVG_WAIT) == false, "The stopping rule waits on a noisy average wait");
+}
+
+void check_long_run_snapshot()
+{
+	double rate = (double) MAX_ARRIVALS / 100001;		//As long_run
+	const long long limit = 20000;
+
+	for (int single = 0; single < 2; single++)
+	{
+		SimConfig config;
+		config.initialize();
+		config.seed = CHECK_SEED;
+		config.n = 56;				//Just over the offered load of about 50.5 tellers, so lines form
+		config.singleLine = (single == 1);
+		config.routing = ROUTE_POWER_OF_D;
+		config.choices = 2;
+		string mode = config.singleLine ? "simulateA" : "simulateB";
+
+		//Branching keeps the precision check and snapshots out of the way, so both runs serve all limit customers
+		LongRunState whole;
+		LongRunState paused;
+		LongRunState resumed;
+		whole.initialize();
+		paused.initialize();
+		resumed.initialize();
+		allocate_long_run(whole, config, rate, limit);
+		allocate_long_run(paused, config, rate, limit);
+		for (LongRunState* state : {&whole, &paused})
+		{
+			Arrival* temp = next_arrival(state->time, rate, state->arrivals, state->service, state->pool);
+			state->eventQueue.enqueue(temp, temp->getArrivalTime());
+			state->generated = 1;
+			state->branching = true;
+		}
+
+		check(stream_events(whole), "A long run of " + mode + " stays stable");
+		paused.until = (SimTime) (limit / rate / 2);
+		stream_events(paused);
+		check(paused.waits.count() > 0 && paused.waits.count() < limit, "A long run of " + mode + " pauses partway");
+
+		char fileName[] = "/tmp/simchecksXXXXXX";
+		int fd = mkstemp(fileName);
+		if (check(fd >= 0, "Making a snapshot file") == true)
+		{
+			close(fd);
+			check(save_long_run(paused, fileName), "Saving a long run of " + mode);
+			if (check(load_long_run(resumed, fileName), "Loading a long run of " + mode))
+			{
+				check(resumed.waits.count() == paused.waits.count() && resumed.generated == paused.generated && resumed.time == paused.time,
+					"A long run of " + mode + " loads where it was saved");
+				resumed.branching = true;
+				stream_events(resumed);
+				check(resumed.waits.count() == whole.waits.count() && resumed.waits.count() == limit && resumed.waits.mean() == whole.waits.mean() &&
+					resumed.generated == whole.generated && resumed.time == whole.time, "A long run of " + mode + " saved halfway ends as if left alone");
+			}
+			remove(fileName);
+		}
+
+		free_long_run(whole);
+		free_long_run(paused);
+		free_long_run(resumed);
+	}
+}
+
+void reference_waits(const Trace& trace, int n, bool roundRobin, Stats& reference)
+{
+	vector<SimTime> free(n, 0);			//Time each teller is next free
+	unsigned long long cumulative = 0;
+	SimTime longest = 0;
+	SimTime end = 0;
+	WaitHistogram waits;
+	for (int k = 0; k < trace.size(); k++)
+	{
+		int teller = roundRobin ? k % n : min_element(free.begin(), free.end()) - free.begin();
+		SimTime start = max(trace.arrivalTimes[k], free[teller]);
+		SimTime wait = start - trace.arrivalTimes[k];
+		free[teller] = start + trace.transactionLengths[k];
+
+		cumulative += wait;
+		longest = max(longest, wait);
+		end = max(end, free[teller]);
+		waits.add(wait);
+	}
+
+	reference.initialize();
+	reference.process_time = end;
+	reference.avg_wait = (double) cumulative / max(trace.size(), 1);
+	reference.max_wait = longest;
+	reference.p95_wait = waits.quantile(0.95);
+}
+
+void check_batched_events()
+{
+	Trace trace = fixed_trace();
+	const int sizes[6] = {1, 2, 3, 5, 8, 40};		//40 runs on TellerArray rather than a FixedDispatch instantiation
+	for (int s = 0; s < 6; s++)
+	{
+		int n = sizes[s];
+		for (int roundRobin = 0; roundRobin < 2; roundRobin++)
+		{
+			Stats simData;
+			Stats reference;
+			simData.initialize();
+			Router router(ROUTE_ROUND_ROBIN, n, 1, NULL);
+			if (roundRobin == 1)
+				simulateB(n, trace, &simData, &router);
+			else
+				simulateA(n, trace, &simData);
+			reference_waits(trace, n, roundRobin == 1, reference);
+
+			string mode = (roundRobin == 1) ? "simulateB with round robin routing" : "simulateA";
+			check(simData.avg_wait == reference.avg_wait && simData.max_wait == reference.max_wait && simData.p95_wait == reference.p95_wait,
+				mode + " on " + to_string(n) + " tellers waits as FIFO tellers do");
+			check(simData.process_time == reference.process_time, mode + " on " + to_string(n) + " tellers ends when the last customer leaves");
+		}
+	}
+}
+
+void check_customer_pool()
+{
+	CustomerPool pool;
+	Arrival* first = pool.acquire(5, 9);
+	first->setQueueIndex(3);
+	first->setClass(2);
+	first->setSlot(17);
+	Departure* gone = first->depart(30);
+	pool.release(gone);
+
+	Arrival* again = pool.acquire(40, 7);
+	Arrival fresh(40, 7);
+	check(again == first, "CustomerPool hands out the customer released last");
+	check(again->getType() == fresh.getType() && again->getArrivalTime() == fresh.getArrivalTime() && again->getTransactionLength() == fresh.getTransactionLength() &&
+		again->getDepartureTime() == fresh.getDepartureTime() && again->getQueueIndex() == fresh.getQueueIndex() && again->getClass() == fresh.getClass() &&
+		again->getSlot() == fresh.getSlot(), "A recycled customer is reset to a fresh arrival");
+	check(pool.allocations() == 1, "CustomerPool allocates nothing to recycle a customer");
+	pool.release(again);
+
+	//Allocations stop at the most customers in the bank at once, a few hundred at most at this load, however many arrive
+	SimConfig config;
+	config.initialize();
+	config.seed = CHECK_SEED;
+	config.n = 56;
+	config.singleLine = true;
+	const long long limit = 50000;
+	LongRunState state;
+	state.initialize();
+	allocate_long_run(state, config, (double) MAX_ARRIVALS / 100001, limit);
+	Arrival* temp = next_arrival(state.time, state.rate, state.arrivals, state.service, state.pool);
+	state.eventQueue.enqueue(temp, temp->getArrivalTime());
+	state.generated = 1;
+	state.branching = true;
+	stream_events(state);
+	long long allocations = state.pool.allocations() + state.eventQueue.allocations();
+	check(state.waits.count() == limit && allocations < 1000, "A long run of " + to_string(limit) + " customers allocates " + to_string(allocations) + " times");
+	free_long_run(state);
+}
+
+void check_server_answers()
+{
+	int fds[2];
+	if (check(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0, "Making a socket pair") == false)
+		return;
+
+	const int requests = 20;
+	const int replications = 60;
+	shared_ptr<ServerConnection> connection = make_shared<ServerConnection>(fds[0]);
+	deque<pair<shared_ptr<ServerRequest>, int> > jobs;
+	for (int r = 0; r < requests; r++)
+	{
+		shared_ptr<ServerRequest> request = open_request("mode=b n=4 cache=0 metrics=avg_wait replications=" + to_string(replications) + " seed=" +
+			to_string(r), connection);
+		request->config.customers = 300;		//Short replications, so they finish close together
+		for (int run = 0; run < replications; run++)
+			jobs.push_back(make_pair(request, run));
+	}
+
+	//The client reads while the workers answer, so a full socket buffer never holds them up
+	vector<string> answers;
+	LineSocket client(fds[1]);
+	thread reader([&]()
+	{
+		string line;
+		while (client.readLine(line))
+			answers.push_back(line);
+	});
+
+	TraceStore traces;
+	mutex guard;
+	vector<thread> workers;
+	for (int i = 0; i < 8; i++)
+	{
+		workers.push_back(thread([&]()
+		{
+			while (true)
+			{
+				pair<shared_ptr<ServerRequest>, int> job;
+				{
+					lock_guard<mutex> lock(guard);
+					if (jobs.empty())
+						return;
+					job = jobs.front();
+					jobs.pop_front();
+				}
+				serve_replication(*job.first, job.second, traces);
+			}
+		}));
+	}
+	for (int i = 0; i < (int) workers.size(); i++)
+		workers[i].join();
+
+	shutdown(fds[0], SHUT_WR);		//The client sees the end of the answers, even if a request was never completed
+	reader.join();
+
+	size_t at = 0;
+	for (int r = 0; r < requests; r++)
+	{
+		int runs = 0;
+		while (at < answers.size() && answers[at].compare(0, 4, "run=") == 0)
+		{
+			runs++;
+			at++;
+		}
+
+		bool answered = runs == replications && at + 2 < answers.size() && answers[at].compare(0, 5, "mean ") == 0 &&
+			answers[at + 1].compare(0, 10, "halfwidth ") == 0 && answers[at + 2].compare(0, 5, "done ") == 0;
+		if (check(answered, "Request " + to_string(r + 1) + " of " + to_string(requests) + " is answered with its runs, then \"done\" last") == false)
+			return;
+		at += 3;
+	}
+	check(at == answers.size(), "Nothing is answered after the last request's \"done\"");
+}
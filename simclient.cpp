@@ -0,0 +1,79 @@
+/**@file simclient.cpp
+ *@brief Sends simulation requests to a simulate3 server (option j) over its Unix domain socket and prints the answers
+ *
+ *Usage: simclient [-s socket] [key=value ...]
+ *With options, they are sent as 1 request. Without, every line of standard input is sent as a request in turn. The protocol is described in SimServer.h,
+ *eg simclient mode=b n=40 routing=d choices=2 seed=7 replications=10 metrics=avg_wait,p95_wait
+ *Exits with 1 if the server could not be reached or refused a request
+ */
+
+#include <iostream>
+#include <string>
+#include "SimServer.h"
+
+using namespace std;
+
+/**@brief Sends 1 request and prints every line of the answer, up to and including its "done" or "error" line
+ *@param server Reference to the connection to the server
+ *@param request The request line
+ *@return bool Returns false if the server refused the request or hung up
+ */
+bool send_request(LineSocket& server, string request);
+
+
+int main(int argc, char* argv[])
+{
+	string path = SERVER_SOCKET;
+	string request;
+	for (int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+		if (arg == "-s" && i + 1 < argc)
+			path = argv[++i];
+		else
+			request += (request.empty() ? "" : " ") + arg;
+	}
+
+	int fd = connect_server(path);
+	if (fd < 0)
+	{
+		cerr << "Could not connect to " << path << endl;
+		return 1;
+	}
+
+	LineSocket server(fd);
+	bool ok = true;
+	if (request.empty() == false)
+	{
+		ok = send_request(server, request);
+	}
+	else
+	{
+		while (getline(cin, request))
+		{
+			if (request.empty() == false)
+				ok = send_request(server, request) && ok;
+		}
+	}
+
+	return ok ? 0 : 1;
+}
+
+bool send_request(LineSocket& server, string request)
+{
+	if (server.writeLine(request) == false)
+		return false;
+
+	string line;
+	while (server.readLine(line))
+	{
+		cout << line << endl;
+		if (line.compare(0, 5, "done ") == 0)
+			return true;
+		if (line.compare(0, 6, "error ") == 0)
+			return false;
+	}
+
+	cerr << "The server hung up" << endl;
+	return false;
+}
@@ -0,0 +1,119 @@
+/**@file simmonitor.cpp
+ *@brief Shows the progress of a running simulate3 from the telemetry page it publishes in shared memory, without stopping or slowing it down
+ *
+ *Usage: simmonitor [-n name] [-i milliseconds] [-1]
+ *Prints 1 line every interval (default 1000 ms) until the simulation exits, or just 1 line with -1. The page is described in Telemetry.h
+ *Exits with 1 if no simulation has published a page
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <cstdlib>
+#include <cerrno>
+#include <thread>
+#include <signal.h>
+#include "Telemetry.h"
+
+using namespace std;
+
+#define MONITOR_INTERVAL_MS 1000		//Default time between lines
+
+/**@brief Maps a telemetry page read only
+ *@param name Name of the shared memory object
+ *@return const TelemetryPage* The page, or NULL if there is none or it is not set up yet
+ */
+const TelemetryPage* map_page(string name);
+
+/**@brief Prints 1 line of the counters on a page
+ *@param page Reference to the page
+ *@return void
+ */
+void write_page(const TelemetryPage& page);
+
+
+int main(int argc, char* argv[])
+{
+	string name = TELEMETRY_NAME;
+	int interval = MONITOR_INTERVAL_MS;
+	bool once = false;
+	for (int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+		if (arg == "-n" && i + 1 < argc)
+			name = argv[++i];
+		else if (arg == "-i" && i + 1 < argc)
+			interval = max(10, atoi(argv[++i]));
+		else if (arg == "-1")
+			once = true;
+		else
+		{
+			cerr << "Usage: simmonitor [-n name] [-i milliseconds] [-1]" << endl;
+			return 1;
+		}
+	}
+
+	const TelemetryPage* page = map_page(name);
+	if (page == NULL)
+	{
+		cerr << "No simulation is publishing " << name << endl;
+		return 1;
+	}
+
+	cout << setw(8) << "pid" << setw(10) << "state" << setw(6) << "run" << setw(14) << "sim time" << setw(16) << "events" << setw(14) << "events/s"
+	     << setw(12) << "event set" << setw(10) << "max line" << setw(10) << "allocs" << setw(10) << "RSS MB" << endl;
+	while (true)
+	{
+		write_page(*page);
+
+		//A page whose simulation was killed before it could close it is never updated again
+		int state = page->state.load(memory_order_relaxed);
+		bool gone = kill(page->pid.load(memory_order_relaxed), 0) != 0 && errno == ESRCH;
+		if (once == true || state == TELEMETRY_CLOSED || gone == true)
+			break;
+
+		this_thread::sleep_for(chrono::milliseconds(interval));
+	}
+
+	return 0;
+}
+
+const TelemetryPage* map_page(string name)
+{
+	int fd = shm_open(name.c_str(), O_RDONLY, 0);
+	if (fd < 0)
+		return NULL;
+
+	//Between simulate3's shm_open and ftruncate the object is empty, and touching a mapping past its end raises SIGBUS
+	struct stat info;
+	void* mapped = MAP_FAILED;
+	if (fstat(fd, &info) == 0 && info.st_size >= (off_t) sizeof(TelemetryPage))
+		mapped = mmap(NULL, sizeof(TelemetryPage), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (mapped == MAP_FAILED)
+		return NULL;
+
+	const TelemetryPage* page = static_cast<const TelemetryPage*> (mapped);
+	if (page->magic != TELEMETRY_MAGIC)
+		return NULL;
+	atomic_thread_fence(memory_order_acquire);
+
+	return page;
+}
+
+void write_page(const TelemetryPage& page)
+{
+	const char* states[] = {"idle", "running", "done", "exited"};
+	int state = page.state.load(memory_order_relaxed);
+
+	cout << setw(8) << page.pid.load(memory_order_relaxed)
+	     << setw(10) << ((state >= TELEMETRY_IDLE && state <= TELEMETRY_CLOSED) ? states[state] : "?")
+	     << setw(6) << page.run.load(memory_order_relaxed)
+	     << setw(14) << page.simTime.load(memory_order_relaxed)
+	     << setw(16) << page.events.load(memory_order_relaxed)
+	     << setw(14) << page.eventsPerSecond.load(memory_order_relaxed)
+	     << setw(12) << page.eventSetSize.load(memory_order_relaxed)
+	     << setw(10) << page.maxLine.load(memory_order_relaxed)
+	     << setw(10) << page.allocations.load(memory_order_relaxed)
+	     << setw(10) << fixed << setprecision(1) << page.rssBytes.load(memory_order_relaxed) / 1048576.0 << endl;
+}
@@ -11,599 +11,4391 @@
 #include <ctime>
 #include <cstdlib>
 #include <string>
+#include <limits>
+#include <chrono>
+#include <map>
+#include <sstream>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <cerrno>
+#include <deque>
+#include <set>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <algorithm>
 #include "ArrayQueue.h"
+#include "ClassQueue.h"
 #include "PriorityQueue.h"
+#include "Tellers.h"
+#include "LineLengths.h"
+#include "Random.h"
+#include "Routing.h"
+#include "Stats.h"
+#include "Statistics.h"
+#include "Queueing.h"
+#include "SteadyState.h"
+#include "ResultCache.h"
+#include "Generator.h"
+#include "Trace.h"
+#include "Prefetch.h"
+#include "CustomerLog.h"
+#include "Telemetry.h"
+#include "SimServer.h"
+#include "BranchNetwork.h"
+#include "TimeWarp.h"
+
+#define MAX_ARRIVALS 99999		//Customers in a generated data file, unless SimConfig::customers says otherwise
+#define PROMPT_MAX_COUNT 4096		//Most tellers, lines or branches an interactive prompt accepts
+
+#define SCENARIO_SIMULATE 0			//Backends a scenario can run each configuration with: replications of simulateA or simulateB,
+#define SCENARIO_ANALYTIC 1			//or analytic_estimate on each replication's customers
+#define SCENARIO_OUTPUT "results.csv"		//CSV file run_scenario writes unless told otherwise
+#define SCENARIO_MAX_POINTS 100000		//Most grid points one scenario can expand to
+#define SCENARIO_MAX_CUSTOMERS 10000000	//Most customers per data file a scenario can ask for
+
+/** @struct SimConfig
+ *  @brief This structure holds the options selected for a run of sim()
+ *  @var SimConfig::n
+ *  Member n holds how many tellers (simulateA) or lines (simulateB) to use
+ *  @var SimConfig::singleLine
+ *  Member singleLine is true to run simulateA and false to run simulateB
+ *  @var SimConfig::routing
+ *  Member routing holds which ROUTE_ mode simulateB uses to pick a line for each arrival
+ *  @var SimConfig::choices
+ *  Member choices holds how many lines are sampled per arrival with ROUTE_POWER_OF_D
+ *  @var SimConfig::seed
+ *  Member seed is the base seed; replication i draws from RandomStream(seed, i * STREAMS_PER_REPLICATION + STREAM_...)
+ *  @var SimConfig::precision
+ *  Member precision holds the target confidence interval half-width as a fraction of the mean, eg 0.05 for +-5%
+ *  @var SimConfig::precisionFields
+ *  Member precisionFields holds a bit (1 << i) for each field i, in STATS_FIELDS order, whose interval has to reach precision; the extremes are never checked
+ *  @var SimConfig::confidence
+ *  Member confidence holds the confidence level of the intervals, eg 0.95
+ *  @var SimConfig::minReplications
+ *  Member minReplications holds how many replications always run before precision is checked
+ *  @var SimConfig::maxReplications
+ *  Member maxReplications holds how many replications run at most, whether or not precision was reached
+ *  @var SimConfig::antithetic
+ *  Member antithetic is true to run every replication twice, the second time on the mirror image (1 - U) of its random numbers, and count the pair's average as one replication
+ *  @var SimConfig::cache
+ *  Member cache is true to reuse data files and Stats from the ResultCache in CACHE_DIR, and to add the ones that are not there yet
+ *  @var SimConfig::customers
+ *  Member customers holds how many customers each generated data file has, spread over the same day
+ *  @var SimConfig::records
+ *  Member records is true to write every customer of run i to the customer log customers<i + 1>.bin, next to its data file
+ *  @var SimConfig::patience
+ *  Member patience holds the mean of the exponential time a customer waits in line before giving up, 0 if customers never give up
+ *  @var SimConfig::breakAfter
+ *  Member breakAfter holds how long a teller is idle before going on a break, 0 if tellers never take breaks
+ *  @var SimConfig::breakLength
+ *  Member breakLength holds how long a break lasts
+ *  @var SimConfig::classes
+ *  Member classes holds how many classes of customers there are, 1 for a single FIFO line
+ *  @var SimConfig::discipline
+ *  Member discipline holds which CLASS_ discipline serves the classes
+ *  @var SimConfig::classMix
+ *  Member classMix holds each class's share of the arrivals, highest class first, eg 1 2 7 for 10% VIP, 20% business and 70% retail
+ *  @var SimConfig::classWeights
+ *  Member classWeights holds each class's weight with CLASS_WEIGHTED
+ *  @var SimConfig::profile
+ *  Member profile holds how the arrival rate of a generated day changes, no breakpoints for the flat day of generate_events
+ *  @var SimConfig::service
+ *  Member service holds the distribution generated transaction times are drawn from
+ *  @var SimConfig::generatorThreads
+ *  Member generatorThreads holds how many threads generate_profiled splits a replication's customers across; the customers are the same for any number
+ */
+struct SimConfig {
+	int n;
+	bool singleLine;
+	int routing;
+	int choices;
+	unsigned long long seed;
+	double precision;
+	int precisionFields;
+	double confidence;
+	int minReplications;
+	int maxReplications;
+	bool antithetic;
+	bool cache;
+	int customers;
+	bool records;
+	double patience;
+	SimTime breakAfter;
+	SimTime breakLength;
+	int classes;
+	int discipline;
+	int classMix[MAX_CLASSES];
+	int classWeights[MAX_CLASSES];
+	ArrivalProfile profile;
+	ServiceModel service;
+	int generatorThreads;
 
-/** @struct Stats
- *  @brief This structure holds all of the data to be collected from the simulation to allow for easy passing between functions
- *  @var Stats::CPU_time
- *  Member CPU_time holds the amount of processor time it takes to run 1 simulation
- *  @var Stats::process_time 
- *  Member process_time holds the amount of virtual time processed in the simulation
- *  @var Stats::avg_wait
- *  Member avg_wait holds the average wait time for 1 simulation
- *  @var Stats::avg_line 
- *  Member avg_line holds the average length of the line during the simulation
- *  @var Stats::max_wait
- *  Member max_wait keeps track of the longest time any 1 customer had to wait during simulation
- *  @var Stats::max_length
- *  Member max_length keeps track of the longest the line becomes at any point during the simulation
- *  @var Stats::idle_time
- *  Member idle_time keeps track of the total idle time spent by tellers
- *  
- */
-struct Stats {
-	double CPU_time;
-	int process_time;
+	void initialize()
+	{
+		n = 1;
+		singleLine = true;
+		routing = ROUTE_SHORTEST;
+		choices = 2;
+		seed = 0;
+		precision = 0.05;
+		precisionFields = 1 << STATS_AVG_WAIT;
+		confidence = 0.95;
+		minReplications = 3;
+		maxReplications = 30;
+		antithetic = false;
+		cache = true;
+		customers = MAX_ARRIVALS;
+		records = false;
+		patience = 0;
+		breakAfter = 0;
+		breakLength = 0;
+		classes = 1;
+		discipline = CLASS_STRICT;
+		for (int c = 0; c < MAX_CLASSES; c++)
+		{
+			classMix[c] = (c == 0) ? 1 : 0;
+			classWeights[c] = 1;
+		}
+		profile.initialize();
+		service.initialize();
+		generatorThreads = max((int) thread::hardware_concurrency(), 1);
+	}
+};
+
+#define TIMER_RENEGE 0			//Timers simulateA and simulateB schedule: a waiting customer runs out of patience,
+#define TIMER_BREAK 1			//an idle teller goes on a break,
+#define TIMER_RETURN 2			//or a teller comes back from one
+
+/** @struct Timeouts
+ *  @brief This structure holds what makes customers give up and tellers take breaks in a run of simulateA or simulateB
+ *
+ *  Every customer who has to wait draws a patience and leaves the line if no teller has taken them by then. A teller who has been idle for breakAfter goes on a
+ *  break for breakLength; customers can still join their line (simulateB), since routing only sees line lengths. Both are timers on a TimingWheel, and
+ *  nearly all patience timers and many break timers are cancelled
+ *  @var Timeouts::patience
+ *  Member patience holds the mean patience, 0 if customers never give up
+ *  @var Timeouts::breakAfter
+ *  Member breakAfter holds the idle time before a break, 0 if tellers never take breaks
+ *  @var Timeouts::breakLength
+ *  Member breakLength holds how long a break lasts
+ *  @var Timeouts::rng
+ *  Member rng is the stream patience is drawn from
+ */
+struct Timeouts {
+	double patience;
+	SimTime breakAfter;
+	SimTime breakLength;
+	RandomStream* rng;
+
+	void initialize()
+	{
+		patience = 0;
+		breakAfter = 0;
+		breakLength = 0;
+		rng = NULL;
+	}
+};
+
+/** @struct Classes
+ *  @brief This structure holds the customer classes of a run of simulateA or simulateB
+ *
+ *  Each arrival draws its class from rng and waits in a ClassQueue, which serves the classes by discipline. Runs without classes pass no Classes
+ *  at all, so their lines stay plain ArrayQueues
+ *  @var Classes::count
+ *  Member count holds how many classes there are, at most MAX_CLASSES
+ *  @var Classes::discipline
+ *  Member discipline holds which CLASS_ discipline the lines use
+ *  @var Classes::weights
+ *  Member weights holds each class's weight with CLASS_WEIGHTED
+ *  @var Classes::cumulative
+ *  Member cumulative holds the share of arrivals in each class and the classes above it
+ *  @var Classes::rng
+ *  Member rng is the stream classes are drawn from
+ */
+struct Classes {
+	int count;
+	int discipline;
+	int weights[MAX_CLASSES];
+	double cumulative[MAX_CLASSES];
+	RandomStream* rng;
+
+	void initialize()
+	{
+		count = 1;
+		discipline = CLASS_STRICT;
+		for (int c = 0; c < MAX_CLASSES; c++)
+		{
+			weights[c] = 1;
+			cumulative[c] = 1;
+		}
+		rng = NULL;
+	}
+
+	//Class of the next arrival
+	int draw() const
+	{
+		double u = rng->uniform();
+		int c = 0;
+		while (c < count - 1 && u >= cumulative[c])
+			c++;
+		return c;
+	}
+};
+
+/** @struct LongRunState
+ *  @brief This structure holds everything a long run needs to carry on from where it is, so it can be written to a snapshot and restored
+ *  @var LongRunState::config
+ *  Member config holds the options the run was started with
+ *  @var LongRunState::rate
+ *  Member rate holds the arrivals per unit of time
+ *  @var LongRunState::limit
+ *  Member limit holds the most customers to generate
+ *  @var LongRunState::time
+ *  Member time holds the (fractional) time of the last arrival generated
+ *  @var LongRunState::generated
+ *  Member generated holds how many arrivals have been generated
+ *  @var LongRunState::cpuTime
+ *  Member cpuTime holds the CPU seconds spent before this process took the run over, 0 unless it was restored from a snapshot
+ *  @var LongRunState::started
+ *  Member started holds clock() when this process started simulating; it is not saved
+ *  @var LongRunState::eventQueue
+ *  Member eventQueue holds the scheduled arrival and departures
+ *  @var LongRunState::pool
+ *  Member pool holds the customers that have departed, for next_arrival to reuse; it is not saved
+ *  @var LongRunState::bankLines
+ *  Member bankLines holds the lines, 1 for simulateA and n for simulateB
+ *  @var LongRunState::lineCount
+ *  Member lineCount holds how many lines there are
+ *  @var LongRunState::tellers
+ *  Member tellers holds the availability of the n tellers
+ *  @var LongRunState::lengths
+ *  Member lengths holds the line lengths routing looks at, NULL for simulateA
+ *  @var LongRunState::arrivals
+ *  Member arrivals is the stream the gaps between arrivals are drawn from
+ *  @var LongRunState::service
+ *  Member service is the stream the transaction times are drawn from
+ *  @var LongRunState::routing
+ *  Member routing is the stream the Router draws from
+ *  @var LongRunState::router
+ *  Member router picks each arrival's line, NULL for simulateA
+ *  @var LongRunState::waits
+ *  Member waits holds the batch means of every wait so far
+ *  @var LongRunState::until
+ *  Member until holds the time the run pauses at: events at or after it are left in eventQueue. SIMTIME_MAX unless what_if is branching the run
+ *  @var LongRunState::branching
+ *  Member branching is true while what_if runs the state, which turns off the precision check, snapshots, and records every wait in branchWaits
+ *  @var LongRunState::branchWaits
+ *  Member branchWaits holds the mean and max of the waits recorded while branching
+ *  @var LongRunState::branchHistogram
+ *  Member branchHistogram holds the waits recorded while branching, for their 95th percentile
+ */
+struct LongRunState {
+	SimConfig config;
+	double rate;
+	long long limit;
+	double time;
+	long long generated;
+	double cpuTime;
+	clock_t started;
+	PriorityQueue eventQueue;
+	CustomerPool pool;
+	ArrayQueue** bankLines;
+	int lineCount;
+	TellerArray* tellers;
+	LineLengths* lengths;
+	RandomStream arrivals;
+	RandomStream service;
+	RandomStream routing;
+	Router* router;
+	BatchMeans waits;
+	SimTime until;
+	bool branching;
+	RunningStat branchWaits;
+	WaitHistogram branchHistogram;
+
+	void initialize()
+	{
+		config.initialize();
+		rate = 0;
+		limit = 0;
+		time = 0;
+		generated = 0;
+		cpuTime = 0;
+		started = 0;
+		bankLines = NULL;
+		lineCount = 0;
+		tellers = NULL;
+		lengths = NULL;
+		router = NULL;
+		waits = BatchMeans();
+		until = SIMTIME_MAX;
+		branching = false;
+		branchWaits = RunningStat();
+		branchHistogram = WaitHistogram();
+	}
+};
+
+/** @struct WhatIf
+ *  @brief This structure holds one variant of a what_if comparison: the changes made to the bank at the branch time
+ *  @var WhatIf::extra
+ *  Member extra holds how many tellers (simulateA) or lines with 1 teller each (simulateB) open at the branch time
+ *  @var WhatIf::closed
+ *  Member closed holds how many lines (simulateB only) stop taking customers at the branch time; they close once their customers are served
+ *  @var WhatIf::routing
+ *  Member routing holds the ROUTE_ mode simulateB uses after the branch time
+ *  @var WhatIf::choices
+ *  Member choices holds how many lines are sampled per arrival with ROUTE_POWER_OF_D after the branch time
+ */
+struct WhatIf {
+	int extra;
+	int closed;
+	int routing;
+	int choices;
+
+	void initialize()
+	{
+		extra = 0;
+		closed = 0;
+		routing = ROUTE_SHORTEST;
+		choices = 2;
+	}
+};
+
+/** @struct BranchResult
+ *  @brief This structure holds what one what_if variant measured after the branch time. It is passed back from the variant's process as raw bytes
+ *  @var BranchResult::ok
+ *  Member ok is false if the variant's process could not be started or did not report back
+ *  @var BranchResult::stable
+ *  Member stable is false if a line filled up
+ *  @var BranchResult::served
+ *  Member served holds how many customers left between the branch time and the end of the comparison
+ *  @var BranchResult::avg_wait
+ *  Member avg_wait holds the average wait of the customers who left
+ *  @var BranchResult::p95_wait
+ *  Member p95_wait holds the 95th percentile wait of the customers who left
+ *  @var BranchResult::max_wait
+ *  Member max_wait holds the longest wait of the customers who left
+ *  @var BranchResult::in_bank
+ *  Member in_bank holds how many customers were still in the bank at the end of the comparison
+ *  @var BranchResult::CPU_time
+ *  Member CPU_time holds the CPU seconds the variant took after the branch
+ */
+struct BranchResult {
+	bool ok;
+	bool stable;
+	long long served;
 	double avg_wait;
-	int avg_length;
-	int max_wait;
-	int max_length;
-	int idle_time;	
+	SimTime p95_wait;
+	SimTime max_wait;
+	long long in_bank;
+	double CPU_time;
 
 	void initialize()
 	{
-		CPU_time = 0;
-		process_time = 0;
+		ok = false;
+		stable = true;
+		served = 0;
 		avg_wait = 0;
-		avg_length = 0;
+		p95_wait = 0;
 		max_wait = 0;
-		max_length = 0;
-		idle_time = 0;	
+		in_bank = 0;
+		CPU_time = 0;
+	}
+};
+
+/** @struct Scenario
+ *  @brief This structure holds a grid of configurations for run_scenario. Every combination of its lists is one grid point
+ *  @var Scenario::modes
+ *  Member modes holds 'a' for simulateA and 'b' for simulateB
+ *  @var Scenario::ns
+ *  Member ns holds the numbers of tellers (simulateA) or lines (simulateB)
+ *  @var Scenario::routings
+ *  Member routings holds the ROUTE_ modes simulateB points are run with; simulateA points ignore it
+ *  @var Scenario::choices
+ *  Member choices holds the numbers of lines sampled per arrival by ROUTE_POWER_OF_D points; other points ignore it
+ *  @var Scenario::seeds
+ *  Member seeds holds the base seeds
+ *  @var Scenario::customers
+ *  Member customers holds the numbers of customers per data file
+ *  @var Scenario::backends
+ *  Member backends holds the SCENARIO_ backends every configuration is run with
+ *  @var Scenario::replications
+ *  Member replications holds how many replications each grid point runs, or at most runs with a precision
+ *  @var Scenario::precision
+ *  Member precision holds the target confidence interval half-width as a fraction of the mean, 0 to always run every replication
+ *  @var Scenario::precisionFields
+ *  Member precisionFields holds a bit (1 << i) for each field i, in STATS_FIELDS order, whose interval has to reach precision
+ *  @var Scenario::confidence
+ *  Member confidence holds the confidence level of the intervals
+ *  @var Scenario::threads
+ *  Member threads holds how many threads the grid is run on
+ *  @var Scenario::output
+ *  Member output holds the name of the CSV file written, or "-" for standard output
+ *  @var Scenario::cache
+ *  Member cache is true to use the ResultCache
+ *  @var Scenario::patience
+ *  Member patience holds the mean patience of customers, 0 if they never give up
+ *  @var Scenario::breakAfter
+ *  Member breakAfter holds how long a teller is idle before a break, 0 for no breaks
+ *  @var Scenario::breakLength
+ *  Member breakLength holds how long a break lasts
+ *  @var Scenario::classMix
+ *  Member classMix holds each class's share of the arrivals, highest class first; 1 share for customers who are all alike
+ *  @var Scenario::disciplines
+ *  Member disciplines holds the CLASS_ disciplines points with several classes are run with
+ *  @var Scenario::classWeights
+ *  Member classWeights holds the weight of each class with CLASS_WEIGHTED
+ *  @var Scenario::profiles
+ *  Member profiles holds the arrival profiles customers are generated with
+ *  @var Scenario::profileNames
+ *  Member profileNames holds the file each profile was read from, "flat" for generate_events' day
+ *  @var Scenario::services
+ *  Member services holds the service distributions customers are generated with
+ *  @var Scenario::serviceNames
+ *  Member serviceNames holds each distribution as it was given
+ */
+struct Scenario {
+	vector<char> modes;
+	vector<int> ns;
+	vector<int> routings;
+	vector<int> choices;
+	vector<unsigned long long> seeds;
+	vector<int> customers;
+	vector<int> backends;
+	int replications;
+	double precision;
+	int precisionFields;
+	double confidence;
+	int threads;
+	string output;
+	bool cache;
+	double patience;
+	SimTime breakAfter;
+	SimTime breakLength;
+	vector<int> classMix;
+	vector<int> disciplines;
+	vector<int> classWeights;
+	vector<ArrivalProfile> profiles;
+	vector<string> profileNames;
+	vector<ServiceModel> services;
+	vector<string> serviceNames;
+
+	void initialize()
+	{
+		modes.assign(1, 'a');
+		ns.clear();
+		routings.assign(1, ROUTE_SHORTEST);
+		choices.assign(1, 2);
+		seeds.assign(1, 0);
+		customers.assign(1, MAX_ARRIVALS);
+		backends.assign(1, SCENARIO_SIMULATE);
+		replications = 3;
+		precision = 0;
+		precisionFields = 1 << STATS_AVG_WAIT;
+		confidence = 0.95;
+		threads = max((int) thread::hardware_concurrency(), 1);
+		output = SCENARIO_OUTPUT;
+		cache = true;
+		patience = 0;
+		breakAfter = 0;
+		breakLength = 0;
+		classMix.assign(1, 1);
+		disciplines.assign(1, CLASS_STRICT);
+		classWeights.clear();
+		profiles.assign(1, ArrivalProfile());
+		profiles[0].initialize();
+		profileNames.assign(1, "flat");
+		services.assign(1, ServiceModel());
+		services[0].initialize();
+		serviceNames.assign(1, "uniform");
+	}
+};
+
+struct ServerRequest;
+
+/** @struct ServerConnection
+ *  @brief This structure holds one client connection of serve()
+ *
+ *  Only serve's own thread reads the socket, so a client that sends nothing holds no worker. Workers write the answers, in the order the requests were
+ *  sent: the lines of a request behind one that is still running wait in its lines until every request before it is answered
+ *  @var ServerConnection::socket
+ *  Member socket is the connection
+ *  @var ServerConnection::answering
+ *  Member answering holds the requests not yet fully answered, oldest first
+ *  @var ServerConnection::hungUp
+ *  Member hungUp is true once an answer could not be written; replications of its requests that have not started yet are skipped
+ *  @var ServerConnection::guard
+ *  Member guard locks answering, hungUp and writing to socket
+ */
+struct ServerConnection {
+	LineSocket socket;
+	deque<shared_ptr<ServerRequest> > answering;
+	bool hungUp;
+	mutex guard;
+
+	ServerConnection(int fd) : socket(fd)
+	{
+		hungUp = false;
+	}
+};
+
+/** @struct ServerRequest
+ *  @brief This structure holds one request serve() is answering. Each of its replications is a separate job for the worker threads
+ *  @var ServerRequest::connection
+ *  Member connection holds the connection the request came on
+ *  @var ServerRequest::config
+ *  Member config holds the options of the request
+ *  @var ServerRequest::replications
+ *  Member replications holds how many replications were asked for
+ *  @var ServerRequest::metrics
+ *  Member metrics holds the Stats fields asked for, as STATS_FIELDS indexes
+ *  @var ServerRequest::results
+ *  Member results holds the Stats of each replication, in order of replication
+ *  @var ServerRequest::finished
+ *  Member finished holds how many replications are done
+ *  @var ServerRequest::hot
+ *  Member hot holds how many simulated replications found their customers in memory
+ *  @var ServerRequest::cached
+ *  Member cached holds how many replications were read from the ResultCache
+ *  @var ServerRequest::failed
+ *  Member failed holds why a replication could not be run, empty if every one ran
+ *  @var ServerRequest::start
+ *  Member start holds when the request was read
+ *  @var ServerRequest::lines
+ *  Member lines holds the answer lines not yet written, since a request before it on the connection is still being answered
+ *  @var ServerRequest::complete
+ *  Member complete is true once lines holds the request's last answer line
+ */
+struct ServerRequest {
+	shared_ptr<ServerConnection> connection;
+	SimConfig config;
+	int replications;
+	vector<int> metrics;
+	vector<Stats> results;
+	int finished;
+	int hot;
+	int cached;
+	string failed;
+	chrono::steady_clock::time_point start;
+	vector<string> lines;
+	bool complete;
+};
+
+/** @struct GridPoint
+ *  @brief This structure holds one point of a Scenario's grid
+ *  @var GridPoint::config
+ *  Member config holds the options the point runs with
+ *  @var GridPoint::backend
+ *  Member backend holds the SCENARIO_ backend that runs it
+ *  @var GridPoint::profile
+ *  Member profile holds which of the Scenario's profiles config.profile is
+ *  @var GridPoint::service
+ *  Member service holds which of the Scenario's service distributions config.service is
+ */
+struct GridPoint {
+	SimConfig config;
+	int backend;
+	int profile;
+	int service;
+
+	void initialize()
+	{
+		config.initialize();
+		backend = SCENARIO_SIMULATE;
+		profile = 0;
+		service = 0;
 	}
 };
 
 
 using namespace std;
 
-#define MAX_ARRIVALS 99999
+#define OPT_AVG_WAIT 0			//Targets optimize_staffing can search against
+#define OPT_P95_WAIT 1
+#define OPT_MAX_WAIT 2
+#define OPT_MAX_TELLERS 4096		//Largest n optimize_staffing tries
+
+#define LONG_RUN_LINE 100000		//Capacity of each line in long_run; a full line means the tellers cannot keep up
+#define LONG_RUN_CHECK 65536		//Customers between checks of whether a long run can stop
+#define LONG_RUN_MAX_LAG1 0.2		//Batch means more correlated than this are too short to trust their interval
+#define LONG_RUN_SNAPSHOT 2097152		//Customers served between snapshots of a long run (a multiple of LONG_RUN_CHECK)
+#define LONG_RUN_SNAPSHOT_FILE "longrun.snap"
+
+#define WHAT_IF_MAX_VARIANTS 64		//Most variants what_if runs side by side, each in its own process
+
+Telemetry telemetry;			//Progress page the engines publish to; only opened by main for the options that simulate on 1 thread
 
 
 
 //Simulation Functions
 /**@brief General simulator function that handles Stats data before calling either simulateA or simulateB
  *
- *@details Runs 10 simulations of either type A or B depending on what value user selects. Keeps track of average stats from all simulations, and writes those results to
- *an output file 
+ *@details Runs replications of either type A or B depending on what value user selects, generating each one's data file just before it runs. Keeps running means
+ *and variances of every stat and stops once the confidence intervals of config.precisionFields are within config.precision of their means (after at least config.minReplications), or after
+ *config.maxReplications. Writes each replication and the confidence intervals to an output file
  *
- *@param n User selected int value that will determine how many tellers or queues to use
- *@param val Boolean value. True if user wants to run simulationA. False if user wants to run simulationB
+ *@param config User selected options: n, which simulation to run, and how simulateB routes arrivals
  * 
  *@return void
  */
-void sim(int n, bool val);
+void sim(SimConfig config);
 
-/**@brief Simulates bank when there is 1 Queue and n tellers 
+/**@brief Reads a number of tellers, lines or branches, asking again until it is 1 - most
+ *@param value Reference to the number that is set
+ *@param most Largest number allowed
+ *@return bool Returns false if the input ends first
+ */
+bool read_count(int& value, int most);
+
+/**@brief Compares two configurations with common random numbers
  *
- *@details Simulates bank with specified number of tellers and 1 line, and calculates the desired statistics about the simulation
+ *@details Every replication generates one data file and runs both configurations on it, with the same routing stream, so the difference between their
+ *stats comes from the configurations and not from the data. Reports each configuration's intervals, the paired difference and its interval, and the
+ *interval the same number of independent runs would have given. Stops once the waiting time difference is within first.precision of its mean, or after
+ *first.maxReplications
+ *
+ *@param first Options for the first configuration; its seed, precision, confidence, replication limits and antithetic setting are used for both
+ *@param second Options for the second configuration
  *
- *@param n User selected int value that determines how many total tellers the bank will have
- *@param file String containing the name of the data file to be used to run the simulation
- *@param simData Pointer to a Stats struct, so data gathered from simulation can be displayed in sim() function
- * 
  *@return void
  */
-void simulateA(int n, string file, Stats* simData);
+void compare(SimConfig first, SimConfig second);
 
-/**@brief Simulates bank when there are n Queue and 1 teller per queue
+/**@brief Finds the smallest n that keeps a wait metric at or under a threshold
  *
- *@details Simulates bank with specified number of queues and 1 teller for each queue, and calculates desired statistics about the simulation
+ *@details Starts from the analytic estimate for the first replication's customers, brackets the answer with doubling steps, then bisects it. The
+ *estimate is steady state while the day is finite, so it only picks where the search starts: every candidate is simulated before it is judged. Every
+ *candidate runs on the same data files, and each candidate stops replicating as soon as its confidence interval lies entirely on one side of the
+ *threshold. Assumes the metric does not get worse as n grows. Writes every candidate tried and the answer to an output file
+ *
+ *@param config Which simulation to run, its routing, seed, confidence and replication limits; n is what is searched
+ *@param metric OPT_ metric to keep under the threshold
+ *@param threshold Largest acceptable value of the metric
  *
- *@param n User selected int value that determines how many total queues the bank will have
- *@param file String containing the name of the data file to be used to run the simulation
- *@param simData Pointer to a Stats struct, so data gathered from simulation can be displayed in sim() function
- * 
  *@return void
  */
-void simulateB(int n, string file, Stats* simData);
+void optimize_staffing(SimConfig config, int metric, double threshold);
 
-//Simulation Helper Functions
-/**@brief Processes an arrival event for simulateA function
+/**@brief Decides whether config.n meets a threshold, replicating only until the confidence interval is clear of it
+ *
+ *@param config Options with the candidate n
+ *@param metric OPT_ metric to test
+ *@param threshold Largest acceptable value of the metric
+ *@param generated Reference to how many replications' data files exist, updated when more are generated
+ *@param simulations Reference to a counter of simulations run, updated
+ *@param out Stream the candidate's result is written to
+ *@return bool Returns true if the mean of the metric is at or under the threshold
+ */
+bool staffing_feasible(SimConfig config, int metric, double threshold, int& generated, long long& simulations, ostream& out);
+
+/**@brief Returns the smallest n whose analytic estimate of a metric is at or under a threshold
  *
- *@details Determines if an arrival can be immediately processed (ie there is an open line and teller) and if not places arrival event into the line
+ *@details simulateB with routing that looks at line lengths keeps its tellers nearly as busy as one shared line, so it is estimated as simulateA
+ *
+ *@param config Which simulation and routing to estimate
+ *@param metric OPT_ metric to estimate
+ *@param threshold Largest acceptable value of the metric
+ *@param moments Arrival rate and transaction time moments of the data file
+ *@return int
+ */
+int staffing_estimate(SimConfig config, int metric, double threshold, const TraceMoments& moments);
+
+/**@brief Returns the value of an OPT_ metric from a replication's stats
+ *@param simData Stats of the replication
+ *@param metric OPT_ metric
+ *@return double
+ */
+double metric_value(const Stats& simData, int metric);
+
+/**@brief Returns the report name of an OPT_ metric
+ *@param metric OPT_ metric
+ *@return string
+ */
+string metric_name(int metric);
+
+/**@brief Estimates the steady-state average wait from one long run instead of many short replications
+ *
+ *@details Arrivals are generated one at a time (Poisson, at the rate generate_events produces) and each customer is recycled for a later arrival once it leaves, so
+ *memory does not grow with the run. Waits go into BatchMeans, which deletes the warm-up with MSER. The run stops once the batch means are nearly
+ *uncorrelated and their interval is within config.precision of the mean, or after limit customers. Writes the estimate to an output file
+ *
+ *@param config Which simulation to run, n, routing, seed, precision and confidence
+ *@param limit Most customers to simulate
  *
- *@param arr Pointer to the arrival event being processed
- *@param eventQueue Pointer to priority event queue in simulateA that is keeping track of all events
- *@param bankLine Pointer to array queue that is representing the line in the bank
- *@param tellerArr Pointer to array of boolean values that represent the availability of each teller
- *@param n User selected integer value that determine number of total tellers 
  *@return void
  */
-void process_ArrivalA(Arrival* arr, PriorityQueue* eventQueue, ArrayQueue* bankLine, bool* tellerArr, int n);
+void long_run(SimConfig config, long long limit);
 
-/**@brief Processes a departure event for simulateA function
+/**@brief Returns true once a long run's batch means are long enough to be nearly independent and precise enough
+ *@param waits Batch means of the waits so far
+ *@param config Options holding the precision and confidence
+ *@return bool
+ */
+bool long_run_done(const BatchMeans& waits, SimConfig config);
+
+/**@brief Creates the next arrival of a Poisson stream with transaction times of 1 - 100
+ *@param time Reference to the (fractional) time of the last arrival, advanced to this one
+ *@param rate Arrivals per unit of time
+ *@param arrivals Stream the gaps between arrivals are drawn from
+ *@param service Stream the transaction times are drawn from
+ *@param pool Reference to the pool the arrival is taken from
+ *@return Arrival*
+ */
+Arrival* next_arrival(double& time, double rate, RandomStream& arrivals, RandomStream& service, CustomerPool& pool);
+
+/**@brief Resumes the long run saved in LONG_RUN_SNAPSHOT_FILE and writes its estimate to an output file
  *
- *@details Removes a departure event from the priority queue, and then creates a new departure event if bankLine is not empty. If bankline is empty then one teller is set to
- *available.
+ *@details The run carries on from the customer the snapshot was taken after, with the same events, lines, tellers, routing, random streams and batch
+ *means, so it ends exactly as the run would have if it had not been stopped. Only the CPU time can differ
  *
- *@param dep Pointer to the departure event being processed
- *@param eventQueue Pointer to priority event queue in simulateA that is keeping track of all events
- *@param bankLine Pointer to array queue that is representing the line in the bank
- *@param tellerArr Pointer to array of boolean values that represent the availability of each teller
- *@param n User selected integer value that determine number of total tellers 
  *@return void
  */
-void process_DepartureA(Departure* dep, PriorityQueue* eventQueue, ArrayQueue* bankLine, bool* tellerArr, int n);
+void resume_long_run();
 
-/**@brief Processes an arrival event for simulateB function
+/**@brief Returns the first line of a long run's output, describing what is simulated
+ *@param config Options of the run
+ *@param rate Arrivals per unit of time
+ *@return string
+ */
+string long_run_title(SimConfig config, double rate);
+
+/**@brief Allocates a long run's lines, tellers and routing and seeds its streams, without scheduling any events
+ *@param state Reference to the state to set up; call state.initialize() first
+ *@param config Which simulation to run, n, routing, seed, precision and confidence
+ *@param rate Arrivals per unit of time
+ *@param limit Most customers to generate
+ *@return void
+ */
+void allocate_long_run(LongRunState& state, SimConfig config, double rate, long long limit);
+
+/**@brief Simulates a long run to its end, writes the estimate to an output file, then frees the state
+ *@param state Reference to a state with its events scheduled
+ *@param outputFile Reference to the output file, whose title line is already written
+ *@return void
+ */
+void run_long_run(LongRunState& state, ostream& outputFile);
+
+/**@brief Long run event loop for simulateA's single line or simulateB's n lines
+ *
+ *@details Every LONG_RUN_SNAPSHOT customers served, snapshot_long_run writes the whole state to LONG_RUN_SNAPSHOT_FILE without stopping the loop
+ *
+ *@param state Reference to the state, which is advanced to where the run stops
+ *@return bool Returns false if the lines filled up, meaning there is no steady state
+ */
+bool stream_events(LongRunState& state);
+
+/**@brief Starts writing a snapshot of a long run from a fork() of this process
+ *
+ *@details The child gets a copy-on-write image of the state as it is now, writes it out and exits, while the parent carries on simulating. A snapshot is
+ *skipped if the child writing the last one has not finished, and written in place if fork() fails
+ *
+ *@param state Reference to the state to save
+ *@param previous Process id of the child writing the last snapshot, or 0
+ *@return pid_t Process id of the child writing a snapshot, or 0 if there is none
+ */
+pid_t snapshot_long_run(LongRunState& state, pid_t previous);
+
+/**@brief Writes a long run's state to a file
+ *
+ *@details The snapshot is written to file.tmp and renamed over file once it is complete, so file always holds a whole snapshot
+ *
+ *@param state Reference to the state to save
+ *@param file Name of the snapshot file
+ *@return bool Returns false if the snapshot could not be written
+ */
+bool save_long_run(const LongRunState& state, string file);
+
+/**@brief Allocates a long run's state and restores it from a file written by save_long_run
+ *@param state Reference to the state to restore; call state.initialize() first, and free_long_run after, even when this fails
+ *@param file Name of the snapshot file
+ *@return bool Returns false if the file is missing, from another build or cut short, or holds a value no long run could have reached
+ */
+bool load_long_run(LongRunState& state, string file);
+
+/**@brief Runs one day of the bank up to a branch time once, then compares variants of it from there, each in its own forked process
+ *
+ *@details The shared prefix is simulated once with the long run engine. At the branch time the process forks once per variant; each child gets a
+ *copy-on-write image of the whole state, applies its changes with apply_what_if and simulates on to the end of the comparison, all in parallel.
+ *Every variant sees the same customers arrive, so the differences between them come from the changes alone. Only waits of customers who leave after
+ *the branch time are compared. Writes the comparison to an output file
+ *
+ *@param config Which simulation to run, n, routing and seed
+ *@param branchTime Time the variants branch at
+ *@param horizon How long after the branch time the variants are compared for
+ *@param variants Changes to compare with the bank as it is, which is always compared first
  *
- *@details Finds the shortest line out of all the queues, and then determines if arrival can be immediately processd (if queue is empty). If not arrival is added to that
- *queue, and the index of that queue is stored in the arrival object
- *@param arr Pointer to the arrival event being processed
- *@param eventQueue Pointer to priority event queue in simulateA that is keeping track of all events
- *@param bankLines Pointer to array of ArrayQueue pointers, which represent each separate line at the bank
- *@param tellerArr Pointer to array of boolean values that represent the availability of each teller
- *@param n User selected integer value that determine number of total tellers 
  *@return void
  */
-void process_ArrivalB(Arrival* arr, PriorityQueue* eventQueue, ArrayQueue** bankLines, bool* tellerArr, int n);
+void what_if(SimConfig config, SimTime branchTime, SimTime horizon, vector<WhatIf> variants);
 
-/**@brief Processes a departure event for simulateB function
+/**@brief Applies a what_if variant to a state paused at the branch time, then simulates it to state.until
+ *@param state Reference to the state, a copy owned by the variant's process
+ *@param variant Changes to make
+ *@param branchTime Time the state is paused at
+ *@return BranchResult
+ */
+BranchResult run_what_if(LongRunState& state, WhatIf variant, SimTime branchTime);
+
+/**@brief Opens extra tellers or lines, closes lines and changes routing of a state paused at the branch time
  *
- *@details Removes a departure event from the priority queue, and then creates a new departure event if corresponding line is not empty. If line is empty, then the teller
- *corresponding to that line is set to true
+ *@details simulateA's new tellers start on the customers already waiting. simulateB's new lines start empty, and closed lines are the last ones, which
+ *are served out but no longer routed to
  *
- *@param dep Pointer to the departure event being processed
- *@param eventQueue Pointer to priority event queue in simulateA that is keeping track of all events
- *@param bankLines Pointer to array of ArrayQueue pointers, which represent each separate line at the bank
- *@param tellerArr Pointer to array of boolean values that represent the availability of each teller
- *@param n User selected integer value that determine number of total tellers 
+ *@param state Reference to the state to change
+ *@param variant Changes to make
+ *@param branchTime Time the state is paused at
+ *@return void
+ */
+void apply_what_if(LongRunState& state, WhatIf variant, SimTime branchTime);
+
+/**@brief Returns a short description of a what_if variant, eg "6 Queues with 1 Teller per Queue (round robin), 1 closed"
+ *@param config Options before the branch
+ *@param variant Changes made at the branch
+ *@return string
+ */
+string describe_what_if(SimConfig config, WhatIf variant);
+
+/**@brief Serves simulation requests on a Unix domain socket until a client sends "shutdown"
+ *
+ *@details The protocol is described in SimServer.h. This thread accepts connections and polls all of them for request lines, so an idle client holds
+ *no thread. Every replication of a request is 1 job for a pool of worker threads, so requests on any connection, and the replications of one request,
+ *run concurrently. Traces stay in memory in a TraceStore and Stats are memoized in the ResultCache, so a repeated query pays for neither generation
+ *nor simulation
+ *
+ *@param path File name of the socket
+ *@param workers Number of worker threads
+ *@return void
+ */
+void serve(string path, int workers);
+
+/**@brief Parses one request line of the server protocol into a request, which is complete at once with its "error" line if it is malformed
+ *@param line The request line
+ *@param connection The connection it came on
+ *@return shared_ptr<ServerRequest>
+ */
+shared_ptr<ServerRequest> open_request(string line, shared_ptr<ServerConnection> connection);
+
+/**@brief Runs one replication of a request on a worker thread, and answers its line; the last replication to finish answers the means too
+ *@param request Reference to the request
+ *@param run Index of the replication
+ *@param traces Reference to the traces kept in memory
+ *@return void
+ */
+void serve_replication(ServerRequest& request, int run, TraceStore& traces);
+
+/**@brief Adds an answer line to a request and writes every line its connection can write so far, in the order of the requests
+ *@param request Reference to the request
+ *@param line The answer line
+ *@param last True if it is the request's last line
+ *@return void
+ */
+void answer_request(ServerRequest& request, string line, bool last);
+
+/**@brief Writes the waiting lines of a connection's oldest requests, up to the first one that is not complete. The caller holds connection.guard
+ *@param connection Reference to the connection
  *@return void
  */
-void process_DepartureB(Departure* dep, PriorityQueue* eventQueue, ArrayQueue** bankLines, bool* tellerArr, int n);
+void write_answers(ServerConnection& connection);
+
+/**@brief Parses the key=value options of a server request
+ *@param request The request line
+ *@param config Reference to the options that are set
+ *@param replications Reference to the number of replications asked for
+ *@param metrics Reference to the Stats fields asked for, as STATS_FIELDS indexes
+ *@param error Reference to the reason the request was refused
+ *@return bool Returns false if the request is malformed
+ */
+bool parse_request(string request, SimConfig& config, int& replications, vector<int>& metrics, string& error);
 
-/**@brief Determines if there is an available teller
+/**@brief Runs one replication on customers kept in a TraceStore, timed with this thread's CPU clock
  *
- *@details Loops through arr of boolean values to see if there is an available teller and returns true if there is one. Also sets index parameter equal to the index where
- *that teller is at so calling function knows what index to use
+ *@details With config.cache, Stats already simulated are read back from the ResultCache (simData->cached is set) without touching the customers, and
+ *new ones are added to it. Customers missing from the store are generated with replication_trace and kept there
  *
- *@param arr Pointer to array of boolean values, which represents availability of tellers
- *@param n User selected n value which determines how many tellers there are
- *@param index reference to integer value so index of available teller can be returned also
- *@return bool Returns true if there is an available teller and false otherwise
+ *@param config Which simulation to run, n, routing, seed and customers
+ *@param run Index of the replication, which picks its customers and routing stream
+ *@param traces Reference to the traces kept in memory
+ *@param simData Pointer to Stats struct that is filled in with the results
+ *@param hot Reference set to true if the customers were already in memory
+ *@return void
  */
-bool available_teller(bool* arr, int n, int& index);
+void store_replication(SimConfig config, int run, TraceStore& traces, Stats* simData, bool& hot);
 
-/**@brief Sets a teller to available
- *@details finds a teller that is currently unavailable and sets its to true after simulation determines that a new teller should be available
+/**@brief Runs a grid of configurations from a scenario file and the command line, without prompting
+ *
+ *@details Usage: simulate3 [--scenario file] [--key value ...], where the keys are those of a scenario file and override it. A scenario file has
+ *1 "key = value, value, ..." line per key, and # starts a comment:
+ *
+ *   mode = a, b			simulateA and/or simulateB
+ *   n = 2-12:2, 16		numbers, and ranges low-high or low-high:step
+ *   routing = s, d, i, r		simulateB's routing: shortest, power of d, join idle, round robin
+ *   choices = 2, 3		lines sampled by routing d
+ *   seed = 1-4
+ *   customers = 50000, 99999	customers per data file
+ *   backend = sim, analytic	simulate, and/or estimate with queueing formulas; fields the formulas do not model are left empty
+ *   replications = 5		each point's replications, or the most it runs with a precision
+ *   precision = 0.05		stop a point's replications once its intervals are within 5% of the means; 0 (the default) runs them all
+ *   precision-fields = avg_wait	fields (as in the CSV header) whose intervals have to be that precise; avg_wait is the default
+ *   confidence = 0.95
+ *   threads = 8			defaults to every core
+ *   output = results.csv		- for standard output
+ *   cache = 1
+ *   patience = 50		mean patience of waiting customers; 0 (the default) for customers who never give up
+ *   break-after = 200		idle time before a teller takes a break of break-length; 0 (the default) for no breaks
+ *   break-length = 100
+ *   classes = 1, 2, 7		shares of the arrivals of each customer class, highest first; 1 number (the default) for 1 class
+ *   discipline = strict, wfq	how the classes are served: strict priority, and/or weighted fair
+ *   class-weights = 4, 2, 1	weight of each class with wfq, 1 if left out
+ *   profile = flat, lunch.txt	arrival profile files (see Generator.h); flat (the default) for the same rate all day
+ *   service = uniform, exponential:50, lognormal:50:30, empirical:tellers.txt
+ *				transaction time distributions; uniform (the default) is 1 - 100
  *
- *@parm arr Pointer to array of boolean values which represnet the availability of tellers
- *@param n User selected value which determines how many tellers there are
- *@return bool Returns true if there is an entry that is able to be set to true
+ *Every replication of every grid point is 1 job, and the jobs of the whole grid share 1 pool of threads. Jobs are ordered so the grid points that
+ *run on the same customers run together, and the customers stay in a TraceStore while they do. Writes 1 CSV row per grid point, with the mean and
+ *confidence interval half-width of every Stats field
+ *
+ *@param argc Number of command line arguments
+ *@param argv Command line arguments
+ *@return int Exit status: 0 on success, 1 if the scenario is malformed or the results could not be written
+ */
+int run_scenario(int argc, char* argv[]);
+
+/**@brief Reads a scenario file into a Scenario
+ *@param fileName Name of the scenario file
+ *@param scenario Reference to the scenario, whose keys that appear in the file are set
+ *@param error Reference to the reason the file was refused
+ *@return bool Returns false if the file could not be opened or has a bad line
+ */
+bool read_scenario(string fileName, Scenario& scenario, string& error);
+
+/**@brief Sets one key of a scenario from its value
+ *@param key Name of the key
+ *@param value Its value, a comma separated list for the grid's keys
+ *@param scenario Reference to the scenario that is set
+ *@param error Reference to the reason the value was refused
+ *@return bool Returns false if the key is unknown or the value is malformed
  */
-bool set_available(bool* arr, int n);
+bool parse_scenario_option(string key, string value, Scenario& scenario, string& error);
+
+/**@brief Parses a comma separated list of numbers and ranges (low-high or low-high:step)
+ *@param value The list
+ *@param low Smallest number allowed
+ *@param high Largest number allowed
+ *@param values Reference to the numbers, in the order listed
+ *@return bool Returns false if an item is malformed or out of bounds
+ */
+bool parse_list(string value, long long low, long long high, vector<long long>& values);
+
+/**@brief Expands a scenario into its grid points, skipping the combinations a configuration ignores (routing for simulateA, choices unless routing d)
+ *@param scenario The scenario
+ *@return vector<GridPoint>
+ */
+vector<GridPoint> expand_scenario(const Scenario& scenario);
 
-/**@brief Computes the average of 10 simulation runs
- *@details Sums all the data from each simulation, then calculates the average and stores in avg struct
+/**@brief Runs every replication of every grid point on a pool of scenario.threads threads
  *
- *@param simData Pointer to array of stats structs, which hold the data for each individaul simulation run
- *@param avg reference to Stats struct which will be updated with average values of simData
- * 
+ *@details With a precision, each point runs its minimum replications and then 1 more per round until its precisionFields are precise enough or it has run
+ *scenario.replications
+ *
+ *@param scenario The scenario, for its threads
+ *@param points Grid points to run
+ *@param results Reference to the Stats of every point's replications, in the order of points and then replications
+ *@param hot Reference to how many simulated replications found their customers in memory
+ *@param cached Reference to how many replications were read from the ResultCache
  *@return void
  */
-void compute_averages(Stats* simData, Stats& avg);
+void run_grid(const Scenario& scenario, const vector<GridPoint>& points, vector<vector<Stats> >& results, int& hot, int& cached);
 
-/**@brief Calculates the idle time for a teller
+/**@brief Writes a header and 1 CSV row per grid point: its options, then the mean and confidence interval half-width of every Stats field
  *
- *@details determines if a teller has been available for an entire event and determines the time difference
- * 
- *@param tellerCurrent value of teller at current cycle
- *@param tellerPrevious value of teller at previous cycle
- *@param start reference variable to start of idle time
- *@param stop reference variable to when idle time stops
+ *@details An analytic point leaves the fields analytic_models says the formulas do not estimate empty, and if it is unstable on any replication's
+ *customers gets "unstable" for every other mean and an empty half-width
  *
- *@return int returns idle time for the teller, if there was any
+ *@param out Stream to write to
+ *@param scenario The scenario, for its confidence
+ *@param points Grid points
+ *@param results Stats of every point's replications
+ *@return void
  */
-int calculate_idle(bool tellerCurrent, bool tellerPrevious, int currentTime, int& start, int& stop);
+void write_grid(ostream& out, const Scenario& scenario, const vector<GridPoint>& points, const vector<vector<Stats> >& results);
 
-/**@brief Finds the shortest line out of all the total lines for the bank simulation
- * 
- *@details used for simulateB when there is more than one queue. Loops through all queues and determines which one is the shortest, and then returns its index
- * 
- *@param bankLines Pointer to array of ArrayQueue pointers
- *@param n number of queues in array
- *@return int returns the index of the shortest line in the array
+/**@brief Deletes every event, line, teller and router of a long run
+ *@param state Reference to the state to free
+ *@return void
  */
-int shortest_line(ArrayQueue** bankLines, int n);
+void free_long_run(LongRunState& state);
 
-/**@brief Calculates the average length of all the lines after each event loop for simulateB
- *@details sums the lengths of all the lines and finds their average
+/**@brief Deletes every event left in an event queue and in the lines when a long run stops
+ *@param eventQueue Reference to the event queue
+ *@param lines Array of pointers to the lines
+ *@param count Number of lines
+ *@return void
+ */
+void clear_events(PriorityQueue& eventQueue, ArrayQueue** lines, int count);
+
+/**@brief Estimates the stats of simulateA or simulateB from queueing formulas, without simulating
+ *
+ *@details simulateA is one G/G/n queue (Allen-Cunneen). simulateB is n separate G/G/1 lines that each get 1/n of the arrivals (M/G/1 for Poisson
+ *arrivals); round robin hands each line every nth arrival, which divides the arrival variability by n. Routing that looks at line lengths does better
+ *than this, so for it the estimate is pessimistic. The max wait and max line length are the 1 - 1/count quantiles. Only simulateA's idle time is
+ *estimated, since simulateB does not measure it. Sets simData->analytic, and simData->unstable with every estimate left at 0 when the offered load is at
+ *least the servers
  *
- *@param bankLines Pointer to array of ArrayQueue pointers
- *@param n number of queues in array
- *@return int returns the average length of all the queues
+ *@param config Which simulation to estimate, n and routing
+ *@param moments Arrival rate and transaction time moments of the data file
+ *@param simData Pointer to Stats struct that is filled in with the estimates
+ *@return void
  */
-int avg_line(ArrayQueue** bankLines, int n);
+void analytic_estimate(SimConfig config, const TraceMoments& moments, Stats* simData);
 
-//Data Generating Functions
+/**@brief Returns whether analytic_estimate models a Stats field of a configuration, or leaves it at 0 without estimating it
+ *
+ *@details The formulas have no customer classes, patience or teller breaks. They never estimate customers reneged or the wait of each class, and
+ *estimate none of the waits, lengths and times of a configuration whose customers give up or whose tellers take breaks, since those change every one
+ *of them. Idle time is only estimated for simulateA, and routing cost only for simulateB
+ *
+ *@param config Which simulation is estimated
+ *@param field Index of the field, in STATS_FIELDS order
+ *@return bool
+ */
+bool analytic_models(SimConfig config, int field);
 
-/**@brief Generates 99,999 random events and writes them into a file
- *@details uses random number generator to generate random arrival times and then uses counting sort to sort them. Then generates random transaction times for each event
+/**@brief Writes the stats of one replication, or of an analytic estimate
  *
- *@param fileName string holding the name of the data file to written into
+ *@param out Stream to write to
+ *@param simData Stats to write
+ *@param singleLine True for simulateA, which has no routing cost
+ *@param classes Customer classes of the run; the wait of each is written when there is more than 1
+ *@return void
  */
-void generate_events(string fileName);
+void write_stats(ostream& out, const Stats& simData, bool singleLine, int classes);
 
-/**@brief Sorts an array of integers by counting the frequency of each element in the array and using this information to place each value into the correct array index
- * 
- *@details This function implements the O(n+K) counting sort algorithm which sorts an array of integers without making any comparisons between the elements of the array.
- *First the function counts the occurrence of each number 0 - 999,999. This information is used to determine the cumulative frequency of each number 0-999,999, so each 
- *array index I indicates how many numbers less than or equal to I there are in the list of integers being sorted. This information is then used to place each integer in
- *the list into the correct index in the sorted array
- * 
- *@param arr[] Array of integers being sorted
- *@param size Size of array being sorted
+/**@brief Runs one replication of simulateA or simulateB and times it
+ *
+ *@details With config.cache, Stats already simulated for the same data file, configuration and run are read back from the ResultCache instead
+ *(simData->cached is set), and new ones are added to it. Runs with config.records are always simulated, to write their customer logs
+ *
+ *@param config Which simulation to run, n and routing
+ *@param file Name of the data file to run on
+ *@param run Index of the run, which picks its routing stream
+ *@param trace Key of the data file's customers, from generate_replication
+ *@param simData Pointer to Stats struct that is filled in with the results
  *@return void
- */ 
-void counting_sort(int arr[], int size);
+ */
+void run_replication(SimConfig config, string file, int run, unsigned long long trace, Stats* simData);
+
+/**@brief Runs one replication of simulateA or simulateB on customers already in memory and times it with this thread's CPU clock
+ *
+ *@details Uses the ResultCache like the data file version. Only the simulation is timed, not loading the customers
+ *
+ *@param config Which simulation to run, n and routing
+ *@param customers Customers to run on
+ *@param run Index of the run, which picks its routing stream
+ *@param trace Key of the customers, from generate_replication
+ *@param simData Pointer to Stats struct that is filled in with the results
+ *@return void
+ */
+void run_replication(SimConfig config, const Trace& customers, int run, unsigned long long trace, Stats* simData);
+
+/**@brief Reads one replication's Stats back from the ResultCache, or simulates them and adds them to it
+ *
+ *@details Used by every replication runner. Runs with config.records are always simulated, to write their customer logs
+ *
+ *@param config Which simulation to run, n and routing
+ *@param run Index of the run, which picks its routing stream
+ *@param trace Key of the customers the run is on
+ *@param simData Pointer to Stats struct that is filled in with the results
+ *@param simulate Function called on a miss to simulate the run, CPU_time included, into the Stats it is passed
+ *@return void
+ */
+void cached_replication(SimConfig config, int run, unsigned long long trace, Stats* simData, function<void(Stats*)> simulate);
+
+/**@brief Runs simulate_trace timed with this thread's CPU clock, which unlike clock() counts no other thread's time
+ *@param config Which simulation to run, n and routing
+ *@param customers Customers to run on
+ *@param run Index of the run, which picks its routing stream
+ *@param simData Pointer to Stats struct that is filled in with the results
+ *@return void
+ */
+void timed_trace(SimConfig config, const Trace& customers, int run, Stats* simData);
+
+/**@brief Runs simulateA or simulateB on customers already in memory, without timing it or using the ResultCache
+ *
+ *@details With config.records, every customer is written to customers<run + 1>.bin while the run is simulated
+ *
+ *@param config Which simulation to run, n and routing
+ *@param trace Customers to run on
+ *@param run Index of the run, which picks its routing stream
+ *@param simData Pointer to Stats struct that is filled in with the results
+ *@return void
+ */
+void simulate_trace(SimConfig config, const Trace& trace, int run, Stats* simData);
+
+/**@brief Returns the ResultCache key of the Stats of one run of a configuration on a data file
+ *@param config Which simulation runs, n and routing
+ *@param trace Key of the data file's customers
+ *@param run Index of the run, which picks its routing stream
+ *@return unsigned long long
+ */
+unsigned long long stats_key(SimConfig config, unsigned long long trace, int run);
+
+/**@brief Returns a short description of a configuration for reports, eg "4 Queues with 1 Teller per Queue (round robin)"
+ *@param config Options to describe
+ *@return string
+ */
+string describe(SimConfig config);
+
+/**@brief Prompts for how simulateB routes arrivals
+ *@param config Reference to the options, whose routing and choices are set
+ *@return void
+ */
+void read_routing(SimConfig& config);
+
+/**@brief Prompts for whether replications run as antithetic pairs
+ *@param config Reference to the options, whose antithetic flag is set
+ *@return void
+ */
+void read_antithetic(SimConfig& config);
+
+/**@brief Prompts for whether every customer is written to a customer log
+ *@param config Reference to the options, whose records flag is set
+ *@return void
+ */
+void read_records(SimConfig& config);
+
+/**@brief Simulates a network of bank branches, once on 1 thread and twice partitioned across threads
+ *
+ *@details Runs simulate_network_sequential, then simulate_network_parallel (conservative) and simulate_network_timewarp (optimistic) on the same network,
+ *checks that every branch's stats are identical to the sequential run, and writes the wall clock times and the per branch stats to an output file
+ *
+ *@param config User selected options for the network
+ *
+ *@return void
+ */
+void sim_network(NetworkConfig config);
+
+/**@brief Checks that two runs of the same network produced identical stats for every branch
+ *
+ *@param a Pointer to array of Stats, one per branch
+ *@param b Pointer to array of Stats, one per branch
+ *@param count Number of branches
+ *@return bool Returns true if every field except CPU time matches exactly
+ */
+bool same_results(Stats* a, Stats* b, int count);
+
+/**@brief Simulates bank when there is 1 Queue and n tellers 
+ *
+ *@details Simulates bank with specified number of tellers and 1 line, and calculates the desired statistics about the simulation
+ *
+ *@param n User selected int value that determines how many total tellers the bank will have
+ *@param trace Customers of the data file to be used to run the simulation
+ *@param simData Pointer to a Stats struct, so data gathered from simulation can be displayed in sim() function
+ *@param log Pointer to the CustomerLog every customer is written to, or NULL
+ *@param timeouts Pointer to the patience and teller breaks of the run, or NULL if customers never give up and tellers never take breaks
+ *@param classes Pointer to the customer classes of the run, or NULL for 1 FIFO line of customers who are all alike
+ * 
+ *@return void
+ */
+void simulateA(int n, const Trace& trace, Stats* simData, CustomerLog* log = NULL, const Timeouts* timeouts = NULL, const Classes* classes = NULL);
+
+/**@brief Simulates bank when there are n Queue and 1 teller per queue
+ *
+ *@details Simulates bank with specified number of queues and 1 teller for each queue, and calculates desired statistics about the simulation
+ *
+ *@param n User selected int value that determines how many total queues the bank will have
+ *@param trace Customers of the data file to be used to run the simulation
+ *@param simData Pointer to a Stats struct, so data gathered from simulation can be displayed in sim() function
+ *@param router Pointer to the Router that picks a line for each arrival, drawing from this replication's random stream
+ *@param log Pointer to the CustomerLog every customer is written to, or NULL
+ *@param timeouts Pointer to the patience and teller breaks of the run, or NULL if customers never give up and tellers never take breaks
+ *@param classes Pointer to the customer classes of the run, or NULL for FIFO lines of customers who are all alike
+ * 
+ *@return void
+ */
+void simulateB(int n, const Trace& trace, Stats* simData, Router* router, CustomerLog* log = NULL, const Timeouts* timeouts = NULL, const Classes* classes = NULL);
+
+/**@brief Event loop for simulateA
+ *
+ *@details Runs the simulation with 1 line, 1 distinct time per pass, taking arrivals from the trace in order. Templated on the teller representation so that small, fixed teller
+ *counts are compiled with their teller state held in a single bitmask. With timeouts, the patience and break timers due at a time fire after its arrivals and departures, from a
+ *TimingWheel the loop also takes its next time from; without them the wheel stays empty and costs 1 comparison per time. Also templated on the line, so runs with classes
+ *use a ClassQueue and every other run keeps its plain ArrayQueue
+ *
+ *@param tellers Teller availability (TellerArray when n is only known at runtime, FixedTellers<N> otherwise)
+ *@param bankLine Reference to the line (ArrayQueue, or ClassQueue with classes)
+ *@param trace Customers of the data file to be used to run the simulation, in order of arrival
+ *@param simData Pointer to a Stats struct, so data gathered from simulation can be displayed in sim() function
+ *@param log Pointer to the CustomerLog each departing customer is written to, or NULL
+ *@param timeouts Pointer to the patience and teller breaks of the run, or NULL
+ *@param classes Pointer to the customer classes of the run, or NULL
+ *
+ *@return void
+ */
+template <class Tellers, class Line>
+void engineA(Tellers& tellers, Line& bankLine, const Trace& trace, Stats* simData, CustomerLog* log, const Timeouts* timeouts, const Classes* classes);
+
+/**@brief Event loop for simulateB
+ *
+ *@details Runs the simulation with 1 line per teller, 1 distinct time per pass, taking arrivals from the trace in order. Templated on the teller and line length representations
+ *so that small, fixed teller counts keep all line lengths in one cache line and compare them in an unrolled loop. Timeouts and classes are handled as in engineA
+ *
+ *@param tellers Teller availability (TellerArray when n is only known at runtime, FixedTellers<N> otherwise)
+ *@param lengths Line lengths (LineLengths when n is only known at runtime, FixedLineLengths<N> otherwise)
+ *@param bankLines Pointer to array of line pointers (ArrayQueue, or ClassQueue with classes), which represent each separate line at the bank
+ *@param trace Customers of the data file to be used to run the simulation, in order of arrival
+ *@param simData Pointer to a Stats struct, so data gathered from simulation can be displayed in sim() function
+ *@param router Reference to the Router that picks a line for each arrival
+ *@param log Pointer to the CustomerLog each departing customer is written to, or NULL
+ *@param timeouts Pointer to the patience and teller breaks of the run, or NULL
+ *@param classes Pointer to the customer classes of the run, or NULL
+ *
+ *@return void
+ */
+template <class Tellers, class Lengths, class Line>
+void engineB(Tellers& tellers, Lengths& lengths, Line** bankLines, const Trace& trace, Stats* simData, Router& router, CustomerLog* log, const Timeouts* timeouts,
+             const Classes* classes);
+
+/**@struct FixedDispatch
+ *@brief Maps a runtime n onto the engineA/engineB instantiation for FixedTellers<n>
+ *
+ *@details Recursively compares n against N, N-1, ... 1. Only called for 1 <= n <= MAX_FIXED_TELLERS
+ */
+template <int N>
+struct FixedDispatch {
+	static void runA(int n, const Trace& trace, Stats* simData, CustomerLog* log, const Timeouts* timeouts);
+	static void runB(int n, const Trace& trace, Stats* simData, Router* router, CustomerLog* log, const Timeouts* timeouts);
+};
+
+//Recursion ends here; simulateA/simulateB never dispatch n < 1
+template <>
+struct FixedDispatch<0> {
+	static void runA(int, const Trace&, Stats*, CustomerLog*, const Timeouts*) {}
+	static void runB(int, const Trace&, Stats*, Router*, CustomerLog*, const Timeouts*) {}
+};
+
+//Simulation Helper Functions
+/**@brief Processes an arrival event for simulateA function
+ *
+ *@details Determines if an arrival can be immediately processed (ie there is an open line and teller), in which case it becomes its own departure event, and if not places arrival event into the line.
+ *An arrival that was in the event queue must already have been taken off it
+ *
+ *@param arr Pointer to the arrival event being processed
+ *@param eventQueue Pointer to priority event queue in simulateA that is keeping track of all events
+ *@param bankLine Pointer to array queue that is representing the line in the bank
+ *@param tellers Reference to the availability of each teller
+ *@return void
+ */
+template <class Tellers, class Line>
+void process_ArrivalA(Arrival* arr, PriorityQueue* eventQueue, Line* bankLine, Tellers& tellers);
+
+/**@brief Processes a departure event for simulateA function
+ *
+ *@details Removes a departure event from the priority queue, and then turns the next customer in bankLine into its departure event if bankLine is not empty, at the
+ *teller that was just freed. If bankline is empty then that teller is set to available. dep is in no queue once this returns, so the caller can recycle it
+ *
+ *@param dep Pointer to the departure event being processed
+ *@param eventQueue Pointer to priority event queue in simulateA that is keeping track of all events
+ *@param bankLine Pointer to array queue that is representing the line in the bank
+ *@param tellers Reference to the availability of each teller
+ *@return Arrival* The customer who went to the freed teller, or NULL if the teller is now available
+ */
+template <class Tellers, class Line>
+Arrival* process_DepartureA(Departure* dep, PriorityQueue* eventQueue, Line* bankLine, Tellers& tellers);
+
+/**@brief Processes an arrival event for simulateB function
+ *
+ *@details Asks the router for a line (the shortest line unless another routing mode was selected), and then determines if arrival can be immediately processd
+ *(if that line is empty and its teller is free). If not arrival is added to that queue. Either way the index of that line is stored in the arrival object.
+ *An arrival that was in the event queue must already have been taken off it
+ *@param arr Pointer to the arrival event being processed
+ *@param eventQueue Pointer to priority event queue in simulateA that is keeping track of all events
+ *@param bankLines Pointer to array of ArrayQueue pointers, which represent each separate line at the bank
+ *@param tellers Reference to the availability of each teller
+ *@param lengths Reference to the line lengths, updated whenever a customer joins a line
+ *@param router Reference to the Router that picks which line the arrival joins
+ *@return void
+ */
+template <class Tellers, class Lengths, class Line>
+void process_ArrivalB(Arrival* arr, PriorityQueue* eventQueue, Line** bankLines, Tellers& tellers, Lengths& lengths, Router& router);
+
+/**@brief Processes a departure event for simulateB function
+ *
+ *@details Removes a departure event from the priority queue, and then turns the next customer of the corresponding line into its departure event if that line is not empty. If line is empty, then the teller
+ *corresponding to that line is set to true. dep is in no queue once this returns, so the caller can recycle it
+ *
+ *@param dep Pointer to the departure event being processed
+ *@param eventQueue Pointer to priority event queue in simulateA that is keeping track of all events
+ *@param bankLines Pointer to array of ArrayQueue pointers, which represent each separate line at the bank
+ *@param tellers Reference to the availability of each teller
+ *@param lengths Reference to the line lengths, updated whenever a customer departs
+ *@param router Reference to the Router, told whenever a teller goes idle
+ *@return Arrival* The customer who went to the freed teller, or NULL if the teller is now available
+ */
+template <class Tellers, class Lengths, class Line>
+Arrival* process_DepartureB(Departure* dep, PriorityQueue* eventQueue, Line** bankLines, Tellers& tellers, Lengths& lengths, Router& router);
+
+/**@brief Starts the patience timer of a customer who has just joined a line
+ *@param arr Pointer to the customer, the last one enqueued on line
+ *@param line Pointer to the line they joined
+ *@param wheel Reference to the wheel the timer goes on
+ *@param timeouts The run's patience
+ *@return void
+ */
+template <class Line>
+void start_patience(Arrival* arr, Line* line, TimingWheel& wheel, const Timeouts& timeouts);
+
+/**@brief Processes a timer for simulateA function
+ *
+ *@details A customer who ran out of patience leaves the middle of bankLine and goes back to the pool. A teller whose idle timer fired goes on a break, and one who comes back
+ *from a break takes the first customer in bankLine, or is available and starts a new idle timer
+ *
+ *@param fired The timer, due now
+ *@param wheel Reference to the wheel new timers go on
+ *@param breaks Reference to each teller's idle or break timer
+ *@param eventQueue Pointer to priority event queue in simulateA that is keeping track of all events
+ *@param bankLine Pointer to array queue that is representing the line in the bank
+ *@param tellers Reference to the availability of each teller
+ *@param timeouts The run's patience and breaks
+ *@param pool Reference to the pool customers who leave go back to
+ *@return bool Returns true if a customer gave up
+ */
+template <class Tellers, class Line>
+bool process_TimerA(const Timer& fired, TimingWheel& wheel, vector<TimerHandle>& breaks, PriorityQueue* eventQueue, Line* bankLine, Tellers& tellers, const Timeouts& timeouts, CustomerPool& pool);
+
+/**@brief Processes a timer for simulateB function
+ *
+ *@details As process_TimerA, with 1 line per teller: a customer who gives up leaves their own line, and a teller back from a break only serves their own line
+ *
+ *@param fired The timer, due now
+ *@param wheel Reference to the wheel new timers go on
+ *@param breaks Reference to each teller's idle or break timer
+ *@param eventQueue Pointer to priority event queue in simulateB that is keeping track of all events
+ *@param bankLines Pointer to array of ArrayQueue pointers, which represent each separate line at the bank
+ *@param tellers Reference to the availability of each teller
+ *@param lengths Reference to the line lengths, updated whenever a customer leaves a line
+ *@param router Reference to the Router, told whenever a teller goes idle
+ *@param timeouts The run's patience and breaks
+ *@param pool Reference to the pool customers who leave go back to
+ *@return bool Returns true if a customer gave up
+ */
+template <class Tellers, class Lengths, class Line>
+bool process_TimerB(const Timer& fired, TimingWheel& wheel, vector<TimerHandle>& breaks, PriorityQueue* eventQueue, Line** bankLines, Tellers& tellers, Lengths& lengths,
+                    Router& router, const Timeouts& timeouts, CustomerPool& pool);
+
+/**@brief Writes "mean +- half-width" for one stat
+ *
+ *@param out Stream to write to
+ *@param stat Running statistics of the stat across replications
+ *@param confidence Confidence level of the interval
+ *@return void
+ */
+void write_interval(ostream& out, const RunningStat& stat, double confidence);
+
+/**@brief Calculates the idle time for a teller
+ *
+ *@details determines if a teller has been available for an entire event and determines the time difference
+ * 
+ *@param tellerCurrent value of teller at current cycle
+ *@param tellerPrevious value of teller at previous cycle
+ *@param start reference variable to start of idle time
+ *@param stop reference variable to when idle time stops
+ *
+ *@return SimTime returns idle time for the teller, if there was any
+ */
+SimTime calculate_idle(bool tellerCurrent, bool tellerPrevious, SimTime currentTime, SimTime& start, SimTime& stop);
+
+//Data Generating Functions
+
+/**@brief Generates count random events, 99,999 unless a configuration asks for another number
+ *@details uses random number generator to generate random arrival times and then uses counting sort to sort them. Then generates random transaction times for each event
+ *
+ *@param arrivals Stream the arrival times are drawn from
+ *@param service Stream the transaction times are drawn from
+ *@param arrivalTimes Array of count SimTimes that the sorted arrival times are written into
+ *@param transactionLengths Array of count SimTimes that the transaction times are written into
+ *@param count Number of events
+ *@return void
+ */
+void generate_events(RandomStream& arrivals, RandomStream& service, SimTime* arrivalTimes, SimTime* transactionLengths, int count);
+
+/**@brief Writes events into a data file, 1 line of arrival time and transaction time per event
+ *@param fileName string holding the name of the data file to written into
+ *@param arrivalTimes Array of arrival times
+ *@param transactionLengths Array of transaction times
+ *@param count Number of events
+ *@return void
+ */
+void write_events(string fileName, const SimTime* arrivalTimes, const SimTime* transactionLengths, int count);
+
+/**@brief Measures the arrival rate and the variability of the times between arrivals and of the transaction times of a data file
+ *
+ *@param fileName string holding the name of the data file to read
+ *@param moments Reference to TraceMoments struct that is filled in
+ *@return void
+ */
+void trace_moments(string fileName, TraceMoments& moments);
+
+/**@brief Measures the arrival rate and the variability of the times between arrivals and of the transaction times of customers in memory
+ *
+ *@param trace Customers to measure
+ *@param moments Reference to TraceMoments struct that is filled in
+ *@return void
+ */
+void trace_moments(const Trace& trace, TraceMoments& moments);
+
+/**@brief Generates the data file for a replication from its own arrival and service streams
+ *
+ *@details Replication i draws arrival times from stream i * STREAMS_PER_REPLICATION + STREAM_ARRIVALS and transaction times from STREAM_SERVICE, so
+ *every configuration given replication i sees the same customers. They come from generate_events, or from generate_profiled on
+ *config.generatorThreads threads when config.profile or config.service is set. With config.cache the customers are copied from the ResultCache when they were
+ *generated before, and added to it when they were not
+ *
+ *@param config Options holding the seed
+ *@param replication Index of the replication
+ *@param mirrored True for the antithetic run of the replication
+ *@param fileName string holding the name of the data file to written into
+ *@return unsigned long long Key of the data file's customers, for run_replication
+ */
+unsigned long long generate_replication(SimConfig config, int replication, bool mirrored, string fileName);
+
+/**@brief Generates the data file for a replication and keeps its customers in memory too, so they need not be read back from the file
+ *@param config Options holding the seed
+ *@param replication Index of the replication
+ *@param mirrored True for the antithetic run of the replication
+ *@param fileName string holding the name of the data file to written into
+ *@param customers Reference to the Trace that is filled in
+ *@return unsigned long long Key of the data file's customers, for run_replication
+ */
+unsigned long long generate_replication(SimConfig config, int replication, bool mirrored, string fileName, Trace& customers);
+
+/**@brief Generates a replication's customers in memory, the same ones generate_replication writes to its data file
+ *@param config Options holding the seed, the number of customers and whether the ResultCache is used
+ *@param replication Index of the replication
+ *@param mirrored True for the antithetic run of the replication
+ *@param trace Reference to the Trace that is filled in
+ *@return unsigned long long Key of the customers
+ */
+unsigned long long replication_trace(SimConfig config, int replication, bool mirrored, Trace& trace);
+
+/**@brief Returns the ResultCache key of a replication's customers: a hash of the seed, replication, mirroring, number of customers, arrival profile and
+ *service distribution
+ *@param config Options holding the seed, the number of customers and what they are generated from
+ *@param replication Index of the replication
+ *@param mirrored True for the antithetic run of the replication
+ *@return unsigned long long
+ */
+unsigned long long trace_key(SimConfig config, int replication, bool mirrored);
+
+/**@brief Sorts an array of integers by counting the frequency of each element in the array and using this information to place each value into the correct array index
+ * 
+ *@details This function implements the O(n+K) counting sort algorithm which sorts an array of integers without making any comparisons between the elements of the array.
+ *First the function counts the occurrence of each number 0 - 999,999. This information is used to determine the cumulative frequency of each number 0-999,999, so each 
+ *array index I indicates how many numbers less than or equal to I there are in the list of integers being sorted. This information is then used to place each integer in
+ *the list into the correct index in the sorted array
+ * 
+ *@param arr[] Array of times being sorted, each 0 - 100,000
+ *@param size Size of array being sorted
+ *@return void
+ */ 
+void counting_sort(SimTime arr[], int size);
+
+
+
+#ifndef SIMCHECKS			//simchecks.cpp includes this file to check the engines, and has a main of its own
+int main(int argc, char* argv[])
+{
+	if (argc > 1)
+		return run_scenario(argc, argv);
+
+
+	cout << "Bank Simulation Options:" << endl;
+	cout << "a - One Queue with n Tellers		b - n Queues with 1 Teller per Queue		c - Network of n Branches		d - Compare two configurations" << endl;
+	cout << "e - Find the minimum n for a target wait		f - Analytic estimate without simulating		g - Steady-state long run" << endl;
+	cout << "h - Resume a long run from " << LONG_RUN_SNAPSHOT_FILE << "		i - What-if variants from a shared prefix		j - Serve queries on " << SERVER_SOCKET << endl;
+	cout << "Please enter the letter that corresponds with the desired option: " << endl;
+	
+	char c;
+	int n;
+	SimConfig config;
+	config.initialize();
+	config.seed = time(0);
+	cin >> c;
+	cin.clear();
+
+	while ( (c < 'a') || (c > 'j') )
+	{
+		cout << "Invalid Input - Please enter a letter from a to j: ";
+		cin >> c;
+		cin.clear();
+	}
+
+	//Engines only run on this thread for these options; the network and the server run theirs on many threads at once
+	if (c != 'c' && c != 'j')
+		telemetry.open();
+
+	switch (c)
+	{
+		case 'a':
+			cout << "Running simulation with 1 Queue and n tellers... Please enter integer value for n: ";
+			if (read_count(n, PROMPT_MAX_COUNT) == false)
+				return 1;
+
+			config.n = n;
+			config.singleLine = true;
+			read_antithetic(config);
+			read_records(config);
+			sim(config);
+			break;
+
+		case 'b':
+			cout << "Running simulation with n Queues and 1 Teller per Queue... Please enter integer value for n: ";
+			if (read_count(n, PROMPT_MAX_COUNT) == false)
+				return 1;
+
+			config.n = n;
+			config.singleLine = false;
+			read_routing(config);
+			read_antithetic(config);
+			read_records(config);
+
+			sim(config);
+			break;
+
+		case 'c':
+		{
+			NetworkConfig network;
+			network.initialize();
+			network.seed = config.seed;
+
+			cout << "Running simulation of a network of n Branches... Please enter integer value for n: ";
+			if (read_count(network.branches, PROMPT_MAX_COUNT) == false)
+				return 1;
+			cout << "Please enter how many tellers each branch has: ";
+			if (read_count(network.tellers, PROMPT_MAX_COUNT) == false)
+				return 1;
+			cout << "Please enter how many threads to use: ";
+			cin >> network.threads;
+			cin.clear();
+
+			sim_network(network);
+			break;
+		}
+
+		case 'd':
+		{
+			SimConfig second = config;
+			SimConfig* configs[] = {&config, &second};
+			for (int k = 0; k < 2; k++)
+			{
+				cout << "Configuration #" << k + 1 << ": a - One Queue with n Tellers		b - n Queues with 1 Teller per Queue: ";
+				cin >> c;
+				cin.clear();
+				configs[k]->singleLine = (c != 'b');
+				cout << "Please enter integer value for n: ";
+				if (read_count(configs[k]->n, PROMPT_MAX_COUNT) == false)
+					return 1;
+				if (c == 'b')
+					read_routing(*configs[k]);
+			}
+
+			read_antithetic(config);
+			second.antithetic = config.antithetic;
+
+			compare(config, second);
+			break;
+		}
+
+		case 'e':
+		{
+			cout << "a - One Queue with n Tellers		b - n Queues with 1 Teller per Queue: ";
+			cin >> c;
+			cin.clear();
+			config.singleLine = (c != 'b');
+			if (c == 'b')
+				read_routing(config);
+
+			int metric;
+			cout << "Target: w - Average wait		p - 95th percentile wait		m - Max wait" << endl;
+			cout << "Please enter the letter that corresponds with the desired target: ";
+			cin >> c;
+			cin.clear();
+			metric = (c == 'p') ? OPT_P95_WAIT : (c == 'm') ? OPT_MAX_WAIT : OPT_AVG_WAIT;
+
+			double threshold;
+			cout << "Please enter the largest acceptable value: ";
+			cin >> threshold;
+			cin.clear();
+
+			optimize_staffing(config, metric, threshold);
+			break;
+		}
+
+		case 'f':
+		{
+			cout << "a - One Queue with n Tellers		b - n Queues with 1 Teller per Queue: ";
+			cin >> c;
+			cin.clear();
+			config.singleLine = (c != 'b');
+			cout << "Please enter integer value for n: ";
+			if (read_count(config.n, PROMPT_MAX_COUNT) == false)
+				return 1;
+			if (c == 'b')
+				read_routing(config);
+
+			TraceMoments moments;
+			Stats estimate;
+			generate_replication(config, 0, false, "data1.txt");
+			trace_moments("data1.txt", moments);
+			analytic_estimate(config, moments, &estimate);
+
+			ofstream outputFile;
+			outputFile.open("output.txt");
+			outputFile << describe(config) << ", customers of data1.txt" << endl;
+			write_stats(outputFile, estimate, config.singleLine, config.classes);
+			cout << "End estimate" << endl;
+			break;
+		}
+
+		case 'g':
+		{
+			cout << "a - One Queue with n Tellers		b - n Queues with 1 Teller per Queue: ";
+			cin >> c;
+			cin.clear();
+			config.singleLine = (c != 'b');
+			cout << "Please enter integer value for n: ";
+			if (read_count(config.n, PROMPT_MAX_COUNT) == false)
+				return 1;
+			if (c == 'b')
+				read_routing(config);
+
+			long long limit;
+			cout << "Please enter the most customers to simulate: ";
+			cin >> limit;
+			cin.clear();
+
+			long_run(config, limit);
+			break;
+		}
+
+		case 'h':
+			resume_long_run();
+			break;
+
+		case 'j':
+		{
+			int workers;
+			cout << "Please enter how many worker threads to serve with: ";
+			cin >> workers;
+			cin.clear();
+
+			serve(SERVER_SOCKET, (workers >= 1) ? workers : SERVER_WORKERS);
+			break;
+		}
+
+		case 'i':
+		{
+			cout << "a - One Queue with n Tellers		b - n Queues with 1 Teller per Queue: ";
+			cin >> c;
+			cin.clear();
+			config.singleLine = (c != 'b');
+			cout << "Please enter integer value for n: ";
+			if (read_count(config.n, PROMPT_MAX_COUNT) == false)
+				return 1;
+			if (c == 'b')
+				read_routing(config);
+
+			SimTime branchTime;
+			SimTime horizon;
+			cout << "Please enter the time to branch at (a day of data is about 100000): ";
+			cin >> branchTime;
+			cin.clear();
+			cout << "Please enter how long after the branch to compare the variants for: ";
+			cin >> horizon;
+			cin.clear();
+			branchTime = max((SimTime) 0, min(branchTime, SIMTIME_MAX / 4));
+			horizon = max((SimTime) 1, min(horizon, SIMTIME_MAX / 4));
+
+			int count;
+			cout << "Please enter how many variants to compare with the bank as is: ";
+			cin >> count;
+			cin.clear();
+			count = max(0, min(count, WHAT_IF_MAX_VARIANTS - 1));
+
+			vector<WhatIf> variants(count);
+			for (int k = 0; k < count; k++)
+			{
+				SimConfig after = config;
+				variants[k].initialize();
+				cout << "Variant #" << k + 1 << " - Please enter how many " << ((c == 'b') ? "lines" : "tellers") << " to open: ";
+				cin >> variants[k].extra;
+				cin.clear();
+				variants[k].extra = max(0, variants[k].extra);
+				if (c == 'b')
+				{
+					cout << "Please enter how many lines to close: ";
+					cin >> variants[k].closed;
+					cin.clear();
+					variants[k].closed = max(0, min(variants[k].closed, config.n + variants[k].extra - 1));
+					read_routing(after);
+				}
+				variants[k].routing = after.routing;
+				variants[k].choices = after.choices;
+			}
+
+			what_if(config, branchTime, horizon, variants);
+			break;
+		}
+	}
+
+	return 0;	
+}
+#endif
+
+bool read_count(int& value, int most)
+{
+	while ( !(cin >> value) || value < 1 || value > most )
+	{
+		if (cin.eof())
+			return false;
+		cin.clear();
+		cin.ignore(numeric_limits<streamsize>::max(), '\n');	//Drop the rest of a line that is not a number
+		cout << "Invalid Input - Please enter an integer from 1 to " << most << ": ";
+	}
+
+	return true;
+}
+
+void sim(SimConfig config)
+{
+	Stats averages;
+	ReplicationStats replications;
+	ReplicationStats allRuns;
+	vector<Stats> simData;
+	averages.initialize();
+
+
+	ofstream outputFile;
+	outputFile.open("output.txt");
+
+	int runs = config.antithetic ? 2 : 1;		//Runs per independent observation
+	bool precise = false;
+
+	//While run r is simulated, a background thread generates run r + 1's data file into the other buffer, so generating and writing data files
+	//is hidden behind simulating. Declared before prefetch, which finishes a load in flight when it is destroyed
+	vector<unsigned long long> traces(config.maxReplications * runs);
+	TracePrefetch prefetch;
+	auto load = [&](int run)
+	{
+		prefetch.start([&config, &traces, run, runs](Trace& customers)
+		{
+			string file = "data" + to_string(run + 1) + ".txt";
+			traces[run] = generate_replication(config, run / runs, run % runs == 1, file, customers);
+		});
+	};
+	load(0);
+
+	//Replications run until every interval is narrow enough, so each data file is generated only when it is needed
+	for (int i = 0; i < config.maxReplications && !precise; i++)
+	{
+		double observation[STATS_FIELDS] = {0};
+		for (int k = 0; k < runs; k++)
+		{
+			int run = simData.size();
+			string file = "data" + to_string(run + 1) + ".txt";
+			cout << "Running simulation #" << run + 1 << " on " << file << endl;
+			const Trace& customers = prefetch.take();
+			if (run + 1 < (int) traces.size())
+				load(run + 1);
+
+			Stats current;
+			run_replication(config, customers, run, traces[run], &current);
+			if (current.cached == true)
+				cout << "Reused the cached results of simulation #" << run + 1 << endl;
+			simData.push_back(current);
+			allRuns.push(current);
+
+			double values[STATS_FIELDS];
+			stats_fields(current, values);
+			for (int f = 0; f < STATS_FIELDS; f++)
+				observation[f] += values[f] / runs;
+		}
+		replications.push(observation);
+
+		if (i + 1 >= config.minReplications)
+			precise = replications.precise(config.precision, config.confidence, config.precisionFields);
+	}
+
+	//The run loaded after the last one is not needed
+	if (prefetch.pending())
+	{
+		prefetch.take();
+		remove(("data" + to_string(simData.size() + 1) + ".txt").c_str());
+	}
+
+	replications.averages(averages);
+	averages.max_wait = allRuns.maxWait.max();		//An antithetic pair's average hides the larger of its two maxima
+	averages.max_length = allRuns.maxLength.max();
+	int count = replications.count();
+
+	//Write stats from each simulation to output file
+	for (int i = 0; i < (int) simData.size(); i++)
+	{
+		outputFile << "Simulation #" << i + 1 << endl;
+		write_stats(outputFile, simData[i], config.singleLine, config.classes);
+		outputFile << endl;
+
+	}
+
+	//Write confidence intervals to output file
+	double confidence = config.confidence;
+	string unit = config.antithetic ? " antithetic pairs" : " Simulations";
+	string fields;
+	for (int f = 0; f < STATS_FIELDS; f++)
+		if ((config.precisionFields & (1 << f)) != 0 && (STATS_EXTREMES & (1 << f)) == 0)
+			fields += (fields.empty() ? "" : ", ") + string(STATS_NAMES[f]);
+	if (precise)
+		outputFile << "Stopped after " << count << unit << ": the interval of " << fields << " is within " << config.precision * 100 << "% of the mean" << endl;
+	else
+		outputFile << "Stopped after the maximum of " << count << unit << ": the interval of " << fields << " is not yet within " << config.precision * 100 << "% of the mean" << endl;
+	outputFile << "Averages of all " << count << unit << " (" << confidence * 100 << "% confidence intervals):" << endl;
+	outputFile << "Average CPU Time = ";
+	write_interval(outputFile, replications.cpu, confidence);
+	outputFile << "		Average Process Time = ";
+	write_interval(outputFile, replications.process, confidence);
+	outputFile << endl << "Average Waiting Time = ";
+	write_interval(outputFile, replications.wait, confidence);
+	outputFile << "	Max Waiting Time = " << averages.max_wait << " (per Simulation ";
+	write_interval(outputFile, replications.maxWait, confidence);
+	outputFile << ")	95th Percentile Waiting Time = ";
+	write_interval(outputFile, replications.p95Wait, confidence);
+	outputFile << endl << "Average Line Length = ";
+	write_interval(outputFile, replications.length, confidence);
+	outputFile << "		Max Line Length = " << averages.max_length << " (per Simulation ";
+	write_interval(outputFile, replications.maxLength, confidence);
+	outputFile << ")" << endl << "Average Total Teller Idle Time = ";
+	write_interval(outputFile, replications.idle, confidence);
+	outputFile << endl;
+	if (config.singleLine == false)
+	{
+		outputFile << "Average Routing Cost = ";
+		write_interval(outputFile, replications.route, confidence);
+		outputFile << " lines inspected per arrival" << endl;
+	}
+	if (replications.reneged.max() > 0)
+	{
+		outputFile << "Average Customers Reneged = ";
+		write_interval(outputFile, replications.reneged, confidence);
+		outputFile << endl;
+	}
+
+	//Queueing formulas for the first replication's customers, as a check on the simulation
+	TraceMoments moments;
+	Stats estimate;
+	trace_moments("data1.txt", moments);
+	analytic_estimate(config, moments, &estimate);
+	outputFile << endl << "Estimate for data1.txt:" << endl;
+	write_stats(outputFile, estimate, config.singleLine, config.classes);
+
+	cout << "End simulation after " << simData.size() << " replications" << endl;
+}
+
+void compare(SimConfig first, SimConfig second)
+{
+	ReplicationStats firstStats;
+	ReplicationStats secondStats;
+	ReplicationStats differences;
+
+	ofstream outputFile;
+	outputFile.open("output.txt");
+	outputFile << "Comparing " << describe(first) << " against " << describe(second) << " on common random numbers" << endl << endl;
+
+	int runs = first.antithetic ? 2 : 1;
+	double confidence = first.confidence;
+	bool precise = false;
+
+	//Both configurations run on the same data file and the same routing stream, so only the configuration differs between them
+	for (int i = 0; i < first.maxReplications && !precise; i++)
+	{
+		double a[STATS_FIELDS] = {0};
+		double b[STATS_FIELDS] = {0};
+		double d[STATS_FIELDS];
+		for (int k = 0; k < runs; k++)
+		{
+			int run = i * runs + k;
+			string file = "data" + to_string(run + 1) + ".txt";
+			cout << "Generating " << file << " and running simulation #" << run + 1 << " of both configurations" << endl;
+			unsigned long long trace = generate_replication(first, i, k == 1, file);
+
+			Stats one;
+			Stats two;
+			run_replication(first, file, run, trace, &one);
+			run_replication(second, file, run, trace, &two);
+
+			outputFile << "Simulation #" << run + 1 << ": Average Waiting Time = " << one.avg_wait << " vs " << two.avg_wait
+			           << "		Difference = " << one.avg_wait - two.avg_wait << endl;
+
+			double values[STATS_FIELDS];
+			stats_fields(one, values);
+			for (int f = 0; f < STATS_FIELDS; f++)
+				a[f] += values[f] / runs;
+			stats_fields(two, values);
+			for (int f = 0; f < STATS_FIELDS; f++)
+				b[f] += values[f] / runs;
+		}
+
+		for (int f = 0; f < STATS_FIELDS; f++)
+			d[f] = a[f] - b[f];
+		firstStats.push(a);
+		secondStats.push(b);
+		differences.push(d);
+
+		//The question is which configuration waits less, so only the waiting time difference has to be precise
+		if (i + 1 >= first.minReplications)
+			precise = differences.wait.halfWidth(confidence) <= first.precision * fabs(differences.wait.mean());
+	}
+
+	int count = differences.count();
+	double t = t_quantile(confidence, max(count - 1, 1));
+	string names[STATS_FIELDS] = {"CPU Time", "Process Time", "Average Waiting Time", "Average Line Length", "Max Waiting Time",
+	                              "Max Line Length", "Total Teller Idle Time", "Routing Cost", "95th Percentile Waiting Time", "Customers Reneged",
+	                              "Class 1 Average Waiting Time", "Class 2 Average Waiting Time", "Class 3 Average Waiting Time", "Class 4 Average Waiting Time"};
+
+	outputFile << endl << (precise ? "Stopped after " : "Stopped after the maximum of ") << count << (first.antithetic ? " antithetic pairs" : " replications")
+	           << " (" << confidence * 100 << "% confidence intervals, first - second):" << endl;
+
+	//CPU time is left out: it measures the machine, not the bank
+	for (int f = 1; f < STATS_FIELDS; f++)
+	{
+		const RunningStat& one = firstStats.field(f);
+		const RunningStat& two = secondStats.field(f);
+		double independent = (count < 2) ? 0 : t * sqrt((one.variance() + two.variance()) / count);
+
+		outputFile << names[f] << ": ";
+		write_interval(outputFile, one, confidence);
+		outputFile << " vs ";
+		write_interval(outputFile, two, confidence);
+		outputFile << "		Difference = ";
+		write_interval(outputFile, differences.field(f), confidence);
+		outputFile << "	(independent runs: +- " << independent << ")" << endl;
+	}
+
+	//Replications scale with the variance of the difference, so the ratio of variances is the saving
+	double paired = differences.wait.variance();
+	double unpaired = firstStats.wait.variance() + secondStats.wait.variance();
+	if (paired > 0)
+		outputFile << "Independent runs would need about " << unpaired / paired << " times as many replications for the same waiting time interval" << endl;
+
+	cout << "End comparison after " << count << " replications" << endl;
+}
+
+void optimize_staffing(SimConfig config, int metric, double threshold)
+{
+	ofstream outputFile;
+	outputFile.open("output.txt");
+
+	int generated = 0;
+	long long simulations = 0;
+	map<int, bool> verdicts;
+
+	//Warm start from the analytic estimate for the first replication's customers
+	TraceMoments moments;
+	generate_replication(config, 0, false, "data1.txt");
+	generated = 1;
+	trace_moments("data1.txt", moments);
+	int guess = staffing_estimate(config, metric, threshold, moments);
+	config.n = 0;
+
+	outputFile << "Minimum n for " << metric_name(metric) << " <= " << threshold << ": " << describe(config) << endl;
+	outputFile << "Arrival rate = " << moments.rate << "		Mean transaction time = " << moments.service_mean << "		Analytic estimate n = " << guess << endl << endl;
+
+	auto feasible = [&](int n) -> bool
+	{
+		if (verdicts.count(n) == 0)
+		{
+			config.n = n;
+			//The day is finite, so even an n under the offered load has a bounded wait that can meet the target: every candidate is simulated
+			verdicts[n] = staffing_feasible(config, metric, threshold, generated, simulations, outputFile);
+		}
+		return verdicts[n];
+	};
+
+	//Find a bracket (low infeasible, high feasible) around the estimate by doubling steps, then bisect it
+	int low = 0;
+	int high = -1;
+	int step = 1;
+	if (feasible(guess))
+	{
+		high = guess;
+		while (high - step > low)
+		{
+			if (feasible(high - step))
+			{
+				high = high - step;
+				step *= 2;
+			}
+			else
+			{
+				low = high - step;
+			}
+		}
+	}
+	else
+	{
+		low = guess;
+		while (high == -1 && low < OPT_MAX_TELLERS)
+		{
+			int next = min(low + step, OPT_MAX_TELLERS);
+			if (feasible(next))
+				high = next;
+			else
+				low = next;
+			step *= 2;
+		}
+	}
+
+	while (high != -1 && high - low > 1)
+	{
+		int mid = (low + high) / 2;
+		if (feasible(mid))
+			high = mid;
+		else
+			low = mid;
+	}
+
+	outputFile << endl;
+	if (high == -1)
+		outputFile << "No n up to " << OPT_MAX_TELLERS << " meets the target" << endl;
+	else
+		outputFile << "Minimum n = " << high << endl;
+	outputFile << "Ran " << simulations << " simulations of " << verdicts.size() << " candidates; a sweep of n = 1 - " << (high == -1 ? OPT_MAX_TELLERS : high)
+	           << " with " << config.maxReplications << " replications each would run " << (long long) (high == -1 ? OPT_MAX_TELLERS : high) * config.maxReplications << endl;
+
+	cout << "End optimization: minimum n = " << high << endl;
+}
+
+bool staffing_feasible(SimConfig config, int metric, double threshold, int& generated, long long& simulations, ostream& out)
+{
+	RunningStat values;
+	for (int i = 0; i < config.maxReplications; i++)
+	{
+		//Every candidate runs on the same data files (common random numbers), so each is generated once
+		string file = "data" + to_string(i + 1) + ".txt";
+		if (i >= generated)
+		{
+			generate_replication(config, i, false, file);
+			generated = i + 1;
+		}
+
+		Stats current;
+		run_replication(config, file, i, trace_key(config, i, false), &current);
+		if (current.cached == false)
+			simulations++;
+		values.push(metric_value(current, metric));
+
+		//Stop as soon as the interval is clearly on one side of the threshold
+		if (i + 1 >= config.minReplications)
+		{
+			double halfWidth = values.halfWidth(config.confidence);
+			if (values.mean() - halfWidth > threshold || values.mean() + halfWidth <= threshold)
+				break;
+		}
+	}
+
+	bool verdict = (values.mean() <= threshold);
+	out << "n = " << config.n << ": " << metric_name(metric) << " = ";
+	write_interval(out, values, config.confidence);
+	out << " after " << values.count() << " replications -> " << (verdict ? "feasible" : "infeasible") << endl;
+
+	return verdict;
+}
+
+int staffing_estimate(SimConfig config, int metric, double threshold, const TraceMoments& moments)
+{
+	if (config.routing != ROUTE_ROUND_ROBIN)
+		config.singleLine = true;
+
+	for (int n = 1; n < OPT_MAX_TELLERS; n++)
+	{
+		Stats estimate;
+		config.n = n;
+		analytic_estimate(config, moments, &estimate);
+
+		if (estimate.unstable == false && metric_value(estimate, metric) <= threshold)
+			return n;
+	}
+
+	return OPT_MAX_TELLERS;
+}
+
+double metric_value(const Stats& simData, int metric)
+{
+	if (metric == OPT_AVG_WAIT)
+		return simData.avg_wait;
+	if (metric == OPT_P95_WAIT)
+		return simData.p95_wait;
+
+	return simData.max_wait;
+}
+
+string metric_name(int metric)
+{
+	string names[] = {"Average Waiting Time", "95th Percentile Waiting Time", "Max Waiting Time"};
+	return names[metric];
+}
+
+void long_run(SimConfig config, long long limit)
+{
+	double rate = (double) MAX_ARRIVALS / 100001;		//Same customers per unit of time as generate_events
+
+	//Stop well before the clock could overflow: about 10^9 customers with 32 bit SimTime, none a run could reach with LONG_HORIZON
+	limit = min(limit, (long long) (rate * (SIMTIME_MAX / 2)));
+
+	ofstream outputFile;
+	outputFile.open("output.txt");
+	outputFile << long_run_title(config, rate) << endl;
+
+	//Transaction times of 1 - 100 average 50.5; at or over n busy tellers the lines grow forever
+	if (rate * 50.5 >= config.n)
+	{
+		outputFile << "Offered load = " << rate * 50.5 << " tellers: with n = " << config.n << " the lines grow without bound, so there is no steady state" << endl;
+		cout << "End long run: unstable" << endl;
+		return;
+	}
+
+	LongRunState state;
+	state.initialize();
+	allocate_long_run(state, config, rate, limit);
+
+	Arrival* temp = next_arrival(state.time, rate, state.arrivals, state.service, state.pool);
+	state.eventQueue.enqueue(temp, temp->getArrivalTime());
+	state.generated = 1;
+
+	run_long_run(state, outputFile);
+}
+
+void resume_long_run()
+{
+	LongRunState state;
+	state.initialize();
+	bool loaded = load_long_run(state, LONG_RUN_SNAPSHOT_FILE);
+
+	ofstream outputFile;
+	outputFile.open("output.txt");
+	if (loaded == false)
+	{
+		outputFile << "Could not restore a long run from " << LONG_RUN_SNAPSHOT_FILE << endl;
+		cout << "End long run: no snapshot" << endl;
+		free_long_run(state);
+		return;
+	}
+
+	outputFile << long_run_title(state.config, state.rate) << endl;
+	cout << "Resuming long run after " << state.waits.count() << " customers" << endl;
+	run_long_run(state, outputFile);
+}
+
+string long_run_title(SimConfig config, double rate)
+{
+	ostringstream title;
+	title << "Long run: " << describe(config) << ", Poisson arrivals at rate " << rate << ", transaction times 1 - 100";
+	return title.str();
+}
+
+void allocate_long_run(LongRunState& state, SimConfig config, double rate, long long limit)
+{
+	state.config = config;
+	state.rate = rate;
+	state.limit = limit;
+	state.arrivals = RandomStream(config.seed, STREAM_ARRIVALS);
+	state.service = RandomStream(config.seed, STREAM_SERVICE);
+	state.routing = RandomStream(config.seed, STREAM_ROUTING);
+
+	state.lineCount = (config.singleLine == true) ? 1 : config.n;
+	state.bankLines = new ArrayQueue*[state.lineCount];
+	for (int i = 0; i < state.lineCount; i++)
+		state.bankLines[i] = new ArrayQueue(LONG_RUN_LINE);
+
+	state.tellers = new TellerArray(config.n);
+	if (config.singleLine == false)
+	{
+		state.lengths = new LineLengths(config.n);
+		state.router = new Router(config.routing, config.n, config.choices, &state.routing);
+	}
+}
+
+void run_long_run(LongRunState& state, ostream& outputFile)
+{
+	state.started = clock();
+	bool stable = stream_events(state);
+	double simulation_time = state.cpuTime + (clock() - state.started) / (double) CLOCKS_PER_SEC;
+
+	BatchMeans& waits = state.waits;
+	SimConfig config = state.config;
+	outputFile << "CPU Time = " << simulation_time << "		Customers Served = " << waits.count() << endl;
+
+	if (stable == false)
+	{
+		outputFile << "A line reached " << LONG_RUN_LINE << " customers: the tellers cannot keep up, so there is no steady state" << endl;
+		cout << "End long run: unstable" << endl;
+		free_long_run(state);
+		return;
+	}
+
+	outputFile << "Warm-up Deleted = " << waits.warmup() << " batches (" << waits.warmup() * waits.batchSize() << " customers)" << endl;
+	outputFile << "Batch Size = " << waits.batchSize() << " customers		Batches Used = " << waits.batches()
+	           << "		Lag 1 Autocorrelation of Batch Means = " << waits.lag1() << endl;
+	outputFile << "Steady-State Average Waiting Time = " << waits.mean() << " +- " << waits.halfWidth(config.confidence)
+	           << " (" << config.confidence * 100 << "% confidence)" << endl;
+	if (long_run_done(waits, config))
+		outputFile << "Stopped once the interval was within " << config.precision * 100 << "% of the mean" << endl;
+	else
+		outputFile << "Stopped at the limit of " << state.limit << " customers before reaching " << config.precision * 100 << "% precision" << endl;
+
+	cout << "End long run after " << waits.count() << " customers" << endl;
+	free_long_run(state);
+}
+
+bool long_run_done(const BatchMeans& waits, SimConfig config)
+{
+	if (waits.batches() < BATCH_COUNT / 2)
+		return false;
+
+	return fabs(waits.lag1()) <= LONG_RUN_MAX_LAG1 && waits.halfWidth(config.confidence) <= config.precision * fabs(waits.mean());
+}
+
+Arrival* next_arrival(double& time, double rate, RandomStream& arrivals, RandomStream& service, CustomerPool& pool)
+{
+	time += -log(1 - arrivals.uniform()) / rate;		//Exponential gap
+	return pool.acquire((SimTime) time, service.below(100) + 1);
+}
+
+bool stream_events(LongRunState& state)
+{
+	bool stable = true;
+	pid_t child = 0;
+	long long events = 0;
+	long long maxLine = 0;				//Most customers waiting in any one line, which only grows on arrivals
+	SimTime now = 0;
+	telemetry.start();
+
+	while ( !state.eventQueue.isEmpty() && state.eventQueue.peekPriority() < state.until )
+	{
+		now = state.eventQueue.peekPriority();
+
+		if ((++events & (TELEMETRY_EVERY - 1)) == 0)
+		{
+			telemetry.publish(now, events, state.eventQueue.size(), maxLine, state.pool.allocations() + state.eventQueue.allocations());
+		}
+
+		Event* nextEvent = state.eventQueue.peekFront();
+		if (nextEvent->getType() == true)
+		{
+			if (state.config.singleLine == true)
+			{
+				if (state.bankLines[0]->isFull())
+				{
+					stable = false;
+					break;
+				}
+
+				state.eventQueue.dequeue();
+				process_ArrivalA(static_cast<Arrival*> (nextEvent), &state.eventQueue, state.bankLines[0], *state.tellers);
+				maxLine = max(maxLine, (long long) state.bankLines[0]->getCount());
+			}
+			else
+			{
+				//No single line can be longer than all of them together, so this is checked before routing picks one
+				if (state.lengths->waiting() >= LONG_RUN_LINE - 1)
+				{
+					stable = false;
+					break;
+				}
+
+				state.eventQueue.dequeue();
+				process_ArrivalB(static_cast<Arrival*> (nextEvent), &state.eventQueue, state.bankLines, *state.tellers, *state.lengths, *state.router);
+				maxLine = max(maxLine, (long long) state.lengths->get(static_cast<Arrival*> (nextEvent)->getQueueIndex()) - 1);	//1 of the line is at its teller
+			}
+
+			//Only the next arrival is ever scheduled, so memory does not grow with the run
+			if (state.generated < state.limit)
+			{
+				Arrival* temp = next_arrival(state.time, state.rate, state.arrivals, state.service, state.pool);
+				state.eventQueue.enqueue(temp, temp->getArrivalTime());
+				state.generated++;
+			}
+		}
+		else
+		{
+			Departure* nextDeparture = static_cast<Departure*> (nextEvent);
+			SimTime wait = nextDeparture->getDepartureTime() - nextDeparture->getTransactionLength() - nextDeparture->getArrivalTime();
+			state.waits.push(wait);
+
+			if (state.config.singleLine == true)
+				process_DepartureA(nextDeparture, &state.eventQueue, state.bankLines[0], *state.tellers);
+			else
+				process_DepartureB(nextDeparture, &state.eventQueue, state.bankLines, *state.tellers, *state.lengths, *state.router);
+			state.pool.release(nextDeparture);
+
+			if (state.branching == true)
+			{
+				state.branchWaits.push(wait);
+				state.branchHistogram.add(wait);
+				continue;
+			}
+
+			if (state.waits.count() % LONG_RUN_CHECK == 0 && long_run_done(state.waits, state.config))
+				break;
+			if (state.waits.count() % LONG_RUN_SNAPSHOT == 0)
+				child = snapshot_long_run(state, child);
+		}
+
+	}
+	telemetry.finish(now, events, maxLine, state.pool.allocations() + state.eventQueue.allocations());
+
+	//The last snapshot is finished before the run reports, so a resume always finds it
+	if (child > 0)
+		waitpid(child, NULL, 0);
+
+	return stable;
+}
+
+pid_t snapshot_long_run(LongRunState& state, pid_t previous)
+{
+	if (previous > 0 && waitpid(previous, NULL, WNOHANG) == 0)
+		return previous;
+
+	//A forked child's CPU clock starts at 0, so the time so far is worked out here
+	double used = state.cpuTime + (clock() - state.started) / (double) CLOCKS_PER_SEC;
+	double before = state.cpuTime;
+	state.cpuTime = used;
+
+	pid_t child = fork();
+	if (child == 0)
+	{
+		//_exit skips the destructors and stream buffers that belong to the parent
+		_exit(save_long_run(state, LONG_RUN_SNAPSHOT_FILE) ? 0 : 1);
+	}
+	else if (child < 0)
+	{
+		save_long_run(state, LONG_RUN_SNAPSHOT_FILE);
+		child = 0;
+	}
+
+	state.cpuTime = before;
+	return child;
+}
+
+bool save_long_run(const LongRunState& state, string file)
+{
+	string temporary = file + ".tmp";
+	Snapshot out(temporary, true);
+
+	out.put(state.config);
+	out.put(state.rate);
+	out.put(state.limit);
+	out.put(state.time);
+	out.put(state.generated);
+	out.put(state.cpuTime);
+	state.arrivals.save(out);
+	state.service.save(out);
+	state.routing.save(out);
+	state.waits.save(out);
+	state.tellers->save(out);
+	if (state.config.singleLine == false)
+	{
+		state.lengths->save(out);
+		state.router->save(out);
+	}
+
+	state.eventQueue.save(out);
+	for (int i = 0; i < state.lineCount; i++)
+		state.bankLines[i]->save(out);
+
+	if (out.close() == false)
+	{
+		remove(temporary.c_str());
+		return false;
+	}
+
+	return rename(temporary.c_str(), file.c_str()) == 0;
+}
+
+bool load_long_run(LongRunState& state, string file)
+{
+	Snapshot in(file, false);
+
+	SimConfig config;
+	double rate = 0;
+	long long limit = 0;
+	config.initialize();
+	in.get(config);
+	in.get(rate);
+	in.get(limit);
+	//Only a run long_run would have started: a stable rate, and a configuration the prompts accept
+	if (in.good() == false || config.n < 1 || config.n > PROMPT_MAX_COUNT || config.routing < ROUTE_SHORTEST || config.routing > ROUTE_ROUND_ROBIN ||
+		!(rate > 0 && rate * 50.5 < config.n) || limit < 1)
+		return false;
+
+	allocate_long_run(state, config, rate, limit);
+	in.get(state.time);
+	in.get(state.generated);
+	in.get(state.cpuTime);
+	if (in.good() == false || !(state.time >= 0) || state.generated < 1 || state.generated > limit || !(state.cpuTime >= 0))
+		return false;
+
+	if (state.arrivals.load(in) == false || state.service.load(in) == false || state.routing.load(in) == false || state.waits.load(in) == false ||
+		state.tellers->load(in) == false)
+		return false;
+	if (state.waits.count() > state.generated)
+		return false;
+	if (config.singleLine == false && (state.lengths->load(in) == false || state.router->load(in) == false))
+		return false;
+
+	if (state.eventQueue.load(in) == false)
+		return false;
+	for (int i = 0; i < state.lineCount; i++)
+	{
+		if (state.bankLines[i]->load(in) == false)
+			return false;
+	}
+
+	return true;
+}
+
+void what_if(SimConfig config, SimTime branchTime, SimTime horizon, vector<WhatIf> variants)
+{
+	double rate = (double) MAX_ARRIVALS / 100001;		//Same customers per unit of time as generate_events
+	variants.insert(variants.begin(), WhatIf());
+	variants[0].initialize();
+	variants[0].routing = config.routing;
+	variants[0].choices = config.choices;
+
+	//Arrivals are only limited by the end of the comparison
+	LongRunState state;
+	state.initialize();
+	allocate_long_run(state, config, rate, LLONG_MAX);
+	state.branching = true;
+	state.until = branchTime;
+
+	Arrival* temp = next_arrival(state.time, rate, state.arrivals, state.service, state.pool);
+	state.eventQueue.enqueue(temp, temp->getArrivalTime());
+	state.generated = 1;
+
+	cout << "Running the shared prefix up to time " << branchTime << endl;
+	clock_t start = clock();
+	bool stable = stream_events(state);
+	double prefix_time = (clock() - start) / (double) CLOCKS_PER_SEC;
+
+	ofstream outputFile;
+	outputFile.open("output.txt");
+	outputFile << "What-if: " << long_run_title(config, rate) << endl;
+	outputFile << "Shared Prefix: 0 - " << branchTime << "		CPU Time = " << prefix_time << "		Customers Served = " << state.waits.count()
+	           << "		Customers in the Bank = " << state.generated - 1 - state.waits.count() << endl;
+
+	if (stable == false)
+	{
+		outputFile << "A line reached " << LONG_RUN_LINE << " customers before the branch time, so there is nothing to compare" << endl;
+		cout << "End what-if: unstable" << endl;
+		free_long_run(state);
+		return;
+	}
+
+	//Every child starts from the state as it is now and reports back through its own pipe
+	state.until = branchTime + horizon;
+	int count = variants.size();
+	vector<BranchResult> results(count);
+	vector<int> readers(count, -1);
+	vector<pid_t> children(count, -1);
+	for (int k = 0; k < count; k++)
+	{
+		results[k].initialize();
+		int fds[2];
+		if (pipe(fds) != 0)
+			continue;
+
+		children[k] = fork();
+		if (children[k] == 0)
+		{
+			close(fds[0]);
+			telemetry.detach();		//The children would all publish to the parent's page at once
+			BranchResult result = run_what_if(state, variants[k], branchTime);
+			_exit(write(fds[1], &result, sizeof(result)) == (ssize_t) sizeof(result) ? 0 : 1);
+		}
+
+		close(fds[1]);
+		if (children[k] < 0)
+			close(fds[0]);
+		else
+			readers[k] = fds[0];
+	}
+
+	cout << "Comparing " << count << " variants from time " << branchTime << " to " << branchTime + horizon << endl;
+	for (int k = 0; k < count; k++)
+	{
+		if (readers[k] < 0)
+			continue;
+
+		BranchResult result;
+		if (read(readers[k], &result, sizeof(result)) == (ssize_t) sizeof(result))
+		{
+			results[k] = result;
+			results[k].ok = true;
+		}
+		close(readers[k]);
+		waitpid(children[k], NULL, 0);
+	}
+
+	outputFile << "Variants Compared: " << branchTime << " - " << branchTime + horizon << ", each on the same customers" << endl;
+	for (int k = 0; k < count; k++)
+	{
+		BranchResult& r = results[k];
+		outputFile << endl << "Variant #" << k << ": " << describe_what_if(config, variants[k]) << endl;
+		if (r.ok == false)
+		{
+			outputFile << "Could not be run" << endl;
+			continue;
+		}
+
+		outputFile << "CPU Time = " << r.CPU_time << "		Customers Served = " << r.served << "		Customers Left in the Bank = " << r.in_bank << endl;
+		outputFile << "Average Waiting Time = " << r.avg_wait << "		95th Percentile Waiting Time = " << r.p95_wait << "		Max Waiting Time = " << r.max_wait << endl;
+		if (r.stable == false)
+			outputFile << "A line reached " << LONG_RUN_LINE << " customers, so this variant stopped early" << endl;
+
+		if (k > 0 && results[0].ok)
+		{
+			outputFile << "Change from Variant #0: Average Waiting Time " << showpos << r.avg_wait - results[0].avg_wait
+			           << "		95th Percentile Waiting Time " << r.p95_wait - results[0].p95_wait
+			           << "		Max Waiting Time " << r.max_wait - results[0].max_wait
+			           << "		Customers Served " << r.served - results[0].served << noshowpos << endl;
+		}
+	}
+
+	cout << "End what-if" << endl;
+	free_long_run(state);
+}
+
+BranchResult run_what_if(LongRunState& state, WhatIf variant, SimTime branchTime)
+{
+	BranchResult result;
+	result.initialize();
+
+	//Only waits after the branch are compared
+	state.branchWaits = RunningStat();
+	state.branchHistogram = WaitHistogram();
+
+	clock_t start = clock();
+	apply_what_if(state, variant, branchTime);
+	result.stable = stream_events(state);
+	result.CPU_time = (clock() - start) / (double) CLOCKS_PER_SEC;
+
+	result.served = state.branchWaits.count();
+	result.avg_wait = state.branchWaits.mean();
+	result.p95_wait = state.branchHistogram.quantile(0.95);
+	result.max_wait = (SimTime) state.branchWaits.max();
+	result.in_bank = state.generated - 1 - state.waits.count();		//One arrival is always scheduled but has not arrived
+	return result;
+}
+
+void apply_what_if(LongRunState& state, WhatIf variant, SimTime branchTime)
+{
+	int n = state.config.n;
+	int grown = n + variant.extra;
+
+	if (variant.extra > 0)
+	{
+		TellerArray* tellers = new TellerArray(grown);
+		for (int i = 0; i < n; i++)
+		{
+			if (state.tellers->isAvailable(i) == false)
+				tellers->setBusy(i);
+		}
+		delete state.tellers;
+		state.tellers = tellers;
+	}
+
+	if (state.config.singleLine == true)
+	{
+		//New tellers take the customers who are already waiting
+		int index;
+		while ( !state.bankLines[0]->isEmpty() && state.tellers->findAvailable(index) )
+		{
+			Arrival* nextCustomer = static_cast<Arrival*> (state.bankLines[0]->peekFront());
+			state.bankLines[0]->dequeue();
+
+			SimTime departureTime = branchTime + nextCustomer->getTransactionLength();
+			state.eventQueue.enqueue(nextCustomer->depart(departureTime), departureTime);
+			state.tellers->setBusy(index);
+			nextCustomer->setQueueIndex(index);
+		}
+
+		state.config.n = grown;
+		return;
+	}
+
+	if (variant.extra > 0)
+	{
+		ArrayQueue** bankLines = new ArrayQueue*[grown];
+		for (int i = 0; i < grown; i++)
+			bankLines[i] = (i < n) ? state.bankLines[i] : new ArrayQueue(LONG_RUN_LINE);
+		delete[] state.bankLines;
+		state.bankLines = bankLines;
+		state.lineCount = grown;
+
+		LineLengths* lengths = new LineLengths(grown);
+		for (int i = 0; i < n; i++)
+		{
+			for (int k = 0; k < state.lengths->get(i); k++)
+				lengths->increment(i);
+		}
+		delete state.lengths;
+		state.lengths = lengths;
+	}
+
+	//The new Router only knows the open lines; join idle teller starts with all of them listed and skips the busy ones
+	int open = max(1, grown - variant.closed);
+	delete state.router;
+	state.router = new Router(variant.routing, open, variant.choices, &state.routing);
+
+	state.config.n = grown;
+	state.config.routing = variant.routing;
+	state.config.choices = variant.choices;
+}
+
+string describe_what_if(SimConfig config, WhatIf variant)
+{
+	bool same = variant.extra == 0 && variant.closed == 0;
+	if (config.singleLine == false)
+		same = same && variant.routing == config.routing && (variant.routing != ROUTE_POWER_OF_D || variant.choices == config.choices);
+	if (same == true)
+		return "As is, " + describe(config);
+
+	config.n += variant.extra;
+	config.routing = variant.routing;
+	config.choices = variant.choices;
+	string closed = (variant.closed > 0) ? ", " + to_string(variant.closed) + " closed" : "";
+	return describe(config) + closed;
+}
+
+void serve(string path, int workers)
+{
+	int listener = listen_server(path);
+	if (listener < 0)
+	{
+		cout << "Could not listen on " << path << endl;
+		return;
+	}
+
+	TraceStore traces;
+	deque<pair<shared_ptr<ServerRequest>, int> > jobs;		//Replications no worker has started yet
+	mutex guard;
+	condition_variable ready;
+	bool stopping = false;
+
+	//Workers finish every job queued before a shutdown, so each request already read is answered
+	auto work = [&]()
+	{
+		while (true)
+		{
+			pair<shared_ptr<ServerRequest>, int> job;
+			{
+				unique_lock<mutex> lock(guard);
+				ready.wait(lock, [&]() { return !jobs.empty() || stopping; });
+				if (jobs.empty())
+					return;
+				job = jobs.front();
+				jobs.pop_front();
+			}
+
+			serve_replication(*job.first, job.second, traces);
+		}
+	};
+
+	vector<thread> pool;
+	for (int i = 0; i < workers; i++)
+		pool.push_back(thread(work));
+
+	cout << "Serving on " << path << " with " << workers << " worker threads" << endl;
+	vector<shared_ptr<ServerConnection> > connections;
+	bool shuttingDown = false;
+	while (shuttingDown == false)
+	{
+		vector<pollfd> polled(connections.size() + 1);
+		polled[0].fd = listener;
+		polled[0].events = POLLIN;
+		for (int i = 0; i < (int) connections.size(); i++)
+		{
+			polled[i + 1].fd = connections[i]->socket.descriptor();
+			polled[i + 1].events = POLLIN;
+		}
+
+		if (poll(polled.data(), polled.size(), -1) < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		//Connections that hung up or stopped sending are dropped from the poll, and closed once their last request is answered
+		vector<shared_ptr<ServerConnection> > open;
+		for (int i = 0; i < (int) connections.size(); i++)
+		{
+			if (polled[i + 1].revents == 0 || shuttingDown == true)
+			{
+				open.push_back(connections[i]);
+				continue;
+			}
+
+			vector<string> lines;
+			bool reading = connections[i]->socket.readLines(lines);
+			for (int l = 0; l < (int) lines.size() && shuttingDown == false; l++)
+			{
+				if (lines[l] == "shutdown")
+				{
+					shared_ptr<ServerRequest> request = open_request("", connections[i]);
+					answer_request(*request, "done shutdown", true);
+					shuttingDown = true;
+					break;
+				}
+
+				shared_ptr<ServerRequest> request = open_request(lines[l], connections[i]);
+				lock_guard<mutex> lock(guard);
+				for (int run = 0; run < request->replications; run++)
+					jobs.push_back(make_pair(request, run));
+				ready.notify_all();
+			}
+
+			if (reading == true)
+				open.push_back(connections[i]);
+		}
+		connections.swap(open);
+
+		if (shuttingDown == false && (polled[0].revents & POLLIN) != 0)
+		{
+			int fd = accept(listener, NULL, NULL);
+			if (fd >= 0)
+				connections.push_back(make_shared<ServerConnection>(fd));
+			else if (errno != EINTR && errno != ECONNABORTED && errno != EAGAIN)
+				break;
+		}
+	}
+
+	{
+		lock_guard<mutex> lock(guard);
+		stopping = true;
+	}
+	ready.notify_all();
+	for (int i = 0; i < workers; i++)
+		pool[i].join();
+
+	connections.clear();
+	close(listener);
+	unlink(path.c_str());
+	cout << "End server" << endl;
+}
+
+shared_ptr<ServerRequest> open_request(string line, shared_ptr<ServerConnection> connection)
+{
+	shared_ptr<ServerRequest> request = make_shared<ServerRequest>();
+	request->connection = connection;
+	request->replications = 0;
+	request->finished = 0;
+	request->hot = 0;
+	request->cached = 0;
+	request->start = chrono::steady_clock::now();
+	request->complete = false;
+	{
+		lock_guard<mutex> lock(connection->guard);
+		connection->answering.push_back(request);
+	}
+
+	string error;
+	if (line.empty() == false && parse_request(line, request->config, request->replications, request->metrics, error) == false)
+	{
+		request->replications = 0;
+		answer_request(*request, "error " + error, true);
+	}
+	else
+	{
+		request->results.resize(request->replications);
+	}
+
+	return request;
+}
+
+void serve_replication(ServerRequest& request, int run, TraceStore& traces)
+{
+	ServerConnection& connection = *request.connection;
+	bool skip;
+	{
+		lock_guard<mutex> lock(connection.guard);
+		skip = connection.hungUp || request.failed.empty() == false;
+	}
+
+	Stats current;
+	current.initialize();
+	bool inMemory = false;
+	string failed;
+	if (skip == false)
+	{
+		try
+		{
+			store_replication(request.config, run, traces, &current, inMemory);
+		}
+		catch (const exception& e)
+		{
+			failed = "could not run replication " + to_string(run + 1) + ": " + e.what();
+		}
+	}
+
+	ostringstream line;
+	if (skip == false && failed.empty() == true)
+	{
+		double values[STATS_FIELDS];
+		stats_fields(current, values);
+		line << "run=" << run + 1;
+		for (int m = 0; m < (int) request.metrics.size(); m++)
+			line << " " << STATS_NAMES[request.metrics[m]] << "=" << values[request.metrics[m]];
+	}
+
+	//The run's line goes in with the count of finished replications, so the last replication to finish cannot answer "done" before it
+	bool last;
+	{
+		lock_guard<mutex> lock(connection.guard);
+		request.results[run] = current;
+		if (current.cached == true)
+			request.cached++;
+		else if (inMemory == true)
+			request.hot++;
+		if (failed.empty() == false && request.failed.empty() == true)
+			request.failed = failed;
+		if (line.tellp() > 0)
+			request.lines.push_back(line.str());
+		last = (++request.finished == request.replications);
+		write_answers(connection);
+	}
+
+	if (last == false)
+		return;
+
+	//Every other replication is done, so nothing else touches request's results now
+	if (request.failed.empty() == false)
+	{
+		answer_request(request, "error " + request.failed, true);
+		return;
+	}
+
+	ReplicationStats results;
+	for (int i = 0; i < request.replications; i++)
+		results.push(request.results[i]);
+
+	ostringstream means;
+	ostringstream halfWidths;
+	means << "mean";
+	halfWidths << "halfwidth";
+	for (int m = 0; m < (int) request.metrics.size(); m++)
+	{
+		means << " " << STATS_NAMES[request.metrics[m]] << "=" << results.field(request.metrics[m]).mean();
+		halfWidths << " " << STATS_NAMES[request.metrics[m]] << "=" << results.field(request.metrics[m]).halfWidth(0.95);
+	}
+
+	double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - request.start).count();
+	ostringstream done;
+	done << "done replications=" << request.replications << " hot=" << request.hot << " cached=" << request.cached << " ms=" << ms;
+	answer_request(request, means.str(), false);
+	answer_request(request, halfWidths.str(), false);
+	answer_request(request, done.str(), true);
+}
+
+void answer_request(ServerRequest& request, string line, bool last)
+{
+	ServerConnection& connection = *request.connection;
+	lock_guard<mutex> lock(connection.guard);
+	request.lines.push_back(line);
+	request.complete = request.complete || last;		//Nothing reopens a request once its last line is in
+	write_answers(connection);
+}
+
+void write_answers(ServerConnection& connection)
+{
+	while (connection.answering.empty() == false)
+	{
+		ServerRequest& oldest = *connection.answering.front();
+		for (int i = 0; i < (int) oldest.lines.size(); i++)
+		{
+			if (connection.hungUp == false && connection.socket.writeLine(oldest.lines[i]) == false)
+				connection.hungUp = true;
+		}
+		oldest.lines.clear();
+
+		if (oldest.complete == false)
+			return;
+		connection.answering.pop_front();		//Drops the request's hold on connection too
+	}
+}
+
+bool parse_request(string request, SimConfig& config, int& replications, vector<int>& metrics, string& error)
+{
+	config.initialize();
+	config.n = 0;
+	config.generatorThreads = 1;		//Each replication already runs on a worker thread of its own
+	replications = config.minReplications;
+	metrics.clear();
+
+	bool modeSet = false;
+	istringstream tokens(request);
+	string token;
+	while (tokens >> token)
+	{
+		size_t equals = token.find('=');
+		if (equals == string::npos)
+		{
+			error = "expected key=value, got " + token;
+			return false;
+		}
+
+		string key = token.substr(0, equals);
+		string value = token.substr(equals + 1);
+		char* end = NULL;
+		long long number = strtoll(value.c_str(), &end, 10);
+		bool numeric = !value.empty() && *end == '\0';
+
+		if (key == "mode" && (value == "a" || value == "b"))
+		{
+			config.singleLine = (value == "a");
+			modeSet = true;
+		}
+		else if (key == "n" && numeric && number >= 1 && number <= OPT_MAX_TELLERS)
+			config.n = number;
+		else if (key == "routing" && value.size() == 1 && string("sdir").find(value[0]) != string::npos)
+		{
+			int modes[] = {ROUTE_SHORTEST, ROUTE_POWER_OF_D, ROUTE_JOIN_IDLE, ROUTE_ROUND_ROBIN};
+			config.routing = modes[string("sdir").find(value[0])];
+		}
+		else if (key == "choices" && numeric && number >= 1 && number <= OPT_MAX_TELLERS)
+			config.choices = number;
+		else if (key == "seed" && numeric && number >= 0)
+			config.seed = number;
+		else if (key == "replications" && numeric && number >= 1 && number <= SERVER_MAX_REPLICATIONS)
+			replications = number;
+		else if (key == "cache" && (value == "0" || value == "1"))
+			config.cache = (value == "1");
+		else if (key == "metrics")
+		{
+			istringstream names(value);
+			string name;
+			while (getline(names, name, ','))
+			{
+				int m = 0;
+				while (m < STATS_FIELDS && name != STATS_NAMES[m])
+					m++;
+				if (m == STATS_FIELDS)
+				{
+					error = "unknown metric " + name;
+					return false;
+				}
+				metrics.push_back(m);
+			}
+		}
+		else
+		{
+			error = "bad option " + token;
+			return false;
+		}
+	}
+
+	if (modeSet == false || config.n == 0)
+	{
+		error = "mode and n are required";
+		return false;
+	}
+
+	if (metrics.empty())
+	{
+		for (int m = 0; m < STATS_FIELDS; m++)
+			metrics.push_back(m);
+	}
+
+	return true;
+}
+
+void store_replication(SimConfig config, int run, TraceStore& traces, Stats* simData, bool& hot)
+{
+	hot = false;
+	unsigned long long trace = trace_key(config, run, false);
+	cached_replication(config, run, trace, simData, [&](Stats* fresh)
+	{
+		shared_ptr<const Trace> customers = traces.load(trace, [&](Trace& made) { replication_trace(config, run, false, made); }, hot);
+		timed_trace(config, *customers, run, fresh);
+	});
+}
+
+int run_scenario(int argc, char* argv[])
+{
+	Scenario scenario;
+	scenario.initialize();
+	string error;
+
+	//The scenario file is read first, wherever it is on the command line, so the other options override it
+	for (int i = 1; i + 1 < argc; i++)
+	{
+		if (string(argv[i]) == "--scenario" && read_scenario(argv[i + 1], scenario, error) == false)
+		{
+			cerr << argv[i + 1] << ": " << error << endl;
+			return 1;
+		}
+	}
+
+	for (int i = 1; i < argc; i++)
+	{
+		string option = argv[i];
+		if (option.compare(0, 2, "--") != 0 || i + 1 >= argc)
+		{
+			cerr << "Usage: simulate3 [--scenario file] [--key value ...]" << endl;
+			cerr << "Keys: mode n routing choices seed customers backend replications precision precision-fields confidence threads output cache patience" << endl;
+			cerr << "      break-after break-length classes discipline class-weights profile service" << endl;
+			return 1;
+		}
+
+		string key = option.substr(2);
+		string value = argv[++i];
+		if (key != "scenario" && parse_scenario_option(key, value, scenario, error) == false)
+		{
+			cerr << option << ": " << error << endl;
+			return 1;
+		}
+	}
+
+	if (scenario.ns.empty())
+	{
+		cerr << "n is required" << endl;
+		return 1;
+	}
+
+	vector<GridPoint> points = expand_scenario(scenario);
+	if (points.size() > SCENARIO_MAX_POINTS)
+	{
+		cerr << "The scenario has " << points.size() << " grid points, more than " << SCENARIO_MAX_POINTS << endl;
+		return 1;
+	}
+
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	vector<vector<Stats> > results;
+	int hot = 0;
+	int cached = 0;
+	run_grid(scenario, points, results, hot, cached);
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+	if (scenario.output == "-")
+	{
+		write_grid(cout, scenario, points, results);
+	}
+	else
+	{
+		ofstream outputFile;
+		outputFile.open(scenario.output.c_str());
+		write_grid(outputFile, scenario, points, results);
+		outputFile.close();
+		if ( !outputFile )
+		{
+			cerr << "Could not write " << scenario.output << endl;
+			return 1;
+		}
+	}
+
+	long long replications = 0;
+	for (int p = 0; p < (int) results.size(); p++)
+		replications += results[p].size();
+	cerr << points.size() << " grid points, " << replications << " replications on " << scenario.threads << " threads in "
+		<< seconds << " s (" << hot << " on customers in memory, " << cached << " from the cache)" << endl;
+	return 0;
+}
+
+bool read_scenario(string fileName, Scenario& scenario, string& error)
+{
+	ifstream scenarioFile;
+	scenarioFile.open(fileName.c_str());
+	if ( !scenarioFile )
+	{
+		error = "could not open the scenario file";
+		return false;
+	}
+
+	string line;
+	int number = 0;
+	while (getline(scenarioFile, line))
+	{
+		number++;
+		line = line.substr(0, line.find('#'));
+		if (line.find_first_not_of(" \t\r") == string::npos)
+			continue;
+
+		size_t equals = line.find('=');
+		if (equals == string::npos)
+		{
+			error = "line " + to_string(number) + ": expected key = value";
+			return false;
+		}
+
+		//Keys and values are trimmed, and the spaces between list items dropped
+		string key;
+		string value;
+		for (size_t k = 0; k < line.size(); k++)
+		{
+			if (line[k] != ' ' && line[k] != '\t' && line[k] != '\r' && k != equals)
+				(k < equals ? key : value) += line[k];
+		}
+
+		if (parse_scenario_option(key, value, scenario, error) == false)
+		{
+			error = "line " + to_string(number) + ": " + error;
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool parse_scenario_option(string key, string value, Scenario& scenario, string& error)
+{
+	vector<long long> numbers;
+	vector<string> names;
+	istringstream items(value);
+	string item;
+	while (getline(items, item, ','))
+		names.push_back(item);
+
+	error = "bad value for " + key + ": " + value;
+	if (key == "mode" || key == "routing" || key == "backend" || key == "discipline")
+	{
+		vector<int> parsed;
+		for (int i = 0; i < (int) names.size(); i++)
+		{
+			if (key == "mode" && (names[i] == "a" || names[i] == "b"))
+				parsed.push_back(names[i][0]);
+			else if (key == "routing" && names[i].size() == 1 && string("sdir").find(names[i][0]) != string::npos)
+			{
+				int modes[] = {ROUTE_SHORTEST, ROUTE_POWER_OF_D, ROUTE_JOIN_IDLE, ROUTE_ROUND_ROBIN};
+				parsed.push_back(modes[string("sdir").find(names[i][0])]);
+			}
+			else if (key == "backend" && (names[i] == "sim" || names[i] == "analytic"))
+				parsed.push_back((names[i] == "sim") ? SCENARIO_SIMULATE : SCENARIO_ANALYTIC);
+			else if (key == "discipline" && (names[i] == "strict" || names[i] == "wfq"))
+				parsed.push_back((names[i] == "strict") ? CLASS_STRICT : CLASS_WEIGHTED);
+			else
+				return false;
+		}
+		if (parsed.empty())
+			return false;
+
+		if (key == "mode")
+			scenario.modes.assign(parsed.begin(), parsed.end());
+		else if (key == "routing")
+			scenario.routings = parsed;
+		else if (key == "discipline")
+			scenario.disciplines = parsed;
+		else
+			scenario.backends = parsed;
+	}
+	else if (key == "n" || key == "choices")
+	{
+		if (parse_list(value, 1, OPT_MAX_TELLERS, numbers) == false)
+			return false;
+		(key == "n" ? scenario.ns : scenario.choices).assign(numbers.begin(), numbers.end());
+	}
+	else if (key == "classes" || key == "class-weights")
+	{
+		//1 number per class, highest class first: shares of the arrivals, or weights with discipline wfq
+		if (parse_list(value, (key == "classes") ? 0 : 1, 1000000, numbers) == false || numbers.empty() || numbers.size() > MAX_CLASSES)
+			return false;
+		(key == "classes" ? scenario.classMix : scenario.classWeights).assign(numbers.begin(), numbers.end());
+	}
+	else if (key == "profile" || key == "service")
+	{
+		//Files are read now, so a bad one is refused before anything runs
+		vector<ArrivalProfile> profiles(names.size());
+		vector<ServiceModel> services(names.size());
+		for (int i = 0; i < (int) names.size(); i++)
+		{
+			if (key == "profile" && names[i] == "flat")
+				profiles[i].initialize();
+			else if (key == "profile" && read_profile(names[i], profiles[i], error) == false)
+				return false;
+			else if (key == "service" && parse_service(names[i], services[i], error) == false)
+				return false;
+		}
+		if (names.empty())
+			return false;
+
+		if (key == "profile")
+		{
+			scenario.profiles = profiles;
+			scenario.profileNames = names;
+		}
+		else
+		{
+			scenario.services = services;
+			scenario.serviceNames = names;
+		}
+	}
+	else if (key == "seed")
+	{
+		if (parse_list(value, 0, LLONG_MAX, numbers) == false)
+			return false;
+		scenario.seeds.assign(numbers.begin(), numbers.end());
+	}
+	else if (key == "customers")
+	{
+		if (parse_list(value, 1, SCENARIO_MAX_CUSTOMERS, numbers) == false)
+			return false;
+		scenario.customers.assign(numbers.begin(), numbers.end());
+	}
+	else if (key == "replications" || key == "threads")
+	{
+		if (parse_list(value, 1, (key == "threads") ? 1024 : SERVER_MAX_REPLICATIONS, numbers) == false || numbers.size() != 1)
+			return false;
+		(key == "threads" ? scenario.threads : scenario.replications) = numbers[0];
+	}
+	else if (key == "confidence")
+	{
+		char* end = NULL;
+		double confidence = strtod(value.c_str(), &end);
+		if (value.empty() || *end != '\0' || !(confidence > 0 && confidence < 1))
+			return false;
+		scenario.confidence = confidence;
+	}
+	else if (key == "precision")
+	{
+		char* end = NULL;
+		double precision = strtod(value.c_str(), &end);
+		if (value.empty() || *end != '\0' || !(precision >= 0 && precision < 1))
+			return false;
+		scenario.precision = precision;
+	}
+	else if (key == "precision-fields")
+	{
+		//Names as in the CSV header; the extremes and CPU time are refused, since no number of replications narrows them
+		int fields = 0;
+		for (int i = 0; i < (int) names.size(); i++)
+		{
+			int f = 0;
+			while (f < STATS_FIELDS && names[i] != STATS_NAMES[f])
+				f++;
+			if (f == STATS_FIELDS || (STATS_EXTREMES & (1 << f)) != 0)
+				return false;
+			fields |= 1 << f;
+		}
+		if (fields == 0)
+			return false;
+		scenario.precisionFields = fields;
+	}
+	else if (key == "patience")
+	{
+		char* end = NULL;
+		double patience = strtod(value.c_str(), &end);
+		if (value.empty() || *end != '\0' || !(patience >= 0 && patience < SIMTIME_MAX))
+			return false;
+		scenario.patience = patience;
+	}
+	else if (key == "break-after" || key == "break-length")
+	{
+		//A break has to last at least 1 time unit, or a teller could go on and come back from it forever at the same time
+		if (parse_list(value, (key == "break-after") ? 0 : 1, SIMTIME_MAX, numbers) == false || numbers.size() != 1)
+			return false;
+		(key == "break-after" ? scenario.breakAfter : scenario.breakLength) = numbers[0];
+	}
+	else if (key == "cache")
+	{
+		if (value != "0" && value != "1")
+			return false;
+		scenario.cache = (value == "1");
+	}
+	else if (key == "output")
+	{
+		if (value.empty())
+			return false;
+		scenario.output = value;
+	}
+	else
+	{
+		error = "unknown key " + key;
+		return false;
+	}
+
+	return true;
+}
+
+bool parse_list(string value, long long low, long long high, vector<long long>& values)
+{
+	values.clear();
+	istringstream items(value);
+	string item;
+	while (getline(items, item, ','))
+	{
+		//low, low-high or low-high:step
+		char* end = NULL;
+		long long first = strtoll(item.c_str(), &end, 10);
+		long long last = first;
+		long long step = 1;
+		if (end == item.c_str() || item[0] == '-')
+			return false;
+		if (*end == '-')
+		{
+			char* from = end + 1;
+			last = strtoll(from, &end, 10);
+			if (end == from)
+				return false;
+			if (*end == ':')
+			{
+				from = end + 1;
+				step = strtoll(from, &end, 10);
+				if (end == from || step < 1)
+					return false;
+			}
+		}
+		if (*end != '\0' || first < low || last > high || first > last)
+			return false;
+
+		for (long long v = first; v <= last && (int) values.size() <= SCENARIO_MAX_POINTS; v += step)
+			values.push_back(v);
+	}
+
+	return !values.empty() && (int) values.size() <= SCENARIO_MAX_POINTS;
+}
+
+vector<GridPoint> expand_scenario(const Scenario& scenario)
+{
+	vector<GridPoint> points;
+	for (int m = 0; m < (int) scenario.modes.size(); m++)
+	for (int r = 0; r < (int) scenario.routings.size(); r++)
+	for (int d = 0; d < (int) scenario.choices.size(); d++)
+	for (int q = 0; q < (int) scenario.disciplines.size(); q++)
+	{
+		bool singleLine = (scenario.modes[m] == 'a');
+		if (singleLine == true && (r > 0 || d > 0))
+			continue;
+		if (singleLine == false && scenario.routings[r] != ROUTE_POWER_OF_D && d > 0)
+			continue;
+		if (scenario.classMix.size() < 2 && q > 0)		//1 class has no discipline
+			continue;
+
+		for (int k = 0; k < (int) scenario.ns.size(); k++)
+		for (int s = 0; s < (int) scenario.seeds.size(); s++)
+		for (int c = 0; c < (int) scenario.customers.size(); c++)
+		for (int a = 0; a < (int) scenario.profiles.size(); a++)
+		for (int v = 0; v < (int) scenario.services.size(); v++)
+		for (int b = 0; b < (int) scenario.backends.size(); b++)
+		{
+			if (points.size() > SCENARIO_MAX_POINTS)
+				return points;
+
+			GridPoint point;
+			point.initialize();
+			point.config.singleLine = singleLine;
+			point.config.n = scenario.ns[k];
+			point.config.routing = scenario.routings[r];
+			point.config.choices = scenario.choices[d];
+			point.config.seed = scenario.seeds[s];
+			point.config.customers = scenario.customers[c];
+			point.config.confidence = scenario.confidence;
+			point.config.precision = scenario.precision;
+			point.config.precisionFields = scenario.precisionFields;
+			point.config.maxReplications = scenario.replications;
+			point.config.minReplications = (scenario.precision > 0) ? min(point.config.minReplications, scenario.replications) : scenario.replications;
+			point.config.cache = scenario.cache;
+			point.config.patience = scenario.patience;
+			point.config.breakAfter = scenario.breakAfter;
+			point.config.breakLength = max(scenario.breakLength, (SimTime) 1);
+			point.config.classes = scenario.classMix.size();
+			point.config.discipline = scenario.disciplines[q];
+			for (int i = 0; i < (int) scenario.classMix.size(); i++)
+			{
+				point.config.classMix[i] = scenario.classMix[i];
+				point.config.classWeights[i] = (i < (int) scenario.classWeights.size()) ? scenario.classWeights[i] : 1;
+			}
+			point.config.profile = scenario.profiles[a];
+			point.config.service = scenario.services[v];
+			point.config.generatorThreads = 1;			//Its replications are generated on the grid's own threads, which already keep every core busy
+			point.profile = a;
+			point.service = v;
+			point.backend = scenario.backends[b];
+			points.push_back(point);
+		}
+	}
+
+	return points;
+}
+
+void run_grid(const Scenario& scenario, const vector<GridPoint>& points, vector<vector<Stats> >& results, int& hot, int& cached)
+{
+	results.assign(points.size(), vector<Stats>());
+
+	//A trace's jobs are done once the threads move past its group, so a few traces per thread is all that has to stay in memory
+	TraceStore traces(2 * scenario.threads);
+	map<unsigned long long, shared_future<TraceMoments> > moments;		//Of each trace analytic points run on, taken once for every point sharing it
+	mutex momentsGuard;
+	atomic<int> inMemory(0);
+	atomic<int> fromCache(0);
+
+	//Every point runs its minimum replications first; with a precision, each later round runs 1 more replication of the points still too wide
+	vector<pair<int, int> > jobs;
+	for (int p = 0; p < (int) points.size(); p++)
+		for (int i = 0; i < points[p].config.minReplications; i++)
+			jobs.push_back(make_pair(p, i));
+
+	while (jobs.empty() == false)
+	{
+		//1 job per replication of each point, grouped by the customers they run on: every job of a group runs while its trace is in memory
+		vector<unsigned long long> keys;
+		for (int j = 0; j < (int) jobs.size(); j++)
+		{
+			keys.push_back(trace_key(points[jobs[j].first].config, jobs[j].second, false));	//Covers the profile and service as well as the seed and customers
+			results[jobs[j].first].resize(jobs[j].second + 1);		//Sized before the threads start, so no Stats moves under them
+		}
+
+		vector<int> order(jobs.size());
+		for (int j = 0; j < (int) order.size(); j++)
+			order[j] = j;
+		stable_sort(order.begin(), order.end(), [&](int x, int y) { return keys[x] < keys[y]; });
+
+		vector<pair<int, int> > grouped;
+		for (int j = 0; j < (int) order.size(); j++)
+			grouped.push_back(jobs[order[j]]);
+		jobs.swap(grouped);
+
+		atomic<size_t> next(0);
+		auto work = [&]()
+		{
+			size_t j;
+			while ( (j = next++) < jobs.size() )
+			{
+				const GridPoint& point = points[jobs[j].first];
+				int run = jobs[j].second;
+				Stats* simData = &results[jobs[j].first][run];
+				bool hotTrace = false;
+
+				if (point.backend == SCENARIO_SIMULATE)
+				{
+					store_replication(point.config, run, traces, simData, hotTrace);
+				}
+				else
+				{
+					unsigned long long key = trace_key(point.config, run, false);
+					promise<TraceMoments> made;
+					shared_future<TraceMoments> ready;
+					bool first = false;
+					{
+						lock_guard<mutex> lock(momentsGuard);
+						map<unsigned long long, shared_future<TraceMoments> >::iterator found = moments.find(key);
+						if (found != moments.end())
+						{
+							ready = found->second;
+						}
+						else
+						{
+							ready = made.get_future().share();
+							moments[key] = ready;
+							first = true;
+						}
+					}
+
+					//Only the first point on a trace takes its moments, from the TraceStore if a simulated point has it there and otherwise from
+					//customers generated for it alone, so analytic points do not push simulated points' traces out of the store
+					if (first == true)
+					{
+						TraceMoments taken;
+						shared_ptr<const Trace> customers = traces.find(key);
+						if (customers)
+						{
+							trace_moments(*customers, taken);
+							hotTrace = true;
+						}
+						else
+						{
+							Trace fresh;
+							replication_trace(point.config, run, false, fresh);
+							trace_moments(fresh, taken);
+						}
+						made.set_value(taken);
+					}
+					analytic_estimate(point.config, ready.get(), simData);
+				}
+
+				if (simData->cached == true)
+					fromCache++;
+				else if (hotTrace == true)
+					inMemory++;
+			}
+		};
+
+		vector<thread> pool;
+		for (int t = 0; t < scenario.threads; t++)
+			pool.push_back(thread(work));
+		for (int t = 0; t < scenario.threads; t++)
+			pool[t].join();
+
+		jobs.clear();
+		for (int p = 0; p < (int) points.size(); p++)
+		{
+			const SimConfig& config = points[p].config;
+			int count = results[p].size();
+			if (count >= config.maxReplications)
+				continue;
+
+			ReplicationStats replications;
+			for (int i = 0; i < count; i++)
+				replications.push(results[p][i]);
+			if (replications.precise(config.precision, config.confidence, config.precisionFields) == false)
+				jobs.push_back(make_pair(p, count));
+		}
+	}
+
+	hot = inMemory;
+	cached = fromCache;
+}
+
+void write_grid(ostream& out, const Scenario& scenario, const vector<GridPoint>& points, const vector<vector<Stats> >& results)
+{
+	string routings[] = {"s", "d", "i", "r"};
+	string disciplines[] = {"strict", "wfq"};
+	out << "point,mode,n,routing,choices,discipline,seed,customers,profile,service,backend,replications,cached";
+	for (int m = 0; m < STATS_FIELDS; m++)
+		out << "," << STATS_NAMES[m] << "_mean," << STATS_NAMES[m] << "_halfwidth";
+	out << '\n';
+
+	for (int p = 0; p < (int) points.size(); p++)
+	{
+		const SimConfig& config = points[p].config;
+		ReplicationStats replications;
+		int cached = 0;
+		int unstable = 0;
+		for (int i = 0; i < (int) results[p].size(); i++)
+		{
+			if (results[p][i].unstable == true)
+				unstable++;
+			else
+				replications.push(results[p][i]);
+			if (results[p][i].cached == true)
+				cached++;
+		}
+
+		out << p + 1 << "," << (config.singleLine ? "a" : "b") << "," << config.n << ",";
+		out << (config.singleLine ? "" : routings[config.routing]) << ",";
+		out << ((config.singleLine == false && config.routing == ROUTE_POWER_OF_D) ? to_string(config.choices) : "") << ",";
+		out << ((config.classes > 1) ? disciplines[config.discipline] : "") << ",";
+		out << config.seed << "," << config.customers << "," << scenario.profileNames[points[p].profile] << "," << scenario.serviceNames[points[p].service] << ",";
+		out << ((points[p].backend == SCENARIO_SIMULATE) ? "sim" : "analytic") << ",";
+		out << results[p].size() << "," << cached;
+		//A point unstable on any replication's customers has no steady state, so none of its estimates are written. Fields the queueing formulas
+		//do not model are left empty rather than written as 0
+		bool analytic = (points[p].backend == SCENARIO_ANALYTIC);
+		for (int m = 0; m < STATS_FIELDS; m++)
+		{
+			if (analytic == true && analytic_models(config, m) == false)
+				out << ",,";
+			else if (unstable > 0)
+				out << ",unstable,";
+			else
+				out << "," << replications.field(m).mean() << "," << replications.field(m).halfWidth(scenario.confidence);
+		}
+		out << '\n';
+	}
+}
+
+void free_long_run(LongRunState& state)
+{
+	if (state.bankLines != NULL)
+	{
+		clear_events(state.eventQueue, state.bankLines, state.lineCount);
+		for (int i = 0; i < state.lineCount; i++)
+			delete state.bankLines[i];
+		delete[] state.bankLines;
+	}
+
+	delete state.tellers;
+	delete state.lengths;
+	delete state.router;
+	state.initialize();
+}
+
+void clear_events(PriorityQueue& eventQueue, ArrayQueue** lines, int count)
+{
+	while ( !eventQueue.isEmpty() )
+	{
+		Event* temp = eventQueue.peekFront();
+		eventQueue.dequeue();
+		delete temp;
+	}
+
+	for (int i = 0; i < count; i++)
+	{
+		while ( !lines[i]->isEmpty() )
+		{
+			delete lines[i]->peekFront();
+			lines[i]->dequeue();
+		}
+	}
+}
+
+void analytic_estimate(SimConfig config, const TraceMoments& moments, Stats* simData)
+{
+	clock_t start = clock();
+	simData->initialize();
+	simData->analytic = true;
+
+	int n = config.n;
+	int servers = n;
+	double rate = moments.rate;
+	double service = moments.service_mean;
+	double ca2 = moments.arrival_scv;
+	double cs2 = moments.service_scv;
+	double extreme = 1 - 1.0 / max(moments.count, 1);		//Quantile the largest of count values sits at
+
+	if (config.singleLine == false)
+	{
+		servers = 1;
+		rate = moments.rate / n;
+		if (config.routing == ROUTE_ROUND_ROBIN)
+			ca2 = moments.arrival_scv / n;
+	}
+
+	double wait = ggn_mean_wait(servers, rate, service, ca2, cs2);
+	if (wait == HUGE_VAL)
+	{
+		//Offered load of at least the servers: the line grows without bound, so there is nothing to estimate
+		simData->unstable = true;
+		simData->CPU_time = (clock() - start) / (double) CLOCKS_PER_SEC;
+		return;
+	}
+
+	simData->avg_wait = wait;
+	simData->p95_wait = clamp_time(ggn_wait_quantile(servers, rate, service, ca2, cs2, 0.95));
+	simData->max_wait = clamp_time(ggn_wait_quantile(servers, rate, service, ca2, cs2, extreme));
+	simData->avg_length = clamp_time(rate * wait);						//Little's law, per line for simulateB
+	simData->max_length = clamp_time(ggn_line_quantile(servers, rate, service, ca2, cs2, extreme));
+	simData->process_time = clamp_time(moments.last_arrival + service + wait);
+
+	if (config.singleLine == true)
+	{
+		//simulateA measures one teller, which is busy offered load / n of the time
+		simData->idle_time = clamp_time(max(moments.last_arrival * (1 - moments.rate * service / n), 0.0));
+	}
+	else
+	{
+		int costs[] = {n, config.choices, 1, 1};
+		simData->route_cost = costs[config.routing];
+	}
+
+	simData->CPU_time = (clock() - start) / (double) CLOCKS_PER_SEC;
+}
+
+bool analytic_models(SimConfig config, int field)
+{
+	if (field == STATS_CPU_TIME)		//CPU time of the estimate itself
+		return true;
+	if (field == STATS_RENEGED || field >= STATS_CLASS_WAIT)
+		return false;
+	if (config.patience > 0 || config.breakAfter > 0)
+		return false;
+	if (field == STATS_IDLE_TIME)
+		return config.singleLine;
+	if (field == STATS_ROUTE_COST)
+		return config.singleLine == false;
+
+	return true;
+}
+
+void write_stats(ostream& out, const Stats& simData, bool singleLine, int classes)
+{
+	if (simData.analytic == true)
+		out << "Analytic estimate, not simulated" << endl;
+	if (simData.unstable == true)
+	{
+		out << "Unstable: the offered load is at least the number of tellers, so the lines grow without bound and there is no steady state to estimate" << endl;
+		return;
+	}
+	out << "CPU Time = " << simData.CPU_time << "		Process Time = " << simData.process_time << endl;
+	out << "Average Waiting Time = " << simData.avg_wait << "	Max Waiting Time = " << simData.max_wait << "	95th Percentile Waiting Time = " << simData.p95_wait << endl;
+	out << "Average Line Length = " << simData.avg_length << "		Max Line Length = " << simData.max_length << endl;
+	out << "Total Teller Idle Time = " << simData.idle_time << endl;
+	if (singleLine == false)
+		out << "Routing Cost = " << simData.route_cost << " lines inspected per arrival" << endl;
+	if (simData.reneged > 0)
+		out << "Customers Reneged = " << simData.reneged << endl;
+	if (classes > 1 && simData.analytic == false)		//The queueing formulas do not tell classes apart
+	{
+		out << "Average Waiting Time by Class =";
+		for (int c = 0; c < min(classes, MAX_CLASSES); c++)
+			out << " " << simData.class_wait[c];
+		out << endl;
+	}
+}
+
+void run_replication(SimConfig config, string file, int run, unsigned long long trace, Stats* simData)
+{
+	cached_replication(config, run, trace, simData, [&](Stats* fresh)
+	{
+		clock_t start = clock();
+		Trace customers;
+		TraceReport report;
+		read_trace(file, customers, report);
+		if (report.malformed > 0)
+			cerr << file << ": skipped " << report.malformed << " malformed lines, the first on line " << report.firstMalformed << endl;
+		if (report.unsorted > 0)
+			cerr << file << ": " << report.unsorted << " customers arrive out of order, the first is customer " << report.firstUnsorted << endl;
+		simulate_trace(config, customers, run, fresh);
+		fresh->CPU_time = (clock() - start) / (double) CLOCKS_PER_SEC;
+	});
+}
+
+void run_replication(SimConfig config, const Trace& customers, int run, unsigned long long trace, Stats* simData)
+{
+	//clock() would also count the thread loading the next replication
+	cached_replication(config, run, trace, simData, [&](Stats* fresh) { timed_trace(config, customers, run, fresh); });
+}
+
+void cached_replication(SimConfig config, int run, unsigned long long trace, Stats* simData, function<void(Stats*)> simulate)
+{
+	simData->initialize();
+	unsigned long long key = stats_key(config, trace, run);
+	if (config.cache == true && config.records == false && ResultCache().getStats(key, *simData))
+		return;
+
+	simulate(simData);
+	if (config.cache == true)
+		ResultCache().putStats(key, *simData);
+}
+
+void timed_trace(SimConfig config, const Trace& customers, int run, Stats* simData)
+{
+	timespec before, after;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &before);
+	simulate_trace(config, customers, run, simData);
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &after);
+	simData->CPU_time = (after.tv_sec - before.tv_sec) + (after.tv_nsec - before.tv_nsec) / 1e9;
+}
+
+void simulate_trace(SimConfig config, const Trace& trace, int run, Stats* simData)
+{
+	CustomerLog* log = NULL;
+	if (config.records == true)
+	{
+		string file = "customers" + to_string(run + 1) + ".bin";
+		log = new CustomerLog(file);
+		if (log->good() == false)
+		{
+			cerr << "Could not write " << file << endl;
+			delete log;
+			log = NULL;
+		}
+	}
+
+	//Without patience or breaks no timer is ever scheduled, and the engines skip the wheel altogether
+	RandomStream patience(config.seed, run * STREAMS_PER_REPLICATION + STREAM_PATIENCE);
+	Timeouts timeouts;
+	timeouts.initialize();
+	timeouts.patience = config.patience;
+	timeouts.breakAfter = config.breakAfter;
+	timeouts.breakLength = config.breakLength;
+	timeouts.rng = &patience;
+	Timeouts* active = (config.patience > 0 || config.breakAfter > 0) ? &timeouts : NULL;
+
+	//With 1 class nobody draws one, and the lines stay plain FIFO ArrayQueues
+	RandomStream draws(config.seed, extra_stream(run, STREAM_CLASS));
+	Classes classes;
+	classes.initialize();
+	classes.count = min(max(config.classes, 1), MAX_CLASSES);
+	classes.discipline = config.discipline;
+	classes.rng = &draws;
+	double total = 0;
+	for (int c = 0; c < classes.count; c++)
+		total += max(config.classMix[c], 0);
+	double share = 0;
+	for (int c = 0; c < classes.count; c++)
+	{
+		share += max(config.classMix[c], 0);
+		classes.cumulative[c] = (total > 0) ? share / total : 1;
+		classes.weights[c] = config.classWeights[c];
+	}
+	Classes* mix = (classes.count > 1) ? &classes : NULL;
+
+	if (config.singleLine == true)
+	{
+		simulateA(config.n, trace, simData, log, active, mix);
+	}
+	else
+	{
+		RandomStream rng(config.seed, run * STREAMS_PER_REPLICATION + STREAM_ROUTING);
+		Router router(config.routing, config.n, config.choices, &rng);
+		simulateB(config.n, trace, simData, &router, log, active, mix);
+	}
+
+	if (log != NULL && log->close() == false)
+		cerr << "Could not write every customer to customers" << run + 1 << ".bin" << endl;
+	delete log;
+}
+
+unsigned long long stats_key(SimConfig config, unsigned long long trace, int run)
+{
+	unsigned long long hash = FNV_OFFSET_BASIS;
+	fnv_add(hash, trace);
+	fnv_add(hash, config.singleLine);
+	fnv_add(hash, config.n);
+	if (config.singleLine == false)
+	{
+		//Only simulateB routes, and only it draws from the run's routing stream
+		fnv_add(hash, config.routing);
+		fnv_add(hash, (config.routing == ROUTE_POWER_OF_D) ? config.choices : 0);
+		fnv_add(hash, config.seed);
+		fnv_add(hash, run);
+	}
+	if (config.patience > 0 || config.breakAfter > 0)
+	{
+		//Patience is drawn from the run's own stream too
+		fnv_add(hash, config.patience);
+		fnv_add(hash, config.breakAfter);
+		fnv_add(hash, config.breakLength);
+		fnv_add(hash, config.seed);
+		fnv_add(hash, run);
+	}
+	if (config.classes > 1)
+	{
+		fnv_add(hash, config.classes);
+		fnv_add(hash, config.discipline);
+		for (int c = 0; c < config.classes; c++)
+		{
+			fnv_add(hash, config.classMix[c]);
+			fnv_add(hash, (config.discipline == CLASS_WEIGHTED) ? config.classWeights[c] : 0);
+		}
+		fnv_add(hash, config.seed);
+		fnv_add(hash, run);
+	}
+
+	return hash;
+}
 
+string describe(SimConfig config)
+{
+	string n = (config.n > 0) ? to_string(config.n) : "n";		//0 while n is being searched for
+	if (config.singleLine == true)
+		return "1 Queue with " + n + " Tellers";
 
+	string routing[] = {"shortest line", "shortest of " + to_string(config.choices) + " random lines", "join idle teller", "round robin"};
+	return n + " Queues with 1 Teller per Queue (" + routing[config.routing] + ")";
+}
 
-int main()
+void sim_network(NetworkConfig config)
 {
-	cout << "Bank Simulation Options:" << endl;
-	cout << "a - One Queue with n Tellers		b - n Queues with 1 Teller per Queue" << endl;
-	cout << "Please enter the letter that corresponds with the desired option: " << endl;
-	
-	char c;
-	int n;
-	cin.clear();
-	fflush(stdin); 
-	cin >> c;
-	cin.clear();
-	fflush(stdin); 
+	if (config.branches < 1 || config.tellers < 1)
+	{
+		cout << "A network needs at least 1 branch, each with at least 1 teller" << endl;
+		return;
+	}
 
-	while ( (c != 'a') && (c != 'b') )
+	int count = config.branches;
+	Stats* sequential = new Stats[count];
+	Stats* parallel = new Stats[count];
+	Stats* optimistic = new Stats[count];
+	for (int b = 0; b < count; b++)
 	{
-		cout << "Invalid Input - Please enter either a or b: ";
-		cin >> c;
-		cin.clear();
-		fflush(stdin);
+		sequential[b].initialize();
+		parallel[b].initialize();
+		optimistic[b].initialize();
 	}
 
-	switch (c)
+	cout << "Running sequential reference..." << endl;
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	simulate_network_sequential(config, sequential);
+	double sequential_time = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+	cout << "Running conservative engine on " << config.threads << " threads..." << endl;
+	start = chrono::steady_clock::now();
+	simulate_network_parallel(config, parallel);
+	double parallel_time = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+	cout << "Running Time Warp engine on " << config.threads << " threads..." << endl;
+	long long rollbacks;
+	start = chrono::steady_clock::now();
+	simulate_network_timewarp(config, optimistic, rollbacks);
+	double optimistic_time = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+	bool parallel_match = same_results(sequential, parallel, count);
+	bool optimistic_match = same_results(sequential, optimistic, count);
+
+	ofstream outputFile;
+	outputFile.open("output.txt");
+
+	outputFile << "Network of " << count << " Branches, " << config.tellers << " Tellers each" << endl;
+	outputFile << "Sequential Wall Time = " << sequential_time << endl;
+	outputFile << "Conservative Wall Time (" << config.threads << " threads) = " << parallel_time << "		Matches sequential run: " << (parallel_match ? "yes" : "NO") << endl;
+	outputFile << "Time Warp Wall Time (" << config.threads << " threads) = " << optimistic_time << "		Matches sequential run: " << (optimistic_match ? "yes" : "NO");
+	outputFile << "		Events Rolled Back = " << rollbacks << endl << endl;
+
+	for (int b = 0; b < count; b++)
 	{
-		case 'a':
-			cout << "Running simulation with 1 Queue and n tellers... Please enter integer value for n: ";
-			cin >> n;
-			cin.clear();
-			fflush(stdin);
+		outputFile << "Branch #" << b + 1 << endl;
+		outputFile << "Process Time = " << sequential[b].process_time << "		Average Waiting Time = " << sequential[b].avg_wait << "	Max Waiting Time = " << sequential[b].max_wait << endl;
+		outputFile << "Average Line Length = " << sequential[b].avg_length << "		Max Line Length = " << sequential[b].max_length << "		Total Teller Idle Time = " << sequential[b].idle_time << endl << endl;
+	}
 
-			sim(n, true);
-			break;
+	cout << "Conservative results match sequential run: " << (parallel_match ? "yes" : "NO") << endl;
+	cout << "Time Warp results match sequential run: " << (optimistic_match ? "yes" : "NO") << endl;
+	cout << "End simulation" << endl;
 
-		case 'b':
-			cout << "Running simulation with n Queues and 1 Teller per Queue... Please enter integer value for n: ";
-			cin >> n;
-			cin.clear();
-			fflush(stdin);
+	delete[] sequential;
+	delete[] parallel;
+	delete[] optimistic;
+}
 
-			sim(n, false);
-			break;
+bool same_results(Stats* a, Stats* b, int count)
+{
+	for (int i = 0; i < count; i++)
+	{
+		if (a[i].process_time != b[i].process_time || a[i].avg_wait != b[i].avg_wait || a[i].avg_length != b[i].avg_length ||
+		    a[i].max_wait != b[i].max_wait || a[i].max_length != b[i].max_length || a[i].idle_time != b[i].idle_time)
+			return false;
 	}
 
-	return 0;	
+	return true;
 }
 
-void sim(int n, bool val)
+void simulateA(int n, const Trace& trace, Stats* simData, CustomerLog* log, const Timeouts* timeouts, const Classes* classes)
 {
-	Stats averages;
-	Stats* simData = new Stats[10];
-	averages.initialize();
+	Trace sorted;
+	const Trace& customers = arrival_order(trace, sorted);
 
+	if (classes != NULL)
+	{
+		//Classes only run on tellers counted at runtime, so none of the FixedDispatch instantiations is doubled for them
+		TellerArray tellers(n);
+		ClassQueue bankLine(classes->count, classes->discipline, classes->weights);
+		engineA(tellers, bankLine, customers, simData, log, timeouts, classes);
+	}
+	else if (n >= 1 && n <= MAX_FIXED_TELLERS)
+	{
+		FixedDispatch<MAX_FIXED_TELLERS>::runA(n, customers, simData, log, timeouts);
+	}
+	else
+	{
+		TellerArray tellers(n);			//Array of tellers initialized to true
+		ArrayQueue bankLine(max(customers.size(), 1));	//Bank Line implemented with array based queue
+		engineA(tellers, bankLine, customers, simData, log, timeouts, NULL);
+	}
+}
 
-	ofstream outputFile;
-	outputFile.open("output.txt");
 
-	string fileNames[] = {"data1.txt", "data2.txt", "data3.txt", "data4.txt", "data5.txt", "data6.txt", "data7.txt", "data8.txt", "data9.txt", "data10.txt"};
-	cout << "Generating and sorting 10 different data files to test on simulation..." << endl << endl;
+void simulateB(int n, const Trace& trace, Stats* simData, Router* router, CustomerLog* log, const Timeouts* timeouts, const Classes* classes)
+{
+	Trace sorted;
+	const Trace& customers = arrival_order(trace, sorted);
 
-	//generates 10 data files 	
-	for (int i = 0; i < 10; i++)					
+	if (classes != NULL)
 	{
-		generate_events(fileNames[i]);		
-	}
-	
-	clock_t start;
-	double simulation_time;
+		ClassQueue** bankLines = new ClassQueue*[n];
+		for (int i = 0; i < n; i++)
+			bankLines[i] = new ClassQueue(classes->count, classes->discipline, classes->weights);
 
-	if (val == true)	
-	{	
-		for (int i = 0; i < 10; i++)
-		{
-			cout << "Running simulation #" << i+1 << endl;
-			string file = fileNames[i];
-			simData[i].initialize();
-			start = clock();
-			simulateA(n, file, &simData[i]);
-			simulation_time = (clock() - start) / (double) CLOCKS_PER_SEC;
-			simData[i].CPU_time = simulation_time;
-		}
+		TellerArray tellers(n);
+		LineLengths lengths(n);
+		engineB(tellers, lengths, bankLines, customers, simData, *router, log, timeouts, classes);
+
+		for (int i = 0; i < n; i++)
+			delete bankLines[i];
+		delete[] bankLines;
+	}
+	else if (n >= 1 && n <= MAX_FIXED_TELLERS)
+	{
+		FixedDispatch<MAX_FIXED_TELLERS>::runB(n, customers, simData, router, log, timeouts);
 	}
 	else
 	{
-		for (int i = 0; i < 10; i++)
+		ArrayQueue** bankLines = new ArrayQueue*[n];
+		for (int i = 0; i < n; i++)
+		{
+			bankLines[i] = new ArrayQueue(max(customers.size(), 1));	//Creating each queue
+		}
+
+		TellerArray tellers(n);			//Array of tellers initialized to true
+		LineLengths lengths(n);
+		engineB(tellers, lengths, bankLines, customers, simData, *router, log, timeouts, NULL);
+
+		for (int i = 0; i < n; i++)
 		{
-			cout << "Running simulation #" << i+1 << endl;
-			string file = fileNames[i];
-			simData[i].initialize();
-			start = clock();
-			simulateB(n, file, &simData[i]);
-			simulation_time = (clock() - start) / (double) CLOCKS_PER_SEC;
-			simData[i].CPU_time = simulation_time;
+			delete bankLines[i];
 		}
+
+		delete[] bankLines;
 	}
+}
 
-	compute_averages(simData, averages);
 
-	//Write stats from each simulation to output file
-	for (int i = 0; i < 10; i++)
+template <int N>
+void FixedDispatch<N> :: runA(int n, const Trace& trace, Stats* simData, CustomerLog* log, const Timeouts* timeouts)
+{
+	if (n == N)
 	{
-		outputFile << "Simulation #" << i + 1 << endl;
-		outputFile << "CPU Time = " << simData[i].CPU_time << "		Process Time = " << simData[i].process_time << endl;
-		outputFile << "Average Waiting Time = " << simData[i].avg_wait << "	Max Waiting Time = " << simData[i].max_wait << endl;
-		outputFile << "Average Line Length = " << simData[i].avg_length << "		Max Line Length = " << simData[i].max_length << endl;
-		outputFile << "Total Teller Idle Time = " << simData[i].idle_time << endl << endl;;
-
+		FixedTellers<N> tellers;
+		ArrayQueue bankLine(max(trace.size(), 1));
+		engineA(tellers, bankLine, trace, simData, log, timeouts, NULL);
+	}
+	else
+	{
+		FixedDispatch<N - 1>::runA(n, trace, simData, log, timeouts);
 	}
+}
 
-	//Write average stats to output file
-	outputFile << "Averages of all 10 Simulations:" << endl;
-	outputFile << "Average CPU Time = " << averages.CPU_time << "		Average Process Time = " << averages.process_time << endl;
-	outputFile << "Average Waiting Time = " << averages.avg_wait << "	Max Waiting Time = " << averages.max_wait << endl;
-	outputFile << "Average Line Length = " << averages.avg_length << "		Max Line Length = " << averages.max_length << endl;
-	outputFile << "Average Total Teller Idle Time = " << averages.idle_time << endl;
+template <int N>
+void FixedDispatch<N> :: runB(int n, const Trace& trace, Stats* simData, Router* router, CustomerLog* log, const Timeouts* timeouts)
+{
+	if (n == N)
+	{
+		ArrayQueue* bankLines[N];
+		for (int i = 0; i < N; i++)
+		{
+			bankLines[i] = new ArrayQueue(max(trace.size(), 1));	//Creating each queue
+		}
 
-	cout << "End simulation" << endl;
+		FixedTellers<N> tellers;
+		FixedLineLengths<N> lengths;
+		engineB(tellers, lengths, bankLines, trace, simData, *router, log, timeouts, NULL);
 
-	delete[] simData;
+		for (int i = 0; i < N; i++)
+		{
+			delete bankLines[i];
+		}
+	}
+	else
+	{
+		FixedDispatch<N - 1>::runB(n, trace, simData, router, log, timeouts);
+	}
 }
 
-void simulateA(int n, string file, Stats* simData)
+template <class Tellers, class Line>
+void engineA(Tellers& tellers, Line& bankLine, const Trace& trace, Stats* simData, CustomerLog* log, const Timeouts* timeouts, const Classes* classes)
 {
-	ArrayQueue bankLine(MAX_ARRIVALS);		//Bank Line implemented with array based queue
 	PriorityQueue eventQueue;			//Event queue implemented with link based priority queue
+	TimingWheel wheel;				//Patience and break timers, empty without timeouts
 	
-	bool* tellerArray = new bool[n];		//Array of tellers initialized to true
+	int n = tellers.size();
+	vector<TimerHandle> breaks(n);			//Each teller's idle or break timer
 	for (int i = 0; i < n; i++)
-		tellerArray[i] = true;		
-
-	//Open data file
-	ifstream dataFile;
-	dataFile.open(file.c_str());
-
-	//Variables for keeping track of stats
-	int processing_time;
-	int wait;
-	unsigned long cumulative_wait = 0;
-	double average_wait;
-	int max_wait = 0;
-	int line;
-	int cumulative_line = 0;
-	int max_line = 0;
-	int average_line;
-	int idle_start;
-	int idle_stop;
-	int idle_time;
-	bool teller_previous;
-
-
-	int a, t;
-	Arrival* temp;
-
-	//Create and add arrival events to event queue
-	for (int i = 0; i < MAX_ARRIVALS; i++)
 	{
-		dataFile >> a;			//Copy arrival time into a
-		dataFile >> t;			//Copy transaction length into t
-
-		temp = new Arrival(a,t);	//Create new arrival event
-
-		eventQueue.enqueue(temp, a);	//Add to eventQueue, passing arrival time as priority
-
+		breaks[i].initialize();
+		if (timeouts != NULL && timeouts->breakAfter > 0)
+			breaks[i] = wheel.schedule(timeouts->breakAfter, TIMER_BREAK, i);	//Every teller starts idle
 	}
-	temp = NULL;
 
+	int count = trace.size();
 
-	//Pointers to manage events
-	Event* nextEvent;
+	//Variables for keeping track of stats
+	SimTime wait;
+	unsigned long long cumulative_wait = 0;
+	SimTime max_wait = 0;
+	int line;
+	long long cumulative_line = 0;
+	SimTime max_line = 0;
+	SimTime idle_start = 0;
+	SimTime idle_stop = 0;
+	SimTime idle_time = 0;
+	WaitHistogram waits;
+	unsigned long long class_wait[MAX_CLASSES] = {0};
+	int class_served[MAX_CLASSES] = {0};
+
+
+	//Pointers to manage events; each customer's Arrival turns into its Departure, and goes back to the pool once it has departed
+	CustomerPool pool;
 	Arrival* nextArrival;
 	Departure* nextDeparture;
 
-	int currentTime;
-	int idleArr[n];
+	int next = 0;					//Next customer of the trace to arrive
+	SimTime currentTime = 0;
 	bool tA = true;
 	bool tP;
+	long long events = 0;
+	long long published = 0;
+	telemetry.start();
 
-	//Event Loop
-	while ( !eventQueue.isEmpty() )
+	Timer fired;
+	int reneged = 0;
+
+	//Event Loop: 1 pass per distinct time. Arrivals are taken straight from the trace, so eventQueue only holds the departures of customers being
+	//served. The arrivals at a time go first, in file order, then the departures at that time in the order they were scheduled, then the timers due
+	//then, so a customer served at the time they would give up stays. Break timers alone never keep the loop going
+	while ( next < count || !eventQueue.isEmpty() || !bankLine.isEmpty() )
 	{
 		tP = tA;
-		
-		nextEvent = eventQueue.peekFront();
-		if (nextEvent->getType() == true)						//getType() returns true if nextEvent points to an arrival
-		{
-			nextArrival = static_cast<Arrival*> (nextEvent);			//Cast base class pointer into arrival pointer
-			currentTime = nextArrival->getArrivalTime();				//Update timer
-
-			process_ArrivalA(nextArrival, &eventQueue, &bankLine, tellerArray, n);
-		}
-		else										//Otherwise newEvent is a departure
-		{			
-			nextDeparture = static_cast<Departure*> (nextEvent);			//Cast base class pointer into arrival departure 
-			Arrival* link = nextDeparture->getLinkedArrival();			//Get address of arrival event corresponding to nextDeparture 
-			currentTime = nextDeparture->getDepartureTime();			//Update timer
-			
-			
-			wait = currentTime - (link->getTransactionLength()) - (link->getArrivalTime());			//wait time = d - t - a
+
+		if (next < count && (eventQueue.isEmpty() || trace.arrivalTimes[next] <= eventQueue.peekPriority()))
+			currentTime = trace.arrivalTimes[next];
+		else if (!eventQueue.isEmpty())
+			currentTime = eventQueue.peekPriority();
+		else
+			currentTime = SIMTIME_MAX;			//Only customers waiting for tellers on a break are left
+		if (wheel.pending() > 0)
+			currentTime = min(currentTime, wheel.nextTime(currentTime));
+
+		while (next < count && trace.arrivalTimes[next] == currentTime)
+		{
+			nextArrival = pool.acquire(currentTime, trace.transactionLengths[next]);	//Arrival event, reusing a departed customer's
+			next++;
+			if (classes != NULL)
+				nextArrival->setClass(classes->draw());
+			process_ArrivalA(nextArrival, &eventQueue, &bankLine, tellers);
+			if (timeouts != NULL)
+			{
+				if (nextArrival->getType() == true)
+					start_patience(nextArrival, &bankLine, wheel, *timeouts);
+				else
+					wheel.cancel(breaks[nextArrival->getQueueIndex()]);	//Served at once, by an idle teller
+			}
+
+			line = bankLine.getCount();				//Get size of bankLine
+			cumulative_line += line;				//Update cumulative total
+			if ( line > max_line )					//Update max_line if current line is greater
+				max_line = line;
+			events++;
+		}
+
+		while (!eventQueue.isEmpty() && eventQueue.peekPriority() == currentTime)
+		{
+			nextDeparture = static_cast<Departure*> (eventQueue.peekFront());	//Only departures are ever in eventQueue
+			wait = currentTime - (nextDeparture->getTransactionLength()) - (nextDeparture->getArrivalTime());	//wait time = d - t - a
 			cumulative_wait += wait;									//Update cumulative wait time
 	
 			if ( wait > max_wait )										//Update max_wait if current wait is longer
 				max_wait = wait;
+			waits.add(wait);
+			if (classes != NULL)
+			{
+				class_wait[nextDeparture->getClass()] += wait;
+				class_served[nextDeparture->getClass()]++;
+			}
+			if (log != NULL)
+				log->record(nextDeparture->getArrivalTime(), currentTime - nextDeparture->getTransactionLength(), currentTime, nextDeparture->getQueueIndex(), 0);
+
+			Arrival* started = process_DepartureA(nextDeparture, &eventQueue, &bankLine, tellers);
+			if (timeouts != NULL)
+			{
+				int teller = nextDeparture->getQueueIndex();
+				if (started != NULL)
+					wheel.cancel(started->getTimer());
+				else if (timeouts->breakAfter > 0)
+					breaks[teller] = wheel.schedule(currentTime + timeouts->breakAfter, TIMER_BREAK, teller);
+			}
+			pool.release(nextDeparture);
+
+			line = bankLine.getCount();
+			cumulative_line += line;
+			if ( line > max_line )
+				max_line = line;
+			events++;
+		}
+
+		while (wheel.pending() > 0 && wheel.pop(currentTime, fired))
+		{
+			if (process_TimerA(fired, wheel, breaks, &eventQueue, &bankLine, tellers, *timeouts, pool) == false)
+				continue;
 
-			process_DepartureA(nextDeparture, &eventQueue, &bankLine, tellerArray, n);
+			reneged++;
+			line = bankLine.getCount();
+			cumulative_line += line;
+			events++;
 		}
 
-		
-		line = bankLine.getCount();				//Get size of bankLine
-		cumulative_line += line;				//Update cumulative total
-		
-		if ( line > max_line )					//Update max_line if current line is greater
-			max_line = line;
-		tA = tellerArray[n/2];
+		//The teller's idle time only changes where its availability differs from 1 distinct time to the next, so it is checked once per time
+		tA = tellers.isAvailable(n/2);
 		idle_time = idle_time + calculate_idle(tA, tP, currentTime, idle_start, idle_stop);	//Keeps track of idle time for teller
-	
+
+		if (events - published >= TELEMETRY_EVERY)
+		{
+			telemetry.publish(currentTime, events, eventQueue.size(), max_line, pool.allocations() + eventQueue.allocations());
+			published = events;
+		}
 	}
+	telemetry.finish(currentTime, events, max_line, pool.allocations() + eventQueue.allocations());
 	
 	simData->process_time = currentTime;				
-	simData->avg_wait = (double) cumulative_wait / MAX_ARRIVALS;		
-	simData->avg_length = cumulative_line / (MAX_ARRIVALS * 2);		
+	simData->avg_wait = (double) cumulative_wait / max(count - reneged, 1);	//Over the customers who were served
+	simData->avg_length = cumulative_line / max(count * 2LL, 1LL);		
 	simData->max_wait = max_wait;
 	simData->max_length = max_line;
 	simData->idle_time = idle_time;
-
-	delete[] tellerArray;
+	simData->reneged = reneged;
+	simData->p95_wait = waits.quantile(0.95);
+	for (int c = 0; c < MAX_CLASSES; c++)
+		simData->class_wait[c] = (double) class_wait[c] / max(class_served[c], 1);
 }
 
 
-void simulateB(int n, string file, Stats* simData)
+template <class Tellers, class Lengths, class Line>
+void engineB(Tellers& tellers, Lengths& lengths, Line** bankLines, const Trace& trace, Stats* simData, Router& router, CustomerLog* log, const Timeouts* timeouts,
+             const Classes* classes)
 {
-	ArrayQueue** bankLines = new ArrayQueue*[n];
-
-	for (int i = 0; i < n; i++)
-	{
-		bankLines[i] = new ArrayQueue(MAX_ARRIVALS);	//Creating each queue
-	}		
 	PriorityQueue eventQueue;			//Event queue implemented with link based priority queue
+	TimingWheel wheel;				//Patience and break timers, empty without timeouts
 	
-
-	bool* tellerArray = new bool[n];		//Array of tellers initialized to true
+	int n = tellers.size();
+	vector<TimerHandle> breaks(n);			//Each teller's idle or break timer
 	for (int i = 0; i < n; i++)
-		tellerArray[i] = true;		
+	{
+		breaks[i].initialize();
+		if (timeouts != NULL && timeouts->breakAfter > 0)
+			breaks[i] = wheel.schedule(timeouts->breakAfter, TIMER_BREAK, i);	//Every teller starts idle
+	}
 
-	//Open data file
-	ifstream dataFile;
-	dataFile.open(file.c_str());
+	int count = trace.size();
 
 	//Variables for keeping track of stats
-	int processing_time;
-	int wait;
-	unsigned long cumulative_wait = 0;
-	double average_wait;
-	int max_wait = 0;
+	SimTime wait;
+	unsigned long long cumulative_wait = 0;
+	SimTime max_wait = 0;
 	int line;
-	int cumulative_line = 0;
-	int max_line = 0;
-	int average_line;
-	int idle_start;
-	int idle_stop;
-	int idle_time;
-	bool teller_previous;
-
-
-	int a, t;
-	Arrival* temp;
-
-	//Create and add arrival events to event queue
-	for (int i = 0; i < MAX_ARRIVALS; i++)
-	{
-		dataFile >> a;			//Copy arrival time into a
-		dataFile >> t;			//Copy transaction length into t
-
-		temp = new Arrival(a,t);	//Create new arrival event
-
-		eventQueue.enqueue(temp, a);	//Add to eventQueue, passing arrival time as priority
-
-	}
-	temp = NULL;
+	long long cumulative_line = 0;
+	SimTime max_line = 0;
+	int longest = 0;				//Most customers waiting in any one line, for the telemetry page; max_line is of the average line
+	WaitHistogram waits;
+	unsigned long long class_wait[MAX_CLASSES] = {0};
+	int class_served[MAX_CLASSES] = {0};
 
 
-	//Pointers to manage events
-	Event* nextEvent;
+	//Pointers to manage events; each customer's Arrival turns into its Departure, and goes back to the pool once it has departed
+	CustomerPool pool;
 	Arrival* nextArrival;
 	Departure* nextDeparture;
-	int currentTime;
+
+	int next = 0;					//Next customer of the trace to arrive
+	SimTime currentTime = 0;
+	long long events = 0;
+	long long published = 0;
+	telemetry.start();
 	
-	//Event Loop
-	while ( !eventQueue.isEmpty() )
+	Timer fired;
+	int reneged = 0;
+	int left = 0;					//Customers who have departed or given up
+
+	//Event Loop: 1 pass per distinct time, arrivals from the trace first, then departures, then timers, as in engineA. Customers waiting for a
+	//teller on a break have no event of their own until the break ends, so the loop runs until every customer has left
+	while ( next < count || left < next )
 	{
+		if (next < count && (eventQueue.isEmpty() || trace.arrivalTimes[next] <= eventQueue.peekPriority()))
+			currentTime = trace.arrivalTimes[next];
+		else if (!eventQueue.isEmpty())
+			currentTime = eventQueue.peekPriority();
+		else
+			currentTime = SIMTIME_MAX;			//Only customers waiting for tellers on a break are left
+		if (wheel.pending() > 0)
+			currentTime = min(currentTime, wheel.nextTime(currentTime));
+
+		while (next < count && trace.arrivalTimes[next] == currentTime)
+		{
+			nextArrival = pool.acquire(currentTime, trace.transactionLengths[next]);	//Arrival event, reusing a departed customer's
+			next++;
+			if (classes != NULL)
+				nextArrival->setClass(classes->draw());
+			process_ArrivalB(nextArrival, &eventQueue, bankLines, tellers, lengths, router);
+			longest = max(longest, lengths.get(nextArrival->getQueueIndex()) - 1);	//Lines only grow on arrivals; 1 of the line is at its teller
+			if (timeouts != NULL)
+			{
+				if (nextArrival->getType() == true)
+					start_patience(nextArrival, bankLines[nextArrival->getQueueIndex()], wheel, *timeouts);
+				else
+					wheel.cancel(breaks[nextArrival->getQueueIndex()]);	//Served at once, by an idle teller
+			}
+
+			line = lengths.waiting() / n;				//Get average size of all lines
+			cumulative_line += line;				//Update cumulative total
+			if ( line > max_line )					//Update max_line if current line is greater
+				max_line = line;
+			events++;
+		}
 
-		
-		nextEvent = eventQueue.peekFront();
-		if (nextEvent->getType() == true)						//getType() returns true if nextEvent points to an arrival
-		{
-			nextArrival = static_cast<Arrival*> (nextEvent);			//Cast base class pointer into arrival pointer
-			currentTime = nextArrival->getArrivalTime();				//Update timer
-
-			process_ArrivalB(nextArrival, &eventQueue, bankLines, tellerArray, n);
-		}
-		else										//Otherwise newEvent is a departure
-		{			
-			nextDeparture = static_cast<Departure*> (nextEvent);			//Cast base class pointer into arrival departure 
-			Arrival* link = nextDeparture->getLinkedArrival();			//Get address of arrival event corresponding to nextDeparture 
-			currentTime = nextDeparture->getDepartureTime();			//Update timer
-			
-			
-			wait = currentTime - (link->getTransactionLength()) - (link->getArrivalTime());			//wait time = d - t - a
+		while (!eventQueue.isEmpty() && eventQueue.peekPriority() == currentTime)
+		{
+			nextDeparture = static_cast<Departure*> (eventQueue.peekFront());	//Only departures are ever in eventQueue
+			wait = currentTime - (nextDeparture->getTransactionLength()) - (nextDeparture->getArrivalTime());	//wait time = d - t - a
 			cumulative_wait += wait;									//Update cumulative wait time
 	
 			if ( wait > max_wait )										//Update max_wait if current wait is longer
 				max_wait = wait;
-
-			process_DepartureB(nextDeparture, &eventQueue, bankLines, tellerArray, n);
+			waits.add(wait);
+			if (classes != NULL)
+			{
+				class_wait[nextDeparture->getClass()] += wait;
+				class_served[nextDeparture->getClass()]++;
+			}
+			if (log != NULL)
+				log->record(nextDeparture->getArrivalTime(), currentTime - nextDeparture->getTransactionLength(), currentTime, nextDeparture->getQueueIndex(), nextDeparture->getQueueIndex());
+
+			Arrival* started = process_DepartureB(nextDeparture, &eventQueue, bankLines, tellers, lengths, router);
+			left++;
+			if (timeouts != NULL)
+			{
+				int teller = nextDeparture->getQueueIndex();
+				if (started != NULL)
+					wheel.cancel(started->getTimer());
+				else if (timeouts->breakAfter > 0)
+					breaks[teller] = wheel.schedule(currentTime + timeouts->breakAfter, TIMER_BREAK, teller);
+			}
+			pool.release(nextDeparture);
+
+			line = lengths.waiting() / n;
+			cumulative_line += line;
+			if ( line > max_line )
+				max_line = line;
+			events++;
 		}
 
-		
-		line = avg_line(bankLines,n);				//Get size of bankLine
-		cumulative_line += line;				//Update cumulative total
-		
-		if ( line > max_line )					//Update max_line if current line is greater
-			max_line = line;
-
+		while (wheel.pending() > 0 && wheel.pop(currentTime, fired))
+		{
+			if (process_TimerB(fired, wheel, breaks, &eventQueue, bankLines, tellers, lengths, router, *timeouts, pool) == false)
+				continue;
+
+			reneged++;
+			left++;
+			line = lengths.waiting() / n;
+			cumulative_line += line;
+			events++;
+		}
 
-	
+		if (events - published >= TELEMETRY_EVERY)
+		{
+			telemetry.publish(currentTime, events, eventQueue.size(), longest, pool.allocations() + eventQueue.allocations());
+			published = events;
+		}
 	}
+	telemetry.finish(currentTime, events, longest, pool.allocations() + eventQueue.allocations());
 	
 	simData->process_time = currentTime;				
-	simData->avg_wait = (double) cumulative_wait / MAX_ARRIVALS;		
-	simData->avg_length = cumulative_line / (MAX_ARRIVALS * 2);		
+	simData->avg_wait = (double) cumulative_wait / max(count - reneged, 1);	//Over the customers who were served
+	simData->avg_length = cumulative_line / max(count * 2LL, 1LL);		
 	simData->max_wait = max_wait;
 	simData->max_length = max_line;
-
-
-	delete[] tellerArray;
-
-	for (int i = 0; i < n; i++)
-	{
-		delete bankLines[i];
-	}	
-	
-	delete[] bankLines;	
-	
+	simData->route_cost = router.cost();
+	simData->reneged = reneged;
+	simData->p95_wait = waits.quantile(0.95);
+	for (int c = 0; c < MAX_CLASSES; c++)
+		simData->class_wait[c] = (double) class_wait[c] / max(class_served[c], 1);
 }
 
-void process_ArrivalA(Arrival* arr, PriorityQueue* eventQueue, ArrayQueue* bankLine, bool* tellerArr, int n)
+template <class Tellers, class Line>
+void process_ArrivalA(Arrival* arr, PriorityQueue* eventQueue, Line* bankLine, Tellers& tellers)
 {
-
-	
-	//Remove arrival event from the priority queue
-	eventQueue->dequeue();
-
-	int currentTime = arr->getArrivalTime();
-	int transactionTime = arr->getTransactionLength();
-	int departureTime;
+	SimTime currentTime = arr->getArrivalTime();
+	SimTime transactionTime = arr->getTransactionLength();
+	SimTime departureTime;
 	int index;
 	
 	//If bankLine is empty and there is an available teller then customer goes straight to that teller
-	if(bankLine->isEmpty() && (available_teller(tellerArr, n, index) == true) )
+	if(bankLine->isEmpty() && (tellers.findAvailable(index) == true) )
 	{
 		departureTime = currentTime + transactionTime;
-		Departure* newDeparture = new Departure(departureTime, arr);
-		eventQueue->enqueue(newDeparture, departureTime);
+		eventQueue->enqueue(arr->depart(departureTime), departureTime);	//The arrival becomes its own departure
 
 
-		tellerArr[index] = false;
-		newDeparture = NULL;
+		tellers.setBusy(index);
+		arr->setQueueIndex(index);				//Storing which teller serves this customer
 	}
 	//Otherwise customer waits in line
 	else
@@ -613,12 +4405,14 @@ void process_ArrivalA(Arrival* arr, PriorityQueue* eventQueue, ArrayQueue* bankL
 }
 
 
-void process_DepartureA(Departure* dep, PriorityQueue* eventQueue, ArrayQueue* bankLine, bool* tellerArr, int n)
+template <class Tellers, class Line>
+Arrival* process_DepartureA(Departure* dep, PriorityQueue* eventQueue, Line* bankLine, Tellers& tellers)
 {
 	//Remove departure from priority queue
 	eventQueue->dequeue();
 	
-	int currentTime = dep->getDepartureTime();
+	SimTime currentTime = dep->getDepartureTime();
+	int teller = dep->getQueueIndex();
 	
 	//If bank line is not empty 
 	if ( !bankLine->isEmpty() )
@@ -627,46 +4421,44 @@ void process_DepartureA(Departure* dep, PriorityQueue* eventQueue, ArrayQueue* b
 		Arrival* nextCustomer = static_cast<Arrival*> (temp);
 		bankLine->dequeue();
 		temp = NULL;
+		nextCustomer->setQueueIndex(teller);			//The next customer goes to the teller that was just freed
 
-		int transactionTime = nextCustomer->getTransactionLength();
-		int departureTime = currentTime + transactionTime;
-
-		//Create new departure event and add it to eventQueue
-		Departure* newDeparture = new Departure(departureTime, nextCustomer);
-		eventQueue->enqueue(newDeparture, departureTime);
+		SimTime transactionTime = nextCustomer->getTransactionLength();
+		SimTime departureTime = currentTime + transactionTime;
 
+		//The waiting customer becomes its own departure event in eventQueue
+		eventQueue->enqueue(nextCustomer->depart(departureTime), departureTime);
+		return nextCustomer;
 	}
 	else
 	{
-		set_available(tellerArr, n);		//Sets one teller entry to true	
+		tellers.setAvailable(teller);		//Only this customer's teller is freed
+		return NULL;
 	}
 }
 
 
-void process_ArrivalB(Arrival* arr, PriorityQueue* eventQueue, ArrayQueue** bankLines, bool* tellerArr, int n)
+template <class Tellers, class Lengths, class Line>
+void process_ArrivalB(Arrival* arr, PriorityQueue* eventQueue, Line** bankLines, Tellers& tellers, Lengths& lengths, Router& router)
 {
-	//Remove arrival event from the priority queue
-	eventQueue->dequeue();
-
-	int currentTime = arr->getArrivalTime();
-	int transactionTime = arr->getTransactionLength();
-	int departureTime;
-	int index_of_shortest = shortest_line(bankLines, n);
+	SimTime currentTime = arr->getArrivalTime();
+	SimTime transactionTime = arr->getTransactionLength();
+	SimTime departureTime;
+	int index_of_shortest = router.choose(lengths);
 
 	arr->setQueueIndex(index_of_shortest);			//Storing which queue this event goes into
+	lengths.increment(index_of_shortest);
 
-	ArrayQueue* shortestLine = bankLines[index_of_shortest];
+	Line* shortestLine = bankLines[index_of_shortest];
 	
-	//If bankLine is empty and there is an available teller then customer goes straight to that teller
-	if(shortestLine->isEmpty() && (available_teller(tellerArr, n, index_of_shortest) == true) )
+	//If line is empty and its teller is available then customer goes straight to that teller
+	if(shortestLine->isEmpty() && (tellers.isAvailable(index_of_shortest) == true) )
 	{
 		departureTime = currentTime + transactionTime;
-		Departure* newDeparture = new Departure(departureTime, arr);
-		eventQueue->enqueue(newDeparture, departureTime);
+		eventQueue->enqueue(arr->depart(departureTime), departureTime);	//The arrival becomes its own departure
 
 
-		tellerArr[index_of_shortest] = false;
-		newDeparture = NULL;
+		tellers.setBusy(index_of_shortest);
 	}
 	//Otherwise customer waits in line
 	else
@@ -675,16 +4467,17 @@ void process_ArrivalB(Arrival* arr, PriorityQueue* eventQueue, ArrayQueue** bank
 	}
 }
 
-void process_DepartureB(Departure* dep, PriorityQueue* eventQueue, ArrayQueue** bankLines, bool* tellerArr, int n)
+template <class Tellers, class Lengths, class Line>
+Arrival* process_DepartureB(Departure* dep, PriorityQueue* eventQueue, Line** bankLines, Tellers& tellers, Lengths& lengths, Router& router)
 {
 	//Remove departure from priority queue
 	eventQueue->dequeue();
-	Arrival* link = dep->getLinkedArrival();			//Get address of arrival event corresponding to Departure 
-	int currentTime = dep->getDepartureTime();
+	SimTime currentTime = dep->getDepartureTime();
 	int index_of_line;
 
-	index_of_line = link->getQueueIndex();
-	ArrayQueue* currentLine = bankLines[index_of_line];
+	index_of_line = dep->getQueueIndex();
+	Line* currentLine = bankLines[index_of_line];
+	lengths.decrement(index_of_line);
 
 	//If bank line is not empty 
 	if ( !currentLine->isEmpty() )
@@ -694,73 +4487,173 @@ void process_DepartureB(Departure* dep, PriorityQueue* eventQueue, ArrayQueue**
 		currentLine->dequeue();
 		temp = NULL;
 
-		int transactionTime = nextCustomer->getTransactionLength();
-		int departureTime = currentTime + transactionTime;
-
-		//Create new departure event and add it to eventQueue
-		Departure* newDeparture = new Departure(departureTime, nextCustomer);
-		eventQueue->enqueue(newDeparture, departureTime);
+		SimTime transactionTime = nextCustomer->getTransactionLength();
+		SimTime departureTime = currentTime + transactionTime;
 
+		//The waiting customer becomes its own departure event in eventQueue
+		eventQueue->enqueue(nextCustomer->depart(departureTime), departureTime);
+		return nextCustomer;
 	}
 	else
 	{
-		tellerArr[index_of_line] = true;
+		tellers.setAvailable(index_of_line);		//Only this line's teller is freed
+		router.lineIdle(index_of_line);
+		return NULL;
 	}
 }
 
 
-bool available_teller(bool* arr, int n, int& index)
-{	
-	for (int i = 0; i < n; i++)
+template <class Line>
+void start_patience(Arrival* arr, Line* line, TimingWheel& wheel, const Timeouts& timeouts)
+{
+	if (timeouts.patience <= 0)
+		return;
+
+	//Exponential patience, at least 1 time unit so nobody gives up at the time they arrive
+	double patience = max(-log(1.0 - timeouts.rng->uniform()) * timeouts.patience, 1.0);
+	arr->setSlot(line->rearSlot());
+	arr->getTimer() = wheel.schedule(clamp_time(arr->getArrivalTime() + patience), TIMER_RENEGE, arr->getQueueIndex(), arr);
+}
+
+
+template <class Tellers, class Line>
+bool process_TimerA(const Timer& fired, TimingWheel& wheel, vector<TimerHandle>& breaks, PriorityQueue* eventQueue, Line* bankLine, Tellers& tellers, const Timeouts& timeouts, CustomerPool& pool)
+{
+	int teller = fired.target;
+
+	if (fired.kind == TIMER_RENEGE)
 	{
-		if (arr[i] == true)
-		{
-			index = i;
-			return true;	
-		}	
+		//The customer leaves from wherever they are in line
+		Arrival* arr = static_cast<Arrival*> (fired.data);
+		bankLine->remove(arr->getSlot());
+		pool.release(arr);
+		return true;
+	}
+
+	if (fired.kind == TIMER_BREAK)
+	{
+		tellers.setBusy(teller);			//Nobody is served by a teller on a break
+		breaks[teller] = wheel.schedule(fired.time + timeouts.breakLength, TIMER_RETURN, teller);
+	}
+	else if ( !bankLine->isEmpty() )
+	{
+		Arrival* nextCustomer = static_cast<Arrival*> (bankLine->peekFront());
+		bankLine->dequeue();
+		wheel.cancel(nextCustomer->getTimer());
+		nextCustomer->setQueueIndex(teller);
+
+		SimTime departureTime = fired.time + nextCustomer->getTransactionLength();
+		eventQueue->enqueue(nextCustomer->depart(departureTime), departureTime);
+	}
+	else
+	{
+		tellers.setAvailable(teller);
+		breaks[teller] = wheel.schedule(fired.time + timeouts.breakAfter, TIMER_BREAK, teller);
 	}
 
 	return false;
 }
 
-bool set_available(bool* arr, int n)
+
+template <class Tellers, class Lengths, class Line>
+bool process_TimerB(const Timer& fired, TimingWheel& wheel, vector<TimerHandle>& breaks, PriorityQueue* eventQueue, Line** bankLines, Tellers& tellers, Lengths& lengths,
+                    Router& router, const Timeouts& timeouts, CustomerPool& pool)
 {
-	//Finds first false entry and sets it to true
-	for (int i = 0; i < n; i++)
+	int teller = fired.target;
+
+	if (fired.kind == TIMER_RENEGE)
 	{
-		if ( arr[i] == false )
-		{
-			arr[i] = true;
-			return true;
-		}
+		Arrival* arr = static_cast<Arrival*> (fired.data);
+		bankLines[teller]->remove(arr->getSlot());		//A waiting customer's target is their line
+		lengths.decrement(teller);
+		pool.release(arr);
+		return true;
+	}
+
+	//While the break lasts it holds the line's first place in lengths, so shortest line routing passes the line over, and join idle routing drops it
+	//from its list of idle lines the next time it comes up; the line is listed again once its teller is idle
+	Line* ownLine = bankLines[teller];
+	if (fired.kind == TIMER_BREAK)
+	{
+		tellers.setBusy(teller);
+		lengths.setBreak(teller, true);
+		breaks[teller] = wheel.schedule(fired.time + timeouts.breakLength, TIMER_RETURN, teller);
+		return false;
+	}
+
+	lengths.setBreak(teller, false);
+	if ( !ownLine->isEmpty() )
+	{
+		Arrival* nextCustomer = static_cast<Arrival*> (ownLine->peekFront());
+		ownLine->dequeue();
+		wheel.cancel(nextCustomer->getTimer());
+
+		SimTime departureTime = fired.time + nextCustomer->getTransactionLength();
+		eventQueue->enqueue(nextCustomer->depart(departureTime), departureTime);
+	}
+	else
+	{
+		tellers.setAvailable(teller);
+		router.lineIdle(teller);
+		breaks[teller] = wheel.schedule(fired.time + timeouts.breakAfter, TIMER_BREAK, teller);
 	}
 
 	return false;
 }
 
-void compute_averages(Stats* simData, Stats& avg)
+
+void read_routing(SimConfig& config)
 {
-	for (int i = 0; i < 10; i++)
+	char c;
+	cout << "Routing: s - Shortest line		d - Shortest of d random lines		i - Join idle teller		r - Round robin" << endl;
+	cout << "Please enter the letter that corresponds with the desired routing: ";
+	cin >> c;
+	cin.clear();
+
+	switch (c)
 	{
-		avg.CPU_time += simData[i].CPU_time;
-		avg.process_time += simData[i].process_time;
-		avg.avg_wait += simData[i].avg_wait;
-		avg.avg_length += simData[i].avg_length;
-		avg.max_length += simData[i].max_length;
-		avg.max_wait += simData[i].max_wait;
-		avg.idle_time += simData[i].idle_time;
+		case 'd':
+			config.routing = ROUTE_POWER_OF_D;
+			cout << "Please enter integer value for d: ";
+			cin >> config.choices;
+			cin.clear();
+			break;
+		case 'i':
+			config.routing = ROUTE_JOIN_IDLE;
+			break;
+		case 'r':
+			config.routing = ROUTE_ROUND_ROBIN;
+			break;
+		default:
+			config.routing = ROUTE_SHORTEST;
+			break;
 	}
+}
 
-	avg.CPU_time /= 10;
-	avg.process_time /= 10;
-	avg.avg_wait /= 10;
-	avg.avg_length /= 10;
-	avg.max_length /= 10;
-	avg.max_wait /= 10;
-	avg.idle_time /= 10;	
+void read_antithetic(SimConfig& config)
+{
+	char c;
+	cout << "Use antithetic pairs of replications? (y/n): ";
+	cin >> c;
+	cin.clear();
+	config.antithetic = (c == 'y');
+}
+
+void read_records(SimConfig& config)
+{
+	char c;
+	cout << "Write every customer's arrival, service start, departure, teller and line to customers<run>.bin? (y/n): ";
+	cin >> c;
+	cin.clear();
+	config.records = (c == 'y');
+}
+
+void write_interval(ostream& out, const RunningStat& stat, double confidence)
+{
+	out << stat.mean() << " +- " << stat.halfWidth(confidence);
 }
 
-int calculate_idle(bool tellerCurrent, bool tellerPrevious, int currentTime, int& start, int& stop)
+SimTime calculate_idle(bool tellerCurrent, bool tellerPrevious, SimTime currentTime, SimTime& start, SimTime& stop)
 {
 	if ((tellerCurrent == true) && (tellerPrevious == false))	//Case 1: Teller is available and wasn't before -> start counting idle time
 	{
@@ -770,79 +4663,144 @@ int calculate_idle(bool tellerCurrent, bool tellerPrevious, int currentTime, int
 	else if ((tellerCurrent == false) && (tellerPrevious == true))	//Case 2: Teller isn't available and was before -> stop counting 
 	{
 		stop = currentTime;			
-		int val = stop - start;	//Calc elapsed time
+		SimTime val = stop - start;	//Calc elapsed time
 		
 		return val;	
 	}
-		
+
+	return 0;							//Case 3: No change in teller availability
 }
 
+void trace_moments(string fileName, TraceMoments& moments)
+{
+	Trace customers;
+	read_trace(fileName, customers);
+	trace_moments(customers, moments);
+}
 
-int shortest_line(ArrayQueue** bankLines, int n)
+void trace_moments(const Trace& trace, TraceMoments& moments)
 {
-	ArrayQueue* temp;
-	int shortest = MAX_ARRIVALS;
-	int length;
-	int index;
-	for (int i = 0; i < n; i++)
+	SimTime previous = -1;
+	RunningStat gaps;
+	RunningStat transactions;
+	for (int i = 0; i < trace.size(); i++)
 	{
-		temp = bankLines[i];	
-		length = temp->getCount();
-
-		if (length < shortest)
-		{
-			shortest = length;
-			index = i;
-		}
+		if (previous != -1)
+			gaps.push(trace.arrivalTimes[i] - previous);
+		previous = trace.arrivalTimes[i];
+		transactions.push(trace.transactionLengths[i]);
 	}
 
-	return index;
+	moments.initialize();
+	moments.count = transactions.count();
+	moments.last_arrival = max(previous, (SimTime) 0);
+	moments.service_mean = transactions.mean();
+	if (transactions.mean() > 0)
+		moments.service_scv = transactions.variance() / (transactions.mean() * transactions.mean());
+	if (gaps.mean() > 0)
+	{
+		moments.rate = 1 / gaps.mean();
+		moments.arrival_scv = gaps.variance() / (gaps.mean() * gaps.mean());
+	}
 }
 
-int avg_line(ArrayQueue** bankLines, int n)
+unsigned long long generate_replication(SimConfig config, int replication, bool mirrored, string fileName)
 {
-	ArrayQueue* temp;
-	int length;
-	int total = 0;
-	for (int i = 0; i < n; i++)
-	{
-		temp = bankLines[i];
-		length = temp->getCount();
-		total = total + length;	
-	}
+	Trace customers;
+	return generate_replication(config, replication, mirrored, fileName, customers);
+}
 
-	return (length / n);
+unsigned long long generate_replication(SimConfig config, int replication, bool mirrored, string fileName, Trace& customers)
+{
+	unsigned long long key = replication_trace(config, replication, mirrored, customers);
+	write_events(fileName, customers.arrivalTimes.data(), customers.transactionLengths.data(), customers.size());
+	return key;
 }
 
-void generate_events(string fileName)
+unsigned long long replication_trace(SimConfig config, int replication, bool mirrored, Trace& trace)
 {
-	ofstream data_file;
-	data_file.open(fileName.c_str());			//Open data file
+	unsigned long long key = trace_key(config, replication, mirrored);
+	if (config.cache == true && ResultCache().getTrace(key, trace.arrivalTimes, trace.transactionLengths))
+		return key;
+
+	RandomStream arrivals(config.seed, replication * STREAMS_PER_REPLICATION + STREAM_ARRIVALS);
+	RandomStream service(config.seed, replication * STREAMS_PER_REPLICATION + STREAM_SERVICE);
+	arrivals.setAntithetic(mirrored);
+	service.setAntithetic(mirrored);
+
+	trace.arrivalTimes.resize(config.customers);
+	trace.transactionLengths.resize(config.customers);
+	if (config.profile.points == 0 && config.service.kind == SERVICE_UNIFORM)
+		generate_events(arrivals, service, trace.arrivalTimes.data(), trace.transactionLengths.data(), config.customers);
+	else
+		generate_profiled(config.profile, config.service, arrivals, service, trace.arrivalTimes.data(), trace.transactionLengths.data(), config.customers,
+			max(config.generatorThreads, 1));
+	if (config.cache == true)
+		ResultCache().putTrace(key, trace.arrivalTimes.data(), trace.transactionLengths.data(), config.customers);
 
-	int* arrivalTimes= new int[MAX_ARRIVALS];			//Holds arrival times
-	int* transactionLengths= new int[MAX_ARRIVALS];		//Holds transaction times
+	return key;
+}
 
+unsigned long long trace_key(SimConfig config, int replication, bool mirrored)
+{
+	unsigned long long hash = FNV_OFFSET_BASIS;
+	int version = CACHE_VERSION;
+	int arrivals = config.customers;
+	fnv_add(hash, version);
+	fnv_add(hash, arrivals);
+	fnv_add(hash, config.seed);
+	fnv_add(hash, replication);
+	fnv_add(hash, mirrored);
+	if (config.profile.points > 0 || config.service.kind != SERVICE_UNIFORM)
+	{
+		//generate_profiled draws different customers from the same streams, even for a flat day
+		const ArrivalProfile& profile = config.profile;
+		const ServiceModel& service = config.service;
+		fnv_add(hash, profile.points);
+		fnv_add(hash, profile.linear);
+		for (int k = 0; k < profile.points; k++)
+		{
+			fnv_add(hash, profile.time[k]);
+			fnv_add(hash, profile.rate[k]);
+		}
+		fnv_add(hash, service.kind);
+		fnv_add(hash, service.mean);
+		fnv_add(hash, service.sd);
+		fnv_add(hash, service.bins);
+		for (int b = 0; b < service.bins; b++)
+		{
+			fnv_add(hash, service.length[b]);
+			fnv_add(hash, service.cumulative[b]);
+		}
+	}
+	return hash;
+}
 
-	srand(time(0));						//Seed random number generator
-	for (int i = 0; i < MAX_ARRIVALS; i++)
+void generate_events(RandomStream& arrivals, RandomStream& service, SimTime* arrivalTimes, SimTime* transactionLengths, int count)
+{
+	for (int i = 0; i < count; i++)
 	{
-		arrivalTimes[i] = rand() % 100001;		//Generate random # from 0-100,000 inclusive
-		transactionLengths[i] = (rand() % 100) + 1;	//Generate random # from 1-100 inclusive
+		arrivalTimes[i] = arrivals.below(100001);		//Generate random # from 0-100,000 inclusive
+		transactionLengths[i] = service.below(100) + 1;	//Generate random # from 1-100 inclusive
 	}
 
-	counting_sort(arrivalTimes, MAX_ARRIVALS);			//Sort arrival times
+	counting_sort(arrivalTimes, count);				//Sort arrival times
+}
 
-	for (int i = 0; i < MAX_ARRIVALS; i++)	
-		data_file << arrivalTimes[i] << "     " << transactionLengths[i] << endl;	
+void write_events(string fileName, const SimTime* arrivalTimes, const SimTime* transactionLengths, int count)
+{
+	ofstream data_file;
+	data_file.open(fileName.c_str());			//Open data file
 
-	delete[] arrivalTimes;					//delete arrays
-	delete[] transactionLengths;
+	//'\n' rather than endl, which would flush the file once per line
+	for (int i = 0; i < count; i++)
+		data_file << arrivalTimes[i] << "     " << transactionLengths[i] << '\n';
 }
 
-void counting_sort(int arr[], int size)
+void counting_sort(SimTime arr[], int size)
 {
 	int count[100001] = {0};				//Frequency tracker
-	int* sorted_arr = new int[size];			//Data will be sorted into here
+	SimTime* sorted_arr = new SimTime[size];			//Data will be sorted into here
 
 	for (int i = 0; i < size; i++)				//Count frequencies
 	{
@@ -854,10 +4812,10 @@ void counting_sort(int arr[], int size)
 		count[i] = count[i] + count[i-1];
 	}
 
-	for (int i = size - 1; i > 0; i--)			//Place values into correct positions in sorted array
+	for (int i = size - 1; i >= 0; i--)			//Place values into correct positions in sorted array
 	{
-		sorted_arr[count[arr[i]]] = arr[i];
 		count[arr[i]]--;
+		sorted_arr[count[arr[i]]] = arr[i];
 	}
 
 	copy(sorted_arr, sorted_arr + size, arr);		//copy sorted array into original array	